@@ -0,0 +1,179 @@
+#include <string.h>
+
+#include "combo.h"
+
+/** The most a call can push: a full buffer let go, then the event itself. */
+#define COMBO_PUSH_MAX (COMBO_BUFFER + 1)
+
+static inline bool has_key(const matrix_t &m, uint pos)
+{
+  return (m.words[pos >> 5] >> (pos & 31)) & 1;
+}
+
+void combo_init(combo_t &c, const combo_table_t &table, uint32_t term_ms)
+{
+  memset(&c, 0, sizeof(c));
+  c.table = &table;
+  c.term_us = term_ms * 1000;
+  c.complete = -1;
+}
+
+/** Look the candidates up against every combo: the one they make up
+ * exactly, -1 if none, and whether a bigger one still has them all. */
+static int match(const combo_t &c, bool &possible)
+{
+  const combo_table_t &table = *c.table;
+  int complete = -1;
+  possible = false;
+  for (uint i = 0; i < table.count; i++)
+  {
+    const matrix_t &keys = table.combos[i].keys;
+    uint32_t extra = 0;
+    uint32_t missing = 0;
+    for (uint w = 0; w < MATRIX_WORDS; w++)
+    {
+      extra |= c.candidates.words[w] & ~keys.words[w];
+      missing |= keys.words[w] & ~c.candidates.words[w];
+    }
+    if (extra)
+      continue;
+    if (missing)
+      possible = true;
+    else if (complete < 0)
+      complete = i;
+  }
+  return complete;
+}
+
+/** Send the buffer as combo: the other events in it first, they came while
+ * the combo was still being pressed, then the combo as a press of its
+ * lowest key at the time its last key went down. False if too many combos
+ * are down already. */
+static bool fire(combo_t &c, const combo_def_t &combo, key_event_queue_t &q)
+{
+  uint slot = 0;
+  while (slot < COMBO_ACTIVE && !matrix_empty(c.active_keys[slot]))
+    slot++;
+  if (slot == COMBO_ACTIVE)
+    return false;
+
+  key_event_t press = {};
+  for (uint i = 0; i < c.count; i++)
+  {
+    const key_event_t &e = c.buffer[i];
+    if (e.pressed && has_key(combo.keys, e.pos))
+      press = e;
+    else
+      event_queue_push(q, e);
+  }
+
+  uint w = 0;
+  while (combo.keys.words[w] == 0)
+    w++;
+  press.pos = w * 32 + __builtin_ctz(combo.keys.words[w]);
+  press.action = combo.action;
+  event_queue_push(q, press);
+
+  c.active_keys[slot] = combo.keys;
+  c.active_pos[slot] = press.pos;
+  for (w = 0; w < MATRIX_WORDS; w++)
+    c.swallowed.words[w] |= combo.keys.words[w];
+  return true;
+}
+
+/** Let the buffer go, as the combo the candidates make up or as it is.
+ * That was worked out when the last of them went down. */
+static void settle(combo_t &c, key_event_queue_t &q)
+{
+  if (c.complete < 0 || !fire(c, c.table->combos[c.complete], q))
+  {
+    for (uint j = 0; j < c.count; j++)
+      event_queue_push(q, c.buffer[j]);
+  }
+  c.count = 0;
+  c.candidates = {};
+  c.complete = -1;
+}
+
+/** Behind the buffer if there is one, straight through if not. */
+static void pass(combo_t &c, const key_event_t &e, key_event_queue_t &q)
+{
+  if (c.count == COMBO_BUFFER)
+    settle(c, q);
+  if (c.count)
+    c.buffer[c.count++] = e;
+  else
+    event_queue_push(q, e);
+}
+
+bool combo_event(combo_t &c, const key_event_t &e, key_event_queue_t &q)
+{
+  uint w = e.pos >> 5;
+  uint32_t mask = 1u << (e.pos & 31);
+  if (c.count == 0 && !((c.table->keys.words[w] | c.swallowed.words[w]) & mask))
+    return event_queue_push(q, e);
+  if (event_queue_space(q) < COMBO_PUSH_MAX)
+    return false;
+
+  if (!e.pressed)
+  {
+    /** One of the keys being pressed let go: whatever they are now is
+     * what they were. */
+    if (c.candidates.words[w] & mask)
+      settle(c, q);
+
+    key_event_t release = e;
+    if (c.swallowed.words[w] & mask)
+    {
+      /** The first key of a combo to go up releases it, the rest are
+       * only let go of. */
+      c.swallowed.words[w] &= ~mask;
+      uint slot = 0;
+      while (slot < COMBO_ACTIVE && !(c.active_keys[slot].words[w] & mask))
+        slot++;
+      if (slot == COMBO_ACTIVE)
+        return true;
+      release.pos = c.active_pos[slot];
+      c.active_keys[slot] = {};
+    }
+    pass(c, release, q);
+    return true;
+  }
+
+  if (c.count && e.time_us - c.buffer[0].time_us >= c.term_us)
+    settle(c, q);
+  if (!(c.table->keys.words[w] & mask))
+  {
+    /** Any other key going down ends the combo being pressed. */
+    if (c.count)
+      settle(c, q);
+    event_queue_push(q, e);
+    return true;
+  }
+  if (c.count == COMBO_BUFFER)
+    settle(c, q);
+
+  c.candidates.words[w] |= mask;
+  bool possible;
+  int complete = match(c, possible);
+  if (complete < 0 && !possible)
+  {
+    /** Not part of what was being pressed, but it may start a combo of
+     * its own. Alone it can't be one yet. */
+    c.candidates.words[w] &= ~mask;
+    settle(c, q);
+    c.candidates.words[w] |= mask;
+  }
+  c.complete = complete;
+  c.buffer[c.count++] = e;
+  if (complete >= 0 && !possible)
+    settle(c, q);
+  return true;
+}
+
+void combo_tick(combo_t &c, uint32_t now_us, key_event_queue_t &q)
+{
+  if (c.count && now_us - c.buffer[0].time_us >= c.term_us &&
+      event_queue_space(q) >= COMBO_PUSH_MAX)
+    settle(c, q);
+}
@@ -0,0 +1,128 @@
+#ifndef COMBO_H_
+#define COMBO_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <array>
+
+#include "event_queue.h"
+#include "layer.h"
+#include "matrix.h"
+
+/** --------------------------------------------------------------------+ */
+/** Combos */
+/** --------------------------------------------------------------------+ */
+/** Two or more keys pressed together within COMBO_TERM_MS send an action
+ * of their own instead of their usual ones. Each combo is a matrix_t of its
+ * keys, so matching is a few word-wide AND/compares per combo against the
+ * keys pressed so far, not a walk over per key combo lists.
+ *
+ * This sits on the scan side between the debouncer and the event queue.
+ * A key that is in no combo goes straight through. A key that is in one is
+ * held back, with everything behind it, only while some combo is still
+ * possible:
+ *  - the pressed keys make up a combo and no bigger one: it goes out.
+ *  - the term runs out, another key goes down or one of them is let go: the
+ *    combo they make up goes out, or if none the keys go through as pressed.
+ * A combo goes out as one press of its lowest key position with the combo's
+ * action in the event, and is released when the first of its keys is. */
+#ifndef COMBO_TERM_MS
+#define COMBO_TERM_MS 30
+#endif
+
+/** Events that can wait behind an unfinished combo. A full buffer settles
+ * it. */
+#define COMBO_BUFFER 8
+/** Combos that can be held down at once. Any more go through as plain
+ * keys. */
+#define COMBO_ACTIVE 4
+
+struct combo_def_t
+{
+  matrix_t keys;
+  action_t action;
+};
+
+struct combo_table_t
+{
+  const combo_def_t *combos;
+  uint16_t count;
+  /** Every key that is in some combo. No other key is ever held back. */
+  matrix_t keys;
+};
+
+struct combo_t
+{
+  const combo_table_t *table;
+  uint32_t term_us;
+
+  /** Events held back in order. The first is always a combo key's press,
+   * candidates are the combo keys pressed among them, and complete the
+   * combo they make up exactly, -1 if none. */
+  key_event_t buffer[COMBO_BUFFER];
+  uint8_t count;
+  matrix_t candidates;
+  int16_t complete;
+
+  /** Combos that went out and are not released yet: their keys and the
+   * position standing in for them. */
+  matrix_t active_keys[COMBO_ACTIVE];
+  uint8_t active_pos[COMBO_ACTIVE];
+  /** Keys of combos that went out whose own release is swallowed. */
+  matrix_t swallowed;
+};
+
+/** The table of a list of combos, at compile time. */
+consteval combo_table_t combo_table(const combo_def_t *combos, size_t count)
+{
+  combo_table_t table{combos, (uint16_t)count, {}};
+  for (size_t i = 0; i < count; i++)
+  {
+    uint keys = 0;
+    for (uint w = 0; w < MATRIX_WORDS; w++)
+    {
+      table.keys.words[w] |= combos[i].keys.words[w];
+      keys += __builtin_popcount(combos[i].keys.words[w]);
+    }
+    if (keys < 2 || keys > COMBO_BUFFER)
+      throw "a combo needs 2 to COMBO_BUFFER keys";
+  }
+  return table;
+}
+
+template <size_t N>
+consteval combo_table_t combo_table(const combo_def_t (&combos)[N])
+{
+  return combo_table(combos, N);
+}
+
+template <size_t N>
+consteval combo_table_t combo_table(const std::array<combo_def_t, N> &combos)
+{
+  return combo_table(combos.data(), N);
+}
+
+/** A list of any number of combos, none included, for combo_table(). */
+template <typename... Defs>
+consteval std::array<combo_def_t, sizeof...(Defs)> combo_list(Defs... defs)
+{
+  return {defs...};
+}
+
+void combo_init(combo_t &c, const combo_table_t &table, uint32_t term_ms);
+
+/** One debounced change. Pushes whatever it lets through onto q. False,
+ * with nothing taken, when q has no room for all it might push: a plain
+ * key only needs its own slot, anything else up to COMBO_BUFFER + 1. */
+bool combo_event(combo_t &c, const key_event_t &e, key_event_queue_t &q);
+
+/** Settle a combo whose term ran out by now_us. Waits for a later call if
+ * q is short of room. */
+void combo_tick(combo_t &c, uint32_t now_us, key_event_queue_t &q);
+
+inline bool combo_empty(const combo_t &c)
+{
+  return c.count == 0;
+}
+
+#endif /* COMBO_H_ */
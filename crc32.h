@@ -0,0 +1,23 @@
+#ifndef CRC32_H_
+#define CRC32_H_
+
+#include <stdint.h>
+
+/** CRC-32 (IEEE, reflected) a nibble at a time, so the table is 64 bytes
+ * of flash rather than 1 KiB. Start from ~0 and invert the result. */
+inline uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+  static const uint32_t nibble[16] = {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+      0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+      0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+  for (uint32_t i = 0; i < len; i++)
+  {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ nibble[crc & 0x0f];
+    crc = (crc >> 4) ^ nibble[crc & 0x0f];
+  }
+  return crc;
+}
+
+#endif /* CRC32_H_ */
@@ -0,0 +1,77 @@
+#include <string.h>
+
+#include "debounce.h"
+
+void debounce_init(debounce_t &db)
+{
+  memset(&db, 0, sizeof(db));
+}
+
+template <int algorithm>
+bool debounce_update_as(debounce_t &db, const matrix_t &raw, uint64_t now_us)
+{
+  uint8_t now = (uint8_t)(now_us >> DEBOUNCE_TICK_SHIFT);
+  bool changed = false;
+
+  for (uint w = 0; w < MATRIX_WORDS; w++)
+  {
+    /** Almost every word is idle: switch agrees with state, no timers. */
+    uint32_t differs = raw.words[w] ^ db.state.words[w];
+    uint32_t work = differs | db.locked.words[w] | db.pending.words[w];
+
+    while (work)
+    {
+      uint bit = __builtin_ctz(work);
+      uint32_t mask = 1u << bit;
+      uint pos = w * 32 + bit;
+      work &= work - 1;
+
+      bool expired = (uint8_t)(now - db.started[pos]) >= DEBOUNCE_TICKS;
+
+      if (db.locked.words[w] & mask)
+      {
+        /** Ignore the switch until the lock runs out, then look at it
+         * again as if it had just changed. */
+        if (!expired)
+          continue;
+        db.locked.words[w] &= ~mask;
+      }
+
+      if (!(differs & mask))
+      {
+        /** Bounced back before it settled. */
+        db.pending.words[w] &= ~mask;
+        continue;
+      }
+
+      bool pressing = raw.words[w] & mask;
+      bool eager = algorithm == DEBOUNCE_EAGER ||
+                   (algorithm == DEBOUNCE_ASYM && pressing);
+
+      if (eager)
+      {
+        db.state.words[w] ^= mask;
+        db.locked.words[w] |= mask;
+        db.pending.words[w] &= ~mask;
+        db.started[pos] = now;
+        changed = true;
+      }
+      else if (!(db.pending.words[w] & mask))
+      {
+        db.pending.words[w] |= mask;
+        db.started[pos] = now;
+      }
+      else if (expired)
+      {
+        db.state.words[w] ^= mask;
+        db.pending.words[w] &= ~mask;
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+template bool debounce_update_as<DEBOUNCE_EAGER>(debounce_t &, const matrix_t &, uint64_t);
+template bool debounce_update_as<DEBOUNCE_DEFER>(debounce_t &, const matrix_t &, uint64_t);
+template bool debounce_update_as<DEBOUNCE_ASYM>(debounce_t &, const matrix_t &, uint64_t);
@@ -0,0 +1,60 @@
+#ifndef DEBOUNCE_H_
+#define DEBOUNCE_H_
+
+#include <stdint.h>
+
+#include "matrix.h"
+
+/** --------------------------------------------------------------------+ */
+/** Per-key debounce */
+/** --------------------------------------------------------------------+ */
+/** Sits between the raw matrix scan and report building. Algorithms:
+ *  - DEBOUNCE_EAGER: a change is accepted the moment it is seen and the key
+ *    then ignores the switch for DEBOUNCE_MS. No added press latency.
+ *  - DEBOUNCE_DEFER: a change is only accepted once the switch has read the
+ *    same for DEBOUNCE_MS. Filters noise, costs DEBOUNCE_MS both ways.
+ *  - DEBOUNCE_ASYM: presses eager, releases deferred. */
+#define DEBOUNCE_EAGER 0
+#define DEBOUNCE_DEFER 1
+#define DEBOUNCE_ASYM 2
+
+#ifndef DEBOUNCE_ALGORITHM
+#define DEBOUNCE_ALGORITHM DEBOUNCE_EAGER
+#endif
+
+#ifndef DEBOUNCE_MS
+#define DEBOUNCE_MS 5
+#endif
+
+/** Timers count in 128 us ticks so a key's timer fits in one byte. */
+#define DEBOUNCE_TICK_SHIFT 7
+#define DEBOUNCE_TICKS ((DEBOUNCE_MS * 1000) >> DEBOUNCE_TICK_SHIFT)
+static_assert(DEBOUNCE_TICKS > 0 && DEBOUNCE_TICKS < 256,
+              "DEBOUNCE_MS must fit in an 8 bit tick counter");
+
+struct debounce_t
+{
+  /** The debounced matrix, what the rest of the firmware sees. */
+  matrix_t state;
+  /** Keys ignoring the switch after an eager change. */
+  matrix_t locked;
+  /** Keys whose switch disagrees with state, waiting for it to settle. */
+  matrix_t pending;
+  /** Tick each locked or pending key's timer started at, by MATRIX_POS. */
+  uint8_t started[MATRIX_WORDS * 32];
+};
+
+void debounce_init(debounce_t &db);
+
+/** Feed one raw scan taken at now_us through the given algorithm. Returns
+ * true if the debounced state changed. */
+template <int algorithm>
+bool debounce_update_as(debounce_t &db, const matrix_t &raw, uint64_t now_us);
+
+/** Feed one raw scan through the configured DEBOUNCE_ALGORITHM. */
+inline bool debounce_update(debounce_t &db, const matrix_t &raw, uint64_t now_us)
+{
+  return debounce_update_as<DEBOUNCE_ALGORITHM>(db, raw, now_us);
+}
+
+#endif /* DEBOUNCE_H_ */
@@ -0,0 +1,61 @@
+#include <string.h>
+
+#include "debug_log.h"
+
+void debug_log_ring_init(debug_log_ring_t &r)
+{
+  r.head.store(0, std::memory_order_relaxed);
+  r.tail.store(0, std::memory_order_relaxed);
+  r.dropped.store(0, std::memory_order_relaxed);
+  r.dropped_logged = 0;
+}
+
+uint debug_log_take(debug_log_ring_t &r, uint32_t *record, uint max)
+{
+  uint32_t tail = r.tail.load(std::memory_order_relaxed);
+  if (tail == r.head.load(std::memory_order_acquire))
+    return 0;
+  uint n = 2 + ((r.words[tail & (DEBUG_LOG_WORDS - 1)] >> 16) & 0xff);
+  if (n > max)
+    return 0;
+  for (uint i = 0; i < n; i++)
+    record[i] = r.words[(tail + i) & (DEBUG_LOG_WORDS - 1)];
+  r.tail.store(tail + n, std::memory_order_release);
+  return n;
+}
+
+#if KEYBOARD_DEBUG_LOG
+
+debug_log_ring_t debug_log_rings[DEBUG_LOG_RINGS];
+
+void debug_log_init(void)
+{
+  for (debug_log_ring_t &r : debug_log_rings)
+    debug_log_ring_init(r);
+}
+
+void debug_log_task(void)
+{
+  if (!hal_cdc_connected())
+    return;
+
+  uint32_t record[DEBUG_LOG_RECORD_MAX];
+  bool wrote = false;
+  for (debug_log_ring_t &r : debug_log_rings)
+  {
+    /** Whole records only: one that does not fit waits for the next
+     * call. */
+    while (hal_cdc_write_available() >= sizeof(record))
+    {
+      uint n = debug_log_take(r, record, DEBUG_LOG_RECORD_MAX);
+      if (n == 0)
+        break;
+      hal_cdc_write(record, n * sizeof(uint32_t));
+      wrote = true;
+    }
+  }
+  if (wrote)
+    hal_cdc_flush();
+}
+
+#endif
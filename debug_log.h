@@ -0,0 +1,148 @@
+#ifndef DEBUG_LOG_H_
+#define DEBUG_LOG_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+
+#include "hal.h"
+
+/** --------------------------------------------------------------------+ */
+/** Binary debug log */
+/** --------------------------------------------------------------------+ */
+/** Built with KEYBOARD_DEBUG_LOG=1 the keyboard has a CDC-ACM interface
+ * next to the HID ones, and DEBUG_LOG(fmt, args...) logs to it without
+ * formatting anything. The format string is put in its own section,
+ * debug_log_fmt, and only its offset in there goes into the log, with the
+ * time and the arguments as raw 32 bit words. The host gets the text back
+ * from the firmware ELF (host/log_reader.cpp), so a log call is a handful
+ * of stores into a RAM ring and never waits: with the host not reading, the
+ * ring fills up and the records that do not fit are counted and dropped.
+ * The ring is drained to the CDC interface after tud_task(). With
+ * KEYBOARD_DEBUG_LOG=0 DEBUG_LOG() compiles to nothing.
+ *
+ * Arguments are 32 bit integers, so formats take %d, %u, %x, %X and %c
+ * (with flags and a width) and nothing else: no strings, no floats.
+ *
+ * A record is 2 + n little endian words:
+ *  - DEBUG_LOG_TAG << 24 | n << 16 | the format's offset,
+ *  - the low 32 bits of hal_time_us(),
+ *  - the n arguments.
+ * DEBUG_LOG_DROPPED in place of the offset says how many records the ring
+ * had to drop just before it, in its one argument. */
+#ifndef KEYBOARD_DEBUG_LOG
+#define KEYBOARD_DEBUG_LOG 0
+#endif
+
+#define DEBUG_LOG_TAG 0xd1
+#define DEBUG_LOG_DROPPED 0xffff
+#define DEBUG_LOG_MAX_ARGS 6
+#define DEBUG_LOG_RECORD_MAX (2 + DEBUG_LOG_MAX_ARGS)
+
+/** Words in each core's ring. */
+#ifndef DEBUG_LOG_WORDS
+#define DEBUG_LOG_WORDS 1024
+#endif
+static_assert((DEBUG_LOG_WORDS & (DEBUG_LOG_WORDS - 1)) == 0,
+              "DEBUG_LOG_WORDS must be a power of two");
+
+/** One ring per core that logs, each one single-producer/single-consumer:
+ * its core writes, the drain after tud_task() reads. head and tail count
+ * words. */
+#if KEYBOARD_DUAL_CORE
+#define DEBUG_LOG_RINGS 2
+#else
+#define DEBUG_LOG_RINGS 1
+#endif
+
+struct debug_log_ring_t
+{
+  uint32_t words[DEBUG_LOG_WORDS];
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> tail;
+  /** Records that did not fit, and how many of those the log has said so
+   * far. Both producer written. */
+  std::atomic<uint32_t> dropped;
+  uint32_t dropped_logged;
+};
+
+void debug_log_ring_init(debug_log_ring_t &r);
+
+inline void debug_log_store(debug_log_ring_t &r, uint32_t &head, uint16_t id,
+                            uint32_t time_us, const uint32_t *args, uint n)
+{
+  r.words[head++ & (DEBUG_LOG_WORDS - 1)] = (uint32_t)DEBUG_LOG_TAG << 24 | n << 16 | id;
+  r.words[head++ & (DEBUG_LOG_WORDS - 1)] = time_us;
+  for (uint i = 0; i < n; i++)
+    r.words[head++ & (DEBUG_LOG_WORDS - 1)] = args[i];
+}
+
+/** Producer side. Append a record, or count it dropped if the ring is
+ * too full. The first record with room after a drop goes in behind a
+ * DEBUG_LOG_DROPPED one, so the log says where the gap is. */
+inline bool debug_log_put(debug_log_ring_t &r, uint16_t id, uint32_t time_us,
+                          const uint32_t *args, uint n)
+{
+  uint32_t head = r.head.load(std::memory_order_relaxed);
+  uint32_t room = DEBUG_LOG_WORDS - (head - r.tail.load(std::memory_order_acquire));
+  uint32_t dropped = r.dropped.load(std::memory_order_relaxed);
+  uint32_t gap = dropped - r.dropped_logged;
+  if (room < (gap ? 3 : 0) + 2 + n)
+  {
+    /** Only the producer writes this, as with the event queue. */
+    r.dropped.store(dropped + 1, std::memory_order_release);
+    return false;
+  }
+  if (gap)
+  {
+    debug_log_store(r, head, DEBUG_LOG_DROPPED, time_us, &gap, 1);
+    r.dropped_logged = dropped;
+  }
+  debug_log_store(r, head, id, time_us, args, n);
+  r.head.store(head, std::memory_order_release);
+  return true;
+}
+
+/** Consumer side. Copy the oldest record into record and take it off the
+ * ring. Returns its length in words, 0 if there is nothing, or if it is
+ * longer than max. */
+uint debug_log_take(debug_log_ring_t &r, uint32_t *record, uint max);
+
+#if KEYBOARD_DEBUG_LOG
+/** Where the format strings are, from the linker. */
+extern "C" const char __start_debug_log_fmt[];
+
+extern debug_log_ring_t debug_log_rings[DEBUG_LOG_RINGS];
+
+void debug_log_init(void);
+
+/** Send what the rings hold to the CDC interface, as much of it as fits.
+ * Called after tud_task(). Records stay put while no terminal has the port
+ * open. */
+void debug_log_task(void);
+
+template <typename... Args>
+inline void debug_log_write(const char *fmt, Args... args)
+{
+  static_assert(sizeof...(Args) <= DEBUG_LOG_MAX_ARGS, "too many arguments to DEBUG_LOG()");
+  const uint32_t words[] = {(uint32_t)args..., 0};
+  debug_log_put(debug_log_rings[DEBUG_LOG_RINGS > 1 ? hal_core_num() : 0],
+                (uint16_t)(fmt - __start_debug_log_fmt), (uint32_t)hal_time_us(), words,
+                sizeof...(Args));
+}
+
+#define DEBUG_LOG(fmt, ...)                                                       \
+  do                                                                              \
+  {                                                                               \
+    static const char debug_log_fmt_[] __attribute__((section("debug_log_fmt"), used)) = \
+        fmt;                                                                      \
+    debug_log_write(debug_log_fmt_, ##__VA_ARGS__);                               \
+  } while (0)
+#else
+#define DEBUG_LOG(fmt, ...) \
+  do                        \
+  {                         \
+  } while (0)
+#endif
+
+#endif /* DEBUG_LOG_H_ */
@@ -0,0 +1,105 @@
+#ifndef EVENT_QUEUE_H_
+#define EVENT_QUEUE_H_
+
+#include <stdint.h>
+#include <atomic>
+
+/** --------------------------------------------------------------------+ */
+/** Key event queue */
+/** --------------------------------------------------------------------+ */
+/** Fixed size single-producer/single-consumer ring of timestamped press and
+ * release events. The scan side pushes, the report side pops, neither ever
+ * blocks or allocates. head is only written by the producer and tail only by
+ * the consumer, so the two sides need no lock. */
+#ifndef KEY_EVENT_QUEUE_SIZE
+#define KEY_EVENT_QUEUE_SIZE 64
+#endif
+static_assert((KEY_EVENT_QUEUE_SIZE & (KEY_EVENT_QUEUE_SIZE - 1)) == 0,
+              "KEY_EVENT_QUEUE_SIZE must be a power of two");
+
+struct key_event_t
+{
+  uint32_t time_us; /** when the debounced change was seen */
+  uint8_t pos;      /** MATRIX_POS(col, row) */
+  bool pressed;
+  /** For a combo, the action it sends in place of resolving pos. 0 for
+   * every plain key. */
+  uint16_t action;
+#if KEYBOARD_LATENCY
+  uint32_t detect_us; /** when the scan first saw the switch change */
+#endif
+};
+
+struct key_event_queue_t
+{
+  key_event_t events[KEY_EVENT_QUEUE_SIZE];
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> tail;
+  /** Pushes refused because the queue was full. Producer written. */
+  std::atomic<uint32_t> overflows;
+  /** Deepest the queue has been. Producer written. */
+  uint32_t high_water;
+};
+
+inline void event_queue_init(key_event_queue_t &q)
+{
+  q.head.store(0, std::memory_order_relaxed);
+  q.tail.store(0, std::memory_order_relaxed);
+  q.overflows.store(0, std::memory_order_relaxed);
+  q.high_water = 0;
+}
+
+/** Producer side. Returns false, and counts an overflow, if the queue is
+ * full. */
+inline bool event_queue_push(key_event_queue_t &q, const key_event_t &e)
+{
+  uint32_t head = q.head.load(std::memory_order_relaxed);
+  uint32_t depth = head - q.tail.load(std::memory_order_acquire);
+  if (depth == KEY_EVENT_QUEUE_SIZE)
+  {
+    /** Only the producer writes this, so no read-modify-write is needed
+     * (the M0+ doesn't have one anyway). */
+    q.overflows.store(q.overflows.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_release);
+    return false;
+  }
+
+  q.events[head & (KEY_EVENT_QUEUE_SIZE - 1)] = e;
+  q.head.store(head + 1, std::memory_order_release);
+  if (depth + 1 > q.high_water)
+    q.high_water = depth + 1;
+  return true;
+}
+
+/** Producer side. How many more events fit right now. */
+inline uint32_t event_queue_space(const key_event_queue_t &q)
+{
+  return KEY_EVENT_QUEUE_SIZE - (q.head.load(std::memory_order_relaxed) -
+                                 q.tail.load(std::memory_order_acquire));
+}
+
+/** Consumer side. Looks at the oldest event without removing it. */
+inline bool event_queue_peek(key_event_queue_t &q, key_event_t &e)
+{
+  uint32_t tail = q.tail.load(std::memory_order_relaxed);
+  if (tail == q.head.load(std::memory_order_acquire))
+    return false;
+  e = q.events[tail & (KEY_EVENT_QUEUE_SIZE - 1)];
+  return true;
+}
+
+/** Either side. True when every event pushed has been popped. */
+inline bool event_queue_empty(const key_event_queue_t &q)
+{
+  return q.tail.load(std::memory_order_acquire) ==
+         q.head.load(std::memory_order_acquire);
+}
+
+/** Consumer side. Drops the event event_queue_peek() returned. */
+inline void event_queue_pop(key_event_queue_t &q)
+{
+  q.tail.store(q.tail.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+}
+
+#endif /* EVENT_QUEUE_H_ */
@@ -0,0 +1,61 @@
+#include <string.h>
+
+#include "governor.h"
+#include "debug_log.h"
+
+static const uint32_t band_period_us[GOVERNOR_BANDS] = {
+    GOVERNOR_FAST_US, GOVERNOR_NORMAL_US, GOVERNOR_SLOW_US, GOVERNOR_NORMAL_US};
+
+/** Count the time since the last call to the band it was spent in, then
+ * move to band. */
+static void enter(governor_t &g, uint band, uint64_t now_us)
+{
+  g.band_us[g.band] += now_us - g.counted_us;
+  g.counted_us = now_us;
+  if (band != g.band)
+  {
+    g.band = band;
+    g.switches++;
+    DEBUG_LOG("scan band %u, every %u us", band, band_period_us[band]);
+  }
+}
+
+void governor_init(governor_t &g, uint64_t now_us)
+{
+  memset(&g, 0, sizeof(g));
+  g.band = GOVERNOR_NORMAL;
+  g.changed_us = now_us;
+  g.counted_us = now_us;
+}
+
+uint32_t governor_scan(governor_t &g, bool changed, uint64_t now_us)
+{
+  if (changed)
+    g.changed_us = now_us;
+
+  uint64_t stable_us = now_us - g.changed_us;
+  uint band = stable_us < GOVERNOR_FAST_FOR_US     ? GOVERNOR_FAST
+              : stable_us < GOVERNOR_SLOW_AFTER_US ? GOVERNOR_NORMAL
+                                                   : GOVERNOR_SLOW;
+  /** Only a change gets the fast band back. A scan that finds nothing new
+   * after the matrix was idle carries on no faster than normal. */
+  if (band == GOVERNOR_FAST && !changed && g.band != GOVERNOR_FAST)
+    band = GOVERNOR_NORMAL;
+  enter(g, band, now_us);
+  return band_period_us[band];
+}
+
+void governor_idle(governor_t &g, uint64_t now_us)
+{
+  enter(g, GOVERNOR_IDLE, now_us);
+}
+
+uint32_t governor_period_us(const governor_t &g)
+{
+  return band_period_us[g.band];
+}
+
+uint64_t governor_band_us(const governor_t &g, uint band, uint64_t now_us)
+{
+  return g.band_us[band] + (band == g.band ? now_us - g.counted_us : 0);
+}
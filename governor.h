@@ -0,0 +1,80 @@
+#ifndef GOVERNOR_H_
+#define GOVERNOR_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/** --------------------------------------------------------------------+ */
+/** Scan rate governor */
+/** --------------------------------------------------------------------+ */
+/** Picks the scan period from how long the matrix has been stable. Any
+ * change puts the scan in the fast band at once, so the keys that follow it
+ * (a release, the next key of a roll) are seen within GOVERNOR_FAST_US. The
+ * way down is slower, one band per dwell: GOVERNOR_FAST_FOR_US without a
+ * change to the normal band, GOVERNOR_SLOW_AFTER_US to the slow one, where
+ * a key held for a long time (a modifier, a game) costs a scan every
+ * GOVERNOR_SLOW_US. Up at once, down only after a dwell: a burst of typing
+ * never flaps between bands.
+ *
+ * Idle mode takes over from the slow band once nothing is down: no scans at
+ * all until a row edge. The time spent idle is counted as a band of its
+ * own. */
+#ifndef GOVERNOR_FAST_US
+#define GOVERNOR_FAST_US 500
+#endif
+#ifndef GOVERNOR_NORMAL_US
+#define GOVERNOR_NORMAL_US 1000
+#endif
+#ifndef GOVERNOR_SLOW_US
+#define GOVERNOR_SLOW_US 4000
+#endif
+#ifndef GOVERNOR_FAST_FOR_US
+#define GOVERNOR_FAST_FOR_US 200000
+#endif
+#ifndef GOVERNOR_SLOW_AFTER_US
+#define GOVERNOR_SLOW_AFTER_US 1000000
+#endif
+static_assert(GOVERNOR_FAST_FOR_US < GOVERNOR_SLOW_AFTER_US,
+              "the fast band has to end before the slow one starts");
+
+enum
+{
+  GOVERNOR_FAST,
+  GOVERNOR_NORMAL,
+  GOVERNOR_SLOW,
+  GOVERNOR_IDLE,
+  GOVERNOR_BANDS
+};
+
+struct governor_t
+{
+  uint8_t band;
+  /** The last scan that found the matrix changed. */
+  uint64_t changed_us;
+  /** Time spent in each band, counted up to counted_us, and how many
+   * times the band changed. */
+  uint64_t counted_us;
+  uint64_t band_us[GOVERNOR_BANDS];
+  uint32_t switches;
+};
+
+/** Start in the normal band at now_us. */
+void governor_init(governor_t &g, uint64_t now_us);
+
+/** A scan at now_us found the matrix changed, or not. Returns the scan
+ * period from here. */
+uint32_t governor_scan(governor_t &g, bool changed, uint64_t now_us);
+
+/** The matrix went idle at now_us. The next scan is the one after the row
+ * edge that ends it. */
+void governor_idle(governor_t &g, uint64_t now_us);
+
+/** The scan period of the current band. The idle band has none: coming
+ * out of it the scan restarts at the normal period until the first scan
+ * says otherwise. */
+uint32_t governor_period_us(const governor_t &g);
+
+/** Time spent in band up to now_us. */
+uint64_t governor_band_us(const governor_t &g, uint band, uint64_t now_us);
+
+#endif /* GOVERNOR_H_ */
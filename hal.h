@@ -0,0 +1,81 @@
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/** --------------------------------------------------------------------+ */
+/** Hardware abstraction layer */
+/** --------------------------------------------------------------------+ */
+/** Everything the scan/report path needs from the board goes through these
+ * functions. On the pico they are thin wrappers around the pico-sdk and
+ * TinyUSB calls (hal_pico.cpp). On the host they are backed by the simulated
+ * key matrix in host/hal_sim.cpp so key_scan() can run on Linux. */
+
+/** GPIO */
+void hal_gpio_init_output(uint pin);
+void hal_gpio_init_input_pullup(uint pin);
+void hal_gpio_put(uint pin, bool value);
+bool hal_gpio_get(uint pin);
+/** Level of every GPIO in the bank at once, bit n for GPIO n. */
+uint32_t hal_gpio_get_all(void);
+/** Arm (or disarm) a falling edge interrupt on every GPIO in mask. Arming
+ * forgets any edge from before. */
+void hal_gpio_edge_irq(uint32_t mask, bool enabled);
+/** True once an armed GPIO has fallen. The interrupt also ends a
+ * hal_wait_until_us(). */
+bool hal_gpio_edge_pending(void);
+
+/** The core this runs on, 0 or 1. */
+uint hal_core_num(void);
+
+/** Time */
+uint64_t hal_time_us(void);
+void hal_sleep_us(uint64_t us);
+/** Sleep (WFE) until deadline_us or until an interrupt wakes the core,
+ * whichever comes first. UINT64_MAX waits for the interrupt alone. */
+void hal_wait_until_us(uint64_t deadline_us);
+
+/** Flash */
+/** The last HAL_FLASH_CONFIG_SECTORS sectors of flash are kept out of the
+ * program for settings. Erase is by sector, back to 0xff, and programming
+ * is by whole pages and can only clear bits. On the pico both stall every
+ * core that runs from flash until they are done: milliseconds for an
+ * erase, under one for a page. */
+#define HAL_FLASH_SECTOR_SIZE 4096
+#define HAL_FLASH_PAGE_SIZE 256
+#ifndef HAL_FLASH_CONFIG_SECTORS
+#define HAL_FLASH_CONFIG_SECTORS 6
+#endif
+#define HAL_FLASH_CONFIG_SIZE (HAL_FLASH_CONFIG_SECTORS * HAL_FLASH_SECTOR_SIZE)
+/** The config region where it can be read in place (through XIP). */
+const uint8_t *hal_flash_config(void);
+/** Erase the sector at offset into the config region. */
+void hal_flash_erase(uint32_t offset);
+/** Program len bytes at offset into the config region, both multiples of
+ * HAL_FLASH_PAGE_SIZE. */
+void hal_flash_program(uint32_t offset, const uint8_t *data, uint32_t len);
+
+/** USB / HID sink */
+bool hal_usb_suspended(void);
+void hal_usb_remote_wakeup(void);
+/** instance is one of the ITF_NUM_* HID interfaces in usb_descriptors.h */
+bool hal_hid_ready(uint8_t instance);
+/** 6KRO report on the keyboard interface. */
+bool hal_hid_keyboard_report(uint8_t modifier, const uint8_t keycode[6]);
+/** Bitmap report on the NKRO interface, bitmap is NKRO_KEY_COUNT / 8 bytes. */
+bool hal_hid_nkro_report(uint8_t modifier, const uint8_t *bitmap);
+/** Consumer control report on the NKRO interface, 0 for none. */
+bool hal_hid_consumer_report(uint16_t usage);
+/** Mouse report on the NKRO interface. */
+bool hal_hid_mouse_report(uint8_t buttons, int8_t x, int8_t y, int8_t wheel, int8_t pan);
+
+/** USB / CDC sink for the debug log, KEYBOARD_DEBUG_LOG only. Connected
+ * means a terminal has the port open (DTR). Writes go into the TX FIFO,
+ * flush sends what is there without waiting for a full packet. */
+bool hal_cdc_connected(void);
+uint32_t hal_cdc_write_available(void);
+void hal_cdc_write(const void *data, uint32_t len);
+void hal_cdc_flush(void);
+
+#endif /* HAL_H_ */
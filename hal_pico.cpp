@@ -0,0 +1,206 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/flash.h"
+#include "pico/flash.h"
+#include "tusb.h"
+
+#include "hal.h"
+#include "usb_descriptors.h"
+
+/** --------------------------------------------------------------------+ */
+/** GPIO */
+/** --------------------------------------------------------------------+ */
+void hal_gpio_init_output(uint pin)
+{
+  gpio_init(pin);
+  gpio_set_dir(pin, GPIO_OUT);
+}
+
+void hal_gpio_init_input_pullup(uint pin)
+{
+  gpio_init(pin);
+  gpio_set_dir(pin, GPIO_IN);
+  gpio_pull_up(pin);
+}
+
+void hal_gpio_put(uint pin, bool value)
+{
+  gpio_put(pin, value);
+}
+
+bool hal_gpio_get(uint pin)
+{
+  return gpio_get(pin);
+}
+
+uint32_t hal_gpio_get_all(void)
+{
+  return gpio_get_all();
+}
+
+static volatile bool edge_pending;
+
+static void edge_callback(uint gpio, uint32_t events)
+{
+  (void)gpio;
+  (void)events;
+  edge_pending = true;
+}
+
+void hal_gpio_edge_irq(uint32_t mask, bool enabled)
+{
+  edge_pending = false;
+  /** Enabling acknowledges any stale edge first, and the bank interrupt goes
+   * to whichever core calls this. */
+  while (mask)
+  {
+    uint pin = __builtin_ctz(mask);
+    mask &= mask - 1;
+    gpio_set_irq_enabled_with_callback(pin, GPIO_IRQ_EDGE_FALL, enabled, edge_callback);
+  }
+}
+
+bool hal_gpio_edge_pending(void)
+{
+  return edge_pending;
+}
+
+uint hal_core_num(void)
+{
+  return get_core_num();
+}
+
+/** --------------------------------------------------------------------+ */
+/** Time */
+/** --------------------------------------------------------------------+ */
+uint64_t hal_time_us(void)
+{
+  return time_us_64();
+}
+
+void hal_sleep_us(uint64_t us)
+{
+  sleep_us(us);
+}
+
+void hal_wait_until_us(uint64_t deadline_us)
+{
+  /** No alarm to set, any interrupt (or SEV) ends the WFE. */
+  if (deadline_us == UINT64_MAX)
+  {
+    __wfe();
+    return;
+  }
+  best_effort_wfe_or_timeout(from_us_since_boot(deadline_us));
+}
+
+/** --------------------------------------------------------------------+ */
+/** Flash */
+/** --------------------------------------------------------------------+ */
+#define CONFIG_OFFSET (PICO_FLASH_SIZE_BYTES - HAL_FLASH_CONFIG_SIZE)
+static_assert(HAL_FLASH_SECTOR_SIZE == FLASH_SECTOR_SIZE && HAL_FLASH_PAGE_SIZE == FLASH_PAGE_SIZE,
+              "the config region uses the flash chip's own sector and page");
+
+const uint8_t *hal_flash_config(void)
+{
+  return (const uint8_t *)(XIP_BASE + CONFIG_OFFSET);
+}
+
+struct flash_op
+{
+  uint32_t offset;
+  const uint8_t *data;
+  uint32_t len;
+};
+
+/** Run with interrupts off and the other core parked, since neither can
+ * fetch from flash while it is being written. */
+static void flash_op_run(void *param)
+{
+  const flash_op *op = (const flash_op *)param;
+  if (op->data)
+    flash_range_program(CONFIG_OFFSET + op->offset, op->data, op->len);
+  else
+    flash_range_erase(CONFIG_OFFSET + op->offset, FLASH_SECTOR_SIZE);
+}
+
+void hal_flash_erase(uint32_t offset)
+{
+  flash_op op = {offset, NULL, 0};
+  flash_safe_execute(flash_op_run, &op, UINT32_MAX);
+}
+
+void hal_flash_program(uint32_t offset, const uint8_t *data, uint32_t len)
+{
+  flash_op op = {offset, data, len};
+  flash_safe_execute(flash_op_run, &op, UINT32_MAX);
+}
+
+/** --------------------------------------------------------------------+ */
+/** USB / HID sink */
+/** --------------------------------------------------------------------+ */
+bool hal_usb_suspended(void)
+{
+  return tud_suspended();
+}
+
+void hal_usb_remote_wakeup(void)
+{
+  tud_remote_wakeup();
+}
+
+bool hal_hid_ready(uint8_t instance)
+{
+  return tud_hid_n_ready(instance);
+}
+
+bool hal_hid_keyboard_report(uint8_t modifier, const uint8_t keycode[6])
+{
+  /** No report ID, the keyboard interface doubles as the boot report. */
+  return tud_hid_n_keyboard_report(ITF_NUM_KEYBOARD, 0, modifier, keycode);
+}
+
+bool hal_hid_nkro_report(uint8_t modifier, const uint8_t *bitmap)
+{
+  uint8_t report[NKRO_REPORT_LEN - 1];
+  report[0] = modifier;
+  memcpy(&report[1], bitmap, NKRO_KEY_COUNT / 8);
+  return tud_hid_n_report(ITF_NUM_NKRO, REPORT_ID_NKRO, report, sizeof(report));
+}
+
+bool hal_hid_consumer_report(uint16_t usage)
+{
+  return tud_hid_n_report(ITF_NUM_NKRO, REPORT_ID_CONSUMER_CONTROL, &usage, sizeof(usage));
+}
+
+bool hal_hid_mouse_report(uint8_t buttons, int8_t x, int8_t y, int8_t wheel, int8_t pan)
+{
+  return tud_hid_n_mouse_report(ITF_NUM_NKRO, REPORT_ID_MOUSE, buttons, x, y, wheel, pan);
+}
+
+#if KEYBOARD_DEBUG_LOG
+/** --------------------------------------------------------------------+ */
+/** USB / CDC */
+/** --------------------------------------------------------------------+ */
+bool hal_cdc_connected(void)
+{
+  return tud_cdc_connected();
+}
+
+uint32_t hal_cdc_write_available(void)
+{
+  return tud_cdc_write_available();
+}
+
+void hal_cdc_write(const void *data, uint32_t len)
+{
+  tud_cdc_write(data, len);
+}
+
+void hal_cdc_flush(void)
+{
+  tud_cdc_write_flush();
+}
+#endif
@@ -0,0 +1,635 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <new>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "matrix.h"
+#include "report.h"
+#include "layer.h"
+#include "combo.h"
+#include "keymap_store.h"
+#include "debug_log.h"
+#include "telemetry.h"
+#include "sim_matrix.h"
+
+#define BENCH_SCANS 20000
+#define BENCH_LOOKUPS 200000
+#define BENCH_RESOLVES 100000
+#define BENCH_FILTERS 1000000
+#define BENCH_COMBOS 128
+#define BENCH_COMBO_TAPS 200000
+#define BENCH_LOG_CALLS 1000000
+#define BENCH_TELEMETRY_SCANS 1000000
+#define BENCH_GET_REPORTS 1000000
+
+/** Every heap allocation goes through here so the benchmark can see what
+ * the old keymap containers cost in RAM. */
+static size_t heap_bytes;
+
+void *operator new(size_t size)
+{
+  heap_bytes += size;
+  void *p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+/** Out of line, so the compiler does not see free() paired with the new
+ * above once the deletes are inlined. */
+__attribute__((noinline)) static void heap_free(void *p) { free(p); }
+
+void operator delete(void *p) noexcept { heap_free(p); }
+void operator delete(void *p, size_t) noexcept { heap_free(p); }
+void operator delete[](void *p) noexcept { heap_free(p); }
+void operator delete[](void *p, size_t) noexcept { heap_free(p); }
+
+struct scan_cost
+{
+  double sim_us;
+  double gpio_reads;
+  double host_ns;
+};
+
+/** Scan the matrix BENCH_SCANS times with a few keys held and report the
+ * average cost per scan in simulated settle time, GPIO reads and host time. */
+static scan_cost measure(void (*scan)(matrix_t &))
+{
+  sim_reset();
+  keyboard_init();
+  sim_load_timeline({sim_event(0, HID_KEY_SHIFT_LEFT, true),
+                     sim_event(0, HID_KEY_H, true),
+                     sim_event(0, HID_KEY_I, true)});
+
+  matrix_t matrix;
+  uint64_t sim_start = sim_now_us();
+  uint64_t reads_start = sim_get_stats().gpio_gets;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_SCANS; i++)
+    scan(matrix);
+  auto end = std::chrono::steady_clock::now();
+
+  scan_cost cost;
+  cost.sim_us = (double)(sim_now_us() - sim_start) / BENCH_SCANS;
+  cost.gpio_reads = (double)(sim_get_stats().gpio_gets - reads_start) / BENCH_SCANS;
+  cost.host_ns = std::chrono::duration<double, std::nano>(end - start).count() / BENCH_SCANS;
+  return cost;
+}
+
+static void print_cost(const char *name, const scan_cost &c)
+{
+  printf("  %-12s %8.1f us/scan %6.1f reads/scan %9.1f host ns/scan\n",
+         name, c.sim_us, c.gpio_reads, c.host_ns);
+}
+
+/** --------------------------------------------------------------------+ */
+/** Keymap lookup */
+/** --------------------------------------------------------------------+ */
+/** The keymap as it used to be: vectors and a map built on the heap at
+ * static init, looked up with .at() and contains(), with Fn as usage 0xff. */
+#define LEGACY_FN_KEY 0xff
+
+struct legacy_keymap
+{
+  std::vector<uint> colPins;
+  std::vector<uint> rowPins;
+  std::vector<std::vector<uint8_t>> keyMap;
+  std::map<uint8_t, uint8_t> fn_transforms;
+};
+
+static legacy_keymap *legacy_build(void)
+{
+  legacy_keymap *k = new legacy_keymap;
+  k->colPins.assign(std::begin(colPins), std::end(colPins));
+  k->rowPins.assign(std::begin(rowPins), std::end(rowPins));
+  for (size_t col = 0; col < MATRIX_COLS; col++)
+  {
+    /** The old layout left out trailing HID_KEY_NONE padding. */
+    size_t rows = MATRIX_ROWS;
+    while (rows > 0 && key_layout[col][rows - 1] == HID_KEY_NONE)
+      rows--;
+    std::vector<uint8_t> keys;
+    for (size_t row = 0; row < rows; row++)
+    {
+      action_t key = key_layout[col][row];
+      keys.push_back(key == FN_KEY ? LEGACY_FN_KEY : (uint8_t)key);
+    }
+    k->keyMap.push_back(keys);
+  }
+  for (const auto &t : fn_transforms)
+    k->fn_transforms.emplace(t.from, t.to);
+  return k;
+}
+
+static void legacy_report(const legacy_keymap &k, const matrix_t &held,
+                          keyboard_report_t &report)
+{
+  bool fn_key_held = false;
+  uint8_t held_count = 0;
+  uint8_t held_keys[MATRIX_COLS * MATRIX_ROWS];
+  for (int col = 0; col < MATRIX_COLS; col++)
+  {
+    for (int row = 0; row < MATRIX_ROWS; row++)
+    {
+      if (matrix_key(held, col, row))
+      {
+        uint8_t key = k.keyMap.at(col).at(row);
+        if (key == LEGACY_FN_KEY)
+        {
+          fn_key_held = true;
+          continue;
+        }
+        held_keys[held_count++] = key;
+      }
+    }
+  }
+
+  report = {};
+  for (int i = 0; i < held_count; i++)
+  {
+    uint8_t key = held_keys[i];
+    if (fn_key_held && k.fn_transforms.contains(key))
+      key = k.fn_transforms.at(key);
+    report_add_key(report, key);
+  }
+}
+
+/** The same report from the actions the held keys locked in on press. */
+static layer_t table_layers;
+
+static void table_report(const matrix_t &held, keyboard_report_t &report)
+{
+  report = {};
+  for (uint w = 0; w < MATRIX_WORDS; w++)
+  {
+    uint32_t bits = held.words[w];
+    while (bits)
+    {
+      uint bit = __builtin_ctz(bits);
+      bits &= bits - 1;
+      action_t action = table_layers.locked[w * 32 + bit];
+      if (ACTION_KIND(action) == ACTION_USAGE)
+        report_add_key(report, (uint8_t)action);
+    }
+  }
+}
+
+/** Fn plus six keys, the worst case the old code did per scan. Fn goes down
+ * first so the others lock in on the Fn layer. */
+static const action_t lookup_keys[] = {FN_KEY, HID_KEY_1, HID_KEY_W, HID_KEY_A,
+                                       HID_KEY_D, HID_KEY_M, HID_KEY_SHIFT_LEFT};
+
+static uint lookup_pos(action_t key)
+{
+  sim_key_event e = sim_event(0, key, true);
+  return MATRIX_POS(e.col, e.row);
+}
+
+static matrix_t lookup_held(void)
+{
+  matrix_t held = {};
+  for (action_t key : lookup_keys)
+  {
+    uint pos = lookup_pos(key);
+    held.words[pos >> 5] |= 1u << (pos & 31);
+  }
+  return held;
+}
+
+template <typename F>
+static double lookup_ns(F report_fn)
+{
+  matrix_t held = lookup_held();
+  keyboard_report_t report;
+  uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_LOOKUPS; i++)
+  {
+    /** Keep the compiler from hoisting the lookup out of the loop. */
+    asm volatile("" : "+m"(held));
+    report_fn(held, report);
+    sink += report.keys[0] ^ report.modifier;
+  }
+  auto end = std::chrono::steady_clock::now();
+  asm volatile("" : : "r"(sink));
+  return std::chrono::duration<double, std::nano>(end - start).count() / BENCH_LOOKUPS;
+}
+
+static void bench_keymap(void)
+{
+  size_t before = heap_bytes;
+  legacy_keymap *legacy = legacy_build();
+  size_t legacy_heap = heap_bytes - before - sizeof(legacy_keymap);
+
+  layer_init(table_layers, default_keymap);
+  for (action_t key : lookup_keys)
+    layer_press(table_layers, lookup_pos(key));
+
+  keyboard_report_t a, b;
+  matrix_t held = lookup_held();
+  legacy_report(*legacy, held, a);
+  table_report(held, b);
+  if (a.modifier != b.modifier || memcmp(a.keys, b.keys, sizeof(a.keys)) != 0)
+  {
+    fprintf(stderr, "keymap tables disagree with the legacy lookup\n");
+    exit(1);
+  }
+
+  double legacy_ns = lookup_ns([&](const matrix_t &h, keyboard_report_t &r)
+                               { legacy_report(*legacy, h, r); });
+  double table_ns = lookup_ns(table_report);
+
+  printf("keymap lookup (%d reports, Fn + 6 keys held)\n", BENCH_LOOKUPS);
+  printf("  %-12s %8.1f host ns/report %6zu heap bytes\n",
+         "vector/map", legacy_ns, legacy_heap);
+  printf("  %-12s %8.1f host ns/report %6d heap bytes %zu flash bytes\n",
+         "constexpr", table_ns, 0,
+         sizeof(colPins) + sizeof(rowPins) + sizeof(keymap_layers) + sizeof(keymap_key_layers));
+  printf("  speedup      %8.1fx\n", legacy_ns / table_ns);
+  delete legacy;
+}
+
+/** --------------------------------------------------------------------+ */
+/** Layer resolution */
+/** --------------------------------------------------------------------+ */
+/** Eight layers, all on, and every layer above the base transparent except
+ * for the top one on a handful of keys: most keys have to fall through
+ * seven layers. */
+static constexpr std::array<layer_table_t, LAYER_MAX> deep_layers = []
+{
+  std::array<layer_table_t, LAYER_MAX> layers{};
+  layers[0] = keymap_layers[LAYER_BASE];
+  for (uint layer = 1; layer < LAYER_MAX; layer++)
+    layers[layer].fill(KC_TRNS);
+  for (uint pos = 0; pos < LAYER_KEYS; pos += 16)
+    layers[LAYER_MAX - 1][pos] = HID_KEY_F12;
+  return layers;
+}();
+static constexpr auto deep_key_layers = layer_key_masks(deep_layers);
+static constexpr layer_keymap_t deep_keymap = {deep_layers.data(), LAYER_MAX,
+                                               deep_key_layers.data(),
+                                               layer_tap_hold_keys(deep_layers)};
+
+/** What resolving costs without the per key masks: walk down the active
+ * layers until one is not transparent. */
+static action_t walk_resolve(const layer_t &l, uint pos)
+{
+  for (int layer = l.keymap->count - 1; layer > 0; layer--)
+  {
+    if ((l.active >> layer) & 1)
+    {
+      action_t action = l.keymap->layers[layer][pos];
+      if (action != KC_TRNS)
+        return action;
+    }
+  }
+  return l.keymap->layers[0][pos];
+}
+
+template <typename F>
+static double resolve_ns(const layer_t &l, F resolve)
+{
+  uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_RESOLVES; i++)
+  {
+    for (uint pos = 0; pos < LAYER_KEYS; pos++)
+    {
+      uint p = pos;
+      asm volatile("" : "+r"(p));
+      sink += resolve(l, p);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  asm volatile("" : : "r"(sink));
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         ((double)BENCH_RESOLVES * LAYER_KEYS);
+}
+
+static void bench_layers(void)
+{
+  layer_t l;
+  layer_init(l, deep_keymap);
+  l.toggled = 0xff;
+  l.active = 0xff;
+
+  for (uint pos = 0; pos < LAYER_KEYS; pos++)
+  {
+    if (layer_resolve(l, pos) != walk_resolve(l, pos))
+    {
+      fprintf(stderr, "layer masks disagree with the layer walk at %u\n", pos);
+      exit(1);
+    }
+  }
+
+  double walk = resolve_ns(l, walk_resolve);
+  double masked = resolve_ns(l, layer_resolve);
+  printf("layer resolve (%d layers active, %d keys x %d)\n", LAYER_MAX,
+         LAYER_KEYS, BENCH_RESOLVES);
+  printf("  %-12s %8.2f host ns/key\n", "layer walk", walk);
+  printf("  %-12s %8.2f host ns/key\n", "key masks", masked);
+  printf("  speedup      %8.1fx\n", walk / masked);
+}
+
+/** The same keymap resolved from an image in the flash store, which the
+ * scan path must not notice. */
+static void bench_store(void)
+{
+  sim_reset();
+  keymap_store_t store;
+  keymap_store_init(store, default_keymap);
+  if (!keymap_store_reset(store))
+  {
+    fprintf(stderr, "keymap store did not take the image\n");
+    exit(1);
+  }
+
+  layer_t compiled, stored;
+  layer_init(compiled, default_keymap);
+  layer_init(stored, store.keymap);
+  compiled.active = stored.active = (1 << LAYER_COUNT) - 1;
+  for (uint pos = 0; pos < LAYER_KEYS; pos++)
+  {
+    if (layer_resolve(compiled, pos) != layer_resolve(stored, pos))
+    {
+      fprintf(stderr, "keymap image disagrees with the compiled tables at %u\n", pos);
+      exit(1);
+    }
+  }
+
+  double compiled_ns = resolve_ns(compiled, layer_resolve);
+  double stored_ns = resolve_ns(stored, layer_resolve);
+  printf("keymap store (%d layers active, %d keys x %d)\n", LAYER_COUNT, LAYER_KEYS,
+         BENCH_RESOLVES);
+  printf("  %-12s %8.2f host ns/key\n", "compiled", compiled_ns);
+  printf("  %-12s %8.2f host ns/key %zu RAM bytes\n", "flash image", stored_ns, sizeof(store));
+}
+
+/** Host time of one ghost filter pass over raw, which is what it adds to
+ * every scan. */
+static double filter_ns(const matrix_t &raw, const matrix_t &previous)
+{
+  uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_FILTERS; i++)
+  {
+    matrix_t m = raw;
+    asm volatile("" : : "r"(&m) : "memory");
+    matrix_filter_ghosts(m, previous);
+    sink += m.words[0];
+  }
+  auto end = std::chrono::steady_clock::now();
+  asm volatile("" : : "r"(sink));
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         BENCH_FILTERS;
+}
+
+static void bench_ghost(void)
+{
+  /** Nothing held is what almost every scan sees, WASD plus shift is a
+   * typical chord, and every key down puts each column against every
+   * other. */
+  matrix_t held = {};
+  for (action_t key : {HID_KEY_W, HID_KEY_A, HID_KEY_S, HID_KEY_D,
+                       HID_KEY_SHIFT_LEFT})
+  {
+    uint pos = lookup_pos(key);
+    held.words[pos >> 5] |= 1u << (pos & 31);
+  }
+  matrix_t all = {};
+  for (uint col = 0; col < MATRIX_COLS; col++)
+  {
+    for (uint row = 0; row < MATRIX_ROWS; row++)
+    {
+      uint pos = MATRIX_POS(col, row);
+      all.words[pos >> 5] |= 1u << (pos & 31);
+    }
+  }
+
+  printf("ghost filter (%d scans)\n", BENCH_FILTERS);
+  printf("  %-12s %8.2f host ns/scan\n", "idle", filter_ns({}, {}));
+  printf("  %-12s %8.2f host ns/scan\n", "WASD+shift", filter_ns(held, held));
+  printf("  %-12s %8.2f host ns/scan\n", "every key", filter_ns(all, {}));
+}
+
+/** --------------------------------------------------------------------+ */
+/** Combos */
+/** --------------------------------------------------------------------+ */
+/** Host time per event of tapping keys through the combo stage: a press
+ * and a release each, the queue drained behind them. */
+static double combo_ns(const combo_table_t &table, const uint8_t *keys, uint n)
+{
+  combo_t c;
+  combo_init(c, table, COMBO_TERM_MS);
+  key_event_queue_t q;
+  event_queue_init(q);
+  uint32_t sink = 0;
+  uint32_t t = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_COMBO_TAPS; i++)
+  {
+    key_event_t e = {};
+    for (uint k = 0; k < n; k++)
+    {
+      e.time_us = t += 1000;
+      e.pos = keys[k];
+      e.pressed = true;
+      combo_event(c, e, q);
+    }
+    for (uint k = 0; k < n; k++)
+    {
+      e.time_us = t += 1000;
+      e.pos = keys[k];
+      e.pressed = false;
+      combo_event(c, e, q);
+    }
+    while (event_queue_peek(q, e))
+    {
+      sink += e.pos;
+      event_queue_pop(q);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  asm volatile("" : : "r"(sink));
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         ((double)BENCH_COMBO_TAPS * 2 * n);
+}
+
+static void bench_combos(void)
+{
+  /** BENCH_COMBOS pairs and triples of letters, picked with a fixed seed,
+   * so space is in none of them. */
+  std::vector<uint8_t> letters;
+  for (action_t key = HID_KEY_A; key <= HID_KEY_Z; key++)
+    letters.push_back(lookup_pos(key));
+  static combo_def_t defs[BENCH_COMBOS];
+  uint32_t seed = 1;
+  for (uint i = 0; i < BENCH_COMBOS; i++)
+  {
+    uint n = i % 3 == 0 ? 3 : 2;
+    defs[i] = {};
+    defs[i].action = HID_KEY_F1 + i % 12;
+    for (uint k = 0; k < n;)
+    {
+      seed = seed * 1103515245 + 12345;
+      uint pos = letters[(seed >> 16) % letters.size()];
+      if (!((defs[i].keys.words[pos >> 5] >> (pos & 31)) & 1))
+      {
+        defs[i].keys.words[pos >> 5] |= 1u << (pos & 31);
+        k++;
+      }
+    }
+  }
+  combo_table_t table = {defs, BENCH_COMBOS, {}};
+  for (const combo_def_t &def : defs)
+  {
+    for (uint w = 0; w < MATRIX_WORDS; w++)
+      table.keys.words[w] |= def.keys.words[w];
+  }
+
+  /** The first combo pressed key by key, its first key alone and a key in
+   * none of them. Against the default keymap's combos (none by default),
+   * J alone. */
+  uint8_t combo_keys[3];
+  uint n = 0;
+  for (uint w = 0; w < MATRIX_WORDS; w++)
+  {
+    for (uint32_t bits = defs[0].keys.words[w]; bits; bits &= bits - 1)
+      combo_keys[n++] = w * 32 + __builtin_ctz(bits);
+  }
+  uint8_t space = lookup_pos(HID_KEY_SPACE);
+  uint8_t j = lookup_pos(HID_KEY_J);
+
+  printf("combo matching (%d combos, %d taps)\n", BENCH_COMBOS, BENCH_COMBO_TAPS);
+  printf("  %-12s %8.2f host ns/event\n", "other key", combo_ns(table, &space, 1));
+  printf("  %-12s %8.2f host ns/event\n", "combo key", combo_ns(table, combo_keys, 1));
+  printf("  %-12s %8.2f host ns/event\n", "combo", combo_ns(table, combo_keys, n));
+  printf("  %-12s %8.2f host ns/event\n", "default map",
+         combo_ns(default_combos, &j, 1));
+}
+
+/** A DEBUG_LOG() call with room in the ring and one with the ring full.
+ * The ring is emptied, untimed, before it fills. */
+static void bench_debug_log(void)
+{
+  debug_log_ring_t &r = debug_log_rings[0];
+  uint32_t record[DEBUG_LOG_RECORD_MAX];
+  std::chrono::nanoseconds logged{0};
+  for (uint32_t i = 0; i < BENCH_LOG_CALLS;)
+  {
+    debug_log_init();
+    auto start = std::chrono::steady_clock::now();
+    for (uint k = 0; k < 100; k++, i++)
+      DEBUG_LOG("key %u down", i);
+    logged += std::chrono::steady_clock::now() - start;
+  }
+
+  while (debug_log_take(r, record, DEBUG_LOG_RECORD_MAX))
+    ;
+  for (uint k = 0; k < DEBUG_LOG_WORDS / 3; k++)
+    DEBUG_LOG("key %u down", k);
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_LOG_CALLS; i++)
+    DEBUG_LOG("key %u down", i);
+  std::chrono::nanoseconds full = std::chrono::steady_clock::now() - start;
+
+  printf("debug log (%d calls, 1 argument)\n", BENCH_LOG_CALLS);
+  printf("  %-12s %8.2f host ns/call\n", "logged", (double)logged.count() / BENCH_LOG_CALLS);
+  printf("  %-12s %8.2f host ns/call\n", "ring full", (double)full.count() / BENCH_LOG_CALLS);
+  printf("  %u dropped\n", r.dropped.load());
+}
+
+/** What the telemetry adds to a scan and debounce run: with a few keys
+ * held and nothing changing, which is nearly every scan, and with a key
+ * going down or up on every one. */
+static double telemetry_ns(bool toggling)
+{
+  telemetry_init();
+  matrix_t held = lookup_held(), previous = held;
+  uint pos = lookup_pos(HID_KEY_K);
+  telemetry_scan(held, matrix_t{});
+  telemetry_debounced(held, 0);
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_TELEMETRY_SCANS; i++)
+  {
+    matrix_t raw = held;
+    if (toggling && (i & 1))
+      raw.words[pos >> 5] |= 1u << (pos & 31);
+    asm volatile("" : "+m"(raw));
+    telemetry_scan(raw, previous);
+    telemetry_debounced(raw, i * 1000);
+    previous = raw;
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / BENCH_TELEMETRY_SCANS;
+}
+
+static void bench_telemetry(void)
+{
+  printf("per-key telemetry (%d scans, %zu bytes of counters)\n", BENCH_TELEMETRY_SCANS,
+         sizeof(telemetry_stats().keys));
+  printf("  %-12s %8.2f host ns/scan\n", "stable", telemetry_ns(false));
+  printf("  %-12s %8.2f host ns/scan\n", "key toggling", telemetry_ns(true));
+}
+
+/** A GET_REPORT for instance's keys, answered from the last report sent. */
+static double get_report_ns(uint8_t instance, uint8_t report_id)
+{
+  uint8_t buffer[NKRO_REPORT_LEN];
+  uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_GET_REPORTS; i++)
+  {
+    asm volatile("" : "+r"(instance));
+    sink += keyboard_get_report(instance, report_id, buffer, sizeof(buffer)) + buffer[1];
+  }
+  auto end = std::chrono::steady_clock::now();
+  asm volatile("" : : "r"(sink));
+  return std::chrono::duration<double, std::nano>(end - start).count() / BENCH_GET_REPORTS;
+}
+
+static void bench_get_report(void)
+{
+  /** Fn plus six keys held and reported, the same as the lookup bench. */
+  sim_reset();
+  keyboard_init();
+  std::vector<sim_key_event> events;
+  for (action_t key : lookup_keys)
+    events.push_back(sim_event(1000, key, true));
+  sim_load_timeline(events);
+  sim_run(30000, 1000, key_scan);
+
+  printf("GET_REPORT (%d requests, Fn + 6 keys held)\n", BENCH_GET_REPORTS);
+  printf("  %-12s %8.2f host ns/request\n", "nkro", get_report_ns(ITF_NUM_NKRO, REPORT_ID_NKRO));
+  sim_set_boot_protocol(true);
+  sim_run(60000, 1000, key_scan);
+  printf("  %-12s %8.2f host ns/request\n", "boot", get_report_ns(ITF_NUM_KEYBOARD, 0));
+}
+
+int main(void)
+{
+  printf("matrix scan (%d scans)\n", BENCH_SCANS);
+  scan_cost per_key = measure(matrix_scan_per_key);
+  scan_cost bank = measure(matrix_scan);
+  print_cost("per-key", per_key);
+  print_cost("bank read", bank);
+  printf("  speedup      %8.1fx settle time\n", per_key.sim_us / bank.sim_us);
+
+  bench_keymap();
+  bench_layers();
+  bench_store();
+  bench_ghost();
+  bench_combos();
+  bench_debug_log();
+  bench_telemetry();
+  bench_get_report();
+  return 0;
+}
@@ -0,0 +1,354 @@
+/** Runs typing corpora through main()'s loop and holds the results against
+ * a stored baseline.
+ *
+ *   pipeline_bench                  print the results
+ *   pipeline_bench --check FILE     fail if any is worse than FILE allows
+ *   pipeline_bench --check FILE --gate-time
+ *                                   the same, host time included
+ *   pipeline_bench --write FILE     make the results the new baseline
+ *
+ * Each corpus runs through the firmware on the simulated matrix the way
+ * main() runs it on a single core: the scheduler, the governor pacing the
+ * scan, idle mode and the host polling every HID_POLL_INTERVAL_MS. The
+ * corpora are the simulator's typing trace at its own pace and at twice
+ * that with more rollover, and every trace in the regression
+ * corpus, as recorded. For each one it reports:
+ *  - host ns per scan, the loop's wall time over the scans it made, the
+ *    simulated GPIO included,
+ *  - the reports it sent,
+ *  - p50 and p99 of press to report taken by the host, in simulated us.
+ * Everything but the host time is deterministic: a change that makes any
+ * of it worse than the baseline plus BENCH_SLACK_PERCENT fails the check.
+ * Host time depends on the machine the baseline was written on, so it is
+ * only reported, unless --gate-time asks for it to fail past
+ * BENCH_NS_SLACK_PERCENT (in an optimized build, on the same machine). A
+ * change that makes things better passes; --write then locks the gain
+ * in. */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "tusb.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "scheduler.h"
+#include "trace_file.h"
+#include "sim_typing.h"
+
+#define BENCH_RUNS 3
+#define BENCH_SLACK_PERCENT 5
+#define BENCH_NS_SLACK_PERCENT 100
+
+struct corpus
+{
+  std::string name;
+  std::vector<sim_key_event> events;
+  /** The presses whose report is timed. */
+  std::vector<sim_key_event> presses;
+};
+
+struct result
+{
+  std::string corpus;
+  uint64_t scans;
+  double ns_per_scan;
+  uint64_t reports;
+  uint64_t p50_us;
+  uint64_t p99_us;
+  uint missed;
+};
+
+/** --------------------------------------------------------------------+ */
+/** Corpora */
+/** --------------------------------------------------------------------+ */
+static std::vector<sim_key_event> scaled(std::vector<sim_key_event> events, uint percent)
+{
+  for (sim_key_event &e : events)
+    e.time_us = e.time_us * percent / 100;
+  return events;
+}
+
+/** The presses of keys whose base layer action is a plain usage, the
+ * ones a report says went down at once. */
+static std::vector<sim_key_event> usage_presses(const std::vector<sim_key_event> &events)
+{
+  std::vector<sim_key_event> presses;
+  for (const sim_key_event &e : events)
+  {
+    action_t action = key_layout[e.col][e.row];
+    if (e.pressed && ACTION_KIND(action) == ACTION_USAGE && action != HID_KEY_NONE &&
+        action < NKRO_KEY_COUNT)
+      presses.push_back(e);
+  }
+  return presses;
+}
+
+static bool load_corpora(const char *dir, std::vector<corpus> &corpora)
+{
+  std::vector<sim_key_event> typed;
+  std::vector<sim_key_event> typing = sim_typing_trace(true, typed);
+  corpora.push_back({"typing", typing, typed});
+  corpora.push_back({"typing_2x", scaled(typing, 50), scaled(typed, 50)});
+
+  std::vector<std::filesystem::path> paths;
+  for (const auto &entry : std::filesystem::directory_iterator(dir))
+  {
+    if (entry.path().extension() == ".ktr")
+      paths.push_back(entry.path());
+  }
+  std::sort(paths.begin(), paths.end());
+  for (const std::filesystem::path &path : paths)
+  {
+    trace_t trace;
+    std::vector<trace_snapshot> snapshots;
+    if (!trace_file_read(path.c_str(), trace) || !trace_decode(trace.stream, snapshots) ||
+        snapshots.empty())
+    {
+      fprintf(stderr, "%s: not a trace\n", path.c_str());
+      return false;
+    }
+    std::vector<sim_key_event> events = trace_timeline(snapshots);
+    corpora.push_back({path.filename().string(), events, usage_presses(events)});
+  }
+  return true;
+}
+
+/** --------------------------------------------------------------------+ */
+/** Runs */
+/** --------------------------------------------------------------------+ */
+static uint64_t scans;
+
+static void counted_scan(void)
+{
+  scans++;
+  keyboard_scan();
+}
+
+/** main()'s task table and loop on a single core. */
+static void run_main_loop(uint64_t until_us)
+{
+  sched_task_t tasks[] = {
+#if KEYBOARD_GOVERNOR
+      SCHED_TASK_PACED(counted_scan, keyboard_scan_period_us),
+      SCHED_TASK_PACED(keyboard_debounce, keyboard_scan_period_us),
+#else
+      SCHED_TASK(counted_scan, KEYBOARD_SCAN_PERIOD_US),
+      SCHED_TASK(keyboard_debounce, KEYBOARD_DEBOUNCE_PERIOD_US),
+#endif
+      SCHED_TASK(keyboard_report, KEYBOARD_REPORT_PERIOD_US),
+  };
+  const uint count = sizeof(tasks) / sizeof(tasks[0]);
+  sched_restart(tasks, count, sim_now_us());
+  while (sim_now_us() < until_us)
+  {
+    if (keyboard_idle())
+    {
+      hal_wait_until_us(until_us);
+      if (!keyboard_idle())
+        sched_restart(tasks, count, sim_now_us());
+      continue;
+    }
+    hal_wait_until_us(sched_run_due(tasks, count));
+  }
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, uint p)
+{
+  if (sorted.empty())
+    return 0;
+  size_t rank = (sorted.size() * p + 99) / 100;
+  return sorted[rank ? rank - 1 : 0];
+}
+
+/** Run c BENCH_RUNS times and keep the fastest host time. */
+static result run(const corpus &c)
+{
+  result r = {c.name, 0, 0, 0, 0, 0, 0};
+  for (uint i = 0; i < BENCH_RUNS; i++)
+  {
+    sim_reset();
+    sim_set_ghosting(false);
+    keyboard_init();
+    sim_load_timeline(c.events);
+    scans = 0;
+    auto start = std::chrono::steady_clock::now();
+    run_main_loop(c.events.back().time_us + TRACE_REPLAY_TAIL_US);
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / scans;
+    r.ns_per_scan = i == 0 || ns < r.ns_per_scan ? ns : r.ns_per_scan;
+  }
+  r.scans = scans;
+  r.reports = sim_reports().size();
+
+  std::vector<uint64_t> latencies;
+  for (const sim_key_event &e : c.presses)
+  {
+    const sim_report *report =
+        sim_find_report((uint8_t)key_layout[e.col][e.row], true, e.time_us);
+    if (report)
+      latencies.push_back(report->complete_us - e.time_us);
+    else
+      r.missed++;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  r.p50_us = percentile(latencies, 50);
+  r.p99_us = percentile(latencies, 99);
+  return r;
+}
+
+/** --------------------------------------------------------------------+ */
+/** Baseline */
+/** --------------------------------------------------------------------+ */
+/** A baseline is a line per corpus: name, scans, host ns per scan,
+ * reports, p50 and p99 us. Lines starting with # are comments. */
+static bool read_baseline(const char *path, std::vector<result> &baseline)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+  {
+    perror(path);
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f))
+  {
+    char name[128];
+    result r = {};
+    unsigned long long scans_, reports, p50, p99;
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    if (sscanf(line, "%127s %llu %lf %llu %llu %llu", name, &scans_, &r.ns_per_scan, &reports,
+               &p50, &p99) != 6)
+    {
+      fprintf(stderr, "%s: cannot read \"%s\"\n", path, line);
+      fclose(f);
+      return false;
+    }
+    r.corpus = name;
+    r.scans = scans_;
+    r.reports = reports;
+    r.p50_us = p50;
+    r.p99_us = p99;
+    baseline.push_back(r);
+  }
+  fclose(f);
+  return true;
+}
+
+static bool write_baseline(const char *path, const std::vector<result> &results)
+{
+  FILE *f = fopen(path, "w");
+  if (!f)
+  {
+    perror(path);
+    return false;
+  }
+  fprintf(f, "# pipeline_bench baseline, rewritten with pipeline_bench --write.\n");
+  fprintf(f, "# corpus scans host_ns_per_scan reports p50_us p99_us\n");
+  for (const result &r : results)
+    fprintf(f, "%s %llu %.0f %llu %llu %llu\n", r.corpus.c_str(), (unsigned long long)r.scans,
+            r.ns_per_scan, (unsigned long long)r.reports, (unsigned long long)r.p50_us,
+            (unsigned long long)r.p99_us);
+  return fclose(f) == 0;
+}
+
+/** One metric against its baseline. True if it is within the slack. */
+static bool within(const char *corpus, const char *metric, double got, double base,
+                   uint slack_percent, bool gated)
+{
+  double limit = base * (100 + slack_percent) / 100;
+  bool ok = got <= limit || !gated;
+  if (got > limit || got < base)
+    printf("  %-14s %-13s %10.0f, baseline %.0f%s\n", corpus, metric, got, base,
+           got < base ? ", better" : ok ? ", not gated" : ", REGRESSED");
+  return ok;
+}
+
+static bool check(const std::vector<result> &results, const std::vector<result> &baseline,
+                  bool gate_time)
+{
+#ifdef NDEBUG
+  const bool time_gated = gate_time;
+#else
+  /** An unoptimized build is no measure of the hot path. */
+  const bool time_gated = false;
+  (void)gate_time;
+#endif
+  bool ok = true;
+  printf("against the baseline:\n");
+  for (const result &r : results)
+  {
+    const result *base = NULL;
+    for (const result &b : baseline)
+    {
+      if (b.corpus == r.corpus)
+        base = &b;
+    }
+    if (!base)
+    {
+      printf("  %-14s not in the baseline\n", r.corpus.c_str());
+      ok = false;
+      continue;
+    }
+    const char *name = r.corpus.c_str();
+    ok &= within(name, "scans", r.scans, base->scans, BENCH_SLACK_PERCENT, true);
+    ok &= within(name, "host ns/scan", r.ns_per_scan, base->ns_per_scan, BENCH_NS_SLACK_PERCENT,
+                 time_gated);
+    ok &= within(name, "reports", r.reports, base->reports, BENCH_SLACK_PERCENT, true);
+    ok &= within(name, "p50 us", r.p50_us, base->p50_us, BENCH_SLACK_PERCENT, true);
+    ok &= within(name, "p99 us", r.p99_us, base->p99_us, BENCH_SLACK_PERCENT, true);
+    if (r.missed)
+    {
+      printf("  %-14s %u presses never reported\n", name, r.missed);
+      ok = false;
+    }
+  }
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  bool gate_time = argc == 4 && !strcmp(argv[1], "--check") && !strcmp(argv[3], "--gate-time");
+  if (gate_time)
+    argc--;
+  if (argc != 1 && (argc != 3 || (strcmp(argv[1], "--check") && strcmp(argv[1], "--write"))))
+  {
+    fprintf(stderr, "usage: %s [--check BASELINE [--gate-time] | --write BASELINE]\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<corpus> corpora;
+  if (!load_corpora(TRACE_CORPUS_DIR, corpora))
+    return 1;
+
+  printf("pipeline (host polls every %u ms, best host time of %d runs)\n", HID_POLL_INTERVAL_MS,
+         BENCH_RUNS);
+  printf("  %-14s %7s %7s %12s %8s %7s %7s\n", "corpus", "presses", "scans", "host ns/scan",
+         "reports", "p50 us", "p99 us");
+  std::vector<result> results;
+  for (const corpus &c : corpora)
+  {
+    result r = run(c);
+    printf("  %-14s %7zu %7llu %12.0f %8llu %7llu %7llu\n", r.corpus.c_str(), c.presses.size(),
+           (unsigned long long)r.scans, r.ns_per_scan, (unsigned long long)r.reports,
+           (unsigned long long)r.p50_us, (unsigned long long)r.p99_us);
+    results.push_back(r);
+  }
+
+  if (argc == 3 && !strcmp(argv[1], "--write"))
+    return write_baseline(argv[2], results) ? 0 : 1;
+  if (argc == 3)
+  {
+    std::vector<result> baseline;
+    if (!read_baseline(argv[2], baseline))
+      return 1;
+    return check(results, baseline, gate_time) ? 0 : 1;
+  }
+  return 0;
+}
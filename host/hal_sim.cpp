@@ -0,0 +1,602 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "keyboard.h"
+#include "debug_log.h"
+#include "sim_matrix.h"
+
+#define SIM_NUM_PINS 32
+#define SIM_DEFAULT_POLL_INTERVAL_US (HID_POLL_INTERVAL_MS * 1000)
+
+/** Pressed rows of each column, bit n for row n. */
+static uint8_t key_rows[16];
+static bool pin_level[SIM_NUM_PINS];
+static uint64_t now_us;
+static uint64_t endpoint_busy_until_us[ITF_NUM_HID];
+static bool endpoint_completing[ITF_NUM_HID];
+static uint32_t host_poll_interval_us;
+static bool usb_suspended;
+static bool ghosting;
+/** Row pins armed for a falling edge, the rows that were LOW at the last
+ * look, whether an armed one has fallen since and how many times one
+ * has. */
+static uint32_t edge_mask;
+static uint8_t edge_rows;
+static bool edge_pending;
+static uint32_t edges;
+
+static std::vector<sim_key_event> timeline;
+static size_t timeline_next;
+
+static std::vector<sim_report> reports;
+
+/** The debug log's CDC port: the device's TX FIFO, whether the host has
+ * the port open and everything it has read. */
+#define SIM_CDC_FIFO_BYTES 512
+static std::vector<uint8_t> cdc_fifo;
+static bool cdc_connected;
+static std::vector<uint8_t> cdc_received;
+static sim_stats stats;
+
+static uint8_t flash[HAL_FLASH_CONFIG_SIZE];
+/** Power cut: armed, bytes of flash work left before it, and whether it
+ * has happened. */
+static bool flash_cut;
+static uint32_t flash_budget;
+static bool flash_dead;
+
+bool sim_report::is_keyboard(void) const
+{
+  return report_id == 0 || report_id == REPORT_ID_NKRO;
+}
+
+bool sim_report::has_key(uint8_t key) const
+{
+  if (!is_keyboard())
+    return false;
+  if (0xE0 <= key && key <= 0xE7)
+    return modifier & (1 << (key - 0xE0));
+  if (instance == ITF_NUM_NKRO)
+    return key < NKRO_KEY_COUNT && (bitmap[key / 8] >> (key % 8)) & 1;
+  for (int i = 0; i < 6; i++)
+  {
+    if (keycode[i] == key)
+      return true;
+  }
+  return false;
+}
+
+bool sim_report::empty(void) const
+{
+  for (int i = 0; i < 6; i++)
+  {
+    if (keycode[i] != 0)
+      return false;
+  }
+  for (size_t i = 0; i < sizeof(bitmap); i++)
+  {
+    if (bitmap[i] != 0)
+      return false;
+  }
+  return modifier == 0 && consumer == 0 && buttons == 0 && x == 0 && y == 0 && wheel == 0 &&
+         pan == 0;
+}
+
+/** What tud_task() does for the HID endpoints: tell the firmware about every
+ * report the host has polled since the last call. */
+static void usb_task(void)
+{
+  for (uint8_t i = 0; i < ITF_NUM_HID; i++)
+  {
+    if (endpoint_completing[i] && now_us >= endpoint_busy_until_us[i])
+    {
+      endpoint_completing[i] = false;
+      keyboard_report_complete(i);
+    }
+  }
+  /** The host takes whatever the FIFO holds, then main() refills it. */
+  if (cdc_connected)
+  {
+    cdc_received.insert(cdc_received.end(), cdc_fifo.begin(), cdc_fifo.end());
+    cdc_fifo.clear();
+  }
+  debug_log_task();
+}
+
+/** When the first report still in an endpoint will have been polled, which
+ * on the device is a USB interrupt. UINT64_MAX if none is. */
+static uint64_t next_completion_us(void)
+{
+  uint64_t next = UINT64_MAX;
+  for (uint8_t i = 0; i < ITF_NUM_HID; i++)
+  {
+    if (endpoint_completing[i] && endpoint_busy_until_us[i] < next)
+      next = endpoint_busy_until_us[i];
+  }
+  return next;
+}
+
+static uint8_t low_rows(void);
+
+/** Latch an edge if an armed row has gone LOW since the last look. Called
+ * whenever a key or a pin level changes. */
+static void check_edges(void)
+{
+  if (edge_mask == 0)
+    return;
+  uint8_t rows = low_rows();
+  uint8_t fell = rows & ~edge_rows;
+  edge_rows = rows;
+  for (uint row = 0; row < MATRIX_ROWS; row++)
+  {
+    if ((fell >> row) & 1 && (edge_mask >> rowPins[row]) & 1)
+    {
+      edge_pending = true;
+      edges++;
+    }
+  }
+}
+
+static void set_key(uint8_t col, uint8_t row, bool pressed)
+{
+  if (pressed)
+    key_rows[col] |= 1 << row;
+  else
+    key_rows[col] &= ~(1 << row);
+  check_edges();
+}
+
+/** Apply every scripted event that is due at the current time. */
+static void apply_timeline(void)
+{
+  while (timeline_next < timeline.size() &&
+         timeline[timeline_next].time_us <= now_us)
+  {
+    const sim_key_event &e = timeline[timeline_next++];
+    set_key(e.col, e.row, e.pressed);
+  }
+}
+
+void sim_reset(void)
+{
+  memset(key_rows, 0, sizeof(key_rows));
+  for (int i = 0; i < SIM_NUM_PINS; i++)
+    pin_level[i] = HIGH;
+  now_us = 0;
+  memset(endpoint_busy_until_us, 0, sizeof(endpoint_busy_until_us));
+  memset(endpoint_completing, 0, sizeof(endpoint_completing));
+  cdc_fifo.clear();
+  cdc_connected = false;
+  cdc_received.clear();
+  host_poll_interval_us = SIM_DEFAULT_POLL_INTERVAL_US;
+  usb_suspended = false;
+  ghosting = true;
+  edge_mask = 0;
+  edge_rows = 0;
+  edge_pending = false;
+  timeline.clear();
+  timeline_next = 0;
+  reports.clear();
+  memset(&stats, 0, sizeof(stats));
+  memset(flash, 0xff, sizeof(flash));
+  sim_flash_power_on();
+}
+
+void sim_load_timeline(const std::vector<sim_key_event> &events)
+{
+  timeline = events;
+  timeline_next = 0;
+  apply_timeline();
+}
+
+void sim_set_key(uint8_t col, uint8_t row, bool pressed)
+{
+  set_key(col, row, pressed);
+}
+
+sim_key_event sim_event(uint64_t time_us, action_t key, bool pressed)
+{
+  for (size_t col = 0; col < MATRIX_COLS; col++)
+  {
+    for (size_t row = 0; row < MATRIX_ROWS; row++)
+    {
+      if (key_layout[col][row] == key)
+        return {time_us, (uint8_t)col, (uint8_t)row, pressed};
+    }
+  }
+  fprintf(stderr, "sim_event: action 0x%04x is not in the keymap\n", key);
+  abort();
+}
+
+uint64_t sim_now_us(void)
+{
+  return now_us;
+}
+
+void sim_advance_us(uint64_t us)
+{
+  now_us += us;
+  apply_timeline();
+}
+
+void sim_set_host_poll_interval_us(uint32_t us)
+{
+  host_poll_interval_us = us;
+}
+
+void sim_set_boot_protocol(bool boot)
+{
+  keyboard_set_protocol(boot);
+}
+
+void sim_set_ghosting(bool on)
+{
+  ghosting = on;
+}
+
+void sim_set_suspended(bool suspended)
+{
+  usb_suspended = suspended;
+}
+
+void sim_pio_capture(const uint32_t *table, uint32_t *raw, uint words,
+                     uint32_t settle_us)
+{
+  for (uint i = 0; i < words; i++)
+  {
+    /** out pindirs, 32: an enabled column outputs 0, the others float back
+     * up on their pull ups. */
+    for (auto pin : colPins)
+      pin_level[pin] = (table[i] >> pin) & 1 ? LOW : HIGH;
+
+    sim_advance_us(settle_us);
+
+    /** in pins, 32 */
+    raw[i] = hal_gpio_get_all();
+  }
+  for (auto pin : colPins)
+    pin_level[pin] = HIGH;
+}
+
+uint8_t *sim_flash(void)
+{
+  return flash;
+}
+
+void sim_flash_cut_after(uint32_t bytes)
+{
+  flash_cut = true;
+  flash_budget = bytes;
+  flash_dead = false;
+}
+
+void sim_flash_power_on(void)
+{
+  flash_cut = false;
+  flash_dead = false;
+}
+
+const std::vector<sim_report> &sim_reports(void)
+{
+  return reports;
+}
+
+const sim_stats &sim_get_stats(void)
+{
+  return stats;
+}
+
+void sim_run(uint64_t until_us, uint32_t period_us, void (*loop)(void))
+{
+  while (now_us < until_us)
+  {
+    uint64_t start = now_us;
+    usb_task();
+    loop();
+    /** A report being polled wakes the core for tud_task() on the way. */
+    while (now_us < start + period_us)
+    {
+      uint64_t next = next_completion_us();
+      uint64_t until = next > now_us && next < start + period_us ? next : start + period_us;
+      sim_advance_us(until - now_us);
+      usb_task();
+    }
+  }
+}
+
+const sim_report *sim_find_report(uint8_t key, bool pressed, uint64_t after_us)
+{
+  for (const sim_report &r : reports)
+  {
+    if (r.queued_us >= after_us && r.is_keyboard() && r.has_key(key) == pressed)
+      return &r;
+  }
+  return NULL;
+}
+
+/** --------------------------------------------------------------------+ */
+/** hal.h */
+/** --------------------------------------------------------------------+ */
+void hal_gpio_init_output(uint pin)
+{
+  pin_level[pin] = LOW;
+}
+
+void hal_gpio_init_input_pullup(uint pin)
+{
+  pin_level[pin] = HIGH;
+}
+
+void hal_gpio_put(uint pin, bool value)
+{
+  stats.gpio_puts++;
+  pin_level[pin] = value;
+  check_edges();
+}
+
+/** Rows pulled LOW right now, bit n for rowPins[n]. A pressed key joins its
+ * column to its row. There are no diodes and an idle column only holds its
+ * level weakly, so with ghosting on a LOW column pulls down every row it can
+ * reach through pressed keys, by way of other rows and columns. */
+static uint8_t low_rows(void)
+{
+  uint32_t reached = 0;
+  for (uint col = 0; col < MATRIX_COLS; col++)
+  {
+    if (pin_level[colPins[col]] == LOW)
+      reached |= 1u << col;
+  }
+
+  uint8_t rows = 0;
+  uint32_t last;
+  do
+  {
+    last = reached;
+    for (uint col = 0; col < MATRIX_COLS; col++)
+    {
+      if (reached & (1u << col))
+        rows |= key_rows[col];
+    }
+    if (!ghosting)
+      break;
+    for (uint col = 0; col < MATRIX_COLS; col++)
+    {
+      if (key_rows[col] & rows)
+        reached |= 1u << col;
+    }
+  } while (reached != last);
+  return rows;
+}
+
+/** Level the pin would read right now. A row reads LOW when it is connected
+ * to a LOW column, otherwise the pull up wins. */
+static bool pin_read(uint pin)
+{
+  for (uint row = 0; row < MATRIX_ROWS; row++)
+  {
+    if (rowPins[row] == pin)
+      return (low_rows() >> row) & 1 ? LOW : HIGH;
+  }
+  return pin_level[pin];
+}
+
+bool hal_gpio_get(uint pin)
+{
+  stats.gpio_gets++;
+  return pin_read(pin);
+}
+
+uint32_t hal_gpio_get_all(void)
+{
+  stats.gpio_gets++;
+  uint32_t bank = 0;
+  for (uint pin = 0; pin < SIM_NUM_PINS; pin++)
+  {
+    if (pin_level[pin])
+      bank |= 1u << pin;
+  }
+  uint8_t rows = low_rows();
+  for (uint row = 0; row < MATRIX_ROWS; row++)
+  {
+    if ((rows >> row) & 1)
+      bank &= ~(1u << rowPins[row]);
+  }
+  return bank;
+}
+
+void hal_gpio_edge_irq(uint32_t mask, bool enabled)
+{
+  edge_mask = enabled ? edge_mask | mask : edge_mask & ~mask;
+  edge_rows = low_rows();
+  edge_pending = false;
+}
+
+bool hal_gpio_edge_pending(void)
+{
+  return edge_pending;
+}
+
+uint hal_core_num(void)
+{
+  return 0;
+}
+
+uint64_t hal_time_us(void)
+{
+  return now_us;
+}
+
+void hal_sleep_us(uint64_t us)
+{
+  stats.sleeps++;
+  stats.slept_us += us;
+  sim_advance_us(us);
+}
+
+void hal_wait_until_us(uint64_t deadline_us)
+{
+  stats.waits++;
+  /** A report being polled is a USB interrupt and ends the wait. */
+  uint64_t polled = next_completion_us();
+  if (polled > now_us && polled < deadline_us)
+    deadline_us = polled;
+  /** So does an armed row edge, at the scripted event that caused it. An
+   * edge from before the wait has woken the core once already: it is
+   * latched until the scan gets to it, but it does not end this wait. */
+  uint32_t seen = edges;
+  while (edge_mask && edges == seen && timeline_next < timeline.size() &&
+         timeline[timeline_next].time_us < deadline_us)
+    sim_advance_us(timeline[timeline_next].time_us - now_us);
+  if (edges == seen && deadline_us > now_us)
+    sim_advance_us(deadline_us - now_us);
+  usb_task();
+}
+
+const uint8_t *hal_flash_config(void)
+{
+  return flash;
+}
+
+/** One more byte of flash work, false once the power is gone. */
+static bool flash_powered(void)
+{
+  if (flash_dead)
+    return false;
+  if (flash_cut && flash_budget-- == 0)
+  {
+    flash_dead = true;
+    return false;
+  }
+  return true;
+}
+
+void hal_flash_erase(uint32_t offset)
+{
+  if (offset % HAL_FLASH_SECTOR_SIZE || offset >= HAL_FLASH_CONFIG_SIZE)
+  {
+    fprintf(stderr, "hal_flash_erase: 0x%x is not a sector in the config region\n", offset);
+    abort();
+  }
+  stats.flash_erases++;
+  for (uint32_t i = 0; i < HAL_FLASH_SECTOR_SIZE && flash_powered(); i++)
+    flash[offset + i] = 0xff;
+}
+
+void hal_flash_program(uint32_t offset, const uint8_t *data, uint32_t len)
+{
+  if (offset % HAL_FLASH_PAGE_SIZE || len % HAL_FLASH_PAGE_SIZE ||
+      offset + len > HAL_FLASH_CONFIG_SIZE)
+  {
+    fprintf(stderr, "hal_flash_program: 0x%x + %u is not whole pages in the config region\n",
+            offset, len);
+    abort();
+  }
+  stats.flash_pages += len / HAL_FLASH_PAGE_SIZE;
+  for (uint32_t i = 0; i < len && flash_powered(); i++)
+    flash[offset + i] &= data[i];
+}
+
+bool hal_usb_suspended(void)
+{
+  return usb_suspended;
+}
+
+void hal_usb_remote_wakeup(void)
+{
+  stats.remote_wakeups++;
+  usb_suspended = false;
+}
+
+bool hal_hid_ready(uint8_t instance)
+{
+  usb_task();
+  return !usb_suspended && now_us >= endpoint_busy_until_us[instance];
+}
+
+/** The report sits in the endpoint until the next host poll. */
+static bool queue_report(sim_report &r)
+{
+  if (!hal_hid_ready(r.instance))
+    return false;
+
+  r.queued_us = now_us;
+  endpoint_busy_until_us[r.instance] =
+      (now_us / host_poll_interval_us + 1) * host_poll_interval_us;
+  r.complete_us = endpoint_busy_until_us[r.instance];
+  endpoint_completing[r.instance] = true;
+  reports.push_back(r);
+  return true;
+}
+
+bool hal_hid_keyboard_report(uint8_t modifier, const uint8_t keycode[6])
+{
+  sim_report r = {};
+  r.instance = ITF_NUM_KEYBOARD;
+  r.modifier = modifier;
+  if (keycode)
+    memcpy(r.keycode, keycode, 6);
+  return queue_report(r);
+}
+
+bool hal_hid_nkro_report(uint8_t modifier, const uint8_t *bitmap)
+{
+  sim_report r = {};
+  r.instance = ITF_NUM_NKRO;
+  r.report_id = REPORT_ID_NKRO;
+  r.modifier = modifier;
+  memcpy(r.bitmap, bitmap, sizeof(r.bitmap));
+  return queue_report(r);
+}
+
+bool hal_hid_consumer_report(uint16_t usage)
+{
+  sim_report r = {};
+  r.instance = ITF_NUM_NKRO;
+  r.report_id = REPORT_ID_CONSUMER_CONTROL;
+  r.consumer = usage;
+  return queue_report(r);
+}
+
+bool hal_hid_mouse_report(uint8_t buttons, int8_t x, int8_t y, int8_t wheel, int8_t pan)
+{
+  sim_report r = {};
+  r.instance = ITF_NUM_NKRO;
+  r.report_id = REPORT_ID_MOUSE;
+  r.buttons = buttons;
+  r.x = x;
+  r.y = y;
+  r.wheel = wheel;
+  r.pan = pan;
+  return queue_report(r);
+}
+
+bool hal_cdc_connected(void)
+{
+  return cdc_connected;
+}
+
+uint32_t hal_cdc_write_available(void)
+{
+  return SIM_CDC_FIFO_BYTES - cdc_fifo.size();
+}
+
+void hal_cdc_write(const void *data, uint32_t len)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  uint32_t n = len < hal_cdc_write_available() ? len : hal_cdc_write_available();
+  cdc_fifo.insert(cdc_fifo.end(), bytes, bytes + n);
+}
+
+void hal_cdc_flush(void) {}
+
+void sim_set_cdc_connected(bool connected)
+{
+  cdc_connected = connected;
+}
+
+const std::vector<uint8_t> &sim_cdc_received(void)
+{
+  return cdc_received;
+}
@@ -0,0 +1,135 @@
+/** Reads the keystroke latency stats off a keyboard built with
+ * KEYBOARD_LATENCY=1 and prints them.
+ *
+ *   latency_reader /dev/hidrawN
+ *
+ * The stats are on the NKRO interface (usually the second hidraw node the
+ * keyboard gets) as feature report REPORT_ID_LATENCY. */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include "latency.h"
+
+static const char *stage_names[LATENCY_STAGES] = {
+    "raw -> debounced",
+    "debounced -> queued",
+    "queued -> complete",
+    "raw -> complete",
+};
+
+static const char *band_names[GOVERNOR_BANDS] = {"fast", "normal", "slow", "idle"};
+
+static const char *task_names[LATENCY_TASKS] = {"scan", "debounce", "report"};
+
+/** Select page 0, then read pages until the struct is complete. */
+static bool read_stats(int fd, latency_stats_t &stats)
+{
+  uint8_t buf[1 + LATENCY_REPORT_LEN];
+  buf[0] = REPORT_ID_LATENCY;
+  buf[1] = 0;
+  if (ioctl(fd, HIDIOCSFEATURE(2), buf) < 0)
+  {
+    perror("HIDIOCSFEATURE");
+    return false;
+  }
+
+  uint8_t raw[LATENCY_PAGES * LATENCY_PAGE_BYTES];
+  for (uint page = 0; page < LATENCY_PAGES; page++)
+  {
+    memset(buf, 0, sizeof(buf));
+    buf[0] = REPORT_ID_LATENCY;
+    if (ioctl(fd, HIDIOCGFEATURE(sizeof(buf)), buf) < 0)
+    {
+      perror("HIDIOCGFEATURE");
+      return false;
+    }
+    if (buf[1] != page)
+    {
+      fprintf(stderr, "expected page %u, got %u\n", page, buf[1]);
+      return false;
+    }
+    memcpy(raw + page * LATENCY_PAGE_BYTES, buf + 2, LATENCY_PAGE_BYTES);
+  }
+
+  memcpy(&stats, raw, sizeof(stats));
+  if (stats.version != LATENCY_VERSION || stats.size != sizeof(stats) ||
+      stats.buckets != LATENCY_BUCKETS || stats.stages != LATENCY_STAGES)
+  {
+    fprintf(stderr, "stats version %u size %u do not match this reader (%u, %zu)\n",
+            stats.version, stats.size, LATENCY_VERSION, sizeof(stats));
+    return false;
+  }
+  return true;
+}
+
+static void print_stats(const latency_stats_t &stats)
+{
+  printf("keystrokes %u, untracked %u, missed ready windows %u, loop overruns %u\n",
+         stats.keystrokes, stats.untracked, stats.missed_ready, stats.overruns);
+  if (stats.scan_period_us)
+  {
+    printf("scanning every %u us;", stats.scan_period_us);
+    for (uint b = 0; b < GOVERNOR_BANDS; b++)
+      printf(" %s %u ms%s", band_names[b], stats.scan_band_ms[b], b + 1 < GOVERNOR_BANDS ? "," : "\n");
+  }
+  for (uint i = 0; i < LATENCY_TASKS; i++)
+  {
+    if (stats.task_period_mean_us[i])
+      printf("%s period min %u us, mean %u us, max %u us\n", task_names[i],
+             stats.task_period_min_us[i], stats.task_period_mean_us[i],
+             stats.task_period_max_us[i]);
+  }
+
+  for (uint s = 0; s < LATENCY_STAGES; s++)
+  {
+    uint32_t total = 0;
+    for (uint b = 0; b < LATENCY_BUCKETS; b++)
+      total += stats.histogram[s][b];
+
+    printf("\n%s (max %u us)\n", stage_names[s], stats.max_us[s]);
+    for (uint b = 0; b < LATENCY_BUCKETS; b++)
+    {
+      uint32_t count = stats.histogram[s][b];
+      if (count == 0)
+        continue;
+      uint lo = b * stats.bucket_us;
+      int bar = total ? (int)(40 * (uint64_t)count / total) : 0;
+      if (b == LATENCY_BUCKETS - 1)
+        printf("  %5u+      us %8u %.*s\n", lo, count, bar,
+               "########################################");
+      else
+        printf("  %5u-%-5u us %8u %.*s\n", lo, lo + stats.bucket_us, count, bar,
+               "########################################");
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s /dev/hidrawN\n", argv[0]);
+    return 2;
+  }
+
+  int fd = open(argv[1], O_RDWR);
+  if (fd < 0)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+
+  latency_stats_t stats;
+  bool ok = read_stats(fd, stats);
+  close(fd);
+  if (!ok)
+    return 1;
+
+  print_stats(stats);
+  return 0;
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+#include <elf.h>
+
+#include "log_decode.h"
+
+/** Find the section called name in the ELF image and copy it out. Class is
+ * Elf32 or Elf64 headers: the firmware is one, the simulator the other. */
+template <typename Ehdr, typename Shdr>
+static bool find_section(const std::vector<uint8_t> &image, const char *name, std::string &out)
+{
+  Ehdr eh;
+  if (image.size() < sizeof(eh))
+    return false;
+  memcpy(&eh, image.data(), sizeof(eh));
+  if (eh.e_shoff == 0 || eh.e_shentsize != sizeof(Shdr) ||
+      eh.e_shoff + (uint64_t)eh.e_shnum * sizeof(Shdr) > image.size() || eh.e_shstrndx >= eh.e_shnum)
+    return false;
+
+  auto section = [&](uint i) {
+    Shdr sh;
+    memcpy(&sh, image.data() + eh.e_shoff + i * sizeof(Shdr), sizeof(sh));
+    return sh;
+  };
+  Shdr names = section(eh.e_shstrndx);
+  for (uint i = 0; i < eh.e_shnum; i++)
+  {
+    Shdr sh = section(i);
+    if (sh.sh_name >= names.sh_size || names.sh_offset + names.sh_size > image.size())
+      continue;
+    const char *sh_name = (const char *)image.data() + names.sh_offset + sh.sh_name;
+    if (strncmp(sh_name, name, names.sh_size - sh.sh_name) != 0)
+      continue;
+    if (sh.sh_type == SHT_NOBITS || sh.sh_offset + sh.sh_size > image.size())
+      return false;
+    out.assign((const char *)image.data() + sh.sh_offset, sh.sh_size);
+    return true;
+  }
+  return false;
+}
+
+bool log_formats_read(const char *path, std::string &formats)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  std::vector<uint8_t> image;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    image.insert(image.end(), buf, buf + n);
+  fclose(f);
+
+  if (image.size() < EI_NIDENT || memcmp(image.data(), ELFMAG, SELFMAG) != 0 ||
+      image[EI_DATA] != ELFDATA2LSB)
+    return false;
+  if (image[EI_CLASS] == ELFCLASS32)
+    return find_section<Elf32_Ehdr, Elf32_Shdr>(image, "debug_log_fmt", formats);
+  if (image[EI_CLASS] == ELFCLASS64)
+    return find_section<Elf64_Ehdr, Elf64_Shdr>(image, "debug_log_fmt", formats);
+  return false;
+}
+
+static uint32_t word_at(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+size_t log_decode(const std::string &formats, const uint8_t *data, size_t len,
+                  std::vector<log_line> &lines)
+{
+  size_t used = 0;
+  while (len - used >= 8)
+  {
+    uint32_t head = word_at(data + used);
+    uint n = (head >> 16) & 0xff;
+    uint id = head & 0xffff;
+    bool valid = head >> 24 == DEBUG_LOG_TAG && n <= DEBUG_LOG_MAX_ARGS &&
+                 (id == DEBUG_LOG_DROPPED ? n == 1 : id < formats.size());
+    if (!valid)
+    {
+      used++;
+      continue;
+    }
+    if (len - used < (2 + n) * 4)
+      break;
+
+    uint32_t args[DEBUG_LOG_MAX_ARGS];
+    for (uint i = 0; i < n; i++)
+      args[i] = word_at(data + used + 8 + i * 4);
+    log_line line;
+    line.time_us = word_at(data + used + 4);
+    if (id == DEBUG_LOG_DROPPED)
+      line.text = log_format("%u records dropped", args, n);
+    else
+      line.text = log_format(formats.c_str() + id, args, n);
+    lines.push_back(line);
+    used += (2 + n) * 4;
+  }
+  return used;
+}
+
+std::string log_format(const char *fmt, const uint32_t *args, uint n)
+{
+  std::string out;
+  uint next = 0;
+  for (const char *p = fmt; *p; p++)
+  {
+    if (*p != '%')
+    {
+      out += *p;
+      continue;
+    }
+
+    /** Copy the spec up to the conversion, minus length modifiers: every
+     * argument is 32 bits whatever the firmware said. */
+    const char *start = p++;
+    std::string spec = "%";
+    while (*p && strchr("-+ #0123456789", *p))
+      spec += *p++;
+    while (*p && strchr("hlzjt", *p))
+      p++;
+    if (!*p)
+    {
+      out.append(start);
+      break;
+    }
+
+    char buf[64];
+    char conv = *p;
+    if (conv == '%')
+    {
+      out += '%';
+      continue;
+    }
+    if (!strchr("diuxXoc", conv))
+    {
+      out.append(start, p + 1);
+      continue;
+    }
+    if (next >= n)
+    {
+      out += '?';
+      continue;
+    }
+    spec += conv;
+    uint32_t arg = args[next++];
+    if (conv == 'd' || conv == 'i')
+      snprintf(buf, sizeof(buf), spec.c_str(), (int)(int32_t)arg);
+    else if (conv == 'c')
+      snprintf(buf, sizeof(buf), spec.c_str(), (int)(uint8_t)arg);
+    else
+      snprintf(buf, sizeof(buf), spec.c_str(), (unsigned)arg);
+    out += buf;
+  }
+  return out;
+}
@@ -0,0 +1,44 @@
+#ifndef LOG_DECODE_H_
+#define LOG_DECODE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#include "debug_log.h"
+
+/** --------------------------------------------------------------------+ */
+/** Debug log decoder */
+/** --------------------------------------------------------------------+ */
+/** Turns the binary records DEBUG_LOG() writes (debug_log.h has the
+ * format) back into text, with the format strings out of the debug_log_fmt
+ * section of the firmware that wrote them. The ELF has to be the one the
+ * keyboard runs: with another build the offsets point at the wrong
+ * formats. */
+
+struct log_line
+{
+  /** The low 32 bits of the keyboard's hal_time_us(). */
+  uint32_t time_us;
+  std::string text;
+};
+
+/** The debug_log_fmt section of the ELF at path, into formats. False if
+ * the file is no ELF or has no such section. */
+bool log_formats_read(const char *path, std::string &formats);
+
+/** Decode the records at the start of data, appending a line for each to
+ * lines. Returns how many bytes it used: a record cut short at the end is
+ * left for the next call, with the rest of it. Bytes that start no record
+ * are skipped, so a stream can be picked up anywhere. */
+size_t log_decode(const std::string &formats, const uint8_t *data, size_t len,
+                  std::vector<log_line> &lines);
+
+/** printf fmt with the n 32 bit args. Takes %d, %i, %u, %x, %X, %o, %c and
+ * %% with flags and a width; a conversion with no argument left prints as
+ * "?". */
+std::string log_format(const char *fmt, const uint32_t *args, uint n);
+
+#endif /* LOG_DECODE_H_ */
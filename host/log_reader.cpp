@@ -0,0 +1,71 @@
+/** Prints the debug log of a keyboard built with KEYBOARD_DEBUG_LOG=1.
+ *
+ *   log_reader FIRMWARE.elf [/dev/ttyACMn]
+ *
+ * The log comes off the keyboard's CDC interface, or stdin without a
+ * port, and its format strings out of FIRMWARE.elf, which has to be the
+ * build the keyboard runs. Each line starts with the keyboard's time in
+ * seconds; that wraps every 71 minutes. */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "log_decode.h"
+
+int main(int argc, char **argv)
+{
+  if (argc != 2 && argc != 3)
+  {
+    fprintf(stderr, "usage: %s FIRMWARE.elf [/dev/ttyACMn]\n", argv[0]);
+    return 2;
+  }
+
+  std::string formats;
+  if (!log_formats_read(argv[1], formats))
+  {
+    fprintf(stderr, "%s: no debug_log_fmt section\n", argv[1]);
+    return 1;
+  }
+
+  int fd = 0;
+  if (argc == 3)
+  {
+    fd = open(argv[2], O_RDONLY | O_NOCTTY);
+    if (fd < 0)
+    {
+      perror(argv[2]);
+      return 1;
+    }
+    /** Raw, or the tty layer eats the bytes that look like control
+     * characters. */
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0)
+    {
+      cfmakeraw(&tio);
+      tcsetattr(fd, TCSANOW, &tio);
+    }
+  }
+
+  std::vector<uint8_t> pending;
+  std::vector<log_line> lines;
+  uint8_t buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+  {
+    pending.insert(pending.end(), buf, buf + n);
+    size_t used = log_decode(formats, pending.data(), pending.size(), lines);
+    pending.erase(pending.begin(), pending.begin() + used);
+    for (const log_line &l : lines)
+      printf("%6u.%06u %s\n", l.time_us / 1000000, l.time_us % 1000000, l.text.c_str());
+    lines.clear();
+    fflush(stdout);
+  }
+  if (n < 0)
+    perror("read");
+  if (fd != 0)
+    close(fd);
+  return n < 0;
+}
@@ -0,0 +1,39 @@
+#ifndef SCENARIO_H_
+#define SCENARIO_H_
+
+#include <stdio.h>
+
+/** --------------------------------------------------------------------+ */
+/** Host scenario registry */
+/** --------------------------------------------------------------------+ */
+/** Each SIM_SCENARIO is a scripted run against the simulated matrix. They
+ * register themselves at static init and keyboard_sim runs them all (or the
+ * ones whose name contains argv[1]). A failing SIM_CHECK ends the scenario
+ * and makes the run exit non-zero. */
+
+typedef void (*scenario_fn)(void);
+
+struct scenario_registrar
+{
+  scenario_registrar(const char *name, scenario_fn fn);
+};
+
+/** Record a failure for the running scenario. */
+void scenario_fail(const char *file, int line, const char *expr);
+
+#define SIM_SCENARIO(name)                                        \
+  static void name(void);                                         \
+  static scenario_registrar name##_registrar(#name, name);        \
+  static void name(void)
+
+#define SIM_CHECK(cond)                                           \
+  do                                                              \
+  {                                                               \
+    if (!(cond))                                                  \
+    {                                                             \
+      scenario_fail(__FILE__, __LINE__, #cond);                   \
+      return;                                                     \
+    }                                                             \
+  } while (0)
+
+#endif /* SCENARIO_H_ */
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "combo.h"
+#include "sim_matrix.h"
+#include "sim_typing.h"
+#include "scenario.h"
+
+/** A few combos over the first positions, and a key in none of them. */
+enum
+{
+  KEY_A,
+  KEY_B,
+  KEY_C,
+  KEY_D,
+  KEY_E,
+  KEY_PLAIN,
+};
+
+#define ACTION_AB HID_KEY_ESCAPE
+#define ACTION_ABC HID_KEY_TAB
+#define ACTION_DE MO(1)
+
+static constexpr combo_def_t test_combo_defs[] = {
+    {{{(1u << KEY_A) | (1u << KEY_B)}}, ACTION_AB},
+    {{{(1u << KEY_A) | (1u << KEY_B) | (1u << KEY_C)}}, ACTION_ABC},
+    {{{(1u << KEY_D) | (1u << KEY_E)}}, ACTION_DE},
+};
+static constexpr combo_table_t test_combos = combo_table(test_combo_defs);
+
+#define TERM_MS 30
+#define TERM_US (TERM_MS * 1000)
+
+/** The scan side in miniature: debounced changes -> combos -> queue. */
+struct harness
+{
+  key_event_queue_t q;
+  combo_t c;
+  std::vector<key_event_t> out;
+
+  harness(const combo_table_t &table = test_combos)
+  {
+    event_queue_init(q);
+    combo_init(c, table, TERM_MS);
+  }
+
+  void event(uint32_t time_us, uint8_t pos, bool pressed)
+  {
+    key_event_t e = {};
+    e.time_us = time_us;
+    e.pos = pos;
+    e.pressed = pressed;
+    combo_event(c, e, q);
+    drain();
+  }
+
+  void tick(uint32_t now_us)
+  {
+    combo_tick(c, now_us, q);
+    drain();
+  }
+
+  void drain(void)
+  {
+    key_event_t e;
+    while (event_queue_peek(q, e))
+    {
+      out.push_back(e);
+      event_queue_pop(q);
+    }
+  }
+
+  bool sent(size_t i, uint8_t pos, bool pressed, action_t action = 0) const
+  {
+    return i < out.size() && out[i].pos == pos && out[i].pressed == pressed &&
+           out[i].action == action;
+  }
+};
+
+SIM_SCENARIO(combo_pair_sends_its_action)
+{
+  harness h;
+  h.event(1000, KEY_D, true);
+  SIM_CHECK(h.out.empty());
+
+  /** D+E is as big as a combo with them gets, so it goes out at once, as
+   * a press of D. */
+  h.event(8000, KEY_E, true);
+  SIM_CHECK(h.out.size() == 1);
+  SIM_CHECK(h.sent(0, KEY_D, true, ACTION_DE));
+  SIM_CHECK(h.out[0].time_us == 8000);
+
+  /** The first key up releases it, the second is swallowed. */
+  h.event(90000, KEY_E, false);
+  h.event(95000, KEY_D, false);
+  SIM_CHECK(h.out.size() == 2);
+  SIM_CHECK(h.sent(1, KEY_D, false));
+  SIM_CHECK(combo_empty(h.c));
+}
+
+SIM_SCENARIO(combo_lone_key_goes_through_after_term)
+{
+  harness h;
+  h.event(1000, KEY_A, true);
+  h.tick(1000 + TERM_US - 1);
+  SIM_CHECK(h.out.empty());
+  h.tick(1000 + TERM_US);
+  SIM_CHECK(h.out.size() == 1);
+  SIM_CHECK(h.sent(0, KEY_A, true));
+  SIM_CHECK(h.out[0].time_us == 1000);
+
+  /** Too late for a combo with B. */
+  h.event(1000 + TERM_US + 5000, KEY_B, true);
+  h.tick(1000 + 2 * TERM_US + 5000);
+  SIM_CHECK(h.sent(1, KEY_B, true));
+}
+
+SIM_SCENARIO(combo_released_early_is_a_plain_tap)
+{
+  harness h;
+  h.event(1000, KEY_A, true);
+  h.event(12000, KEY_A, false);
+  SIM_CHECK(h.out.size() == 2);
+  SIM_CHECK(h.sent(0, KEY_A, true));
+  SIM_CHECK(h.sent(1, KEY_A, false));
+}
+
+SIM_SCENARIO(combo_other_key_ends_it)
+{
+  harness h;
+  h.event(1000, KEY_A, true);
+  h.event(5000, KEY_PLAIN, true);
+  SIM_CHECK(h.out.size() == 2);
+  SIM_CHECK(h.sent(0, KEY_A, true));
+  SIM_CHECK(h.sent(1, KEY_PLAIN, true));
+
+  /** A combo key from another combo starts over with itself. */
+  h.event(40000, KEY_B, true);
+  h.event(45000, KEY_D, true);
+  SIM_CHECK(h.out.size() == 3);
+  SIM_CHECK(h.sent(2, KEY_B, true));
+  h.event(50000, KEY_E, true);
+  SIM_CHECK(h.sent(3, KEY_D, true, ACTION_DE));
+}
+
+SIM_SCENARIO(combo_waits_for_a_bigger_one)
+{
+  /** A+B could still become A+B+C. */
+  harness h;
+  h.event(1000, KEY_A, true);
+  h.event(4000, KEY_B, true);
+  SIM_CHECK(h.out.empty());
+  h.event(9000, KEY_C, true);
+  SIM_CHECK(h.out.size() == 1);
+  SIM_CHECK(h.sent(0, KEY_A, true, ACTION_ABC));
+
+  /** Without C, A+B goes out when the term runs out. */
+  harness h2;
+  h2.event(1000, KEY_A, true);
+  h2.event(4000, KEY_B, true);
+  h2.tick(1000 + TERM_US);
+  SIM_CHECK(h2.out.size() == 1);
+  SIM_CHECK(h2.sent(0, KEY_A, true, ACTION_AB));
+
+  /** Or when one of them is let go, as a tap. */
+  harness h3;
+  h3.event(1000, KEY_A, true);
+  h3.event(4000, KEY_B, true);
+  h3.event(20000, KEY_B, false);
+  SIM_CHECK(h3.out.size() == 2);
+  SIM_CHECK(h3.sent(0, KEY_A, true, ACTION_AB));
+  SIM_CHECK(h3.sent(1, KEY_A, false));
+}
+
+SIM_SCENARIO(combo_keeps_other_releases_in_order)
+{
+  harness h;
+  h.event(1000, KEY_PLAIN, true);
+  h.event(20000, KEY_D, true);
+  /** Released while D is held back: it has to wait behind D. */
+  h.event(22000, KEY_PLAIN, false);
+  SIM_CHECK(h.out.size() == 1);
+  h.event(25000, KEY_E, true);
+  SIM_CHECK(h.out.size() == 3);
+  SIM_CHECK(h.sent(1, KEY_PLAIN, false));
+  SIM_CHECK(h.sent(2, KEY_D, true, ACTION_DE));
+}
+
+SIM_SCENARIO(combo_hundreds_all_match)
+{
+  /** Every pair of neighbouring switches on the layout, and every run of
+   * three down a column, as a combo of its own. */
+  std::vector<uint8_t> keys;
+  for (uint col = 0; col < MATRIX_COLS; col++)
+  {
+    for (uint row = 0; row < MATRIX_ROWS; row++)
+    {
+      if (key_layout[col][row] != HID_KEY_NONE)
+        keys.push_back(MATRIX_POS(col, row));
+    }
+  }
+  std::vector<combo_def_t> defs;
+  for (size_t i = 0; i + 1 < keys.size(); i++)
+  {
+    combo_def_t def = {};
+    def.keys.words[keys[i] >> 5] |= 1u << (keys[i] & 31);
+    def.keys.words[keys[i + 1] >> 5] |= 1u << (keys[i + 1] & 31);
+    def.action = HID_KEY_A + defs.size() % 26;
+    defs.push_back(def);
+  }
+  for (uint col = 0; col < MATRIX_COLS; col++)
+  {
+    for (uint row = 0; row + 2 < MATRIX_ROWS; row++)
+    {
+      combo_def_t def = {};
+      for (uint r = row; r < row + 3; r++)
+      {
+        uint pos = MATRIX_POS(col, r);
+        def.keys.words[pos >> 5] |= 1u << (pos & 31);
+      }
+      def.action = HID_KEY_F1 + defs.size() % 12;
+      defs.push_back(def);
+    }
+  }
+  printf("    %zu combos\n", defs.size());
+  SIM_CHECK(defs.size() >= 100);
+
+  combo_table_t table = {defs.data(), (uint16_t)defs.size(), {}};
+  for (const combo_def_t &def : defs)
+  {
+    for (uint w = 0; w < MATRIX_WORDS; w++)
+      table.keys.words[w] |= def.keys.words[w];
+  }
+
+  /** Each one pressed key by key and held past the term comes out as
+   * itself, unless it is part of a bigger one that is also on the table. */
+  uint32_t t = 0;
+  size_t fired = 0;
+  for (size_t i = 0; i < defs.size(); i++)
+  {
+    harness h(table);
+    std::vector<uint8_t> pressed;
+    for (uint w = 0; w < MATRIX_WORDS; w++)
+    {
+      for (uint32_t bits = defs[i].keys.words[w]; bits; bits &= bits - 1)
+      {
+        pressed.push_back(w * 32 + __builtin_ctz(bits));
+        h.event(t += 1000, pressed.back(), true);
+      }
+    }
+    h.tick(t + TERM_US);
+    fired += h.out.size() == 1 && h.out[0].action == defs[i].action &&
+             h.out[0].pos == pressed[0];
+    for (uint8_t pos : pressed)
+      h.event(t += 1000, pos, false);
+    SIM_CHECK(combo_empty(h.c));
+    SIM_CHECK(h.out.size() == 2 && h.sent(1, pressed[0], false));
+  }
+  SIM_CHECK(fired == defs.size());
+}
+
+/** --------------------------------------------------------------------+ */
+/** The keymap.h example: J and K together for Escape */
+/** --------------------------------------------------------------------+ */
+static constexpr auto jk_combo_defs =
+    combo_list(keymap_detail::combo({HID_KEY_J, HID_KEY_K}, HID_KEY_ESCAPE));
+static constexpr combo_table_t jk_combos = combo_table(jk_combo_defs);
+
+static uint8_t key_pos(action_t key)
+{
+  sim_key_event e = sim_event(0, key, true);
+  return MATRIX_POS(e.col, e.row);
+}
+
+SIM_SCENARIO(jk_combo_sends_escape)
+{
+  uint8_t j = key_pos(HID_KEY_J), k = key_pos(HID_KEY_K);
+  uint8_t first = j < k ? j : k;
+  harness h(jk_combos);
+  h.event(10000, j, true);
+  h.event(25000, k, true);
+  SIM_CHECK(h.out.size() == 1 && h.sent(0, first, true, HID_KEY_ESCAPE));
+  h.event(90000, j, false);
+  h.event(100000, k, false);
+  SIM_CHECK(h.out.size() == 2 && h.sent(1, first, false));
+
+  /** Rolled apart, J then K. */
+  h.event(200000, j, true);
+  h.tick(200000 + TERM_US);
+  h.event(260000, k, true);
+  h.tick(260000 + TERM_US);
+  SIM_CHECK(h.out.size() == 4 && h.sent(2, j, true) && h.sent(3, k, true));
+}
+
+/** --------------------------------------------------------------------+ */
+/** Whole firmware, default keymap */
+/** --------------------------------------------------------------------+ */
+#define LOOP_PERIOD_US 1000
+
+SIM_SCENARIO(combo_typing_trace_latency)
+{
+  std::vector<sim_key_event> typed;
+  std::vector<sim_key_event> events = sim_typing_trace(false, typed);
+  std::vector<uint64_t> latency = sim_press_latencies(events, typed, LOOP_PERIOD_US);
+  sim_print_latencies("typing", latency);
+
+  /** The default keymap has no combos, so no key waits on them: one loop
+   * period to be scanned and one host poll for the endpoint to be free, at
+   * worst. */
+  uint64_t bound = LOOP_PERIOD_US + HID_POLL_INTERVAL_MS * 1000 +
+                   MATRIX_COLS * GPIO_PIN_SETTLE_DELAY_US;
+  SIM_CHECK(default_combos.count == 0);
+  for (uint64_t l : latency)
+    SIM_CHECK(l <= bound);
+  SIM_CHECK(sim_find_report(HID_KEY_ESCAPE, true, 0) == NULL);
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "debounce.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+#define SCAN_PERIOD_US 250
+#define KEYSTROKES 200
+
+/** One keystroke on a bouncy switch: contact and release each chatter for
+ * up to ~2 ms before settling. */
+struct chatter_stroke
+{
+  uint64_t contact_us;
+  uint64_t release_us;
+  std::vector<uint64_t> edges; /** every raw transition, starting closed */
+};
+
+static std::vector<chatter_stroke> chatter_trace(unsigned seed)
+{
+  srand(seed);
+  std::vector<chatter_stroke> strokes;
+  uint64_t t = 1000;
+  for (int i = 0; i < KEYSTROKES; i++)
+  {
+    chatter_stroke s;
+    s.contact_us = t;
+    s.edges.push_back(t);
+    int bounces = rand() % 4;
+    for (int b = 0; b < bounces; b++)
+    {
+      t += 100 + rand() % 300;
+      s.edges.push_back(t); /** opens */
+      t += 100 + rand() % 300;
+      s.edges.push_back(t); /** closes */
+    }
+
+    t += 30000 + rand() % 60000;
+    s.release_us = t;
+    s.edges.push_back(t);
+    bounces = rand() % 4;
+    for (int b = 0; b < bounces; b++)
+    {
+      t += 100 + rand() % 300;
+      s.edges.push_back(t); /** closes */
+      t += 100 + rand() % 300;
+      s.edges.push_back(t); /** opens */
+    }
+    t += 30000 + rand() % 60000;
+    strokes.push_back(s);
+  }
+  return strokes;
+}
+
+struct debounce_result
+{
+  int presses;
+  int releases;
+  uint64_t press_latency_max;
+  uint64_t press_latency_total;
+  uint64_t release_latency_max;
+  uint64_t release_latency_total;
+};
+
+/** Replay the trace through one algorithm on a single key, sampling the
+ * switch every SCAN_PERIOD_US. */
+template <int algorithm>
+static debounce_result replay(const std::vector<chatter_stroke> &strokes)
+{
+  std::vector<uint64_t> edges;
+  for (const chatter_stroke &s : strokes)
+    edges.insert(edges.end(), s.edges.begin(), s.edges.end());
+
+  debounce_t db;
+  debounce_init(db);
+  debounce_result r = {};
+  size_t next_edge = 0;
+  bool closed = false;
+  bool reported = false;
+  size_t stroke = 0;
+  uint64_t seen_us = 0;
+  uint64_t end = edges.back() + 100000;
+
+  for (uint64_t now = 0; now < end; now += SCAN_PERIOD_US)
+  {
+    while (next_edge < edges.size() && edges[next_edge] <= now)
+    {
+      closed = !closed;
+      next_edge++;
+    }
+
+    /** Latency is counted from the first scan that sees the switch move,
+     * whatever the scan rate misses is not the debouncer's doing. */
+    if (stroke < strokes.size() && seen_us == 0 && closed != reported &&
+        now >= (reported ? strokes[stroke].release_us : strokes[stroke].contact_us))
+      seen_us = now;
+
+    matrix_t raw = {};
+    if (closed)
+      matrix_set_col(raw, 1, 1 << 2);
+    debounce_update_as<algorithm>(db, raw, now);
+
+    bool pressed = matrix_key(db.state, 1, 2);
+    if (pressed == reported)
+      continue;
+    reported = pressed;
+
+    if (pressed)
+    {
+      uint64_t latency = now - seen_us;
+      r.presses++;
+      r.press_latency_total += latency;
+      r.press_latency_max = latency > r.press_latency_max ? latency : r.press_latency_max;
+    }
+    else
+    {
+      uint64_t latency = now - seen_us;
+      r.releases++;
+      r.release_latency_total += latency;
+      r.release_latency_max = latency > r.release_latency_max ? latency : r.release_latency_max;
+      stroke++;
+    }
+    seen_us = 0;
+  }
+  return r;
+}
+
+static void print_result(const char *name, const debounce_result &r)
+{
+  printf("    %-6s press +%4llu us mean, +%4llu us max | release +%4llu us mean, +%4llu us max\n",
+         name,
+         (unsigned long long)(r.press_latency_total / (r.presses ? r.presses : 1)),
+         (unsigned long long)r.press_latency_max,
+         (unsigned long long)(r.release_latency_total / (r.releases ? r.releases : 1)),
+         (unsigned long long)r.release_latency_max);
+}
+
+SIM_SCENARIO(debounce_chatter_trace_latency)
+{
+  std::vector<chatter_stroke> strokes = chatter_trace(4);
+
+  debounce_result eager = replay<DEBOUNCE_EAGER>(strokes);
+  debounce_result defer = replay<DEBOUNCE_DEFER>(strokes);
+  debounce_result asym = replay<DEBOUNCE_ASYM>(strokes);
+  print_result("eager", eager);
+  print_result("defer", defer);
+  print_result("asym", asym);
+
+  /** Every keystroke comes out as exactly one press and one release. */
+  SIM_CHECK(eager.presses == KEYSTROKES && eager.releases == KEYSTROKES);
+  SIM_CHECK(defer.presses == KEYSTROKES && defer.releases == KEYSTROKES);
+  SIM_CHECK(asym.presses == KEYSTROKES && asym.releases == KEYSTROKES);
+
+  /** Eager presses are reported from the scan that sees them, deferred ones
+   * wait for the switch to settle. */
+  SIM_CHECK(eager.press_latency_max == 0);
+  SIM_CHECK(asym.press_latency_max == 0);
+  SIM_CHECK(defer.press_latency_total / KEYSTROKES >= DEBOUNCE_MS * 1000 - 128);
+  SIM_CHECK(asym.release_latency_total / KEYSTROKES >= DEBOUNCE_MS * 1000 - 128);
+  SIM_CHECK(eager.release_latency_max == 0);
+}
+
+SIM_SCENARIO(debounce_defer_filters_single_scan_glitch)
+{
+  debounce_t eager, defer;
+  debounce_init(eager);
+  debounce_init(defer);
+
+  matrix_t glitch = {};
+  matrix_set_col(glitch, 4, 1);
+  matrix_t idle = {};
+
+  debounce_update_as<DEBOUNCE_EAGER>(eager, glitch, 1000);
+  debounce_update_as<DEBOUNCE_DEFER>(defer, glitch, 1000);
+  for (uint64_t t = 1250; t < 20000; t += SCAN_PERIOD_US)
+  {
+    debounce_update_as<DEBOUNCE_EAGER>(eager, idle, t);
+    SIM_CHECK(!debounce_update_as<DEBOUNCE_DEFER>(defer, idle, t));
+  }
+
+  /** Eager takes the glitch as a (short) press, deferred never sees it. */
+  SIM_CHECK(matrix_empty(eager.state));
+  SIM_CHECK(matrix_empty(defer.state));
+}
+
+SIM_SCENARIO(key_scan_reports_chattering_press_once)
+{
+  sim_reset();
+  keyboard_init();
+
+  /** Contact chatter lines up with the scans. */
+  std::vector<sim_key_event> events;
+  uint64_t t = 1000;
+  for (int b = 0; b < 3; b++)
+  {
+    events.push_back(sim_event(t, HID_KEY_K, true));
+    events.push_back(sim_event(t + 600, HID_KEY_K, false));
+    t += 1200;
+  }
+  events.push_back(sim_event(t, HID_KEY_K, true));
+  events.push_back(sim_event(t + 50000, HID_KEY_K, false));
+  sim_load_timeline(events);
+  sim_run(t + 100000, 500, key_scan);
+
+  int presses = 0;
+  bool down = false;
+  for (const sim_report &r : sim_reports())
+  {
+    if (r.has_key(HID_KEY_K) && !down)
+      presses++;
+    down = r.has_key(HID_KEY_K);
+  }
+  SIM_CHECK(presses == 1);
+}
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "debug_log.h"
+#include "log_decode.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+#define LOOP_PERIOD_US 1000
+#define TAPS 20
+#define STRESS_RECORDS 1000000u
+
+static void no_scan(void) {}
+
+/** What the simulated host read off the CDC port, decoded the way
+ * log_reader does, with the formats out of this very binary. */
+static bool read_log(std::vector<log_line> &lines)
+{
+  std::string formats;
+  if (!log_formats_read("/proc/self/exe", formats))
+    return false;
+  const std::vector<uint8_t> &received = sim_cdc_received();
+  return log_decode(formats, received.data(), received.size(), lines) == received.size();
+}
+
+static bool ends_with(const std::string &s, const char *end)
+{
+  size_t n = strlen(end);
+  return s.size() >= n && s.compare(s.size() - n, n, end) == 0;
+}
+
+SIM_SCENARIO(debug_log_decodes_against_the_elf)
+{
+  sim_reset();
+  sim_set_cdc_connected(true);
+  keyboard_init();
+
+  std::vector<sim_key_event> events;
+  for (int i = 0; i < TAPS; i++)
+  {
+    uint64_t t = 5000 + i * 30000;
+    events.push_back(sim_event(t, HID_KEY_L, true));
+    events.push_back(sim_event(t + 12000, HID_KEY_L, false));
+  }
+  sim_load_timeline(events);
+  sim_run(5000 + TAPS * 30000 + 20000, LOOP_PERIOD_US, key_scan);
+  DEBUG_LOG("%d|%5u|%-4x|%c|%o|100%%|%u", -7, 42, 0xab, 'q', 8, 3000000000u);
+  DEBUG_LOG("no arguments");
+  sim_run(sim_now_us() + 2 * LOOP_PERIOD_US, LOOP_PERIOD_US, no_scan);
+
+  std::vector<log_line> lines;
+  SIM_CHECK(read_log(lines));
+  uint downs = 0, ups = 0;
+  bool in_order = true;
+  for (size_t i = 0; i < lines.size(); i++)
+  {
+    if (lines[i].text.compare(0, 4, "key ") == 0)
+    {
+      downs += ends_with(lines[i].text, " down");
+      ups += ends_with(lines[i].text, " up");
+    }
+    in_order &= i == 0 || lines[i].time_us >= lines[i - 1].time_us;
+  }
+  printf("    %zu lines in %zu bytes\n", lines.size(), sim_cdc_received().size());
+  SIM_CHECK(downs == TAPS && ups == TAPS);
+  SIM_CHECK(in_order);
+  SIM_CHECK(lines.size() >= 2);
+  SIM_CHECK(lines[lines.size() - 2].text == "-7|   42|ab  |q|10|100%|3000000000");
+  SIM_CHECK(lines.back().text == "no arguments");
+}
+
+SIM_SCENARIO(debug_log_queue_full_once_per_stall)
+{
+  /** The host goes quiet for 200 ms while keys are tapped, so the queue
+   * stays full for most of it: one line for the stall, not one a run. */
+  sim_reset();
+  sim_set_cdc_connected(true);
+  keyboard_init();
+  sim_set_host_poll_interval_us(200000);
+  std::vector<sim_key_event> events;
+  const uint8_t keys[] = {HID_KEY_A, HID_KEY_S, HID_KEY_D, HID_KEY_F};
+  for (int i = 0; i < 40; i++)
+  {
+    events.push_back(sim_event(1000 + i * 4000, keys[i % 4], true));
+    events.push_back(sim_event(3000 + i * 4000, keys[i % 4], false));
+  }
+  sim_load_timeline(events);
+  sim_run(200000, LOOP_PERIOD_US, key_scan);
+  sim_set_host_poll_interval_us(1000);
+  sim_run(400000, LOOP_PERIOD_US, key_scan);
+
+  std::vector<log_line> lines;
+  SIM_CHECK(read_log(lines));
+  uint full = 0;
+  for (const log_line &line : lines)
+    full += line.text.compare(0, 16, "event queue full") == 0;
+  printf("    %u queue full lines out of %zu\n", full, lines.size());
+  SIM_CHECK(full == 1);
+}
+
+SIM_SCENARIO(debug_log_drops_instead_of_blocking)
+{
+  /** No terminal on the port: the ring fills and then counts what it
+   * could not keep, and nothing waits for the host. */
+  sim_reset();
+  keyboard_init();
+  const uint fit = DEBUG_LOG_WORDS / 3;
+  for (uint i = 0; i < 3 * fit; i++)
+    DEBUG_LOG("filler %u", i);
+  sim_run(sim_now_us() + 10 * LOOP_PERIOD_US, LOOP_PERIOD_US, no_scan);
+  SIM_CHECK(sim_cdc_received().empty());
+  SIM_CHECK(debug_log_rings[0].dropped.load() == 2 * fit);
+
+  /** The terminal opens: what the ring kept comes out, then the next
+   * record says how many went missing before it. */
+  sim_set_cdc_connected(true);
+  sim_run(sim_now_us() + 10 * LOOP_PERIOD_US, LOOP_PERIOD_US, no_scan);
+  DEBUG_LOG("after the gap");
+  sim_run(sim_now_us() + 2 * LOOP_PERIOD_US, LOOP_PERIOD_US, no_scan);
+
+  std::vector<log_line> lines;
+  SIM_CHECK(read_log(lines));
+  SIM_CHECK(lines.size() == fit + 2);
+  for (uint i = 0; i < fit; i++)
+    SIM_CHECK(lines[i].text == "filler " + std::to_string(i));
+  char dropped[32];
+  snprintf(dropped, sizeof(dropped), "%u records dropped", 2 * fit);
+  SIM_CHECK(lines[fit].text == dropped);
+  SIM_CHECK(lines[fit + 1].text == "after the gap");
+}
+
+SIM_SCENARIO(debug_log_picks_up_mid_stream)
+{
+  /** A reader that opens the port part way through a record skips to the
+   * next one. */
+  sim_reset();
+  sim_set_cdc_connected(true);
+  keyboard_init();
+  DEBUG_LOG("first %u %u", 1, 2);
+  DEBUG_LOG("second %u", 3);
+  sim_run(2 * LOOP_PERIOD_US, LOOP_PERIOD_US, no_scan);
+
+  std::string formats;
+  SIM_CHECK(log_formats_read("/proc/self/exe", formats));
+  const std::vector<uint8_t> &received = sim_cdc_received();
+  std::vector<log_line> lines;
+  SIM_CHECK(log_decode(formats, received.data() + 5, received.size() - 5, lines) ==
+            received.size() - 5);
+  SIM_CHECK(lines.size() == 1 && lines[0].text == "second 3");
+}
+
+SIM_SCENARIO(debug_log_spsc_stress_two_threads)
+{
+  /** As event_queue_spsc_stress_two_threads: one thread logs flat out the
+   * way a core does, the other drains. Every record either comes out, in
+   * order, or is counted in the drop record in front of the next one. */
+  static debug_log_ring_t r;
+  debug_log_ring_init(r);
+
+  std::thread producer([] {
+    for (uint32_t i = 0; i < STRESS_RECORDS; i++)
+    {
+      uint32_t args[2] = {i, ~i};
+      /** Gone is gone, but give the drain a chance to catch up. */
+      if (!debug_log_put(r, 0, i, args, 1 + (i & 1)))
+        std::this_thread::yield();
+    }
+    /** One more into an empty ring, to tell the last drops. */
+    while (r.head.load() != r.tail.load())
+      std::this_thread::yield();
+    debug_log_put(r, 0, STRESS_RECORDS, NULL, 0);
+  });
+
+  uint32_t expected = 0, received = 0, dropped = 0;
+  bool in_order = true;
+  while (expected <= STRESS_RECORDS)
+  {
+    uint32_t record[DEBUG_LOG_RECORD_MAX];
+    uint n = debug_log_take(r, record, DEBUG_LOG_RECORD_MAX);
+    if (n == 0)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    if ((record[0] & 0xffff) == DEBUG_LOG_DROPPED)
+    {
+      in_order &= n == 3;
+      expected += record[2];
+      dropped += record[2];
+      continue;
+    }
+    uint args = expected == STRESS_RECORDS ? 0 : 1 + (expected & 1);
+    in_order &= n == 2 + args && record[1] == expected &&
+                (args == 0 || record[2] == expected) && (args < 2 || record[3] == ~expected);
+    expected++;
+    received++;
+  }
+  producer.join();
+
+  printf("    %u records, %u dropped while the ring was full\n", STRESS_RECORDS, dropped);
+  SIM_CHECK(in_order);
+  SIM_CHECK(received + dropped == STRESS_RECORDS + 1);
+  SIM_CHECK(dropped == r.dropped.load());
+  SIM_CHECK(r.head.load() == r.tail.load());
+}
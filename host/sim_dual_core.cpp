@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <thread>
+
+#include "event_queue.h"
+#include "scenario.h"
+
+/** Core 1 and core 0 stand-ins: one thread pushes the way keyboard_debounce()
+ * does, the other pops the way keyboard_report() does, as fast as they can
+ * so the ring is wrapped and refilled constantly. */
+#define STRESS_EVENTS 1000000u
+
+SIM_SCENARIO(event_queue_spsc_stress_two_threads)
+{
+  static key_event_queue_t q;
+  event_queue_init(q);
+
+  std::thread producer([] {
+    for (uint32_t i = 0; i < STRESS_EVENTS; i++)
+    {
+      key_event_t e;
+      e.time_us = i;
+      e.pos = i % 120;
+      e.pressed = i & 1;
+      /** A full queue is retried on the next debounce run. */
+      while (!event_queue_push(q, e))
+        std::this_thread::yield();
+    }
+  });
+
+  uint32_t expected = 0;
+  bool in_order = true;
+  while (expected < STRESS_EVENTS)
+  {
+    key_event_t e;
+    if (!event_queue_peek(q, e))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    if (e.time_us != expected || e.pos != expected % 120 ||
+        e.pressed != (bool)(expected & 1))
+      in_order = false;
+    event_queue_pop(q);
+    expected++;
+  }
+  producer.join();
+
+  printf("    %u events, %u pushes refused while full, deepest %u\n",
+         STRESS_EVENTS, q.overflows.load(), q.high_water);
+  SIM_CHECK(in_order);
+  SIM_CHECK(q.head.load() == q.tail.load());
+  SIM_CHECK(q.high_water <= KEY_EVENT_QUEUE_SIZE);
+}
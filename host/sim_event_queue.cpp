@@ -0,0 +1,92 @@
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+/** Scan much faster than the host polls, so the endpoint is busy for most
+ * of the scans. */
+#define LOOP_PERIOD_US 250
+#define HOST_POLL_US 5000
+
+SIM_SCENARIO(short_tap_during_busy_endpoint_reaches_host)
+{
+  sim_reset();
+  keyboard_init();
+  sim_set_host_poll_interval_us(HOST_POLL_US);
+
+  /** Holding A keeps a report in flight on every poll. */
+  sim_load_timeline({sim_event(1000, HID_KEY_A, true),
+                     sim_event(20300, HID_KEY_J, true),
+                     sim_event(21300, HID_KEY_J, false),
+                     sim_event(60000, HID_KEY_A, false)});
+  sim_run(100000, LOOP_PERIOD_US, key_scan);
+
+  const sim_report *down = sim_find_report(HID_KEY_J, true, 0);
+  SIM_CHECK(down != NULL);
+  SIM_CHECK(down->has_key(HID_KEY_A));
+  const sim_report *up = sim_find_report(HID_KEY_J, false, down->queued_us + 1);
+  SIM_CHECK(up != NULL);
+  SIM_CHECK(up->has_key(HID_KEY_A));
+  SIM_CHECK(sim_reports().back().empty());
+  SIM_CHECK(keyboard_events().overflows.load() == 0);
+}
+
+SIM_SCENARIO(events_are_coalesced_but_never_cancelled)
+{
+  sim_reset();
+  keyboard_init();
+  sim_set_host_poll_interval_us(HOST_POLL_US);
+
+  /** Three keys land while a report is in flight: they go out together. A
+   * tap of the same key twice can't share a report. */
+  sim_load_timeline({sim_event(1000, HID_KEY_Q, true),
+                     sim_event(2000, HID_KEY_W, true),
+                     sim_event(2500, HID_KEY_E, true),
+                     sim_event(3000, HID_KEY_R, true),
+                     sim_event(40000, HID_KEY_Q, false),
+                     sim_event(40000, HID_KEY_W, false),
+                     sim_event(40000, HID_KEY_E, false),
+                     sim_event(40000, HID_KEY_R, false)});
+  sim_run(80000, LOOP_PERIOD_US, key_scan);
+
+  const sim_report *all = sim_find_report(HID_KEY_W, true, 0);
+  SIM_CHECK(all != NULL);
+  SIM_CHECK(all->has_key(HID_KEY_E) && all->has_key(HID_KEY_R));
+  SIM_CHECK(sim_reports().back().empty());
+}
+
+SIM_SCENARIO(queue_overflow_is_counted_and_resynced)
+{
+  sim_reset();
+  keyboard_init();
+
+  /** The host goes quiet for 200 ms while 40 keys are tapped. */
+  sim_set_host_poll_interval_us(200000);
+  std::vector<sim_key_event> events;
+  events.push_back(sim_event(100, HID_KEY_Z, true));
+  const uint8_t keys[] = {HID_KEY_A, HID_KEY_S, HID_KEY_D, HID_KEY_F};
+  uint64_t t = 1000;
+  for (int i = 0; i < 40; i++)
+  {
+    events.push_back(sim_event(t, keys[i % 4], true));
+    events.push_back(sim_event(t + 2000, keys[i % 4], false));
+    t += 4000;
+  }
+  sim_load_timeline(events);
+  sim_run(200000, LOOP_PERIOD_US, key_scan);
+
+  /** Then comes back and drains the queue. */
+  sim_set_host_poll_interval_us(1000);
+  sim_run(400000, LOOP_PERIOD_US, key_scan);
+
+  SIM_CHECK(keyboard_events().overflows.load() > 0);
+  SIM_CHECK(keyboard_events().high_water == KEY_EVENT_QUEUE_SIZE);
+
+  /** Z is still down, everything else was released: no stuck keys. */
+  const sim_report &last = sim_reports().back();
+  SIM_CHECK(last.has_key(HID_KEY_Z));
+  for (uint8_t key : keys)
+    SIM_CHECK(!last.has_key(key));
+}
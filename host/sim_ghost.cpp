@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "matrix.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+struct key_pos
+{
+  uint8_t col;
+  uint8_t row;
+};
+
+/** Every position that has a switch on it. */
+static std::vector<key_pos> physical_keys(void)
+{
+  std::vector<key_pos> keys;
+  for (uint8_t col = 0; col < MATRIX_COLS; col++)
+  {
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++)
+    {
+      if (key_layout[col][row] != HID_KEY_NONE)
+        keys.push_back({col, row});
+    }
+  }
+  return keys;
+}
+
+/** a is a subset of b. */
+static bool matrix_within(const matrix_t &a, const matrix_t &b)
+{
+  for (uint w = 0; w < MATRIX_WORDS; w++)
+  {
+    if (a.words[w] & ~b.words[w])
+      return false;
+  }
+  return true;
+}
+
+struct ghost_run
+{
+  uint64_t combos;
+  uint64_t ghosted;   /** combos whose unfiltered scan had a phantom key */
+  uint64_t phantoms;  /** scans that still reported a key nobody pressed */
+  uint64_t dropped;   /** scans that lost a key already reported */
+  uint64_t withheld;  /** scans without a rectangle not reported in full */
+  uint64_t blocked;   /** real presses held back as ambiguous */
+};
+
+/** Press the keys of one combination one scan at a time, then all at once
+ * from nothing, and check what the filtered scan reports each time. */
+static void check_combo(const key_pos *combo, uint n, ghost_run &run)
+{
+  matrix_t real = {};
+  matrix_t previous = {};
+  bool ghosted = false;
+  for (uint i = 0; i < n; i++)
+  {
+    sim_set_key(combo[i].col, combo[i].row, true);
+    real.words[MATRIX_POS(combo[i].col, combo[i].row) >> 5] |=
+        1u << (MATRIX_POS(combo[i].col, combo[i].row) & 31);
+
+    matrix_t raw;
+    matrix_scan(raw);
+    ghosted |= !matrix_within(raw, real);
+    bool clear = matrix_empty(matrix_ambiguous(raw));
+    matrix_filter_ghosts(raw, previous);
+
+    run.phantoms += !matrix_within(raw, real);
+    run.dropped += !matrix_within(previous, raw);
+    if (clear)
+      run.withheld += !matrix_equal(raw, real);
+    else
+      run.blocked += !matrix_equal(raw, real);
+    previous = raw;
+  }
+
+  matrix_t raw;
+  matrix_scan(raw);
+  bool clear = matrix_empty(matrix_ambiguous(raw));
+  matrix_filter_ghosts(raw, {});
+  run.phantoms += !matrix_within(raw, real);
+  if (clear)
+    run.withheld += !matrix_equal(raw, real);
+
+  for (uint i = 0; i < n; i++)
+    sim_set_key(combo[i].col, combo[i].row, false);
+  run.combos++;
+  run.ghosted += ghosted;
+}
+
+static ghost_run check_all_combos(uint n)
+{
+  sim_reset();
+  keyboard_init();
+  std::vector<key_pos> keys = physical_keys();
+  ghost_run run = {};
+  key_pos combo[4];
+  uint idx[4];
+  uint k = keys.size();
+
+  /** Walk every n-subset in lexicographic order. */
+  for (uint i = 0; i < n; i++)
+    idx[i] = i;
+  while (true)
+  {
+    for (uint i = 0; i < n; i++)
+      combo[i] = keys[idx[i]];
+    check_combo(combo, n, run);
+
+    int i = n - 1;
+    while (i >= 0 && idx[i] == k - n + i)
+      i--;
+    if (i < 0)
+      break;
+    idx[i]++;
+    for (uint j = i + 1; j < n; j++)
+      idx[j] = idx[j - 1] + 1;
+  }
+
+  printf("    %u keys: %llu combos, %llu ghost a key, %llu phantom scans, "
+         "%llu dropped, %llu withheld, %llu ambiguous presses blocked\n",
+         n, (unsigned long long)run.combos, (unsigned long long)run.ghosted,
+         (unsigned long long)run.phantoms, (unsigned long long)run.dropped,
+         (unsigned long long)run.withheld, (unsigned long long)run.blocked);
+  return run;
+}
+
+SIM_SCENARIO(ghost_rectangle_is_blocked)
+{
+  sim_reset();
+  keyboard_init();
+
+  /** Q, W and A held: S is the fourth corner and reads as pressed. */
+  sim_set_key(1, 1, true);
+  sim_set_key(2, 1, true);
+  sim_set_key(1, 2, true);
+  matrix_t raw;
+  matrix_scan(raw);
+  SIM_CHECK(matrix_key(raw, 2, 2));
+
+  /** Pressed one after another, the three real keys were reported first,
+   * so they stay and only the phantom is dropped. */
+  matrix_t previous = {};
+  previous.words[0] = (1u << MATRIX_POS(1, 1)) | (1u << MATRIX_POS(2, 1)) |
+                      (1u << MATRIX_POS(1, 2));
+  matrix_filter_ghosts(raw, previous);
+  SIM_CHECK(matrix_equal(raw, previous));
+
+  /** A matrix with diodes (ghosting off in the model) has nothing to
+   * block. */
+  sim_set_ghosting(false);
+  matrix_scan(raw);
+  SIM_CHECK(!matrix_key(raw, 2, 2));
+}
+
+SIM_SCENARIO(ghost_never_reaches_host)
+{
+  sim_reset();
+  keyboard_init();
+  sim_load_timeline({sim_event(1000, HID_KEY_Q, true),
+                     sim_event(11000, HID_KEY_W, true),
+                     sim_event(21000, HID_KEY_A, true),
+                     sim_event(41000, HID_KEY_W, false)});
+  sim_run(60000, 1000, key_scan);
+
+  /** A and S look the same while Q and W are held, so neither goes out
+   * until W lets go and only A is left reading as pressed. */
+  const sim_report *a = sim_find_report(HID_KEY_A, true, 0);
+  SIM_CHECK(a != NULL);
+  SIM_CHECK(a->queued_us > 41000);
+  SIM_CHECK(a->has_key(HID_KEY_Q) && !a->has_key(HID_KEY_W));
+  SIM_CHECK(sim_find_report(HID_KEY_S, true, 0) == NULL);
+}
+
+SIM_SCENARIO(ghost_every_three_key_combo)
+{
+  ghost_run run = check_all_combos(3);
+  SIM_CHECK(run.ghosted > 0);
+  SIM_CHECK(run.phantoms == 0);
+  SIM_CHECK(run.dropped == 0);
+  SIM_CHECK(run.withheld == 0);
+}
+
+SIM_SCENARIO(ghost_every_four_key_combo)
+{
+  ghost_run run = check_all_combos(4);
+  SIM_CHECK(run.ghosted > 0);
+  SIM_CHECK(run.phantoms == 0);
+  SIM_CHECK(run.dropped == 0);
+  SIM_CHECK(run.withheld == 0);
+}
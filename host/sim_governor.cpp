@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "tusb.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "matrix.h"
+#include "governor.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "trace_file.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+/** Fixed periods to hold the governor up against: its slow, normal and
+ * fast bands all the time. */
+static const uint32_t fixed_periods[] = {GOVERNOR_SLOW_US, GOVERNOR_NORMAL_US, GOVERNOR_FAST_US};
+
+static uint64_t scans;
+
+static void counted_scan(void)
+{
+  scans++;
+  keyboard_scan();
+}
+
+/** main()'s task table, with the governor pacing the matrix tasks when
+ * period_us is 0 and a fixed period_us otherwise. */
+static void make_tasks(sched_task_t *tasks, uint32_t period_us)
+{
+  if (period_us)
+  {
+    tasks[0] = SCHED_TASK(counted_scan, period_us);
+    tasks[1] = SCHED_TASK(keyboard_debounce, period_us);
+  }
+  else
+  {
+    tasks[0] = SCHED_TASK_PACED(counted_scan, keyboard_scan_period_us);
+    tasks[1] = SCHED_TASK_PACED(keyboard_debounce, keyboard_scan_period_us);
+  }
+  tasks[2] = SCHED_TASK(keyboard_report, KEYBOARD_REPORT_PERIOD_US);
+}
+
+/** main()'s loop, as in sim_scheduler.cpp. */
+static void run_main_loop(sched_task_t *tasks, uint64_t until_us)
+{
+  while (sim_now_us() < until_us)
+  {
+    if (keyboard_idle())
+    {
+      hal_wait_until_us(until_us);
+      if (!keyboard_idle())
+        sched_restart(tasks, 3, sim_now_us());
+      continue;
+    }
+    hal_wait_until_us(sched_run_due(tasks, 3));
+  }
+}
+
+struct trade_off
+{
+  double scans_per_s;
+  double mean_detect_us;
+  uint64_t max_detect_us;
+  uint64_t boot_us;
+};
+
+/** A trace only says which scan saw a key change, so put each change back
+ * somewhere in the scan period before it, spread evenly. */
+static std::vector<sim_key_event> unscanned(const std::vector<trace_snapshot> &snapshots,
+                                            uint32_t scan_period_us)
+{
+  std::vector<sim_key_event> events = trace_timeline(snapshots);
+  uint64_t boot_us = snapshots.front().scan_us;
+  uint32_t seed = 12345;
+  for (sim_key_event &e : events)
+  {
+    seed = seed * 1103515245 + 12345;
+    /** Whatever the first scan read was down at boot. */
+    uint64_t early = e.time_us - 1 - (seed >> 8) % (scan_period_us - 1);
+    if (e.time_us > boot_us)
+      e.time_us = early > boot_us ? early : boot_us + 1;
+  }
+  std::sort(events.begin(), events.end(),
+            [](const sim_key_event &a, const sim_key_event &b) { return a.time_us < b.time_us; });
+  return events;
+}
+
+/** Boot at boot_us and play events through main()'s loop until until_us,
+ * then see from the trace the keyboard recorded how long after each change
+ * the scan that read it started. */
+static trade_off run_events(const std::vector<sim_key_event> &events, uint64_t boot_us,
+                            uint64_t until_us, uint32_t period_us, bool &ok)
+{
+  sim_reset();
+  sim_set_ghosting(false);
+  sim_advance_us(boot_us);
+  keyboard_init();
+  sim_load_timeline(events);
+  sched_task_t tasks[3];
+  make_tasks(tasks, period_us);
+  sched_restart(tasks, 3, boot_us);
+  scans = 0;
+  run_main_loop(tasks, until_us);
+
+  std::vector<uint8_t> stream;
+  std::vector<trace_snapshot> seen;
+  ok = !trace_drain(stream) && trace_decode(stream, seen);
+
+  /** The nth change of a key in the one is the nth in the other. */
+  std::deque<uint64_t> changed_us[MATRIX_COLS * MATRIX_ROWS];
+  for (const sim_key_event &e : events)
+    changed_us[e.col * MATRIX_ROWS + e.row].push_back(e.time_us);
+  uint64_t total = 0, max = 0, detected = 0;
+  for (const sim_key_event &e : trace_timeline(seen))
+  {
+    std::deque<uint64_t> &pending = changed_us[e.col * MATRIX_ROWS + e.row];
+    if (pending.empty())
+    {
+      ok = false;
+      break;
+    }
+    /** A change during the scan that reads it counts as no wait at all. */
+    uint64_t detect = e.time_us > pending.front() ? e.time_us - pending.front() : 0;
+    pending.pop_front();
+    total += detect;
+    max = detect > max ? detect : max;
+    detected++;
+  }
+  ok &= detected == events.size();
+
+  return {scans * 1e6 / (until_us - boot_us), detected ? (double)total / detected : 0, max,
+          boot_us};
+}
+
+static void print_trade_off(const char *name, const trade_off &t)
+{
+  printf("    %-14s %6.0f scans/s, detected after %5.0f us mean, %5llu us max\n", name,
+         t.scans_per_s, t.mean_detect_us, (unsigned long long)t.max_detect_us);
+}
+
+/** Time in each band since boot_us, all of it accounted for. */
+static bool print_bands(uint64_t boot_us)
+{
+  static const char *band_names[GOVERNOR_BANDS] = {"fast", "normal", "slow", "idle"};
+  const governor_t &g = keyboard_governor();
+  uint64_t now = sim_now_us(), counted = 0;
+  printf("   ");
+  for (uint b = 0; b < GOVERNOR_BANDS; b++)
+  {
+    counted += governor_band_us(g, b, now);
+    printf(" %s %llu ms", band_names[b], (unsigned long long)(governor_band_us(g, b, now) / 1000));
+  }
+  printf(", %u band changes\n", g.switches);
+  return counted == now - boot_us;
+}
+
+SIM_SCENARIO(governor_trades_scans_for_detection_latency)
+{
+  trace_t trace;
+  std::vector<trace_snapshot> snapshots;
+  SIM_CHECK(trace_file_read(TRACE_CORPUS_DIR "/typing.ktr", trace));
+  SIM_CHECK(trace_decode(trace.stream, snapshots) && !snapshots.empty());
+  std::vector<sim_key_event> events = unscanned(snapshots, trace.header.scan_period_us);
+  uint64_t boot = snapshots.front().scan_us;
+  uint64_t end = snapshots.back().scan_us + TRACE_REPLAY_TAIL_US;
+
+  bool ok;
+  trade_off fixed[3];
+  char name[32];
+  for (uint i = 0; i < 3; i++)
+  {
+    fixed[i] = run_events(events, boot, end, fixed_periods[i], ok);
+    SIM_CHECK(ok);
+    snprintf(name, sizeof(name), "fixed %u us", fixed_periods[i]);
+    print_trade_off(name, fixed[i]);
+  }
+  trade_off governed = run_events(events, boot, end, 0, ok);
+  SIM_CHECK(ok);
+  print_trade_off("governed", governed);
+  SIM_CHECK(print_bands(boot));
+
+  /** Typing keeps the governor in the fast band: keys are seen as soon as
+   * scanning fast all the time sees them, and it costs no more scans. */
+  SIM_CHECK(governed.max_detect_us <= fixed[2].max_detect_us);
+  SIM_CHECK(governed.mean_detect_us < fixed[1].mean_detect_us);
+  SIM_CHECK(governed.scans_per_s <= fixed[2].scans_per_s);
+}
+
+SIM_SCENARIO(governor_backs_off_while_keys_are_held)
+{
+  /** W held down for ten seconds, the way a game holds it, with a jump
+   * every 2.5 s. The matrix never goes idle, so only the governor saves
+   * scans. */
+  std::vector<sim_key_event> events = {sim_event(10000, HID_KEY_W, true)};
+  for (uint i = 1; i <= 3; i++)
+  {
+    uint64_t t = i * 2500000 + i * 137;
+    events.push_back(sim_event(t, HID_KEY_SPACE, true));
+    events.push_back(sim_event(t + 80000 + i * 311, HID_KEY_SPACE, false));
+  }
+  events.push_back(sim_event(10000000, HID_KEY_W, false));
+  uint64_t end = 10000000 + TRACE_REPLAY_TAIL_US;
+
+  bool ok;
+  trade_off normal = run_events(events, 0, end, GOVERNOR_NORMAL_US, ok);
+  SIM_CHECK(ok);
+  print_trade_off("fixed 1000 us", normal);
+  trade_off governed = run_events(events, 0, end, 0, ok);
+  SIM_CHECK(ok);
+  print_trade_off("governed", governed);
+  SIM_CHECK(print_bands(0));
+
+  /** Over half the hold at the slow rate, and a quarter fewer scans for it
+   * all: a jump waits for a slow scan at worst, its release is seen at the
+   * fast rate. */
+  const governor_t &g = keyboard_governor();
+  SIM_CHECK(governor_band_us(g, GOVERNOR_SLOW, sim_now_us()) > 5000000);
+  SIM_CHECK(governed.scans_per_s * 4 < normal.scans_per_s * 3);
+  SIM_CHECK(governed.max_detect_us <= GOVERNOR_SLOW_US);
+  const sim_report *r = sim_find_report(HID_KEY_SPACE, false, events[2].time_us);
+  SIM_CHECK(r != NULL && r->queued_us - events[2].time_us <=
+                             GOVERNOR_FAST_US + KEYBOARD_REPORT_PERIOD_US);
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+/** key_scan() run like the original 5 ms main loop. */
+#define LOOP_PERIOD_US 5000
+
+static void start(void)
+{
+  sim_reset();
+  keyboard_init();
+}
+
+SIM_SCENARIO(tap_is_reported_then_released)
+{
+  start();
+  sim_load_timeline({sim_event(1000, HID_KEY_A, true),
+                     sim_event(60000, HID_KEY_A, false)});
+  sim_run(100000, LOOP_PERIOD_US, key_scan);
+
+  const sim_report *down = sim_find_report(HID_KEY_A, true, 0);
+  SIM_CHECK(down != NULL);
+  const sim_report *up = sim_find_report(HID_KEY_A, false, down->queued_us);
+  SIM_CHECK(up != NULL);
+  SIM_CHECK(up->empty());
+  SIM_CHECK(up->queued_us >= 60000);
+}
+
+SIM_SCENARIO(modifier_goes_in_modifier_byte)
+{
+  start();
+  sim_load_timeline({sim_event(0, HID_KEY_SHIFT_LEFT, true),
+                     sim_event(0, HID_KEY_Q, true)});
+  sim_run(20000, LOOP_PERIOD_US, key_scan);
+
+  const sim_report *r = sim_find_report(HID_KEY_Q, true, 0);
+  SIM_CHECK(r != NULL);
+  SIM_CHECK(r->modifier == KEYBOARD_MODIFIER_LEFTSHIFT);
+}
+
+SIM_SCENARIO(fn_transforms_number_row)
+{
+  start();
+  sim_load_timeline({sim_event(0, FN_KEY, true),
+                     sim_event(10000, HID_KEY_1, true)});
+  sim_run(30000, LOOP_PERIOD_US, key_scan);
+
+  SIM_CHECK(sim_find_report(HID_KEY_F1, true, 0) != NULL);
+  SIM_CHECK(sim_find_report(HID_KEY_1, true, 0) == NULL);
+}
+
+SIM_SCENARIO(fn_release_keeps_held_key)
+{
+  start();
+  sim_load_timeline({sim_event(0, FN_KEY, true),
+                     sim_event(10000, HID_KEY_W, true),
+                     sim_event(30000, FN_KEY, false),
+                     sim_event(60000, HID_KEY_W, false)});
+  sim_run(100000, LOOP_PERIOD_US, key_scan);
+
+  /** W went down on the Fn layer so it stays an arrow until released. */
+  const sim_report *down = sim_find_report(HID_KEY_ARROW_UP, true, 0);
+  SIM_CHECK(down != NULL);
+  SIM_CHECK(sim_find_report(HID_KEY_W, true, 0) == NULL);
+  const sim_report *up = sim_find_report(HID_KEY_ARROW_UP, false, down->queued_us);
+  SIM_CHECK(up != NULL);
+  SIM_CHECK(up->queued_us >= 60000);
+}
+
+SIM_SCENARIO(any_key_wakes_suspended_host)
+{
+  start();
+  sim_set_suspended(true);
+  sim_run(20000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(sim_get_stats().remote_wakeups == 0);
+
+  sim_set_key(7, 2, true);
+  sim_run(40000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(sim_get_stats().remote_wakeups == 1);
+}
+
+SIM_SCENARIO(key_held_into_suspend_does_not_wake)
+{
+  start();
+  sim_set_key(7, 2, true);
+  sim_run(20000, LOOP_PERIOD_US, key_scan);
+  sim_set_suspended(true);
+  sim_run(40000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(sim_get_stats().remote_wakeups == 0);
+
+  /** Once it is let go the rows arm, and the next press wakes the host. */
+  sim_set_key(7, 2, false);
+  sim_run(60000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(sim_get_stats().remote_wakeups == 0);
+  sim_set_key(7, 2, true);
+  sim_run(80000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(sim_get_stats().remote_wakeups == 1);
+}
+
+SIM_SCENARIO(scan_cost_and_press_latency)
+{
+  start();
+
+  /** One scan with nothing held. */
+  key_scan();
+  uint64_t scan_us = sim_now_us();
+  printf("    scan: %llu us, %llu gpio reads\n",
+         (unsigned long long)scan_us,
+         (unsigned long long)sim_get_stats().gpio_gets);
+
+  /** Taps at staggered phases against the loop and host poll. */
+  std::vector<sim_key_event> events;
+  const uint64_t spacing = 40000;
+  const int taps = 50;
+  for (int i = 0; i < taps; i++)
+  {
+    uint64_t t = 10000 + i * spacing + (i * 397) % LOOP_PERIOD_US;
+    events.push_back(sim_event(t, HID_KEY_L, true));
+    events.push_back(sim_event(t + 15000, HID_KEY_L, false));
+  }
+  sim_load_timeline(events);
+  sim_run(10000 + taps * spacing + 20000, LOOP_PERIOD_US, key_scan);
+
+  uint64_t min = UINT64_MAX, max = 0, total = 0;
+  for (int i = 0; i < taps; i++)
+  {
+    uint64_t pressed_at = events[2 * i].time_us;
+    const sim_report *r = sim_find_report(HID_KEY_L, true, pressed_at);
+    SIM_CHECK(r != NULL);
+    uint64_t latency = r->complete_us - pressed_at;
+    min = latency < min ? latency : min;
+    max = latency > max ? latency : max;
+    total += latency;
+  }
+  printf("    press to host: min %llu us, mean %llu us, max %llu us\n",
+         (unsigned long long)min, (unsigned long long)(total / taps),
+         (unsigned long long)max);
+}
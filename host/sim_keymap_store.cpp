@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "tusb.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "keymap_store.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+#define LOOP_PERIOD_US 1000
+#define CUT_STRIDE 5
+
+static uint key_pos(action_t key)
+{
+  sim_key_event e = sim_event(0, key, true);
+  return MATRIX_POS(e.col, e.row);
+}
+
+/** The keymap the store gives, the same as the compiled-in one except at
+ * the edited positions. */
+static bool keymap_is(const layer_keymap_t &k, const std::vector<keymap_edit_t> &edits)
+{
+  if (k.count != default_keymap.count)
+    return false;
+  for (uint layer = 0; layer < k.count; layer++)
+  {
+    for (uint pos = 0; pos < LAYER_KEYS; pos++)
+    {
+      action_t expected = default_keymap.layers[layer][pos];
+      for (const keymap_edit_t &e : edits)
+      {
+        if (e.layer == layer && e.pos == pos)
+          expected = e.action;
+      }
+      if (k.layers[layer][pos] != expected)
+        return false;
+    }
+  }
+  /** The masks have to be what layer.h builds from the same layers. */
+  for (uint pos = 0; pos < LAYER_KEYS; pos++)
+  {
+    uint8_t mask = 1;
+    bool tap_hold = false;
+    for (uint layer = 0; layer < k.count; layer++)
+    {
+      if (layer > 0 && k.layers[layer][pos] != KC_TRNS)
+        mask |= 1 << layer;
+      tap_hold |= action_is_tap_hold(k.layers[layer][pos]);
+    }
+    if (k.key_layers[pos] != mask ||
+        ((k.tap_hold_keys.words[pos >> 5] >> (pos & 31)) & 1) != tap_hold)
+      return false;
+  }
+  return true;
+}
+
+static bool in_flash(const void *p)
+{
+  const uint8_t *b = (const uint8_t *)p;
+  return b >= sim_flash() && b < sim_flash() + HAL_FLASH_CONFIG_SIZE;
+}
+
+SIM_SCENARIO(keymap_store_starts_compiled_in)
+{
+  sim_reset();
+  keymap_store_t s;
+  keymap_store_init(s, default_keymap);
+  SIM_CHECK(s.image == NULL);
+  SIM_CHECK(s.keymap.layers == default_keymap.layers);
+  SIM_CHECK(keymap_is(s.keymap, {}));
+}
+
+SIM_SCENARIO(keymap_store_reads_in_place)
+{
+  sim_reset();
+  keymap_store_t s;
+  keymap_store_init(s, default_keymap);
+  keymap_edit_t edit = {LAYER_BASE, (uint8_t)key_pos(HID_KEY_H), HID_KEY_X};
+  SIM_CHECK(keymap_store_edit(s, edit.layer, edit.pos, edit.action));
+  SIM_CHECK(keymap_store_commit(s));
+  SIM_CHECK(s.staged == 0);
+  SIM_CHECK(keymap_is(s.keymap, {edit}));
+
+  /** The tables are the image in flash, after a reboot too. */
+  SIM_CHECK(in_flash(s.keymap.layers) && in_flash(s.keymap.key_layers));
+  keymap_store_init(s, default_keymap);
+  SIM_CHECK(in_flash(s.keymap.layers));
+  SIM_CHECK(keymap_is(s.keymap, {edit}));
+  printf("    image %zu bytes in a %u byte slot, %u slots a sector, %zu bytes of RAM\n",
+         sizeof(keymap_image_t) + default_keymap.count * sizeof(layer_table_t),
+         s.slot_size, s.sector_slots, sizeof(s));
+}
+
+/** The default keymap as a firmware update might change it: H sends F12. */
+static constexpr auto updated_layers = [] {
+  auto layers = keymap_layers;
+  sim_key_event h = {};
+  for (uint col = 0; col < MATRIX_COLS; col++)
+  {
+    for (uint row = 0; row < MATRIX_ROWS; row++)
+    {
+      if (key_layout[col][row] == HID_KEY_H)
+        h = {0, (uint8_t)col, (uint8_t)row, true};
+    }
+  }
+  layers[LAYER_BASE][MATRIX_POS(h.col, h.row)] = HID_KEY_F12;
+  return layers;
+}();
+static constexpr auto updated_key_layers = layer_key_masks(updated_layers);
+static constexpr layer_keymap_t updated_keymap = {updated_layers.data(), LAYER_COUNT,
+                                                  updated_key_layers.data(),
+                                                  layer_tap_hold_keys(updated_layers)};
+
+SIM_SCENARIO(keymap_store_reset_follows_the_defaults)
+{
+  sim_reset();
+  keymap_store_t s;
+  keymap_store_init(s, default_keymap);
+  uint pos = key_pos(HID_KEY_H);
+  SIM_CHECK(keymap_store_edit(s, LAYER_BASE, pos, HID_KEY_X));
+  SIM_CHECK(keymap_store_commit(s));
+  SIM_CHECK(keymap_store_reset(s));
+  SIM_CHECK(s.keymap.layers == default_keymap.layers);
+
+  /** After an update the new defaults are the keymap, not the old ones a
+   * reset saw. */
+  keymap_store_init(s, updated_keymap);
+  SIM_CHECK(s.image != NULL);
+  SIM_CHECK(s.keymap.layers == updated_keymap.layers);
+  SIM_CHECK(s.keymap.layers[LAYER_BASE][pos] == HID_KEY_F12);
+
+  /** And an edit from there builds on them. */
+  uint q = key_pos(HID_KEY_Q);
+  SIM_CHECK(keymap_store_edit(s, LAYER_BASE, q, HID_KEY_Z));
+  SIM_CHECK(keymap_store_commit(s));
+  keymap_store_init(s, updated_keymap);
+  SIM_CHECK(in_flash(s.keymap.layers));
+  SIM_CHECK(s.keymap.layers[LAYER_BASE][pos] == HID_KEY_F12);
+  SIM_CHECK(s.keymap.layers[LAYER_BASE][q] == HID_KEY_Z);
+}
+
+SIM_SCENARIO(keymap_store_only_erases_to_move_on)
+{
+  sim_reset();
+  keymap_store_t s;
+  keymap_store_init(s, default_keymap);
+  uint pos = key_pos(HID_KEY_H);
+
+  /** The log goes round the region several times, one remap a commit. */
+  const uint commits = 10 * KEYMAP_STORE_SECTORS * s.sector_slots;
+  uint erases[KEYMAP_STORE_SECTORS] = {};
+  for (uint i = 0; i < commits; i++)
+  {
+    uint64_t before = sim_get_stats().flash_erases;
+    SIM_CHECK(keymap_store_edit(s, LAYER_BASE, pos, HID_KEY_A + i % 26));
+    SIM_CHECK(keymap_store_commit(s));
+    erases[s.image_slot / s.sector_slots] += sim_get_stats().flash_erases - before;
+  }
+  keymap_store_init(s, default_keymap);
+  SIM_CHECK(keymap_is(s.keymap, {{LAYER_BASE, (uint8_t)pos,
+                                  (action_t)(HID_KEY_A + (commits - 1) % 26)}}));
+
+  printf("    %u commits, %llu erases, %llu pages, erases per sector:", commits,
+         (unsigned long long)sim_get_stats().flash_erases,
+         (unsigned long long)sim_get_stats().flash_pages);
+  for (uint sector = 0; sector < KEYMAP_STORE_SECTORS; sector++)
+    printf(" %u", erases[sector]);
+  printf("\n");
+  SIM_CHECK(sim_get_stats().flash_erases == commits / s.sector_slots);
+  for (uint sector = 0; sector < KEYMAP_STORE_SECTORS; sector++)
+    SIM_CHECK(erases[sector] == commits / s.sector_slots / KEYMAP_STORE_SECTORS);
+}
+
+SIM_SCENARIO(keymap_store_survives_power_loss)
+{
+  /** Enough commits to fill a sector and erase the next, with the power
+   * cut after every CUT_STRIDE bytes of flash work they do in turn. After
+   * the reboot the keymap is the last commit that went through or the one
+   * being written, never anything else, and the store still takes
+   * commits. */
+  sim_reset();
+  keymap_store_t s;
+  keymap_store_init(s, default_keymap);
+  const uint commits = s.sector_slots + 1;
+  uint8_t pos = key_pos(HID_KEY_H);
+  for (uint i = 0; i < commits; i++)
+  {
+    keymap_store_edit(s, LAYER_BASE, pos, HID_KEY_A + i);
+    keymap_store_commit(s);
+  }
+  const uint32_t work = sim_get_stats().flash_erases * HAL_FLASH_SECTOR_SIZE +
+                        sim_get_stats().flash_pages * HAL_FLASH_PAGE_SIZE;
+
+  uint runs = 0, torn = 0;
+  for (uint32_t cut = 0; cut <= work; cut += CUT_STRIDE)
+  {
+    sim_reset();
+    keymap_store_init(s, default_keymap);
+    sim_flash_cut_after(cut);
+    int last = -1;
+    for (uint i = 0; i < commits; i++)
+    {
+      keymap_store_edit(s, LAYER_BASE, pos, HID_KEY_A + i);
+      if (keymap_store_commit(s))
+        last = i;
+    }
+
+    sim_flash_power_on();
+    keymap_store_init(s, default_keymap);
+    std::vector<keymap_edit_t> got;
+    if (s.image)
+      got.push_back({LAYER_BASE, pos, s.keymap.layers[LAYER_BASE][pos]});
+    bool as_last = last < 0 ? got.empty()
+                            : !got.empty() && got[0].action == HID_KEY_A + last;
+    bool as_next = !got.empty() && got[0].action == HID_KEY_A + last + 1;
+    SIM_CHECK(as_last || as_next);
+    SIM_CHECK(keymap_is(s.keymap, got));
+    torn += last + 1 < (int)commits;
+
+    SIM_CHECK(keymap_store_edit(s, LAYER_BASE, pos, HID_KEY_Z));
+    SIM_CHECK(keymap_store_commit(s));
+    keymap_store_init(s, default_keymap);
+    SIM_CHECK(keymap_is(s.keymap, {{LAYER_BASE, pos, HID_KEY_Z}}));
+    runs++;
+  }
+  printf("    %u cuts over %u bytes of flash work, %u of them mid commit, all came back\n",
+         runs, work, torn);
+}
+
+/** A SET_REPORT as the host would send it. */
+static void send_op(std::vector<uint8_t> report)
+{
+  report.resize(KEYMAP_REPORT_LEN);
+  keyboard_keymap_set_report(report.data(), report.size());
+}
+
+static keymap_store_status_t status(void)
+{
+  uint8_t buffer[KEYMAP_REPORT_LEN];
+  keymap_store_status_t st;
+  if (keyboard_keymap_get_report(buffer, sizeof(buffer)) != KEYMAP_REPORT_LEN)
+    memset(buffer, 0, sizeof(buffer));
+  memcpy(&st, buffer, sizeof(st));
+  return st;
+}
+
+/** Tap key, with Fn held if fn, and return what the host saw go down. */
+static uint8_t tap(action_t key, uint64_t at_us, bool fn = false)
+{
+  std::vector<sim_key_event> events;
+  if (fn)
+    events.push_back(sim_event(at_us - 5000, FN_KEY, true));
+  events.push_back(sim_event(at_us, key, true));
+  events.push_back(sim_event(at_us + 20000, key, false));
+  if (fn)
+    events.push_back(sim_event(at_us + 25000, FN_KEY, false));
+  sim_load_timeline(events);
+  sim_run(at_us + 45000, LOOP_PERIOD_US, key_scan);
+  for (const sim_report &r : sim_reports())
+  {
+    if (r.queued_us < at_us)
+      continue;
+    for (uint usage = 1; usage < NKRO_KEY_COUNT; usage++)
+    {
+      if (r.has_key(usage))
+        return usage;
+    }
+  }
+  return 0;
+}
+
+SIM_SCENARIO(keymap_remapped_over_vendor_report)
+{
+  sim_reset();
+  keyboard_init();
+  SIM_CHECK(tap(HID_KEY_H, 1000) == HID_KEY_H);
+
+  /** H becomes X, and Fn + H becomes Y. */
+  uint8_t pos = key_pos(HID_KEY_H);
+  send_op({KEYMAP_OP_EDIT, 2, LAYER_BASE, pos, HID_KEY_X, 0, LAYER_FN, pos, HID_KEY_Y, 0});
+  SIM_CHECK(status().last_ok && status().staged == 2);
+  SIM_CHECK(tap(HID_KEY_H, 50000) == HID_KEY_H);
+  send_op({KEYMAP_OP_COMMIT});
+  keymap_store_status_t st = status();
+  SIM_CHECK(st.last_op == KEYMAP_OP_COMMIT && st.last_ok);
+  SIM_CHECK(st.sequence == 1 && st.staged == 0 && st.count == LAYER_COUNT);
+  SIM_CHECK(tap(HID_KEY_H, 100000) == HID_KEY_X);
+  SIM_CHECK(tap(HID_KEY_H, 150000, true) == HID_KEY_Y);
+
+  /** A reboot keeps it. */
+  keyboard_init();
+  SIM_CHECK(tap(HID_KEY_H, 200000) == HID_KEY_X);
+
+  /** An edit that can't be made says so. */
+  send_op({KEYMAP_OP_EDIT, 1, LAYER_COUNT, pos, HID_KEY_Z, 0});
+  SIM_CHECK(!status().last_ok);
+  send_op({KEYMAP_OP_DISCARD});
+  SIM_CHECK(status().last_ok && status().staged == 0);
+
+  send_op({KEYMAP_OP_RESET});
+  SIM_CHECK(status().last_ok && status().sequence == 0);
+  SIM_CHECK(tap(HID_KEY_H, 250000) == HID_KEY_H);
+}
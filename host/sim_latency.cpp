@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "tusb.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "latency.h"
+#include "scheduler.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+#define LOOP_PERIOD_US 1000
+#define TAPS 40
+
+/** Read the stats back page by page, the way latency_reader does over
+ * GET_REPORT. */
+static bool read_back(latency_stats_t &stats)
+{
+  uint8_t raw[LATENCY_PAGES * LATENCY_PAGE_BYTES];
+  uint8_t report[LATENCY_REPORT_LEN];
+  latency_select_page(0);
+  for (uint page = 0; page < LATENCY_PAGES; page++)
+  {
+    if (latency_read_page(report, sizeof(report)) != LATENCY_REPORT_LEN ||
+        report[0] != page)
+      return false;
+    memcpy(raw + page * LATENCY_PAGE_BYTES, report + 1, LATENCY_PAGE_BYTES);
+  }
+  memcpy(&stats, raw, sizeof(stats));
+  return stats.version == LATENCY_VERSION && stats.size == sizeof(stats);
+}
+
+static uint32_t histogram_total(const latency_stats_t &stats, uint stage)
+{
+  uint32_t total = 0;
+  for (uint b = 0; b < LATENCY_BUCKETS; b++)
+    total += stats.histogram[stage][b];
+  return total;
+}
+
+SIM_SCENARIO(latency_histograms_cover_every_keystroke)
+{
+  sim_reset();
+  keyboard_init();
+
+  std::vector<sim_key_event> events;
+  for (int i = 0; i < TAPS; i++)
+  {
+    uint64_t t = 5000 + i * 30000 + (i * 137) % LOOP_PERIOD_US;
+    events.push_back(sim_event(t, HID_KEY_L, true));
+    events.push_back(sim_event(t + 12000, HID_KEY_L, false));
+  }
+  sim_load_timeline(events);
+  sim_run(5000 + TAPS * 30000 + 20000, LOOP_PERIOD_US, key_scan);
+
+  latency_stats_t stats;
+  SIM_CHECK(read_back(stats));
+  SIM_CHECK(stats.keystrokes == 2 * TAPS);
+  SIM_CHECK(stats.untracked == 0);
+  for (uint s = 0; s < LATENCY_STAGES; s++)
+    SIM_CHECK(histogram_total(stats, s) == 2 * TAPS);
+
+  /** Eager debounce adds nothing, a 1 ms loop and a 1 ms poll keep the rest
+   * within a couple of milliseconds. */
+  SIM_CHECK(stats.max_us[LATENCY_DEBOUNCE] == 0);
+  SIM_CHECK(stats.max_us[LATENCY_TOTAL] <= 3 * LOOP_PERIOD_US);
+  printf("    raw -> complete: max %u us, queued -> complete: max %u us\n",
+         stats.max_us[LATENCY_TOTAL], stats.max_us[LATENCY_USB]);
+}
+
+SIM_SCENARIO(latency_counts_missed_ready_windows)
+{
+  sim_reset();
+  keyboard_init();
+  sim_set_host_poll_interval_us(8000);
+
+  /** Two keys a loop apart: the second finds the endpoint still holding the
+   * first one's report. */
+  sim_load_timeline({sim_event(1000, HID_KEY_A, true),
+                     sim_event(2000, HID_KEY_S, true)});
+  sim_run(30000, LOOP_PERIOD_US, key_scan);
+
+  latency_stats_t stats;
+  SIM_CHECK(read_back(stats));
+  SIM_CHECK(stats.keystrokes == 2);
+  SIM_CHECK(stats.missed_ready > 0);
+  SIM_CHECK(stats.max_us[LATENCY_QUEUE] >= 6000);
+}
+
+SIM_SCENARIO(latency_exports_task_periods)
+{
+  sim_reset();
+  keyboard_init();
+  static sched_task_t tasks[] = {
+      SCHED_TASK(keyboard_scan, KEYBOARD_SCAN_PERIOD_US),
+      SCHED_TASK(keyboard_debounce, KEYBOARD_DEBOUNCE_PERIOD_US),
+      SCHED_TASK(keyboard_report, KEYBOARD_REPORT_PERIOD_US),
+  };
+  latency_tasks(tasks, 3);
+  sched_init(tasks, 3, sim_now_us());
+
+  /** Keep a key down so the matrix never idles. */
+  sim_load_timeline({sim_event(1000, HID_KEY_L, true)});
+  while (sim_now_us() < 200000)
+    hal_wait_until_us(sched_run_due(tasks, 3));
+
+  latency_stats_t stats;
+  SIM_CHECK(read_back(stats));
+  for (uint i = 0; i < 3; i++)
+  {
+    SIM_CHECK(stats.task_period_mean_us[i] == tasks[i].period_us);
+    SIM_CHECK(stats.task_period_min_us[i] <= stats.task_period_mean_us[i]);
+    SIM_CHECK(stats.task_period_max_us[i] >= stats.task_period_mean_us[i]);
+  }
+  SIM_CHECK(stats.overruns == 0);
+}
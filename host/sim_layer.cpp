@@ -0,0 +1,139 @@
+#include "tusb.h"
+#include "layer.h"
+#include "scenario.h"
+
+/** A small keymap that only uses the first few positions. */
+enum
+{
+  KEY_A,
+  KEY_MO1,
+  KEY_TG2,
+  KEY_OSL3,
+  KEY_B,
+  KEY_MO1_AGAIN,
+};
+
+static constexpr std::array<layer_table_t, 4> test_layers = []
+{
+  std::array<layer_table_t, 4> layers{};
+  for (uint layer = 1; layer < 4; layer++)
+    layers[layer].fill(KC_TRNS);
+
+  layers[0][KEY_A] = HID_KEY_A;
+  layers[0][KEY_MO1] = MO(1);
+  layers[0][KEY_TG2] = TG(2);
+  layers[0][KEY_OSL3] = OSL(3);
+  layers[0][KEY_B] = HID_KEY_B;
+  layers[0][KEY_MO1_AGAIN] = MO(1);
+
+  layers[1][KEY_A] = HID_KEY_X;
+  layers[2][KEY_A] = HID_KEY_Y;
+  layers[2][KEY_B] = HID_KEY_Z;
+  layers[3][KEY_A] = HID_KEY_1;
+  return layers;
+}();
+static constexpr auto test_key_layers = layer_key_masks(test_layers);
+static constexpr layer_keymap_t test_keymap = {test_layers.data(), 4,
+                                               test_key_layers.data(),
+                                               layer_tap_hold_keys(test_layers)};
+
+/** Press and release a key, returning what it sent. */
+static action_t tap(layer_t &l, uint pos)
+{
+  action_t action = layer_press(l, pos);
+  layer_release(l, pos);
+  return action;
+}
+
+SIM_SCENARIO(layer_momentary_while_held)
+{
+  layer_t l;
+  layer_init(l, test_keymap);
+
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_A);
+  layer_press(l, KEY_MO1);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_X);
+  /** Layer 1 leaves B transparent. */
+  SIM_CHECK(tap(l, KEY_B) == HID_KEY_B);
+  layer_release(l, KEY_MO1);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_A);
+  SIM_CHECK(l.active == 1);
+}
+
+SIM_SCENARIO(layer_momentary_counts_holds)
+{
+  layer_t l;
+  layer_init(l, test_keymap);
+
+  layer_press(l, KEY_MO1);
+  layer_press(l, KEY_MO1_AGAIN);
+  layer_release(l, KEY_MO1);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_X);
+  layer_release(l, KEY_MO1_AGAIN);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_A);
+}
+
+SIM_SCENARIO(layer_toggle_flips)
+{
+  layer_t l;
+  layer_init(l, test_keymap);
+
+  tap(l, KEY_TG2);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_Y);
+  SIM_CHECK(tap(l, KEY_B) == HID_KEY_Z);
+  tap(l, KEY_TG2);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_A);
+  SIM_CHECK(tap(l, KEY_B) == HID_KEY_B);
+}
+
+SIM_SCENARIO(layer_transparent_falls_through)
+{
+  layer_t l;
+  layer_init(l, test_keymap);
+
+  /** 1, 2 and 3 on: A comes from 3, B falls through 3 to 2. */
+  tap(l, KEY_TG2);
+  layer_press(l, KEY_MO1);
+  layer_press(l, KEY_OSL3);
+  SIM_CHECK(layer_resolve(l, KEY_A) == HID_KEY_1);
+  SIM_CHECK(layer_resolve(l, KEY_B) == HID_KEY_Z);
+  layer_release(l, KEY_OSL3);
+  SIM_CHECK(tap(l, KEY_B) == HID_KEY_Z); /** uses up the one shot */
+  tap(l, KEY_TG2);
+  SIM_CHECK(layer_resolve(l, KEY_A) == HID_KEY_X);
+  SIM_CHECK(layer_resolve(l, KEY_B) == HID_KEY_B);
+}
+
+SIM_SCENARIO(layer_oneshot_lasts_one_press)
+{
+  layer_t l;
+  layer_init(l, test_keymap);
+
+  /** Tapped: only the next key press gets the layer. */
+  tap(l, KEY_OSL3);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_1);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_A);
+
+  /** Held: works like MO until released. */
+  layer_press(l, KEY_OSL3);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_1);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_1);
+  layer_release(l, KEY_OSL3);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_A);
+}
+
+SIM_SCENARIO(layer_key_locks_in_on_press)
+{
+  layer_t l;
+  layer_init(l, test_keymap);
+
+  layer_press(l, KEY_MO1);
+  SIM_CHECK(layer_press(l, KEY_A) == HID_KEY_X);
+  layer_release(l, KEY_MO1);
+  tap(l, KEY_TG2);
+
+  /** Still X while held and on release, whatever the layers did. */
+  SIM_CHECK(l.locked[KEY_A] == HID_KEY_X);
+  SIM_CHECK(layer_release(l, KEY_A) == HID_KEY_X);
+  SIM_CHECK(tap(l, KEY_A) == HID_KEY_Y);
+}
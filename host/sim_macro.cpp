@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "macro.h"
+#include "sim_matrix.h"
+#include "sim_typing.h"
+#include "scenario.h"
+
+#define LOOP_PERIOD_US 1000
+#define HOST_POLL_US 1000
+
+static const char sign_off[] = "Thanks,\n";
+
+/** The example macros on Fn+Enter and Fn+C, from a fresh keyboard. */
+static void macro_keyboard(void)
+{
+  sim_reset();
+  keyboard_init();
+  sim_map_fn({{HID_KEY_ENTER, MACRO(MACRO_SIGN_OFF)}, {HID_KEY_C, MACRO(MACRO_COPY_ALL)}});
+}
+
+/** What a text box on the simulated host ends up with: each usage going
+ * down types its character, shifted if a shift is down in the same report.
+ * With Ctrl down it is written as ^ and the letter. */
+static std::string host_text(void)
+{
+  char chars[2][256] = {};
+  for (uint c = 0; c < 128; c++)
+  {
+    uint8_t code = macro_ascii[c];
+    if (code)
+      chars[code & MACRO_ASCII_SHIFT ? 1 : 0][code & ~MACRO_ASCII_SHIFT] = (char)c;
+  }
+
+  std::string text;
+  bool down[256] = {};
+  for (const sim_report &r : sim_reports())
+  {
+    bool shift = r.modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
+    bool ctrl = r.modifier & (KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_RIGHTCTRL);
+    for (uint usage = 1; usage < 0xe0; usage++)
+    {
+      bool now = r.has_key(usage);
+      if (now && !down[usage])
+      {
+        if (ctrl)
+          text += '^';
+        text += chars[shift && !ctrl][usage] ? chars[shift && !ctrl][usage] : '?';
+      }
+      down[usage] = now;
+    }
+  }
+  return text;
+}
+
+/** text is a and b interleaved, each kept in order. */
+static bool interleaves(const std::string &text, const std::string &a, const std::string &b)
+{
+  if (text.size() != a.size() + b.size())
+    return false;
+  /** ok[j] after row i: text[0, i + j) can be a[0, i) and b[0, j). */
+  std::vector<bool> ok(b.size() + 1);
+  for (size_t i = 0; i <= a.size(); i++)
+  {
+    for (size_t j = 0; j <= b.size(); j++)
+    {
+      if (i == 0 && j == 0)
+        ok[j] = true;
+      else
+        ok[j] = (i > 0 && ok[j] && a[i - 1] == text[i + j - 1]) ||
+                (j > 0 && ok[j - 1] && b[j - 1] == text[i + j - 1]);
+    }
+  }
+  return ok[b.size()];
+}
+
+SIM_SCENARIO(macro_bytecode_is_compact)
+{
+  const uint8_t expected[] = {MACRO_TYPE, 'T', 'h', 'a', 'n', 'k', 's', ',', 0,
+                              MACRO_TAP, HID_KEY_ENTER, MACRO_END};
+  SIM_CHECK(macro_sign_off.size() == sizeof(expected));
+  SIM_CHECK(memcmp(macro_sign_off.data(), expected, sizeof(expected)) == 0);
+  printf("    sign off: %zu bytes, copy all: %zu bytes\n", macro_sign_off.size(),
+         macro_copy_all.size());
+}
+
+/** Fn+Enter tapped count times with the main loop running every loop_us.
+ * Taps come as fast as the loop can scan them: with a 1 ms loop each comes
+ * while the last macro is still playing. */
+static void type_sign_offs(int count, uint32_t loop_us)
+{
+  macro_keyboard();
+  sim_set_host_poll_interval_us(HOST_POLL_US);
+  uint64_t every = 2 * loop_us + 8000;
+  std::vector<sim_key_event> events;
+  events.push_back(sim_event(1000, FN_KEY, true));
+  for (int i = 0; i < count; i++)
+  {
+    events.push_back(sim_event(10000 + i * every, HID_KEY_ENTER, true));
+    events.push_back(sim_event(10000 + i * every + every / 2, HID_KEY_ENTER, false));
+  }
+  events.push_back(sim_event(10000 + count * every, FN_KEY, false));
+  sim_load_timeline(events);
+  sim_run(count * (every + 20000) + 100000, loop_us, key_scan);
+}
+
+SIM_SCENARIO(macro_types_at_host_poll_rate)
+{
+  const int count = 10;
+  for (uint32_t loop_us : {LOOP_PERIOD_US, 10 * LOOP_PERIOD_US})
+  {
+    type_sign_offs(count, loop_us);
+    std::string expected;
+    for (int i = 0; i < count; i++)
+      expected += sign_off;
+    SIM_CHECK(host_text() == expected);
+
+    /** A press and a release per character, each its own report, queued as
+     * the last one completes: within a macro they never wait on the main
+     * loop. */
+    const std::vector<sim_report> &r = sim_reports();
+    SIM_CHECK(r.size() == 2 * expected.size());
+    uint64_t gaps = 0;
+    for (size_t i = 1; i < r.size(); i++)
+      gaps += r[i].queued_us != r[i - 1].complete_us;
+    double seconds = (r.back().complete_us - r.front().queued_us) / 1e6;
+    printf("    loop every %5u us: %zu chars in %.1f ms, %.0f chars/s, "
+           "%llu reports not queued on completion\n",
+           loop_us, expected.size(), seconds * 1e3, expected.size() / seconds,
+           (unsigned long long)gaps);
+    /** Only where a macro starts: its Enter has to be scanned first. */
+    SIM_CHECK(gaps <= count);
+    SIM_CHECK(r.back().empty());
+  }
+}
+
+SIM_SCENARIO(macro_shortcut_holds_modifier)
+{
+  macro_keyboard();
+  sim_load_timeline({sim_event(1000, FN_KEY, true),
+                     sim_event(10000, HID_KEY_C, true),
+                     sim_event(15000, HID_KEY_C, false),
+                     sim_event(20000, FN_KEY, false)});
+  sim_run(60000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(host_text() == "^a^c");
+  SIM_CHECK(sim_reports().back().empty());
+}
+
+SIM_SCENARIO(macro_interleaves_live_typing)
+{
+  /** "hi" typed by hand at every offset against the macro, so the live h
+   * lands on each of its steps, the macro's own h among them. */
+  int runs = 0, correct = 0;
+  for (uint64_t offset = 0; offset < 20000; offset += 250)
+  {
+    macro_keyboard();
+    uint64_t t = 12000 + offset;
+    sim_load_timeline({sim_event(1000, FN_KEY, true),
+                       sim_event(10000, HID_KEY_ENTER, true),
+                       sim_event(11000, FN_KEY, false),
+                       sim_event(11000, HID_KEY_ENTER, false),
+                       sim_event(t, HID_KEY_H, true),
+                       sim_event(t + 3000, HID_KEY_H, false),
+                       sim_event(t + 4000, HID_KEY_I, true),
+                       sim_event(t + 7000, HID_KEY_I, false)});
+    sim_run(80000, LOOP_PERIOD_US, key_scan);
+    std::string text = host_text();
+    runs++;
+    correct += interleaves(text, sign_off, "hi") && sim_reports().back().empty();
+  }
+  printf("    %d of %d runs typed both in order\n", correct, runs);
+  SIM_CHECK(correct == runs);
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "scenario.h"
+
+struct scenario
+{
+  const char *name;
+  scenario_fn fn;
+};
+
+static std::vector<scenario> &registry(void)
+{
+  static std::vector<scenario> scenarios;
+  return scenarios;
+}
+
+static bool current_failed;
+
+scenario_registrar::scenario_registrar(const char *name, scenario_fn fn)
+{
+  registry().push_back({name, fn});
+}
+
+void scenario_fail(const char *file, int line, const char *expr)
+{
+  printf("    %s:%d: check failed: %s\n", file, line, expr);
+  current_failed = true;
+}
+
+int main(int argc, char **argv)
+{
+  const char *filter = argc > 1 ? argv[1] : NULL;
+  int run = 0;
+  int failed = 0;
+
+  for (const scenario &s : registry())
+  {
+    if (filter && !strstr(s.name, filter))
+      continue;
+
+    printf("[ RUN  ] %s\n", s.name);
+    current_failed = false;
+    s.fn();
+    printf("[ %s ] %s\n", current_failed ? "FAIL" : " OK ", s.name);
+    run++;
+    if (current_failed)
+      failed++;
+  }
+
+  printf("%d scenarios, %d failed\n", run, failed);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+#ifndef SIM_MATRIX_H_
+#define SIM_MATRIX_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "usb_descriptors.h"
+#include "layer.h"
+
+/** --------------------------------------------------------------------+ */
+/** Simulated 15x5 key matrix */
+/** --------------------------------------------------------------------+ */
+/** Backs hal.h on the host. Keys are pressed and released either directly or
+ * from a scripted timeline, the row pins read LOW when the column they share
+ * a pressed key with is driven LOW, and time only moves when the firmware
+ * sleeps or the harness advances it. Every HID report the firmware sends is
+ * recorded together with the time the simulated host picked it up. */
+
+/** A scripted press or release of the key at key_layout[col][row]. */
+struct sim_key_event
+{
+  uint64_t time_us;
+  uint8_t col;
+  uint8_t row;
+  bool pressed;
+};
+
+/** A report as seen by the simulated host. */
+struct sim_report
+{
+  uint64_t queued_us;   /** when the firmware handed it to the HID sink */
+  uint64_t complete_us; /** when the host polled it off the endpoint */
+  uint8_t instance;  /** ITF_NUM_KEYBOARD or ITF_NUM_NKRO */
+  uint8_t report_id; /** 0 on the keyboard interface */
+  uint8_t modifier;
+  uint8_t keycode[6];               /** keyboard interface */
+  uint8_t bitmap[NKRO_KEY_COUNT / 8]; /** REPORT_ID_NKRO */
+  uint16_t consumer;                /** REPORT_ID_CONSUMER_CONTROL */
+  uint8_t buttons;                  /** REPORT_ID_MOUSE */
+  int8_t x, y, wheel, pan;
+
+  /** A keyboard report, on either interface. */
+  bool is_keyboard(void) const;
+  bool has_key(uint8_t key) const;
+  bool empty(void) const;
+};
+
+/** Counters for the work the firmware asked the hardware to do. */
+struct sim_stats
+{
+  uint64_t gpio_puts;
+  uint64_t gpio_gets;
+  uint64_t sleeps;
+  uint64_t slept_us;
+  uint64_t remote_wakeups;
+  uint64_t waits; /** hal_wait_until_us() calls, each one a core wakeup */
+  uint64_t flash_erases;
+  uint64_t flash_pages;
+};
+
+/** Back to power-on state: time 0, no keys held, no reports, host polling
+ * at the descriptor's bInterval, ghosting on, flash erased. */
+void sim_reset(void);
+
+/** Replace the scripted timeline. Events must be sorted by time. */
+void sim_load_timeline(const std::vector<sim_key_event> &events);
+
+/** Press or release a key right now. */
+void sim_set_key(uint8_t col, uint8_t row, bool pressed);
+
+/** A timeline event for the key whose base layer action is key. */
+sim_key_event sim_event(uint64_t time_us, action_t key, bool pressed);
+
+/** Simulated clock. */
+uint64_t sim_now_us(void);
+void sim_advance_us(uint64_t us);
+
+/** Interval at which the simulated host polls the HID endpoints. */
+void sim_set_host_poll_interval_us(uint32_t us);
+
+/** Switch the keyboard interface between boot and report protocol, the way
+ * the host's SET_PROTOCOL does. keyboard_init() starts in report protocol,
+ * like any modern OS. */
+void sim_set_boot_protocol(bool boot);
+
+/** Model the diode-less matrix: keys held on three corners of a rectangle
+ * make the fourth read as pressed. On after sim_reset(). */
+void sim_set_ghosting(bool on);
+
+/** Put the simulated bus into or out of suspend. */
+void sim_set_suspended(bool suspended);
+
+/** Open or close the debug log's CDC port on the simulated host. While it
+ * is open the host reads the FIFO dry every time tud_task() would run.
+ * Closed after sim_reset(). */
+void sim_set_cdc_connected(bool connected);
+
+/** Everything the host has read off the CDC port since sim_reset(). */
+const std::vector<uint8_t> &sim_cdc_received(void);
+
+/** Run the matrix_scan.pio program for one pass of the strobe table: for
+ * each word, drive the columns in its pindirs mask LOW (releasing the rest),
+ * let them settle and sample the whole GPIO bank into raw. */
+void sim_pio_capture(const uint32_t *table, uint32_t *raw, uint words,
+                     uint32_t settle_us);
+
+/** The flash config region behind hal_flash_*(). It is NOR flash: an
+ * erase sets a sector to 0xff, programming ANDs whole pages into it.
+ * keyboard_init() on its own is a reboot: flash keeps what was written. */
+uint8_t *sim_flash(void);
+
+/** Cut the power after bytes more bytes of flash have been erased or
+ * programmed: the erase or program that runs out stops part way and every
+ * one after it does nothing, until sim_flash_power_on(). */
+void sim_flash_cut_after(uint32_t bytes);
+void sim_flash_power_on(void);
+
+const std::vector<sim_report> &sim_reports(void);
+const sim_stats &sim_get_stats(void);
+
+/** Run loop() the way main() does: call it, then wait out the rest of
+ * period_us, until the clock reaches until_us. */
+void sim_run(uint64_t until_us, uint32_t period_us, void (*loop)(void));
+
+/** First keyboard report queued at or after after_us that reports key (or, when
+ * pressed is false, the first one that no longer does). NULL if none. */
+const sim_report *sim_find_report(uint8_t key, bool pressed, uint64_t after_us);
+
+#endif /* SIM_MATRIX_H_ */
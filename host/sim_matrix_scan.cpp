@@ -0,0 +1,70 @@
+#include <stdlib.h>
+
+#include "keyboard.h"
+#include "matrix.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+SIM_SCENARIO(bank_read_matches_per_key_scan)
+{
+  sim_reset();
+  keyboard_init();
+  srand(1);
+
+  for (int trial = 0; trial < 500; trial++)
+  {
+    for (int col = 0; col < MATRIX_COLS; col++)
+    {
+      for (int row = 0; row < MATRIX_ROWS; row++)
+        sim_set_key(col, row, rand() % 8 == 0);
+    }
+
+    matrix_t bank, per_key;
+    matrix_scan(bank);
+    matrix_scan_per_key(per_key);
+    SIM_CHECK(matrix_equal(bank, per_key));
+  }
+}
+
+SIM_SCENARIO(bank_read_settles_once_per_column)
+{
+  sim_reset();
+  keyboard_init();
+
+  matrix_t matrix;
+  uint64_t start = sim_now_us();
+  matrix_scan(matrix);
+  SIM_CHECK(sim_now_us() - start == MATRIX_COLS * GPIO_PIN_SETTLE_DELAY_US);
+  SIM_CHECK(matrix_empty(matrix));
+}
+
+SIM_SCENARIO(pio_snapshot_decodes_like_cpu_scan)
+{
+  sim_reset();
+  keyboard_init();
+  srand(2);
+
+  uint32_t table[MATRIX_SNAPSHOT_WORDS];
+  matrix_build_strobe_table(table);
+
+  /** Only the idle slot may leave every column released. */
+  for (int col = 0; col < MATRIX_SNAPSHOT_WORDS; col++)
+    SIM_CHECK((table[col] == 0) == (col >= MATRIX_COLS));
+
+  for (int trial = 0; trial < 500; trial++)
+  {
+    for (int col = 0; col < MATRIX_COLS; col++)
+    {
+      for (int row = 0; row < MATRIX_ROWS; row++)
+        sim_set_key(col, row, rand() % 8 == 0);
+    }
+
+    uint32_t raw[MATRIX_SNAPSHOT_WORDS];
+    sim_pio_capture(table, raw, MATRIX_SNAPSHOT_WORDS, 2);
+
+    matrix_t pio, cpu;
+    matrix_decode_snapshot(raw, pio);
+    matrix_scan(cpu);
+    SIM_CHECK(matrix_equal(pio, cpu));
+  }
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "mousekey.h"
+#include "sim_matrix.h"
+#include "sim_typing.h"
+#include "scenario.h"
+
+#define LOOP_PERIOD_US 1000
+#define HOLD_US 1500000
+
+/** The media and mouse keys of the keymap.h example on the Fn layer. */
+static void map_media_mouse_keys(void)
+{
+  sim_map_fn({
+      {HID_KEY_BRACKET_LEFT, CONSUMER(HID_USAGE_CONSUMER_SCAN_PREVIOUS)},
+      {HID_KEY_BRACKET_RIGHT, CONSUMER(HID_USAGE_CONSUMER_SCAN_NEXT)},
+      {HID_KEY_BACKSLASH, CONSUMER(HID_USAGE_CONSUMER_PLAY_PAUSE)},
+      {HID_KEY_COMMA, CONSUMER(HID_USAGE_CONSUMER_VOLUME_DECREMENT)},
+      {HID_KEY_PERIOD, CONSUMER(HID_USAGE_CONSUMER_VOLUME_INCREMENT)},
+      {HID_KEY_SLASH, CONSUMER(HID_USAGE_CONSUMER_MUTE)},
+      {HID_KEY_I, MOUSE_KEY(MOUSEKEY_UP)},
+      {HID_KEY_K, MOUSE_KEY(MOUSEKEY_DOWN)},
+      {HID_KEY_J, MOUSE_KEY(MOUSEKEY_LEFT)},
+      {HID_KEY_L, MOUSE_KEY(MOUSEKEY_RIGHT)},
+      {HID_KEY_U, MOUSE_KEY(MOUSEKEY_BUTTON1)},
+      {HID_KEY_O, MOUSE_KEY(MOUSEKEY_BUTTON1 + 1)},
+      {HID_KEY_Y, MOUSE_KEY(MOUSEKEY_WHEEL_UP)},
+      {HID_KEY_H, MOUSE_KEY(MOUSEKEY_WHEEL_DOWN)},
+  });
+}
+
+/** How far the pointer goes with a move key held for t_us, in px. */
+static double expected_distance(double t_us)
+{
+  double t = t_us / 1e6, accel = MOUSEKEY_ACCEL_MS / 1e3;
+  double ramp = t < accel ? t : accel;
+  return 1 + MOUSEKEY_SPEED_MIN * ramp +
+         (MOUSEKEY_SPEED_MAX - MOUSEKEY_SPEED_MIN) * ramp * ramp * ramp / (3 * accel * accel) +
+         MOUSEKEY_SPEED_MAX * (t - ramp);
+}
+
+/** Hold Fn + key from 10 ms for hold_us with the host polling every
+ * poll_us, and return the mouse reports. */
+static std::vector<sim_report> hold_mouse_key(action_t key, uint64_t hold_us, uint32_t poll_us)
+{
+  sim_reset();
+  sim_set_host_poll_interval_us(poll_us);
+  keyboard_init();
+  map_media_mouse_keys();
+  sim_load_timeline({sim_event(5000, FN_KEY, true), sim_event(10000, key, true),
+                     sim_event(10000 + hold_us, key, false),
+                     sim_event(20000 + hold_us, FN_KEY, false)});
+  sim_run(100000 + hold_us, LOOP_PERIOD_US, key_scan);
+
+  std::vector<sim_report> mouse;
+  for (const sim_report &r : sim_reports())
+  {
+    if (r.report_id == REPORT_ID_MOUSE)
+      mouse.push_back(r);
+  }
+  return mouse;
+}
+
+SIM_SCENARIO(consumer_keys_send_media_usages)
+{
+  sim_reset();
+  keyboard_init();
+  map_media_mouse_keys();
+  sim_load_timeline({sim_event(5000, FN_KEY, true), sim_event(10000, HID_KEY_PERIOD, true),
+                     sim_event(40000, HID_KEY_PERIOD, false),
+                     sim_event(50000, HID_KEY_COMMA, true),
+                     sim_event(60000, HID_KEY_COMMA, false), sim_event(70000, FN_KEY, false)});
+  sim_run(100000, LOOP_PERIOD_US, key_scan);
+
+  std::vector<uint16_t> usages;
+  for (const sim_report &r : sim_reports())
+  {
+    if (r.report_id == REPORT_ID_CONSUMER_CONTROL)
+      usages.push_back(r.consumer);
+    /** Fn and the media keys send nothing on the keyboard report. */
+    else
+      SIM_CHECK(!r.is_keyboard() || r.empty());
+  }
+  SIM_CHECK((usages == std::vector<uint16_t>{HID_USAGE_CONSUMER_VOLUME_INCREMENT, 0,
+                                              HID_USAGE_CONSUMER_VOLUME_DECREMENT, 0}));
+}
+
+SIM_SCENARIO(mouse_keys_accelerate_smoothly)
+{
+  std::vector<sim_report> mouse = hold_mouse_key(HID_KEY_L, HOLD_US, LOOP_PERIOD_US);
+  SIM_CHECK(!mouse.empty() && mouse[0].x == 1);
+
+  /** Speed only ever goes up, a pixel a report at most at a time, and ends
+   * up at the top speed. */
+  int x = 0, last_step = 0, top = 0;
+  uint64_t reported_us = mouse[0].queued_us;
+  for (const sim_report &r : mouse)
+  {
+    SIM_CHECK(r.y == 0 && r.wheel == 0 && r.pan == 0 && r.buttons == 0);
+    SIM_CHECK(r.x >= 0);
+    if (r.x > 0 && r.queued_us - reported_us <= LOOP_PERIOD_US)
+    {
+      SIM_CHECK(abs(r.x - last_step) <= 1);
+      last_step = r.x;
+    }
+    if (r.x > 0)
+      reported_us = r.queued_us;
+    x += r.x;
+    if (r.queued_us > HOLD_US - 490000 && r.queued_us <= HOLD_US + 10000)
+      top += r.x;
+  }
+  SIM_CHECK(abs(top - MOUSEKEY_SPEED_MAX / 2) <= 3);
+
+  double expected = expected_distance(HOLD_US);
+  printf("    %u ms hold: %d px in %zu reports, expected %.0f px\n", HOLD_US / 1000, x,
+         mouse.size(), expected);
+  SIM_CHECK(abs(x - (int)expected) <= 3);
+}
+
+SIM_SCENARIO(mouse_motion_coalesces_at_any_poll_rate)
+{
+  /** The slower the host takes mouse reports, the more motion each one
+   * carries; the pointer ends up in the same place. */
+  const uint32_t polls[] = {1000, 4000, 8000};
+  int moved[3] = {};
+  for (uint i = 0; i < 3; i++)
+  {
+    std::vector<sim_report> mouse = hold_mouse_key(HID_KEY_I, HOLD_US, polls[i]);
+    for (const sim_report &r : mouse)
+      moved[i] += r.y;
+    printf("    %u us poll: %d px up in %zu reports\n", polls[i], -moved[i], mouse.size());
+  }
+  SIM_CHECK(moved[0] < 0);
+  SIM_CHECK(moved[1] == moved[0] && moved[2] == moved[0]);
+
+  /** The wheel steps on press, then keeps turning. */
+  int wheel = 0;
+  for (const sim_report &r : hold_mouse_key(HID_KEY_Y, 500000, LOOP_PERIOD_US))
+    wheel += r.wheel;
+  SIM_CHECK(wheel == 1 + MOUSEKEY_WHEEL_RATE / 2);
+}
+
+SIM_SCENARIO(keyboard_reports_go_first_while_mouse_streams)
+{
+  /** Typing with Fn held (keys the Fn layer leaves alone), once on its own
+   * and once with the pointer moving the whole time. One key at a time, so
+   * no three keys down make a ghost the filter has to hold back. */
+  const action_t letters[] = {HID_KEY_Q, HID_KEY_E, HID_KEY_R, HID_KEY_T, HID_KEY_G,
+                              HID_KEY_V, HID_KEY_B, HID_KEY_N, HID_KEY_M, HID_KEY_P,
+                              HID_KEY_Z, HID_KEY_X, HID_KEY_F};
+  std::vector<sim_key_event> typing = {sim_event(5000, FN_KEY, true)};
+  std::vector<sim_key_event> presses;
+  uint64_t t = 20000;
+  for (uint i = 0; i < 120; i++)
+  {
+    action_t key = letters[i % std::size(letters)];
+    t += 23000 + (i * 7919) % 41000;
+    presses.push_back(sim_event(t, key, true));
+    typing.push_back(presses.back());
+    typing.push_back(sim_event(t + 8000 + (i * 331) % 12000, key, false));
+  }
+  std::sort(typing.begin(), typing.end(),
+            [](const sim_key_event &a, const sim_key_event &b) { return a.time_us < b.time_us; });
+  typing.push_back(sim_event(t + 100000, FN_KEY, false));
+
+  std::vector<uint64_t> alone =
+      sim_press_latencies(typing, presses, LOOP_PERIOD_US, map_media_mouse_keys);
+
+  std::vector<sim_key_event> streaming = typing;
+  streaming.insert(streaming.begin() + 1, sim_event(10000, HID_KEY_L, true));
+  streaming.insert(streaming.end() - 1, sim_event(t + 90000, HID_KEY_L, false));
+  std::vector<uint64_t> with_mouse =
+      sim_press_latencies(streaming, presses, LOOP_PERIOD_US, map_media_mouse_keys);
+
+  size_t mouse_reports = 0;
+  for (const sim_report &r : sim_reports())
+    mouse_reports += r.report_id == REPORT_ID_MOUSE;
+
+  sim_print_latencies("keys alone", alone);
+  sim_print_latencies("mouse moving", with_mouse);
+  printf("    %zu mouse reports around them\n", mouse_reports);
+
+  /** At worst a keystroke waits out the one mouse report in the endpoint:
+   * a single host poll. */
+  uint64_t worst_alone = 0, worst = 0;
+  for (size_t i = 0; i < presses.size(); i++)
+  {
+    SIM_CHECK(alone[i] != UINT64_MAX && with_mouse[i] != UINT64_MAX);
+    worst_alone = std::max(worst_alone, alone[i]);
+    worst = std::max(worst, with_mouse[i]);
+  }
+  SIM_CHECK(worst <= worst_alone + HID_POLL_INTERVAL_MS * 1000);
+  SIM_CHECK(mouse_reports > (t - 10000) / 2000);
+}
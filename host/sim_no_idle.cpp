@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "telemetry.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+/** Scenarios for a build without idle mode (KEYBOARD_IDLE=0), as the PIO
+ * backend builds it: keyboard_idle() is never true there. */
+
+#define LOOP_PERIOD_US 1000
+
+static_assert(!KEYBOARD_IDLE, "keyboard_sim_no_idle is built without idle mode");
+
+/** main()'s telemetry step without idle mode. */
+static bool save_telemetry(void)
+{
+  return keyboard_quiet() && telemetry_task(sim_now_us());
+}
+
+SIM_SCENARIO(no_idle_telemetry_still_saves)
+{
+  sim_reset();
+  keyboard_init();
+  sim_load_timeline({sim_event(10000, HID_KEY_A, true),
+                     sim_event(70000, HID_KEY_A, false),
+                     sim_event(TELEMETRY_SAVE_US + 10000, HID_KEY_S, true)});
+  sim_run(200000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(!keyboard_idle());
+  SIM_CHECK(keyboard_quiet());
+
+  /** Not while S is down, even once the save is due. */
+  sim_run(TELEMETRY_SAVE_US + 50000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(!keyboard_quiet());
+  SIM_CHECK(!save_telemetry());
+
+  sim_load_timeline({sim_event(TELEMETRY_SAVE_US + 60000, HID_KEY_S, false)});
+  sim_run(TELEMETRY_SAVE_US + 100000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(save_telemetry());
+
+  /** And counting carries on from the save after a reboot. */
+  keyboard_init();
+  SIM_CHECK(telemetry_stats().sequence == 1);
+  sim_key_event a = sim_event(0, HID_KEY_A, true);
+  SIM_CHECK(telemetry_stats().keys[a.col * MATRIX_ROWS + a.row].presses == 1);
+}
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "usb_descriptors.h"
+#include "sim_matrix.h"
+#include "sim_typing.h"
+#include "scenario.h"
+
+#define LOOP_PERIOD_US 5000
+
+/** The host switches protocol this often while typing, out of step with
+ * the keystrokes, and has the keys off the old interface this long after. */
+#define PROTOCOL_FLIP_US 37000
+#define PROTOCOL_SETTLE_US 3000
+
+/** Eleven keys, one per column, so the chord has no ghosts to block. */
+static const uint8_t chord[] = {HID_KEY_Q, HID_KEY_S, HID_KEY_E, HID_KEY_F,
+                                HID_KEY_T, HID_KEY_H, HID_KEY_U, HID_KEY_K,
+                                HID_KEY_O, HID_KEY_P, HID_KEY_SHIFT_LEFT};
+
+static void press_chord(void)
+{
+  sim_reset();
+  keyboard_init();
+  std::vector<sim_key_event> events;
+  for (uint8_t key : chord)
+    events.push_back(sim_event(1000, key, true));
+  sim_load_timeline(events);
+}
+
+SIM_SCENARIO(nkro_reports_every_held_key)
+{
+  press_chord();
+  sim_run(20000, LOOP_PERIOD_US, key_scan);
+
+  SIM_CHECK(!sim_reports().empty());
+  const sim_report &r = sim_reports().back();
+  SIM_CHECK(r.instance == ITF_NUM_NKRO);
+  for (uint8_t key : chord)
+    SIM_CHECK(r.has_key(key));
+}
+
+SIM_SCENARIO(boot_protocol_falls_back_to_6kro)
+{
+  sim_reset();
+  keyboard_init();
+  sim_set_boot_protocol(true);
+  sim_load_timeline({sim_event(1000, HID_KEY_H, true),
+                     sim_event(1000, HID_KEY_I, true),
+                     sim_event(30000, HID_KEY_H, false),
+                     sim_event(30000, HID_KEY_I, false)});
+  sim_run(60000, LOOP_PERIOD_US, key_scan);
+
+  const sim_report *down = sim_find_report(HID_KEY_H, true, 0);
+  SIM_CHECK(down != NULL);
+  SIM_CHECK(down->instance == ITF_NUM_KEYBOARD);
+  SIM_CHECK(down->has_key(HID_KEY_I));
+  SIM_CHECK(sim_reports().back().empty());
+}
+
+SIM_SCENARIO(boot_protocol_rolls_over_past_six_keys)
+{
+  press_chord();
+  sim_set_boot_protocol(true);
+  sim_run(20000, LOOP_PERIOD_US, key_scan);
+
+  SIM_CHECK(!sim_reports().empty());
+  const sim_report &r = sim_reports().back();
+  SIM_CHECK(r.instance == ITF_NUM_KEYBOARD);
+  SIM_CHECK(r.modifier == KEYBOARD_MODIFIER_LEFTSHIFT);
+  for (int i = 0; i < 6; i++)
+    SIM_CHECK(r.keycode[i] == 0x01);
+}
+
+SIM_SCENARIO(held_keys_send_nothing)
+{
+  sim_reset();
+  keyboard_init();
+  sim_set_host_poll_interval_us(1000);
+
+  /** Three keys held for a second, then released. */
+  sim_load_timeline({sim_event(1000, HID_KEY_SHIFT_LEFT, true),
+                     sim_event(1000, HID_KEY_L, true),
+                     sim_event(1000, HID_KEY_H, true),
+                     sim_event(1001000, HID_KEY_SHIFT_LEFT, false),
+                     sim_event(1001000, HID_KEY_L, false),
+                     sim_event(1001000, HID_KEY_H, false)});
+  sim_run(1100000, 1000, key_scan);
+
+  /** One report down, one up, nothing in between. */
+  size_t held_reports = 0;
+  for (const sim_report &r : sim_reports())
+  {
+    if (r.queued_us > 10000 && r.queued_us < 1001000)
+      held_reports++;
+  }
+  printf("    %zu reports in total, %zu reports/s while held\n",
+         sim_reports().size(), held_reports);
+  SIM_CHECK(held_reports == 0);
+  SIM_CHECK(sim_reports().size() == 2);
+  SIM_CHECK(sim_reports().front().has_key(HID_KEY_H));
+  SIM_CHECK(sim_reports().back().empty());
+}
+
+SIM_SCENARIO(boot_slots_keep_order_across_releases)
+{
+  sim_reset();
+  keyboard_init();
+  sim_set_boot_protocol(true);
+  sim_load_timeline({sim_event(1000, HID_KEY_M, true),
+                     sim_event(11000, HID_KEY_A, true),
+                     sim_event(21000, HID_KEY_L, true),
+                     sim_event(31000, HID_KEY_C, true),
+                     sim_event(41000, HID_KEY_A, false),
+                     sim_event(51000, HID_KEY_B, true),
+                     sim_event(61000, HID_KEY_M, false)});
+  sim_run(80000, LOOP_PERIOD_US, key_scan);
+
+  /** Press order, never re-sorted: M A L C, then A goes, B joins at the
+   * end, M goes. All in different columns, so nothing is a ghost. */
+  const uint8_t expected[][6] = {
+      {HID_KEY_M},
+      {HID_KEY_M, HID_KEY_A},
+      {HID_KEY_M, HID_KEY_A, HID_KEY_L},
+      {HID_KEY_M, HID_KEY_A, HID_KEY_L, HID_KEY_C},
+      {HID_KEY_M, HID_KEY_L, HID_KEY_C},
+      {HID_KEY_M, HID_KEY_L, HID_KEY_C, HID_KEY_B},
+      {HID_KEY_L, HID_KEY_C, HID_KEY_B},
+  };
+  const size_t steps = sizeof(expected) / sizeof(expected[0]);
+  SIM_CHECK(sim_reports().size() == steps);
+  for (size_t i = 0; i < steps; i++)
+    SIM_CHECK(memcmp(sim_reports()[i].keycode, expected[i], 6) == 0);
+}
+
+/** The newest keyboard report the host took on instance, NULL for none. */
+static const sim_report *last_keyboard_report(uint8_t instance)
+{
+  const std::vector<sim_report> &reports = sim_reports();
+  for (size_t i = reports.size(); i-- > 0;)
+  {
+    if (reports[i].instance == instance && reports[i].is_keyboard())
+      return &reports[i];
+  }
+  return NULL;
+}
+
+/** Whether GET_REPORT on instance answers with r, or with nothing held
+ * when r is NULL. */
+static bool get_report_matches(uint8_t instance, const sim_report *r)
+{
+  sim_report none = {};
+  r = r ? r : &none;
+  uint8_t buffer[NKRO_REPORT_LEN];
+  if (instance == ITF_NUM_KEYBOARD)
+    return keyboard_get_report(instance, 0, buffer, sizeof(buffer)) == 8 &&
+           buffer[0] == r->modifier && memcmp(buffer + 2, r->keycode, 6) == 0;
+  return keyboard_get_report(instance, REPORT_ID_NKRO, buffer, sizeof(buffer)) ==
+             NKRO_REPORT_LEN - 1 &&
+         buffer[0] == r->modifier && memcmp(buffer + 1, r->bitmap, sizeof(r->bitmap)) == 0;
+}
+
+static bool flip_boot;
+static uint64_t flipped_us;
+static uint flips;
+static bool flip_ok;
+
+/** key_scan() with the host flipping the protocol every PROTOCOL_FLIP_US,
+ * checking as it goes that the interface left behind has been released
+ * and that GET_REPORT agrees with the endpoint on both. */
+static void flipping_scan(void)
+{
+  bool boot = sim_now_us() / PROTOCOL_FLIP_US & 1;
+  if (boot != flip_boot)
+  {
+    sim_set_boot_protocol(boot);
+    flip_boot = boot;
+    flipped_us = sim_now_us();
+    flips++;
+  }
+  key_scan();
+
+  uint8_t left = flip_boot ? ITF_NUM_NKRO : ITF_NUM_KEYBOARD;
+  const sim_report *old = last_keyboard_report(left);
+  if (flipped_us && sim_now_us() - flipped_us >= PROTOCOL_SETTLE_US && old && !old->empty())
+    flip_ok = false;
+  for (uint8_t instance : {ITF_NUM_KEYBOARD, ITF_NUM_NKRO})
+  {
+    if (!get_report_matches(instance, last_keyboard_report(instance)))
+      flip_ok = false;
+  }
+}
+
+SIM_SCENARIO(protocol_switches_mid_typing_leave_nothing_stuck)
+{
+  sim_reset();
+  keyboard_init();
+  sim_set_host_poll_interval_us(1000);
+  std::vector<sim_key_event> typed;
+  std::vector<sim_key_event> events = sim_typing_trace(false, typed);
+  sim_load_timeline(events);
+  flip_boot = false;
+  flipped_us = 0;
+  flips = 0;
+  flip_ok = true;
+  sim_run(events.back().time_us + 100000, 1000, flipping_scan);
+
+  uint missed = 0;
+  for (const sim_key_event &e : typed)
+  {
+    const sim_report *r = sim_find_report((uint8_t)key_layout[e.col][e.row], true, e.time_us);
+    missed += r == NULL;
+  }
+  printf("    %zu presses, %u protocol switches, %zu reports, %u presses lost\n", typed.size(),
+         flips, sim_reports().size(), missed);
+  SIM_CHECK(flips > 10);
+  SIM_CHECK(flip_ok);
+  SIM_CHECK(missed == 0);
+  const sim_report *boot = last_keyboard_report(ITF_NUM_KEYBOARD);
+  const sim_report *nkro = last_keyboard_report(ITF_NUM_NKRO);
+  SIM_CHECK(boot != NULL && boot->empty());
+  SIM_CHECK(nkro != NULL && nkro->empty());
+}
+
+SIM_SCENARIO(get_report_answers_from_the_last_report)
+{
+  sim_reset();
+  keyboard_init();
+  uint8_t buffer[NKRO_REPORT_LEN];
+
+  /** Nothing sent yet reads as nothing held, a report that does not exist
+   * or a buffer too short for it stalls. */
+  SIM_CHECK(get_report_matches(ITF_NUM_KEYBOARD, NULL));
+  SIM_CHECK(get_report_matches(ITF_NUM_NKRO, NULL));
+  SIM_CHECK(keyboard_get_report(ITF_NUM_NKRO, REPORT_ID_KEYMAP, buffer, sizeof(buffer)) == 0);
+  SIM_CHECK(keyboard_get_report(ITF_NUM_NKRO, REPORT_ID_NKRO, buffer, 4) == 0);
+
+  sim_load_timeline({sim_event(1000, HID_KEY_SHIFT_LEFT, true), sim_event(1000, HID_KEY_G, true)});
+  sim_run(30000, 1000, key_scan);
+  const sim_report *r = last_keyboard_report(ITF_NUM_NKRO);
+  SIM_CHECK(r != NULL && r->has_key(HID_KEY_G) && r->has_key(HID_KEY_SHIFT_LEFT));
+  SIM_CHECK(get_report_matches(ITF_NUM_NKRO, r));
+
+  /** A key going down between two reports is not in the answer until a
+   * report has taken it. */
+  sim_key_event h = sim_event(0, HID_KEY_H, true);
+  sim_set_key(h.col, h.row, true);
+  SIM_CHECK(get_report_matches(ITF_NUM_NKRO, r));
+  sim_run(60000, 1000, key_scan);
+  SIM_CHECK(last_keyboard_report(ITF_NUM_NKRO)->has_key(HID_KEY_H));
+  SIM_CHECK(get_report_matches(ITF_NUM_NKRO, last_keyboard_report(ITF_NUM_NKRO)));
+}
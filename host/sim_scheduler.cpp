@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <vector>
+
+#include "tusb.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "matrix.h"
+#include "scheduler.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+/** The task table main() runs without the governor. */
+static sched_task_t tasks[] = {
+    SCHED_TASK(keyboard_scan, KEYBOARD_SCAN_PERIOD_US),
+    SCHED_TASK(keyboard_debounce, KEYBOARD_DEBOUNCE_PERIOD_US),
+    SCHED_TASK(keyboard_report, KEYBOARD_REPORT_PERIOD_US),
+};
+static const char *task_names[] = {"scan", "debounce", "report"};
+#define TASK_COUNT (sizeof(tasks) / sizeof(tasks[0]))
+
+/** main()'s loop. The end of the run stands in for the end of time when
+ * the matrix is idle and only an interrupt can wake the core. */
+static void run_main_loop(uint64_t until_us)
+{
+  while (sim_now_us() < until_us)
+  {
+    if (keyboard_idle())
+    {
+      hal_wait_until_us(until_us);
+      if (!keyboard_idle())
+        sched_restart(tasks, TASK_COUNT, sim_now_us());
+      continue;
+    }
+    hal_wait_until_us(sched_run_due(tasks, TASK_COUNT));
+  }
+}
+
+SIM_SCENARIO(scheduler_holds_stage_periods)
+{
+  sim_reset();
+  keyboard_init();
+  sched_init(tasks, TASK_COUNT, 0);
+
+  run_main_loop(1000000);
+
+  for (uint i = 0; i < TASK_COUNT; i++)
+  {
+    const sched_task_t &t = tasks[i];
+    printf("    %-8s period min %4u us, mean %4u us, max %4u us, %u overruns\n",
+           task_names[i], t.period_min_us, sched_period_mean_us(t),
+           t.period_max_us, t.overruns);
+
+    /** Deadlines are on a fixed grid, so a late start (behind a 150 us scan)
+     * never accumulates. */
+    SIM_CHECK(sched_period_mean_us(t) == t.period_us);
+    SIM_CHECK(t.period_max_us < t.period_us + 2 * MATRIX_COLS * GPIO_PIN_SETTLE_DELAY_US);
+    SIM_CHECK(t.overruns == 0);
+  }
+}
+
+SIM_SCENARIO(scheduler_first_run_after_boot_is_on_time)
+{
+  sim_reset();
+  keyboard_init();
+  /** The tasks start however long after boot main() gets to them. */
+  hal_wait_until_us(1234567);
+  sched_init(tasks, TASK_COUNT, sim_now_us());
+
+  run_main_loop(sim_now_us() + 100000);
+  for (const sched_task_t &t : tasks)
+    SIM_CHECK(t.overruns == 0);
+}
+
+SIM_SCENARIO(scheduler_press_to_host_latency)
+{
+  sim_reset();
+  keyboard_init();
+  sched_init(tasks, TASK_COUNT, 0);
+
+  std::vector<sim_key_event> events;
+  const int taps = 200;
+  for (int i = 0; i < taps; i++)
+  {
+    uint64_t t = 10000 + i * 20000 + (i * 137) % 1000;
+    events.push_back(sim_event(t, HID_KEY_L, true));
+    events.push_back(sim_event(t + 8000, HID_KEY_L, false));
+  }
+  sim_load_timeline(events);
+  run_main_loop(10000 + taps * 20000 + 20000);
+
+  uint64_t min = UINT64_MAX, max = 0, total = 0;
+  for (int i = 0; i < taps; i++)
+  {
+    uint64_t pressed_at = events[2 * i].time_us;
+    const sim_report *r = sim_find_report(HID_KEY_L, true, pressed_at);
+    SIM_CHECK(r != NULL);
+    uint64_t latency = r->complete_us - pressed_at;
+    min = latency < min ? latency : min;
+    max = latency > max ? latency : max;
+    total += latency;
+  }
+  printf("    press to host: min %llu us, mean %llu us, max %llu us\n",
+         (unsigned long long)min, (unsigned long long)(total / taps),
+         (unsigned long long)max);
+
+  /** One scan period, one report period and one host poll at worst. */
+  SIM_CHECK(max <= KEYBOARD_SCAN_PERIOD_US + KEYBOARD_REPORT_PERIOD_US +
+                       HID_POLL_INTERVAL_MS * 1000 + MATRIX_COLS * GPIO_PIN_SETTLE_DELAY_US);
+}
+
+SIM_SCENARIO(idle_stops_scanning)
+{
+  sim_reset();
+  keyboard_init();
+  sched_restart(tasks, TASK_COUNT, 0);
+
+  /** Scanning until the matrix has been quiet long enough, then one last
+   * round of puts to drive the columns LOW, then nothing. */
+  run_main_loop(KEYBOARD_IDLE_AFTER_US + 10000);
+  SIM_CHECK(keyboard_idle());
+  sim_stats before = sim_get_stats();
+  run_main_loop(1000000);
+  sim_stats after = sim_get_stats();
+  printf("    idle for %llu us: %llu gpio puts, %llu gpio reads, %llu wakeups\n",
+         (unsigned long long)(1000000 - KEYBOARD_IDLE_AFTER_US - 10000),
+         (unsigned long long)(after.gpio_puts - before.gpio_puts),
+         (unsigned long long)(after.gpio_gets - before.gpio_gets),
+         (unsigned long long)(after.waits - before.waits));
+  SIM_CHECK(after.gpio_puts == before.gpio_puts);
+  SIM_CHECK(after.gpio_gets == before.gpio_gets);
+  SIM_CHECK(after.waits - before.waits <= 1);
+}
+
+SIM_SCENARIO(idle_press_is_scanned_at_once)
+{
+  sim_reset();
+  keyboard_init();
+  sched_restart(tasks, TASK_COUNT, 0);
+
+  /** Taps far enough apart that the matrix is idle before each one, at
+   * staggered phases against the scan period the idle loop no longer has. */
+  std::vector<sim_key_event> events;
+  const int taps = 50;
+  const uint64_t spacing = 2 * KEYBOARD_IDLE_AFTER_US;
+  for (int i = 0; i < taps; i++)
+  {
+    uint64_t t = spacing + i * spacing + (i * 137) % 1000;
+    events.push_back(sim_event(t, HID_KEY_L, true));
+    events.push_back(sim_event(t + 8000, HID_KEY_L, false));
+  }
+  sim_load_timeline(events);
+
+  uint64_t max_queued = 0;
+  uint64_t idle_taps = 0;
+  for (int i = 0; i < taps; i++)
+  {
+    uint64_t pressed_at = events[2 * i].time_us;
+    run_main_loop(pressed_at - 1);
+    idle_taps += keyboard_idle();
+    run_main_loop(pressed_at + spacing / 2);
+
+    const sim_report *r = sim_find_report(HID_KEY_L, true, pressed_at);
+    SIM_CHECK(r != NULL);
+    uint64_t queued = r->queued_us - pressed_at;
+    max_queued = queued > max_queued ? queued : max_queued;
+  }
+  printf("    %llu of %d taps from idle, press to report queued: max %llu us\n",
+         (unsigned long long)idle_taps, taps, (unsigned long long)max_queued);
+
+  /** No waiting for the next scan period: the edge is followed by one scan
+   * and the report straight after it. */
+  SIM_CHECK(idle_taps == (uint64_t)taps);
+  SIM_CHECK(max_queued <= 2 * MATRIX_COLS * GPIO_PIN_SETTLE_DELAY_US);
+}
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "layer.h"
+#include "taphold.h"
+#include "timer_wheel.h"
+#include "sim_matrix.h"
+#include "sim_typing.h"
+#include "scenario.h"
+
+/** A small keymap that only uses the first few positions. */
+enum
+{
+  KEY_A,
+  KEY_B,
+  KEY_CTL_ESC,
+  KEY_LT1_SPACE,
+};
+
+static constexpr std::array<layer_table_t, 2> test_layers = []
+{
+  std::array<layer_table_t, 2> layers{};
+  layers[1].fill(KC_TRNS);
+
+  layers[0][KEY_A] = HID_KEY_A;
+  layers[0][KEY_B] = HID_KEY_B;
+  layers[0][KEY_CTL_ESC] = MT(MOD_LCTL, HID_KEY_ESCAPE);
+  layers[0][KEY_LT1_SPACE] = LT(1, HID_KEY_SPACE);
+
+  layers[1][KEY_A] = HID_KEY_ARROW_LEFT;
+  return layers;
+}();
+static constexpr auto test_key_layers = layer_key_masks(test_layers);
+static constexpr layer_keymap_t test_keymap = {test_layers.data(), 2,
+                                               test_key_layers.data(),
+                                               layer_tap_hold_keys(test_layers)};
+
+#define TERM_MS 200
+#define TERM_US (TERM_MS * 1000)
+
+/** The report side in miniature: queue -> tap-hold -> layers, recording
+ * what each event was applied as. */
+struct harness
+{
+  key_event_queue_t q;
+  taphold_t t;
+  layer_t l;
+  struct applied
+  {
+    uint8_t pos;
+    bool pressed;
+    action_t action;
+  };
+  std::vector<applied> out;
+
+  harness(uint8_t flags)
+  {
+    event_queue_init(q);
+    taphold_init(t, test_keymap, TERM_MS, flags, 0);
+    layer_init(l, test_keymap);
+  }
+
+  void event(uint32_t time_us, uint8_t pos, bool pressed)
+  {
+    key_event_t e = {};
+    e.time_us = time_us;
+    e.pos = pos;
+    e.pressed = pressed;
+    event_queue_push(q, e);
+  }
+
+  /** What keyboard_report() does with the events at now_us. */
+  void run(uint32_t now_us)
+  {
+    taphold_fill(t, q);
+    taphold_tick(t, now_us);
+    key_event_t e;
+    action_t action;
+    while (taphold_peek(t, l, e, action))
+    {
+      if (e.pressed)
+        layer_press_action(l, e.pos, action);
+      else
+        action = layer_release(l, e.pos);
+      out.push_back({e.pos, e.pressed, action});
+      taphold_pop(t);
+    }
+  }
+
+  bool applied_as(size_t i, uint8_t pos, bool pressed, action_t action) const
+  {
+    return i < out.size() && out[i].pos == pos && out[i].pressed == pressed &&
+           out[i].action == action;
+  }
+};
+
+SIM_SCENARIO(taphold_quick_release_is_a_tap)
+{
+  harness h(TAPHOLD_PERMISSIVE_HOLD);
+  h.event(1000, KEY_CTL_ESC, true);
+  h.run(1000);
+  SIM_CHECK(h.out.empty());
+
+  h.event(80000, KEY_CTL_ESC, false);
+  h.run(80000);
+  SIM_CHECK(h.out.size() == 2);
+  SIM_CHECK(h.applied_as(0, KEY_CTL_ESC, true, HID_KEY_ESCAPE));
+  SIM_CHECK(h.applied_as(1, KEY_CTL_ESC, false, HID_KEY_ESCAPE));
+}
+
+SIM_SCENARIO(taphold_held_past_term_is_a_hold)
+{
+  harness h(TAPHOLD_PERMISSIVE_HOLD);
+  h.event(1000, KEY_CTL_ESC, true);
+  h.run(1000 + TERM_US - 1);
+  SIM_CHECK(h.out.empty());
+
+  /** The timer decides it without any other event coming along. */
+  h.run(1000 + TERM_US + 1024);
+  SIM_CHECK(h.out.size() == 1);
+  SIM_CHECK(h.applied_as(0, KEY_CTL_ESC, true, MT(MOD_LCTL, HID_KEY_ESCAPE)));
+  SIM_CHECK(action_hold_modifier(h.out[0].action) == KEYBOARD_MODIFIER_LEFTCTRL);
+}
+
+SIM_SCENARIO(taphold_permissive_hold_on_nested_tap)
+{
+  harness h(TAPHOLD_PERMISSIVE_HOLD);
+  h.event(1000, KEY_LT1_SPACE, true);
+  h.event(30000, KEY_A, true);
+  h.run(30000);
+  /** A went down, but that alone is not enough to call it. */
+  SIM_CHECK(h.out.empty());
+
+  h.event(60000, KEY_A, false);
+  h.run(60000);
+  /** A was tapped inside the hold: layer 1, and A replayed on it. */
+  SIM_CHECK(h.out.size() == 3);
+  SIM_CHECK(h.applied_as(0, KEY_LT1_SPACE, true, MO(1)));
+  SIM_CHECK(h.applied_as(1, KEY_A, true, HID_KEY_ARROW_LEFT));
+  SIM_CHECK(h.applied_as(2, KEY_A, false, HID_KEY_ARROW_LEFT));
+}
+
+SIM_SCENARIO(taphold_rolling_over_is_a_tap)
+{
+  harness h(TAPHOLD_PERMISSIVE_HOLD);
+  /** Fast typing: space goes down, A goes down, space comes up first. */
+  h.event(1000, KEY_LT1_SPACE, true);
+  h.event(30000, KEY_A, true);
+  h.event(50000, KEY_LT1_SPACE, false);
+  h.event(70000, KEY_A, false);
+  h.run(70000);
+  SIM_CHECK(h.out.size() == 4);
+  SIM_CHECK(h.applied_as(0, KEY_LT1_SPACE, true, HID_KEY_SPACE));
+  SIM_CHECK(h.applied_as(1, KEY_A, true, HID_KEY_A));
+  SIM_CHECK(h.applied_as(2, KEY_LT1_SPACE, false, HID_KEY_SPACE));
+  SIM_CHECK(h.applied_as(3, KEY_A, false, HID_KEY_A));
+}
+
+SIM_SCENARIO(taphold_hold_on_other_press)
+{
+  harness h(TAPHOLD_HOLD_ON_OTHER_PRESS);
+  h.event(1000, KEY_CTL_ESC, true);
+  h.event(30000, KEY_B, true);
+  h.run(30000);
+  SIM_CHECK(h.out.size() == 2);
+  SIM_CHECK(h.applied_as(0, KEY_CTL_ESC, true, MT(MOD_LCTL, HID_KEY_ESCAPE)));
+  SIM_CHECK(h.applied_as(1, KEY_B, true, HID_KEY_B));
+
+  /** Without either flag the same thing waits for the term. */
+  harness plain(0);
+  plain.event(1000, KEY_CTL_ESC, true);
+  plain.event(30000, KEY_B, true);
+  plain.event(60000, KEY_B, false);
+  plain.run(60000);
+  SIM_CHECK(plain.out.empty());
+  plain.run(1000 + TERM_US + 1024);
+  SIM_CHECK(plain.applied_as(0, KEY_CTL_ESC, true, MT(MOD_LCTL, HID_KEY_ESCAPE)));
+  SIM_CHECK(plain.out.size() == 3);
+}
+
+SIM_SCENARIO(taphold_decides_by_event_time)
+{
+  harness h(0);
+  /** Released 250 ms after the press, but the report side only gets to
+   * look at it afterwards: still a hold. */
+  h.event(1000, KEY_CTL_ESC, true);
+  h.event(1000 + TERM_US + 50000, KEY_CTL_ESC, false);
+  h.run(1000 + TERM_US + 60000);
+  SIM_CHECK(h.applied_as(0, KEY_CTL_ESC, true, MT(MOD_LCTL, HID_KEY_ESCAPE)));
+}
+
+SIM_SCENARIO(taphold_plain_keys_pass_straight_through)
+{
+  harness h(TAPHOLD_PERMISSIVE_HOLD);
+  h.event(1000, KEY_A, true);
+  h.run(1000);
+  SIM_CHECK(h.applied_as(0, KEY_A, true, HID_KEY_A));
+  SIM_CHECK(taphold_empty(h.t));
+  SIM_CHECK(h.t.timers.armed == 0);
+}
+
+SIM_SCENARIO(timer_wheel_fires_on_time)
+{
+  timer_wheel_t w;
+  /** Start close to the 32 bit wrap so deadlines run across it. */
+  uint32_t start = 0xffffffffu - 100000;
+  timer_wheel_init(w, start);
+  const uint32_t after[] = {500, 1024, 5000, 33000, 200000, 1000000};
+  for (uint i = 0; i < std::size(after); i++)
+    timer_wheel_arm(w, i, start + after[i]);
+  timer_wheel_arm(w, 10, start + 7000);
+  timer_wheel_cancel(w, 10);
+
+  uint32_t fired_at[std::size(after)] = {};
+  uint32_t fired = 0;
+  for (uint32_t t = 0; t <= 1100000; t += 250)
+  {
+    uint32_t bits = timer_wheel_advance(w, start + t);
+    SIM_CHECK(!(bits & (1u << 10)));
+    while (bits)
+    {
+      uint id = __builtin_ctz(bits);
+      bits &= bits - 1;
+      fired |= 1u << id;
+      fired_at[id] = t;
+    }
+  }
+  for (uint i = 0; i < std::size(after); i++)
+  {
+    SIM_CHECK(fired & (1u << i));
+    /** No earlier than the deadline, no later than the next advance. */
+    SIM_CHECK(fired_at[i] >= after[i] && fired_at[i] < after[i] + 250);
+  }
+  SIM_CHECK(w.armed == 0);
+}
+
+/** --------------------------------------------------------------------+ */
+/** Whole firmware, default keymap with SIM_CTL_ESC on Caps Lock */
+/** --------------------------------------------------------------------+ */
+#define LOOP_PERIOD_US 1000
+
+SIM_SCENARIO(ctl_esc_tap_and_hold)
+{
+  sim_reset();
+  keyboard_init();
+  sim_map_ctl_esc();
+  sim_load_timeline({sim_event(10000, HID_KEY_CAPS_LOCK, true),
+                     sim_event(60000, HID_KEY_CAPS_LOCK, false),
+                     sim_event(200000, HID_KEY_CAPS_LOCK, true),
+                     sim_event(260000, HID_KEY_C, true),
+                     sim_event(300000, HID_KEY_C, false),
+                     sim_event(340000, HID_KEY_CAPS_LOCK, false)});
+  sim_run(400000, LOOP_PERIOD_US, key_scan);
+
+  const sim_report *esc = sim_find_report(HID_KEY_ESCAPE, true, 0);
+  SIM_CHECK(esc != NULL);
+  SIM_CHECK(esc->queued_us >= 60000 && esc->modifier == 0);
+  SIM_CHECK(sim_find_report(HID_KEY_ESCAPE, false, esc->queued_us) != NULL);
+
+  /** Ctrl+C, and no Escape from the hold. */
+  const sim_report *c = sim_find_report(HID_KEY_C, true, 200000);
+  SIM_CHECK(c != NULL);
+  SIM_CHECK(c->modifier == KEYBOARD_MODIFIER_LEFTCTRL);
+  SIM_CHECK(sim_find_report(HID_KEY_ESCAPE, true, 200000) == NULL);
+  SIM_CHECK(sim_reports().back().empty());
+}
+
+/** Press to report queued of every letter and space in the typing trace,
+ * leaving out any combo keys: they wait on the combos, see sim_combo. */
+static std::vector<uint64_t> plain_latencies(bool chords)
+{
+  std::vector<sim_key_event> typed;
+  std::vector<sim_key_event> events = sim_typing_trace(chords, typed);
+  std::vector<sim_key_event> plain;
+  for (const sim_key_event &e : typed)
+  {
+    uint pos = MATRIX_POS(e.col, e.row);
+    if (!((default_combos.keys.words[pos >> 5] >> (pos & 31)) & 1))
+      plain.push_back(e);
+  }
+  return sim_press_latencies(events, plain, LOOP_PERIOD_US,
+                             chords ? sim_map_ctl_esc : nullptr);
+}
+
+SIM_SCENARIO(taphold_typing_trace_latency)
+{
+  std::vector<uint64_t> typing = plain_latencies(false);
+  std::vector<uint64_t> chords = plain_latencies(true);
+  sim_print_latencies("typing", typing);
+  sim_print_latencies("with chords", chords);
+
+  /** Plain keys never wait on the tap-hold engine: one loop period to be
+   * scanned and one host poll for the endpoint to be free, at worst. */
+  uint64_t bound = LOOP_PERIOD_US + HID_POLL_INTERVAL_MS * 1000 +
+                   MATRIX_COLS * GPIO_PIN_SETTLE_DELAY_US;
+  SIM_CHECK(typing.size() == chords.size());
+  for (size_t i = 0; i < typing.size(); i++)
+  {
+    SIM_CHECK(typing[i] <= bound);
+    SIM_CHECK(chords[i] <= bound);
+  }
+}
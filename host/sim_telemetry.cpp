@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "debounce.h"
+#include "keymap_store.h"
+#include "telemetry.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+#define LOOP_PERIOD_US 1000
+#define TAPS 20
+#define TAP_HOLD_US 60000
+
+/** Read the counters back page by page, the way telemetry_reader does over
+ * GET_REPORT. */
+static bool read_back(telemetry_stats_t &stats)
+{
+  uint8_t raw[TELEMETRY_PAGES * TELEMETRY_PAGE_BYTES];
+  uint8_t report[TELEMETRY_REPORT_LEN];
+  telemetry_select_page(0);
+  for (uint page = 0; page < TELEMETRY_PAGES; page++)
+  {
+    if (telemetry_read_page(report, sizeof(report)) != TELEMETRY_REPORT_LEN ||
+        report[0] != page)
+      return false;
+    memcpy(raw + page * TELEMETRY_PAGE_BYTES, report + 1, TELEMETRY_PAGE_BYTES);
+  }
+  memcpy(&stats, raw, sizeof(stats));
+  return stats.version == TELEMETRY_VERSION && stats.size == sizeof(stats);
+}
+
+static const key_telemetry_t &counters(const telemetry_stats_t &stats, action_t key)
+{
+  sim_key_event e = sim_event(0, key, true);
+  return stats.keys[e.col * MATRIX_ROWS + e.row];
+}
+
+/** The switch at key closing at each of toggles and opening at the next,
+ * and so on, from t. */
+static void chatter(std::vector<sim_key_event> &events, uint64_t t, action_t key,
+                    std::initializer_list<uint32_t> toggles)
+{
+  bool pressed = true;
+  for (uint32_t at : toggles)
+  {
+    events.push_back(sim_event(t + at, key, pressed));
+    pressed = !pressed;
+  }
+}
+
+static void print_key(const char *name, const key_telemetry_t &k)
+{
+  printf("    %-8s %4u presses %4u bounces, shortest %u ms, %u under %u ms%s\n", name,
+         k.presses, k.bounces, k.shortest_ms, k.short_presses, TELEMETRY_SHORT_MS,
+         telemetry_suspect(k) ? ", failing" : "");
+}
+
+SIM_SCENARIO(telemetry_counts_injected_chatter)
+{
+  sim_reset();
+  keyboard_init();
+
+  /** Scans fall on whole ms, every change below is seen by one. A taps
+   * cleanly. S bounces four times on the way down and four times on the
+   * way up, all of it inside the debounce lock. D reopens and closes
+   * again 7 ms after its release, past the lock, so the debouncer lets a
+   * second press through: a double typed letter. */
+  std::vector<sim_key_event> events;
+  for (uint i = 0; i < TAPS; i++)
+  {
+    uint64_t t = 10000 + i * 300000;
+    chatter(events, t, HID_KEY_A, {300, TAP_HOLD_US + 300});
+    chatter(events, t + 100000, HID_KEY_S,
+            {300, 1500, 2500, 3500, 4500, TAP_HOLD_US + 300, TAP_HOLD_US + 1500,
+             TAP_HOLD_US + 2500, TAP_HOLD_US + 3500, TAP_HOLD_US + 4500});
+    chatter(events, t + 200000, HID_KEY_D,
+            {300, TAP_HOLD_US + 300, TAP_HOLD_US + 7300, TAP_HOLD_US + 8500});
+  }
+  sim_load_timeline(events);
+  sim_run(10000 + TAPS * 300000, LOOP_PERIOD_US, key_scan);
+
+  telemetry_stats_t stats;
+  SIM_CHECK(read_back(stats));
+  const key_telemetry_t &a = counters(stats, HID_KEY_A);
+  const key_telemetry_t &s = counters(stats, HID_KEY_S);
+  const key_telemetry_t &d = counters(stats, HID_KEY_D);
+  print_key("clean", a);
+  print_key("bouncy", s);
+  print_key("chatter", d);
+
+  SIM_CHECK(a.presses == TAPS && a.bounces == 0 && a.short_presses == 0);
+  SIM_CHECK(a.shortest_ms >= TAP_HOLD_US / 1000 - 1 && a.shortest_ms <= TAP_HOLD_US / 1000 + 1);
+  SIM_CHECK(!telemetry_suspect(a));
+
+  SIM_CHECK(s.presses == TAPS && s.bounces == 8 * TAPS && s.short_presses == 0);
+  SIM_CHECK(telemetry_suspect(s));
+
+  /** The second press lasts as long as the debounce lock holds it. */
+  SIM_CHECK(d.presses == 2 * TAPS && d.bounces == 0 && d.short_presses == TAPS);
+  SIM_CHECK(d.shortest_ms == DEBOUNCE_MS);
+  SIM_CHECK(telemetry_suspect(d));
+
+  /** No other key saw anything. */
+  uint used = 0;
+  for (const key_telemetry_t &k : stats.keys)
+    used += k.presses || k.bounces || k.shortest_ms != TELEMETRY_NO_PRESS;
+  SIM_CHECK(used == 3);
+}
+
+/** Tap key count times, then let the matrix go idle. */
+static void tap(action_t key, uint count)
+{
+  std::vector<sim_key_event> events;
+  uint64_t t = sim_now_us() + 1000;
+  for (uint i = 0; i < count; i++)
+    chatter(events, t + i * 100000, key, {300, 30300});
+  sim_load_timeline(events);
+  sim_run(t + count * 100000 + KEYBOARD_IDLE_AFTER_US, LOOP_PERIOD_US, key_scan);
+}
+
+SIM_SCENARIO(telemetry_snapshots_survive_reboots)
+{
+  sim_reset();
+  keymap_store_t store;
+  keymap_store_init(store, default_keymap);
+  SIM_CHECK(keymap_store_edit(store, LAYER_BASE, MATRIX_POS(0, 0), HID_KEY_X));
+  SIM_CHECK(keymap_store_commit(store));
+  keyboard_init();
+
+  /** Nothing goes to flash before TELEMETRY_SAVE_US, nor after it without
+   * anything new to save. */
+  tap(HID_KEY_A, 3);
+  SIM_CHECK(keyboard_idle());
+  uint64_t pages = sim_get_stats().flash_pages;
+  SIM_CHECK(!telemetry_task(sim_now_us()));
+  sim_advance_us(TELEMETRY_SAVE_US);
+  SIM_CHECK(telemetry_task(sim_now_us()));
+  SIM_CHECK(sim_get_stats().flash_pages - pages == TELEMETRY_SLOT_SIZE / HAL_FLASH_PAGE_SIZE);
+  sim_advance_us(TELEMETRY_SAVE_US);
+  SIM_CHECK(!telemetry_task(sim_now_us()));
+
+  /** Round the slots a few times, a reboot after every save. */
+  const uint saves = 3 * TELEMETRY_SLOTS;
+  uint64_t erases = sim_get_stats().flash_erases;
+  for (uint i = 0; i < saves; i++)
+  {
+    keyboard_init();
+    SIM_CHECK(counters(telemetry_stats(), HID_KEY_A).presses == 3 + i);
+    tap(HID_KEY_A, 1);
+    sim_advance_us(TELEMETRY_SAVE_US);
+    SIM_CHECK(telemetry_task(sim_now_us()));
+  }
+  keyboard_init();
+  const telemetry_stats_t &stats = telemetry_stats();
+  printf("    %u saves, %llu erases, %zu byte image in a %zu byte slot\n", saves,
+         (unsigned long long)(sim_get_stats().flash_erases - erases),
+         sizeof(telemetry_image_t), (size_t)TELEMETRY_SLOT_SIZE);
+  SIM_CHECK(stats.sequence == saves + 1);
+  SIM_CHECK(counters(stats, HID_KEY_A).presses == 3 + saves);
+  SIM_CHECK(sim_get_stats().flash_erases - erases ==
+            saves / (HAL_FLASH_SECTOR_SIZE / TELEMETRY_SLOT_SIZE));
+
+  /** A save the power cuts short leaves the one before it. */
+  tap(HID_KEY_A, 1);
+  sim_advance_us(TELEMETRY_SAVE_US);
+  sim_flash_cut_after(HAL_FLASH_PAGE_SIZE * 2);
+  SIM_CHECK(!telemetry_task(sim_now_us()));
+  sim_flash_power_on();
+  keyboard_init();
+  SIM_CHECK(telemetry_stats().sequence == saves + 1);
+  SIM_CHECK(counters(telemetry_stats(), HID_KEY_A).presses == 3 + saves);
+
+  /** And the keymap store never noticed. */
+  keymap_store_init(store, default_keymap);
+  SIM_CHECK(store.image != NULL && store.image->sequence == 1);
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "trace.h"
+#include "trace_file.h"
+#include "sim_typing.h"
+#include "sim_matrix.h"
+#include "scenario.h"
+
+#define LOOP_PERIOD_US 1000
+
+static std::vector<std::string> report_lines(void)
+{
+  std::vector<std::string> lines;
+  for (const sim_report &r : sim_reports())
+    lines.push_back(trace_report_line(r));
+  return lines;
+}
+
+/** Record events, replay the trace, and check the replay sent the same
+ * reports at the same times and recorded the same trace. */
+static bool replays_exactly(const std::vector<sim_key_event> &events, uint32_t period_us,
+                            uint32_t poll_us, trace_t &trace)
+{
+  if (trace_record(events, period_us, poll_us, trace))
+    return false;
+  std::vector<std::string> recorded = report_lines();
+
+  if (!trace_replay(trace))
+    return false;
+  std::vector<uint8_t> again;
+  trace_drain(again);
+  return report_lines() == recorded && !recorded.empty() && again == trace.stream;
+}
+
+SIM_SCENARIO(trace_replays_typing_exactly)
+{
+  std::vector<sim_key_event> typed;
+  std::vector<sim_key_event> events = sim_typing_trace(true, typed);
+  trace_t trace;
+  SIM_CHECK(replays_exactly(events, LOOP_PERIOD_US, HID_POLL_INTERVAL_MS * 1000, trace));
+
+  /** A delta is the tag, a time of up to 3 bytes for typing gaps and the
+   * keys, and only changes are recorded: far less than a 10 byte snapshot a
+   * scan. */
+  std::vector<trace_snapshot> snapshots;
+  SIM_CHECK(trace_decode(trace.stream, snapshots));
+  uint64_t scans = snapshots.back().scan_us / LOOP_PERIOD_US + 1;
+  printf("    %zu records over %llu scans in %zu bytes, %.1f bytes a record, %.0fx smaller than "
+         "a snapshot a scan\n",
+         snapshots.size(), (unsigned long long)scans, trace.stream.size(),
+         (double)trace.stream.size() / snapshots.size(),
+         (double)scans * TRACE_FRAME_BYTES / trace.stream.size());
+  SIM_CHECK(trace.stream.size() < 6 * snapshots.size());
+  SIM_CHECK(trace.stream.size() * 50 < scans * TRACE_FRAME_BYTES);
+}
+
+SIM_SCENARIO(trace_replays_slow_loops_and_ghosts)
+{
+  /** A 4 ms loop against an 8 ms poll, and a rectangle whose fourth corner
+   * the scan reads as pressed: the ghost is in the trace and the filter
+   * makes the same call on it in the replay. */
+  std::vector<sim_key_event> typed;
+  trace_t trace;
+  SIM_CHECK(replays_exactly(sim_typing_trace(false, typed), 4000, 8000, trace));
+
+  sim_key_event a = sim_event(0, HID_KEY_Q, true);
+  sim_key_event b = sim_event(0, HID_KEY_W, true);
+  sim_key_event c = sim_event(0, HID_KEY_A, true);
+  std::vector<sim_key_event> rectangle = {
+      {10000, a.col, a.row, true},   {12000, b.col, b.row, true},
+      {30000, c.col, c.row, true},   {60000, c.col, c.row, false},
+      {70000, a.col, a.row, false},  {71000, b.col, b.row, false},
+  };
+  SIM_CHECK(replays_exactly(rectangle, LOOP_PERIOD_US, HID_POLL_INTERVAL_MS * 1000, trace));
+  SIM_CHECK(sim_find_report(HID_KEY_S, true, 0) == NULL);
+
+  sim_key_event ghost = sim_event(0, HID_KEY_S, true);
+  std::vector<trace_snapshot> snapshots;
+  SIM_CHECK(trace_decode(trace.stream, snapshots));
+  bool traced = false;
+  for (const trace_snapshot &s : snapshots)
+    traced |= matrix_key(s.raw, ghost.col, ghost.row);
+  SIM_CHECK(traced);
+}
+
+SIM_SCENARIO(trace_recovers_from_a_full_ring)
+{
+  /** Nobody reads the ring while hundreds of taps go by: records are
+   * dropped, the scan goes on, and once the host reads again the trace
+   * starts over with a key frame. */
+  sim_reset();
+  keyboard_init();
+  std::vector<sim_key_event> events;
+  for (uint i = 0; i < 2000; i++)
+  {
+    events.push_back(sim_event(10000 + i * 20000, HID_KEY_J, true));
+    events.push_back(sim_event(20000 + i * 20000, HID_KEY_J, false));
+  }
+  sim_load_timeline(events);
+  sim_run(10000 + 2000 * 20000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(trace_dropped() > 0 && trace_dropped() < events.size());
+  SIM_CHECK(sim_find_report(HID_KEY_J, true, 10000 + 1999 * 20000) != NULL);
+
+  std::vector<uint8_t> stream;
+  SIM_CHECK(trace_drain(stream));
+  SIM_CHECK(stream.size() > TRACE_BUFFER - TRACE_RECORD_MAX && stream.size() <= TRACE_BUFFER);
+  size_t before_gap = stream.size();
+
+  sim_load_timeline({sim_event(sim_now_us() + 5000, HID_KEY_K, true),
+                     sim_event(sim_now_us() + 30000, HID_KEY_K, false)});
+  sim_run(sim_now_us() + 50000, LOOP_PERIOD_US, key_scan);
+  SIM_CHECK(!trace_drain(stream));
+  SIM_CHECK(stream.size() > before_gap && stream[before_gap] == TRACE_KEY_FRAME);
+
+  std::vector<trace_snapshot> snapshots;
+  SIM_CHECK(trace_decode(stream, snapshots));
+  SIM_CHECK(matrix_empty(snapshots.back().raw));
+  printf("    %u changes dropped, %zu bytes kept, picked up again with a key frame\n",
+         trace_dropped(), stream.size());
+}
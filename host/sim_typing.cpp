@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "keymap_store.h"
+#include "sim_typing.h"
+
+std::vector<sim_key_event> sim_typing_trace(bool chords, std::vector<sim_key_event> &typed)
+{
+  static const char text[] =
+      "the quick brown fox jumps over the lazy dog while five boxing wizards "
+      "jump quickly and a mad boxer shot a quick gloved jab to the jaw of his "
+      "dizzy opponent";
+  std::vector<sim_key_event> events;
+  uint32_t seed = 12345;
+  auto next = [&](uint32_t lo, uint32_t hi) {
+    seed = seed * 1103515245 + 12345;
+    return lo + (seed >> 16) % (hi - lo);
+  };
+
+  uint64_t t = 20000;
+  int word = 0;
+  action_t last_key = 0;
+  uint64_t last_release_us = 0;
+  for (const char *p = text; *p; p++)
+  {
+    if (chords && (p == text || p[-1] == ' '))
+    {
+      word++;
+      if (word % 7 == 0)
+      {
+        events.push_back(sim_event(t, HID_KEY_CAPS_LOCK, true));
+        events.push_back(sim_event(t + 60000, HID_KEY_C, true));
+        events.push_back(sim_event(t + 110000, HID_KEY_C, false));
+        events.push_back(sim_event(t + 150000, HID_KEY_CAPS_LOCK, false));
+        t += 250000;
+      }
+      else if (word % 5 == 0)
+      {
+        events.push_back(sim_event(t, HID_KEY_CAPS_LOCK, true));
+        events.push_back(sim_event(t + next(30000, 90000), HID_KEY_CAPS_LOCK, false));
+        t += 150000;
+      }
+    }
+
+    action_t key = *p == ' ' ? HID_KEY_SPACE : HID_KEY_A + (*p - 'a');
+    /** A double letter has to be let go before it can go down again. */
+    if (key == last_key && t < last_release_us + 20000)
+      t = last_release_us + 20000;
+    typed.push_back(sim_event(t, key, true));
+    events.push_back(typed.back());
+    last_key = key;
+    last_release_us = t + next(30000, 110000);
+    events.push_back(sim_event(last_release_us, key, false));
+    t += next(50000, 150000);
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const sim_key_event &a, const sim_key_event &b) {
+                     return a.time_us < b.time_us;
+                   });
+  return events;
+}
+
+/** Edit the bindings onto layer, as many to a report as fit, and commit. */
+static void map_keys(uint layer, const std::vector<sim_binding> &bindings)
+{
+  for (size_t i = 0; i < bindings.size(); i += KEYMAP_REPORT_EDITS)
+  {
+    size_t count = std::min(bindings.size() - i, (size_t)KEYMAP_REPORT_EDITS);
+    uint8_t report[KEYMAP_REPORT_LEN] = {KEYMAP_OP_EDIT, (uint8_t)count};
+    for (size_t j = 0; j < count; j++)
+    {
+      sim_key_event key = sim_event(0, bindings[i + j].key, true);
+      action_t action = bindings[i + j].action;
+      uint8_t *e = report + 2 + j * 4;
+      e[0] = (uint8_t)layer;
+      e[1] = (uint8_t)MATRIX_POS(key.col, key.row);
+      e[2] = (uint8_t)action;
+      e[3] = (uint8_t)(action >> 8);
+    }
+    keyboard_keymap_set_report(report, sizeof(report));
+  }
+  uint8_t commit[KEYMAP_REPORT_LEN] = {KEYMAP_OP_COMMIT};
+  keyboard_keymap_set_report(commit, sizeof(commit));
+}
+
+void sim_map_ctl_esc(void)
+{
+  map_keys(LAYER_BASE, {{HID_KEY_CAPS_LOCK, SIM_CTL_ESC}});
+}
+
+void sim_map_fn(const std::vector<sim_binding> &bindings)
+{
+  map_keys(LAYER_FN, bindings);
+}
+
+std::vector<uint64_t> sim_press_latencies(const std::vector<sim_key_event> &events,
+                                          const std::vector<sim_key_event> &presses,
+                                          uint32_t period_us, void (*setup)(void))
+{
+  sim_reset();
+  keyboard_init();
+  if (setup)
+    setup();
+  sim_load_timeline(events);
+  sim_run(events.back().time_us + 300000, period_us, key_scan);
+
+  std::vector<uint64_t> latencies;
+  for (const sim_key_event &e : presses)
+  {
+    const sim_report *r = sim_find_report((uint8_t)key_layout[e.col][e.row], true, e.time_us);
+    latencies.push_back(r ? r->queued_us - e.time_us : UINT64_MAX);
+  }
+  return latencies;
+}
+
+void sim_print_latencies(const char *name, const std::vector<uint64_t> &latencies)
+{
+  uint64_t max = 0, total = 0;
+  for (uint64_t v : latencies)
+  {
+    max = v > max ? v : max;
+    total += v;
+  }
+  printf("    %-14s %3zu presses, press to report queued: mean %llu us, max %llu us\n",
+         name, latencies.size(),
+         (unsigned long long)(latencies.empty() ? 0 : total / latencies.size()),
+         (unsigned long long)max);
+}
@@ -0,0 +1,49 @@
+#ifndef SIM_TYPING_H_
+#define SIM_TYPING_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "sim_matrix.h"
+
+/** --------------------------------------------------------------------+ */
+/** Typing traces */
+/** --------------------------------------------------------------------+ */
+/** A deterministic typing trace: a pangram paragraph typed with uneven gaps
+ * and holds, long enough for neighbouring keys to overlap. With chords,
+ * every 7th word is preceded by a C chord on the Caps Lock key and every
+ * 5th by a tap of it, which are Ctrl+C and Escape with sim_map_ctl_esc().
+ * The letter and space presses are also appended to typed. Sorted, ready
+ * for sim_load_timeline(). */
+std::vector<sim_key_event> sim_typing_trace(bool chords, std::vector<sim_key_event> &typed);
+
+/** The tap-hold example: Escape tapped, Ctrl held. */
+#define SIM_CTL_ESC MT(MOD_LCTL, HID_KEY_ESCAPE)
+
+/** Put SIM_CTL_ESC on the Caps Lock key of the running firmware, the way
+ * the host would over the keymap report. After keyboard_init(). */
+void sim_map_ctl_esc(void);
+
+/** A key of the default layout, by its base usage, and an action for it. */
+struct sim_binding
+{
+  action_t key;
+  action_t action;
+};
+
+/** Put each action on the Fn layer of its key, the same way, for the
+ * example bindings the default keymap leaves out. After keyboard_init(). */
+void sim_map_fn(const std::vector<sim_binding> &bindings);
+
+/** Run events through the whole firmware with the default keymap, with
+ * whatever setup (such as sim_map_ctl_esc) maps after keyboard_init(),
+ * calling key_scan() every period_us, and return press to report queued of
+ * each of presses. UINT64_MAX for one that was never reported. */
+std::vector<uint64_t> sim_press_latencies(const std::vector<sim_key_event> &events,
+                                          const std::vector<sim_key_event> &presses,
+                                          uint32_t period_us, void (*setup)(void) = nullptr);
+
+/** One line with the count, mean and max of latencies. */
+void sim_print_latencies(const char *name, const std::vector<uint64_t> &latencies);
+
+#endif /* SIM_TYPING_H_ */
@@ -0,0 +1,109 @@
+/** Reads the per-key counters off a keyboard built with
+ * KEYBOARD_TELEMETRY=1 and prints every key that has been used, failing
+ * switches marked.
+ *
+ *   telemetry_reader /dev/hidrawN
+ *
+ * The counters are on the NKRO interface (usually the second hidraw node
+ * the keyboard gets) as feature report REPORT_ID_TELEMETRY. Exits with 3
+ * when a switch looks like it is failing, so a fleet can be swept with a
+ * script. */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include "telemetry.h"
+
+/** Select page 0, then read pages until the struct is complete. */
+static bool read_stats(int fd, telemetry_stats_t &stats)
+{
+  uint8_t buf[1 + TELEMETRY_REPORT_LEN];
+  buf[0] = REPORT_ID_TELEMETRY;
+  buf[1] = 0;
+  if (ioctl(fd, HIDIOCSFEATURE(2), buf) < 0)
+  {
+    perror("HIDIOCSFEATURE");
+    return false;
+  }
+
+  uint8_t raw[TELEMETRY_PAGES * TELEMETRY_PAGE_BYTES];
+  for (uint page = 0; page < TELEMETRY_PAGES; page++)
+  {
+    memset(buf, 0, sizeof(buf));
+    buf[0] = REPORT_ID_TELEMETRY;
+    if (ioctl(fd, HIDIOCGFEATURE(sizeof(buf)), buf) < 0)
+    {
+      perror("HIDIOCGFEATURE");
+      return false;
+    }
+    if (buf[1] != page)
+    {
+      fprintf(stderr, "expected page %u, got %u\n", page, buf[1]);
+      return false;
+    }
+    memcpy(raw + page * TELEMETRY_PAGE_BYTES, buf + 2, TELEMETRY_PAGE_BYTES);
+  }
+
+  memcpy(&stats, raw, sizeof(stats));
+  if (stats.version != TELEMETRY_VERSION || stats.size != sizeof(stats) ||
+      stats.cols != MATRIX_COLS || stats.rows != MATRIX_ROWS)
+  {
+    fprintf(stderr, "telemetry version %u size %u do not match this reader (%u, %zu)\n",
+            stats.version, stats.size, TELEMETRY_VERSION, sizeof(stats));
+    return false;
+  }
+  return true;
+}
+
+/** The table, and how many keys look like they are failing. */
+static uint print_stats(const telemetry_stats_t &stats)
+{
+  printf("%u snapshots saved since boot, newest in flash #%u\n", stats.saves, stats.sequence);
+  printf("key      presses  bounces  shortest  under %u ms\n", stats.short_ms);
+  uint suspects = 0;
+  for (uint col = 0; col < MATRIX_COLS; col++)
+  {
+    for (uint row = 0; row < MATRIX_ROWS; row++)
+    {
+      const key_telemetry_t &k = stats.keys[col * MATRIX_ROWS + row];
+      if (k.presses == 0 && k.bounces == 0)
+        continue;
+      bool suspect = telemetry_suspect(k);
+      suspects += suspect;
+      char shortest[16] = "-";
+      if (k.shortest_ms != TELEMETRY_NO_PRESS)
+        snprintf(shortest, sizeof(shortest), "%u ms", k.shortest_ms);
+      printf("c%-2u r%u %10u %8u %9s %12u%s\n", col, row, k.presses, k.bounces, shortest,
+             k.short_presses, suspect ? "  failing?" : "");
+    }
+  }
+  return suspects;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s /dev/hidrawN\n", argv[0]);
+    return 2;
+  }
+
+  int fd = open(argv[1], O_RDWR);
+  if (fd < 0)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+
+  telemetry_stats_t stats;
+  bool ok = read_stats(fd, stats);
+  close(fd);
+  if (!ok)
+    return 1;
+
+  return print_stats(stats) ? 3 : 0;
+}
@@ -0,0 +1,236 @@
+#include <string.h>
+
+#include "tusb.h"
+#include "keyboard.h"
+#include "trace_file.h"
+
+trace_file_header_t trace_header(uint32_t scan_period_us, uint32_t poll_interval_us)
+{
+  trace_file_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = TRACE_FILE_MAGIC;
+  header.version = TRACE_FILE_VERSION;
+  header.keys = TRACE_KEYS;
+  header.scan_period_us = scan_period_us;
+  header.poll_interval_us = poll_interval_us;
+  return header;
+}
+
+bool trace_file_read(const char *path, trace_t &trace)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    perror(path);
+    return false;
+  }
+  bool ok = fread(&trace.header, sizeof(trace.header), 1, f) == 1 &&
+            trace.header.magic == TRACE_FILE_MAGIC &&
+            trace.header.version == TRACE_FILE_VERSION && trace.header.keys == TRACE_KEYS &&
+            trace.header.scan_period_us > 0 && trace.header.poll_interval_us > 0;
+  trace.stream.clear();
+  uint8_t chunk[4096];
+  size_t n;
+  while (ok && (n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    trace.stream.insert(trace.stream.end(), chunk, chunk + n);
+  fclose(f);
+  if (!ok)
+    fprintf(stderr, "%s: not a version %u trace of %u keys\n", path, TRACE_FILE_VERSION,
+            TRACE_KEYS);
+  return ok;
+}
+
+bool trace_file_write(const char *path, const trace_t &trace)
+{
+  FILE *f = fopen(path, "wb");
+  if (!f)
+  {
+    perror(path);
+    return false;
+  }
+  bool ok = fwrite(&trace.header, sizeof(trace.header), 1, f) == 1 &&
+            fwrite(trace.stream.data(), 1, trace.stream.size(), f) == trace.stream.size();
+  ok &= fclose(f) == 0;
+  if (!ok)
+    perror(path);
+  return ok;
+}
+
+static bool get_varint(const std::vector<uint8_t> &stream, size_t &at, uint64_t &v)
+{
+  v = 0;
+  for (uint shift = 0; shift < 64; shift += 7)
+  {
+    if (at == stream.size())
+      return false;
+    uint8_t b = stream[at++];
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+static void flip(matrix_t &m, uint key)
+{
+  uint col = key / MATRIX_ROWS, row = key % MATRIX_ROWS;
+  matrix_set_col(m, col, matrix_col(m, col) ^ (1 << row));
+}
+
+bool trace_decode(const std::vector<uint8_t> &stream, std::vector<trace_snapshot> &snapshots)
+{
+  trace_snapshot s = {};
+  bool synced = false;
+  size_t at = 0;
+  while (at < stream.size())
+  {
+    uint8_t tag = stream[at++];
+    uint64_t time;
+    if (!get_varint(stream, at, time))
+      return false;
+
+    if (tag == TRACE_KEY_FRAME)
+    {
+      if (stream.size() - at < TRACE_FRAME_BYTES)
+        return false;
+      s.scan_us = time;
+      s.raw = {};
+      for (uint key = 0; key < TRACE_KEYS; key++)
+      {
+        if ((stream[at + key / 8] >> (key % 8)) & 1)
+          flip(s.raw, key);
+      }
+      at += TRACE_FRAME_BYTES;
+      synced = true;
+    }
+    else
+    {
+      if (!synced || tag == 0 || tag > TRACE_KEYS || stream.size() - at < tag)
+        return false;
+      s.scan_us += time;
+      for (uint i = 0; i < tag; i++)
+      {
+        if (stream[at] >= TRACE_KEYS)
+          return false;
+        flip(s.raw, stream[at++]);
+      }
+    }
+    snapshots.push_back(s);
+  }
+  return true;
+}
+
+bool trace_drain(std::vector<uint8_t> &stream)
+{
+  uint8_t report[TRACE_REPORT_LEN];
+  bool dropped = false;
+  while (trace_read_report(report, sizeof(report)) == TRACE_REPORT_LEN)
+  {
+    dropped |= report[1] & TRACE_REPORT_DROPPED;
+    if (report[0] == 0)
+      break;
+    stream.insert(stream.end(), report + 2, report + 2 + report[0]);
+  }
+  return dropped;
+}
+
+static std::vector<uint8_t> *recording;
+static bool recording_dropped;
+
+static void scan_and_drain(void)
+{
+  key_scan();
+  recording_dropped |= trace_drain(*recording);
+}
+
+bool trace_record(const std::vector<sim_key_event> &events, uint32_t scan_period_us,
+                  uint32_t poll_interval_us, trace_t &trace)
+{
+  trace.header = trace_header(scan_period_us, poll_interval_us);
+  trace.stream.clear();
+  recording = &trace.stream;
+  recording_dropped = false;
+
+  sim_reset();
+  sim_set_host_poll_interval_us(poll_interval_us);
+  keyboard_init();
+  sim_load_timeline(events);
+  uint64_t end = events.empty() ? 0 : events.back().time_us;
+  sim_run(end + TRACE_REPLAY_TAIL_US, scan_period_us, scan_and_drain);
+  recording = NULL;
+  return recording_dropped;
+}
+
+std::vector<sim_key_event> trace_timeline(const std::vector<trace_snapshot> &snapshots)
+{
+  std::vector<sim_key_event> events;
+  matrix_t keys = {};
+  for (const trace_snapshot &s : snapshots)
+  {
+    for (uint col = 0; col < MATRIX_COLS; col++)
+    {
+      uint8_t flipped = matrix_col(s.raw, col) ^ matrix_col(keys, col);
+      for (uint row = 0; row < MATRIX_ROWS; row++)
+      {
+        if ((flipped >> row) & 1)
+          events.push_back({s.scan_us, (uint8_t)col, (uint8_t)row, matrix_key(s.raw, col, row)});
+      }
+    }
+    keys = s.raw;
+  }
+  return events;
+}
+
+bool trace_replay(const trace_t &trace)
+{
+  std::vector<trace_snapshot> snapshots;
+  if (!trace_decode(trace.stream, snapshots))
+    return false;
+
+  /** The keys are set to exactly what was read, ghosts included, so the
+   * simulated matrix must not add ghosts of its own. */
+  std::vector<sim_key_event> events = trace_timeline(snapshots);
+
+  sim_reset();
+  sim_set_ghosting(false);
+  sim_set_host_poll_interval_us(trace.header.poll_interval_us);
+  /** Boot at the first scan, so the replay scans on the same grid. */
+  if (!snapshots.empty())
+    sim_advance_us(snapshots.front().scan_us);
+  keyboard_init();
+  sim_load_timeline(events);
+  uint64_t end = snapshots.empty() ? 0 : snapshots.back().scan_us;
+  sim_run(end + TRACE_REPLAY_TAIL_US, trace.header.scan_period_us, key_scan);
+  return true;
+}
+
+std::string trace_report_line(const sim_report &r)
+{
+  char field[64];
+  if (r.report_id == REPORT_ID_CONSUMER_CONTROL)
+  {
+    snprintf(field, sizeof(field), "%llu %llu consumer %04x\n", (unsigned long long)r.queued_us,
+             (unsigned long long)r.complete_us, r.consumer);
+    return field;
+  }
+  if (r.report_id == REPORT_ID_MOUSE)
+  {
+    snprintf(field, sizeof(field), "%llu %llu mouse %02x %d %d %d %d\n",
+             (unsigned long long)r.queued_us, (unsigned long long)r.complete_us, r.buttons, r.x,
+             r.y, r.wheel, r.pan);
+    return field;
+  }
+  snprintf(field, sizeof(field), "%llu %llu %s %02x", (unsigned long long)r.queued_us,
+           (unsigned long long)r.complete_us, r.instance == ITF_NUM_KEYBOARD ? "kbd" : "nkro",
+           r.modifier);
+  std::string line = field;
+  for (uint usage = 1; usage < NKRO_KEY_COUNT; usage++)
+  {
+    if (r.has_key(usage))
+    {
+      snprintf(field, sizeof(field), " %02x", usage);
+      line += field;
+    }
+  }
+  return line + "\n";
+}
@@ -0,0 +1,73 @@
+#ifndef TRACE_FILE_H_
+#define TRACE_FILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+#include "sim_matrix.h"
+
+/** --------------------------------------------------------------------+ */
+/** Trace files and replay */
+/** --------------------------------------------------------------------+ */
+/** Reads and writes the trace files trace_reader saves (trace.h has the
+ * format), and runs them back through the firmware on the simulated
+ * matrix. The replay boots at the first snapshot, calls key_scan() every
+ * scan_period_us from there and sets the simulated keys to each snapshot
+ * when its scan starts. A trace recorded on that grid, as the simulator and
+ * the device's 1 ms scan task record them, replays to the reports the
+ * keyboard sent; a snapshot off it is picked up by the next scan. The
+ * keymap is the compiled-in one. */
+
+/** How long the replay keeps scanning after the last snapshot, for the
+ * reports still to come from it. */
+#define TRACE_REPLAY_TAIL_US 500000
+
+/** The matrix as one scan read it. */
+struct trace_snapshot
+{
+  uint64_t scan_us;
+  matrix_t raw;
+};
+
+struct trace_t
+{
+  trace_file_header_t header;
+  std::vector<uint8_t> stream;
+};
+
+/** A header for a trace recorded at these periods. */
+trace_file_header_t trace_header(uint32_t scan_period_us, uint32_t poll_interval_us);
+
+bool trace_file_read(const char *path, trace_t &trace);
+bool trace_file_write(const char *path, const trace_t &trace);
+
+/** Decode stream into snapshots. False if it is cut short, starts with a
+ * delta or has a record no recorder writes; snapshots then holds what came
+ * before. */
+bool trace_decode(const std::vector<uint8_t> &stream, std::vector<trace_snapshot> &snapshots);
+
+/** Read the simulated keyboard's recorder dry the way trace_reader does,
+ * appending to stream. True if it says records were dropped. */
+bool trace_drain(std::vector<uint8_t> &stream);
+
+/** sim_reset(), boot and run events through the firmware, calling
+ * key_scan() every scan_period_us and draining the recorder after each
+ * call, into trace. True if records were dropped. */
+bool trace_record(const std::vector<sim_key_event> &events, uint32_t scan_period_us,
+                  uint32_t poll_interval_us, trace_t &trace);
+
+/** A timeline for the simulated matrix: each key goes down or up when the
+ * snapshot it changed in was read. */
+std::vector<sim_key_event> trace_timeline(const std::vector<trace_snapshot> &snapshots);
+
+/** sim_reset(), then boot and run the firmware on the trace. The reports
+ * are in sim_reports() after. False if the stream does not decode. */
+bool trace_replay(const trace_t &trace);
+
+/** A line for r: times, interface, modifiers and the keys down. */
+std::string trace_report_line(const sim_report &r);
+
+#endif /* TRACE_FILE_H_ */
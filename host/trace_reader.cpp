@@ -0,0 +1,103 @@
+/** Saves the matrix trace off a keyboard built with KEYBOARD_TRACE=1 until
+ * Ctrl-C, for trace_replay.
+ *
+ *   trace_reader /dev/hidrawN TRACE.ktr
+ *
+ * The trace is on the NKRO interface (usually the second hidraw node the
+ * keyboard gets) as feature report REPORT_ID_TRACE. Each read takes the
+ * next slice of the keyboard's ring, so reading flat out keeps it from
+ * filling; if it does fill anyway the keyboard says so, and the trace picks
+ * up again at its next key frame. */
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include "keyboard.h"
+#include "trace.h"
+
+/** How long to wait before asking again when the ring was empty. */
+#define IDLE_POLL_US 2000
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int)
+{
+  stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3)
+  {
+    fprintf(stderr, "usage: %s /dev/hidrawN TRACE.ktr\n", argv[0]);
+    return 2;
+  }
+
+  int fd = open(argv[1], O_RDWR);
+  if (fd < 0)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  FILE *out = fopen(argv[2], "wb");
+  if (!out)
+  {
+    perror(argv[2]);
+    close(fd);
+    return 1;
+  }
+
+  trace_file_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = TRACE_FILE_MAGIC;
+  header.version = TRACE_FILE_VERSION;
+  header.keys = TRACE_KEYS;
+  header.scan_period_us = KEYBOARD_SCAN_PERIOD_US;
+  header.poll_interval_us = HID_POLL_INTERVAL_MS * 1000;
+  fwrite(&header, sizeof(header), 1, out);
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  fprintf(stderr, "recording, Ctrl-C to stop\n");
+
+  int status = 0;
+  uint64_t bytes = 0;
+  uint drops = 0;
+  while (!stop)
+  {
+    uint8_t buf[1 + TRACE_REPORT_LEN];
+    memset(buf, 0, sizeof(buf));
+    buf[0] = REPORT_ID_TRACE;
+    if (ioctl(fd, HIDIOCGFEATURE(sizeof(buf)), buf) < 0)
+    {
+      if (!stop)
+      {
+        perror("HIDIOCGFEATURE");
+        status = 1;
+      }
+      break;
+    }
+    uint n = buf[1] <= TRACE_REPORT_BYTES ? buf[1] : TRACE_REPORT_BYTES;
+    if (buf[2] & TRACE_REPORT_DROPPED)
+      drops++;
+    fwrite(buf + 3, 1, n, out);
+    bytes += n;
+    if (n == 0)
+      usleep(IDLE_POLL_US);
+  }
+
+  if (fclose(out) != 0)
+  {
+    perror(argv[2]);
+    status = 1;
+  }
+  close(fd);
+  fprintf(stderr, "%llu bytes of trace, %u gaps where the keyboard dropped records\n",
+          (unsigned long long)bytes, drops);
+  return status;
+}
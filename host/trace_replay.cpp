@@ -0,0 +1,146 @@
+/** Runs matrix traces back through the firmware on the simulated matrix.
+ *
+ *   trace_replay TRACE.ktr           print the reports the trace makes
+ *   trace_replay --check DIR         replay every DIR/NAME.ktr and compare
+ *                                    with the reports in DIR/NAME.reports
+ *   trace_replay --record TRACE.ktr  record the simulator's typing trace,
+ *                                    with the reports it made next to it
+ *
+ * Traces come off a keyboard with trace_reader. DIR is the regression
+ * corpus: a trace there and the reports the keyboard sent for it, so a
+ * change that makes the firmware send anything else fails the check. */
+
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <string>
+
+#include "tusb.h"
+#include "trace_file.h"
+#include "sim_typing.h"
+
+#define RECORD_SCAN_PERIOD_US 1000
+
+static std::string reports_text(void)
+{
+  std::string text;
+  for (const sim_report &r : sim_reports())
+    text += trace_report_line(r);
+  return text;
+}
+
+static bool read_text(const std::filesystem::path &path, std::string &text)
+{
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+  {
+    perror(path.c_str());
+    return false;
+  }
+  char chunk[4096];
+  size_t n;
+  text.clear();
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    text.append(chunk, n);
+  fclose(f);
+  return true;
+}
+
+static bool write_text(const std::filesystem::path &path, const std::string &text)
+{
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f || fwrite(text.data(), 1, text.size(), f) != text.size() || fclose(f) != 0)
+  {
+    perror(path.c_str());
+    return false;
+  }
+  return true;
+}
+
+/** The first line where got and expected differ, 1 based. */
+static uint first_difference(const std::string &got, const std::string &expected)
+{
+  uint line = 1;
+  for (size_t i = 0; i < got.size() && i < expected.size() && got[i] == expected[i]; i++)
+    line += got[i] == '\n';
+  return line;
+}
+
+static int check(const char *dir)
+{
+  uint traces = 0, failed = 0;
+  for (const auto &entry : std::filesystem::directory_iterator(dir))
+  {
+    std::filesystem::path path = entry.path();
+    if (path.extension() != ".ktr")
+      continue;
+    traces++;
+
+    trace_t trace;
+    std::string expected;
+    if (!trace_file_read(path.c_str(), trace) ||
+        !read_text(std::filesystem::path(path).replace_extension(".reports"), expected))
+    {
+      failed++;
+      continue;
+    }
+    if (!trace_replay(trace))
+    {
+      printf("FAIL %s: the stream does not decode\n", path.c_str());
+      failed++;
+      continue;
+    }
+    std::string got = reports_text();
+    if (got != expected)
+    {
+      printf("FAIL %s: reports differ from line %u\n", path.c_str(),
+             first_difference(got, expected));
+      failed++;
+      continue;
+    }
+    printf("ok   %s: %zu reports from %zu bytes of trace\n", path.c_str(),
+           sim_reports().size(), trace.stream.size());
+  }
+  printf("%u of %u traces replayed as recorded\n", traces - failed, traces);
+  return failed || traces == 0 ? 1 : 0;
+}
+
+static int record(const char *path)
+{
+  std::vector<sim_key_event> typed;
+  trace_t trace;
+  if (trace_record(sim_typing_trace(true, typed), RECORD_SCAN_PERIOD_US,
+                   HID_POLL_INTERVAL_MS * 1000, trace))
+  {
+    fprintf(stderr, "the recorder dropped records\n");
+    return 1;
+  }
+  if (!trace_file_write(path, trace) ||
+      !write_text(std::filesystem::path(path).replace_extension(".reports"), reports_text()))
+    return 1;
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 3 && strcmp(argv[1], "--check") == 0)
+    return check(argv[2]);
+  if (argc == 3 && strcmp(argv[1], "--record") == 0)
+    return record(argv[2]);
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s TRACE.ktr | --check DIR | --record TRACE.ktr\n", argv[0]);
+    return 2;
+  }
+
+  trace_t trace;
+  if (!trace_file_read(argv[1], trace))
+    return 1;
+  if (!trace_replay(trace))
+  {
+    fprintf(stderr, "%s: the stream does not decode\n", argv[1]);
+    return 1;
+  }
+  fputs(reports_text().c_str(), stdout);
+  return 0;
+}
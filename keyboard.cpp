@@ -0,0 +1,619 @@
+#include <string.h>
+
+#include "tusb.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "matrix.h"
+#include "debounce.h"
+#include "report.h"
+#include "layer.h"
+#include "taphold.h"
+#include "combo.h"
+#include "macro.h"
+#include "mousekey.h"
+#include "governor.h"
+#include "keymap_store.h"
+#include "latency.h"
+#include "trace.h"
+#include "debug_log.h"
+#include "telemetry.h"
+#if MATRIX_SCAN_PIO
+#include "matrix_pio.h"
+#endif
+
+/** The latest raw scan and when it was taken. */
+static matrix_t raw;
+static uint64_t raw_time_us;
+
+static debounce_t debouncer;
+
+/** Picks the scan period from how long the matrix has been stable. Scan
+ * side. */
+static governor_t governor;
+
+/** Combo keys held back between the debouncer and the queue. Scan side. */
+static combo_t combos;
+
+/** Whether the last event the debouncer handed over found the queue full,
+ * so a stall is logged once and not on every run it lasts. Scan side. */
+static bool queue_full;
+
+#if KEYBOARD_IDLE
+/** The rows are armed and the matrix is not being scanned. active_us is
+ * the last scan that found anything down or still to be released. */
+static bool scan_idle;
+static uint64_t active_us;
+#endif
+
+/** Scan to report hand off. queued is the debounced state as far as the
+ * events pushed so far describe it and belongs to the scan side, held is
+ * the report side's view once it has applied the events it has popped. In
+ * dual core builds the queue is the only thing the two cores share. */
+static key_event_queue_t key_events;
+static matrix_t queued;
+static matrix_t held;
+
+/** The keymap in flash the layers resolve against, and its edits. Report
+ * side, like the USB callbacks that change it. */
+static keymap_store_t keymap_store;
+
+/** Layer state, and the action each held key locked in when pressed. Only
+ * the report side touches it. */
+static layer_t layers;
+
+/** Events on their way from the queue to the held keys, held back while a
+ * dual role key is undecided. Report side. */
+static taphold_t taphold;
+
+/** The macro playing, if any, whether the last report took one of its
+ * steps, and whether keyboard_report() is running (a report completing can
+ * call it from inside). Report side. */
+static macro_player_t macros;
+static bool macro_stepped;
+static bool reporting;
+
+/** The consumer usage the held keys ask for as of the last report, and the
+ * mouse keys. Report side. */
+static uint16_t consumer_usage;
+static mousekey_t mousekeys;
+
+/** Whether the host has put the keyboard interface in boot protocol. Set
+ * from tud_hid_set_protocol_cb(). Report side. */
+static bool boot_protocol;
+
+/** What each report last took, so reports only go out on a change. Also
+ * what GET_REPORT answers with. */
+static keyboard_report_t sent_nkro;
+static uint8_t sent_boot_modifier;
+static uint8_t sent_boot_keys[6];
+static uint16_t sent_consumer;
+
+void keyboard_init(void)
+{
+  matrix_init();
+  debounce_init(debouncer);
+  combo_init(combos, default_combos, COMBO_TERM_MS);
+  queue_full = false;
+  event_queue_init(key_events);
+  raw = {};
+  raw_time_us = 0;
+  governor_init(governor, hal_time_us());
+#if KEYBOARD_IDLE
+  scan_idle = false;
+  active_us = 0;
+#endif
+  queued = {};
+  held = {};
+  keymap_store_init(keymap_store, default_keymap);
+  layer_init(layers, keymap_store.keymap);
+  taphold_init(taphold, keymap_store.keymap, TAPHOLD_TERM_MS, TAPHOLD_FLAGS,
+               (uint32_t)hal_time_us());
+  macro_init(macros, default_macros);
+  macro_stepped = false;
+  reporting = false;
+  consumer_usage = 0;
+  mousekey_init(mousekeys);
+  boot_protocol = false;
+  sent_nkro = {};
+  sent_boot_modifier = 0;
+  memset(sent_boot_keys, 0, sizeof(sent_boot_keys));
+  sent_consumer = 0;
+#if KEYBOARD_LATENCY
+  latency_init();
+#if KEYBOARD_GOVERNOR
+  latency_governor(&governor);
+#endif
+#endif
+#if KEYBOARD_TRACE
+  trace_init();
+#endif
+#if KEYBOARD_DEBUG_LOG
+  debug_log_init();
+#endif
+#if KEYBOARD_TELEMETRY
+  telemetry_init();
+#endif
+#if MATRIX_SCAN_PIO
+  matrix_pio_init();
+#endif
+}
+
+/** --------------------------------------------------------------------+ */
+/** Scan side */
+/** --------------------------------------------------------------------+ */
+void keyboard_scan(void)
+{
+#if KEYBOARD_TRACE
+  /** A trace replays each snapshot from here, so coming out of idle sees
+   * it too. */
+  uint64_t scan_us = hal_time_us();
+#endif
+#if !KEYBOARD_DUAL_CORE
+  /** Remote wakeup */
+  if (hal_usb_suspended())
+  {
+    /** Originally this was done using the boot select button on the pico
+     * but I don't want to open the keyboard to press the button, so any key
+     * going down does it. */
+#if KEYBOARD_IDLE
+    /** Same as idle: the core sleeps until a row falls. Keys still held
+     * from before the suspend keep it from arming until they are let go. */
+    if (!scan_idle)
+      scan_idle = matrix_idle_enter();
+    else if (matrix_idle_woken())
+      hal_usb_remote_wakeup();
+#else
+    matrix_t matrix = {};
+#if MATRIX_SCAN_PIO
+    /** The PIO owns the column pins, but it is scanning anyway. Only a
+     * changed snapshot is decoded, so a key held through the suspend does
+     * not count. */
+    if (matrix_pio_read(matrix) && !matrix_empty(matrix))
+#else
+    matrix_scan(matrix);
+    if (!matrix_empty(matrix))
+#endif
+    {
+      hal_usb_remote_wakeup();
+    }
+#endif
+    return;
+  }
+#endif
+
+#if KEYBOARD_IDLE
+  if (scan_idle)
+  {
+    if (!matrix_idle_woken())
+      return;
+    matrix_idle_exit();
+    scan_idle = false;
+  }
+#endif
+
+#if MATRIX_ANTI_GHOST || KEYBOARD_GOVERNOR || KEYBOARD_TELEMETRY
+  matrix_t previous = raw;
+#endif
+#if MATRIX_SCAN_PIO
+  /** Only decodes when the latest snapshot differs from the last one. */
+  matrix_pio_read(raw);
+#else
+  matrix_scan(raw);
+#endif
+#if KEYBOARD_TRACE
+  /** What the matrix read, ghosts and all. */
+  trace_scan(raw, scan_us);
+#endif
+#if MATRIX_ANTI_GHOST
+  /** Phantom keys never get as far as the debouncer. */
+  matrix_filter_ghosts(raw, previous);
+#endif
+  raw_time_us = hal_time_us();
+#if KEYBOARD_LATENCY
+  latency_scan(raw, debouncer.state, raw_time_us);
+#endif
+#if KEYBOARD_GOVERNOR
+  governor_scan(governor, !matrix_equal(raw, previous), raw_time_us);
+#endif
+#if KEYBOARD_TELEMETRY
+  telemetry_scan(raw, previous);
+#endif
+
+#if KEYBOARD_IDLE
+  /** Back to idle once nothing has been down for a while and every release
+   * has been queued. */
+  if (!matrix_empty(raw) || !matrix_empty(queued))
+    active_us = raw_time_us;
+  else if (raw_time_us - active_us >= KEYBOARD_IDLE_AFTER_US)
+  {
+    scan_idle = matrix_idle_enter();
+#if KEYBOARD_GOVERNOR
+    if (scan_idle)
+      governor_idle(governor, raw_time_us);
+#endif
+  }
+#endif
+}
+
+void keyboard_debounce(void)
+{
+  /** Switch chatter is filtered out here, before anything is reported. */
+  debounce_update(debouncer, raw, raw_time_us);
+#if KEYBOARD_TELEMETRY
+  telemetry_debounced(debouncer.state, (uint32_t)raw_time_us);
+#endif
+  combo_tick(combos, (uint32_t)raw_time_us, key_events);
+
+  /** Queue an event for every key the debounced state changed, by way of
+   * the combos. A key only counts as queued once they have taken its
+   * event, so if the queue is full the change is simply handed over on a
+   * later run and nothing gets stuck. */
+  for (uint w = 0; w < MATRIX_WORDS; w++)
+  {
+    uint32_t changed = debouncer.state.words[w] ^ queued.words[w];
+    while (changed)
+    {
+      uint bit = __builtin_ctz(changed);
+      changed &= changed - 1;
+
+      key_event_t e;
+      e.time_us = (uint32_t)raw_time_us;
+      e.pos = w * 32 + bit;
+      e.pressed = (debouncer.state.words[w] >> bit) & 1;
+      e.action = 0;
+#if KEYBOARD_LATENCY
+      e.detect_us = latency_detect_us(e.pos, e.time_us);
+#endif
+      if (!combo_event(combos, e, key_events))
+      {
+        if (!queue_full)
+          DEBUG_LOG("event queue full, key %u waits", e.pos);
+        queue_full = true;
+        return;
+      }
+      queue_full = false;
+      queued.words[w] ^= 1u << bit;
+      if (e.pressed)
+        DEBUG_LOG("key %u down", e.pos);
+      else
+        DEBUG_LOG("key %u up", e.pos);
+#if KEYBOARD_LATENCY
+      latency_accepted(e);
+#endif
+    }
+  }
+}
+
+/** --------------------------------------------------------------------+ */
+/** Report side */
+/** --------------------------------------------------------------------+ */
+/** Turn the held keys into a report, and the consumer usage: the lowest
+ * held, the report has room for one. */
+static void build_report(const matrix_t &held, keyboard_report_t &report, uint16_t &consumer)
+{
+  /** Every held key goes into the bitmap, there is no limit of 6 here. Each
+   * key sends what it resolved to when it was pressed, layer keys (like Fn)
+   * don't exist as far as the pc is concerned. */
+  report = {};
+  consumer = 0;
+  for (uint w = 0; w < MATRIX_WORDS; w++)
+  {
+    uint32_t bits = held.words[w];
+    while (bits)
+    {
+      uint bit = __builtin_ctz(bits);
+      bits &= bits - 1;
+      action_t action = layers.locked[w * 32 + bit];
+      if (ACTION_KIND(action) == ACTION_USAGE)
+        report_add_key(report, (uint8_t)action);
+      else if (ACTION_KIND(action) == ACTION_MOD_TAP)
+        report.modifier |= action_hold_modifier(action);
+      else if (ACTION_KIND(action) == ACTION_CONSUMER && consumer == 0)
+        consumer = ACTION_ARG(action);
+    }
+  }
+}
+
+/** Apply one event to the held keys and the layer state. A press locks in
+ * action, as decided by taphold_peek(). */
+static inline void apply_event(const key_event_t &e, action_t action)
+{
+  uint32_t mask = 1u << (e.pos & 31);
+  if (e.pressed)
+  {
+    held.words[e.pos >> 5] |= mask;
+    layer_press_action(layers, e.pos, action);
+  }
+  else
+  {
+    held.words[e.pos >> 5] &= ~mask;
+    action = layer_release(layers, e.pos);
+  }
+  /** Mouse keys move from when the key was scanned, not from when the
+   * endpoint was next free. */
+  if (ACTION_KIND(action) == ACTION_MOUSE)
+    mousekey_key(mousekeys, ACTION_ARG(action), e.pressed, e.time_us);
+}
+
+static void send_report(void)
+{
+  if (hal_usb_suspended())
+  {
+#if KEYBOARD_DUAL_CORE
+    /** Core 1 keeps scanning but must not call into TinyUSB, so the wakeup
+     * press is picked out of the events here instead. */
+    key_event_t e;
+    action_t action;
+    taphold_fill(taphold, key_events);
+    taphold_tick(taphold, (uint32_t)hal_time_us());
+    while (taphold_peek(taphold, layers, e, action))
+    {
+      apply_event(e, action);
+      taphold_pop(taphold);
+      if (e.pressed)
+        hal_usb_remote_wakeup();
+    }
+#endif
+    return;
+  }
+
+  /** Boot protocol hosts (BIOS, KVMs) only understand the 6KRO report on
+   * the keyboard interface, everyone else gets the NKRO bitmap. */
+  bool boot = boot_protocol;
+  uint8_t instance = boot ? ITF_NUM_KEYBOARD : ITF_NUM_NKRO;
+
+  /** After a protocol switch the interface left behind still has keys down
+   * as far as the host knows, and a KVM may still be listening to it:
+   * release them there once. Boot slots shift down, so the first one is
+   * empty only when they all are. */
+  if (boot && !report_empty(sent_nkro) && hal_hid_ready(ITF_NUM_NKRO))
+  {
+    keyboard_report_t none = {};
+    if (hal_hid_nkro_report(0, (const uint8_t *)none.keys))
+      sent_nkro = none;
+  }
+  else if (!boot && (sent_boot_modifier || sent_boot_keys[0]) &&
+           hal_hid_ready(ITF_NUM_KEYBOARD))
+  {
+    static const uint8_t none[6] = {};
+    if (hal_hid_keyboard_report(0, none))
+    {
+      sent_boot_modifier = 0;
+      memset(sent_boot_keys, 0, sizeof(sent_boot_keys));
+    }
+  }
+  if (!hal_hid_ready(instance))
+  {
+#if KEYBOARD_LATENCY
+    key_event_t waiting;
+    if (event_queue_peek(key_events, waiting))
+      latency_missed_ready();
+#endif
+    return;
+  }
+
+  /** Merge queued events into the held keys until one touches a key that
+   * already changed in this report: sending both would cancel a press or
+   * release the host never saw, so that event waits for the next report. */
+  taphold_fill(taphold, key_events);
+  taphold_tick(taphold, (uint32_t)hal_time_us());
+  matrix_t touched = {};
+  key_event_t e;
+  action_t action;
+  while (taphold_peek(taphold, layers, e, action))
+  {
+    uint32_t mask = 1u << (e.pos & 31);
+    if (touched.words[e.pos >> 5] & mask)
+      break;
+    /** A usage the macro is holding would not be seen going down, and a
+     * second macro waits for the first. */
+    if (e.pressed && ACTION_KIND(action) == ACTION_USAGE &&
+        report_has_key(macros.report, (uint8_t)action))
+      break;
+    if (e.pressed && ACTION_KIND(action) == ACTION_MACRO &&
+        !macro_start(macros, ACTION_ARG(action)))
+      break;
+    touched.words[e.pos >> 5] |= mask;
+
+    apply_event(e, action);
+    taphold_pop(taphold);
+#if KEYBOARD_LATENCY
+    latency_applied(e);
+#endif
+  }
+
+  keyboard_report_t report;
+  build_report(held, report, consumer_usage);
+  mousekey_update(mousekeys, (uint32_t)hal_time_us());
+
+  /** At most one macro step per report, so none of them merge. */
+  macro_stepped = macro_step(macros, report, (uint32_t)hal_time_us());
+  report.modifier |= macros.report.modifier;
+  for (uint w = 0; w < NKRO_WORDS; w++)
+    report.keys[w] |= macros.report.keys[w];
+
+  /** Only a change in the logical state goes out: holding keys down costs
+   * no USB traffic at all. */
+  bool sent = false;
+  if (boot)
+  {
+    /** Keys keep their slot until released, new ones are appended. */
+    uint8_t keycode[6];
+    memcpy(keycode, sent_boot_keys, 6);
+    report_update_boot(report, keycode);
+    if (report.modifier != sent_boot_modifier || memcmp(keycode, sent_boot_keys, 6) != 0)
+    {
+      sent = hal_hid_keyboard_report(report.modifier, keycode);
+      if (sent)
+      {
+        sent_boot_modifier = report.modifier;
+        memcpy(sent_boot_keys, keycode, 6);
+      }
+    }
+  }
+  else if (!report_equal(report, sent_nkro))
+  {
+    sent = hal_hid_nkro_report(report.modifier, (const uint8_t *)report.keys);
+    if (sent)
+      sent_nkro = report;
+  }
+
+#if KEYBOARD_LATENCY
+  if (sent)
+    latency_report_queued(instance, hal_time_us());
+  else
+    latency_discard_applied();
+#endif
+
+  /** Consumer and mouse reports share the NKRO endpoint and only get it
+   * when the keyboard report has nothing to send, a consumer change before
+   * mouse motion. So a keystroke never waits behind more than the one
+   * report already in the endpoint, and keyboard_report_complete() runs
+   * this again as soon as that one is taken. Motion that builds up in the
+   * meantime goes out as one report. */
+  if ((boot || !sent) && hal_hid_ready(ITF_NUM_NKRO))
+  {
+    if (consumer_usage != sent_consumer)
+    {
+      if (hal_hid_consumer_report(consumer_usage))
+        sent_consumer = consumer_usage;
+    }
+    else if (mousekey_pending(mousekeys))
+    {
+      mousekey_t next = mousekeys;
+      mouse_report_t m;
+      mousekey_take(next, m);
+      if (hal_hid_mouse_report(m.buttons, m.x, m.y, m.wheel, m.pan))
+        mousekeys = next;
+    }
+  }
+}
+
+void keyboard_report(void)
+{
+  reporting = true;
+  send_report();
+  reporting = false;
+}
+
+void keyboard_report_complete(uint8_t instance)
+{
+#if KEYBOARD_LATENCY
+  latency_report_complete(instance, hal_time_us());
+#else
+  (void)instance;
+#endif
+  /** A macro's next step goes out as soon as the host has taken the last
+   * one, not on the next report period. After its last step, a macro
+   * waiting behind it starts the same way, and so do consumer and mouse
+   * reports, which keeps held mouse keys streaming. */
+  if ((macro_playing(macros) || macro_stepped || mousekeys.held || mousekey_pending(mousekeys) ||
+       consumer_usage != sent_consumer) &&
+      !reporting)
+    keyboard_report();
+}
+
+void keyboard_set_protocol(bool boot)
+{
+  /** The next report moves the held keys over, see send_report(). */
+  boot_protocol = boot;
+}
+
+uint16_t keyboard_get_report(uint8_t instance, uint8_t report_id, uint8_t *buffer, uint16_t len)
+{
+  /** The host sees the same bytes it last took off the interrupt endpoint.
+   * Mouse motion is relative, so only the buttons are repeated. */
+  if (instance == ITF_NUM_KEYBOARD && report_id == 0 && len >= 8)
+  {
+    buffer[0] = sent_boot_modifier;
+    buffer[1] = 0;
+    memcpy(buffer + 2, sent_boot_keys, 6);
+    return 8;
+  }
+  if (instance != ITF_NUM_NKRO)
+    return 0;
+  if (report_id == REPORT_ID_NKRO && len >= NKRO_REPORT_LEN - 1)
+  {
+    buffer[0] = sent_nkro.modifier;
+    memcpy(buffer + 1, sent_nkro.keys, NKRO_KEY_COUNT / 8);
+    return NKRO_REPORT_LEN - 1;
+  }
+  if (report_id == REPORT_ID_CONSUMER_CONTROL && len >= sizeof(sent_consumer))
+  {
+    memcpy(buffer, &sent_consumer, sizeof(sent_consumer));
+    return sizeof(sent_consumer);
+  }
+  if (report_id == REPORT_ID_MOUSE && len >= 5)
+  {
+    memset(buffer, 0, 5);
+    buffer[0] = mousekeys.sent_buttons;
+    return 5;
+  }
+  return 0;
+}
+
+void keyboard_keymap_set_report(const uint8_t *buffer, uint16_t len)
+{
+  /** Held keys keep the actions they locked in, only presses from here on
+   * see the new keymap. */
+  keymap_store_set_report(keymap_store, buffer, len);
+}
+
+uint16_t keyboard_keymap_get_report(uint8_t *buffer, uint16_t len)
+{
+  return keymap_store_get_report(keymap_store, buffer, len);
+}
+
+bool keyboard_idle(void)
+{
+#if KEYBOARD_IDLE && KEYBOARD_DUAL_CORE
+  /** Core 1's view, the report side is core 0's business. */
+  return scan_idle && !matrix_idle_woken() && event_queue_empty(key_events);
+#elif KEYBOARD_IDLE
+  return scan_idle && !matrix_idle_woken() && event_queue_empty(key_events) &&
+         taphold_empty(taphold) && !macro_playing(macros) && !mousekey_pending(mousekeys) &&
+         consumer_usage == sent_consumer;
+#else
+  return false;
+#endif
+}
+
+bool keyboard_quiet(void)
+{
+  /** In dual core builds the scan side is read from core 0 without a
+   * lock. A key that went down a moment ago can be missed, which only
+   * costs it whatever the caller does next. */
+  return matrix_empty(raw) && matrix_empty(debouncer.state) && matrix_empty(queued) &&
+         combo_empty(combos) && event_queue_empty(key_events) && matrix_empty(held) &&
+         taphold_empty(taphold) && !macro_playing(macros) && !mousekey_pending(mousekeys) &&
+         consumer_usage == sent_consumer;
+}
+
+uint32_t keyboard_scan_period_us(void)
+{
+#if KEYBOARD_GOVERNOR
+  return governor_period_us(governor);
+#else
+  return KEYBOARD_SCAN_PERIOD_US;
+#endif
+}
+
+const governor_t &keyboard_governor(void)
+{
+  return governor;
+}
+
+const key_event_queue_t &keyboard_events(void)
+{
+  return key_events;
+}
+
+/** --------------------------------------------------------------------+ */
+/** USB HID */
+/** --------------------------------------------------------------------+ */
+void key_scan(void)
+{
+  keyboard_scan();
+  keyboard_debounce();
+  keyboard_report();
+}
@@ -0,0 +1,117 @@
+#ifndef KEYBOARD_H_
+#define KEYBOARD_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "event_queue.h"
+#include "governor.h"
+#include "keymap.h"
+#include "usb_descriptors.h"
+
+/** --------------------------------------------------------------------+ */
+/** MACRO CONSTANT TYPEDEF PROTYPES */
+/** --------------------------------------------------------------------+ */
+#define GPIO_PIN_SETTLE_DELAY_US 10
+#define HIGH 1
+#define LOW 0
+
+/** Set up the key matrix pins. */
+void keyboard_init(void);
+
+/** How often main() runs each stage. Reports go out at most once per host
+ * poll anyway. */
+#ifndef KEYBOARD_SCAN_PERIOD_US
+#define KEYBOARD_SCAN_PERIOD_US 1000
+#endif
+#ifndef KEYBOARD_DEBOUNCE_PERIOD_US
+#define KEYBOARD_DEBOUNCE_PERIOD_US 1000
+#endif
+#ifndef KEYBOARD_REPORT_PERIOD_US
+#define KEYBOARD_REPORT_PERIOD_US (HID_POLL_INTERVAL_MS * 1000)
+#endif
+
+/** Idle mode: once the matrix has been quiet for KEYBOARD_IDLE_AFTER_US the
+ * columns are all driven LOW, the rows armed for a falling edge and nothing
+ * is scanned until one falls, which gets a full scan straight away. The PIO
+ * backend owns the column pins and scans for free, so it has no idle mode. */
+#ifndef KEYBOARD_IDLE
+#define KEYBOARD_IDLE !MATRIX_SCAN_PIO
+#endif
+#ifndef KEYBOARD_IDLE_AFTER_US
+#define KEYBOARD_IDLE_AFTER_US 50000
+#endif
+#if KEYBOARD_IDLE && MATRIX_SCAN_PIO
+#error "KEYBOARD_IDLE needs the column pins, MATRIX_SCAN_PIO has them"
+#endif
+
+/** Scan rate governor (governor.h): main() scans and debounces at the
+ * period keyboard_scan_period_us() gives after each scan instead of the
+ * fixed KEYBOARD_SCAN_PERIOD_US. Like idle mode it is for the GPIO scan,
+ * the PIO backend scans at its own rate whatever main() does. */
+#ifndef KEYBOARD_GOVERNOR
+#define KEYBOARD_GOVERNOR !MATRIX_SCAN_PIO
+#endif
+
+/** Scan the matrix into the raw state. While the bus is suspended the rows
+ * are armed as in idle mode and any key going down wakes the host. */
+void keyboard_scan(void);
+
+/** Debounce the latest raw scan and queue an event for every change. Never
+ * waits on USB. */
+void keyboard_debounce(void);
+
+/** Apply queued events to the held keys and take the next step of a playing
+ * macro, and if that changed what the host should see, send a report. Does
+ * nothing while the endpoint is busy. */
+void keyboard_report(void);
+
+/** The host has taken the last report queued on instance. Called from
+ * tud_hid_report_complete_cb(). While a macro plays its next report goes
+ * out from here. */
+void keyboard_report_complete(uint8_t instance);
+
+/** The host has put the keyboard interface in boot protocol, or back in
+ * report protocol. Called from tud_hid_set_protocol_cb(), on the report
+ * side. Reports go out in the new format from the next one on, and the
+ * keys held on the interface left behind are released there. */
+void keyboard_set_protocol(bool boot);
+
+/** Answer a GET_REPORT for an input report: instance's report_id as the
+ * host last took it, from the copy kept to spot changes. Nothing is
+ * scanned or built. Returns the length, 0 to stall a report there is no
+ * such copy of. */
+uint16_t keyboard_get_report(uint8_t instance, uint8_t report_id, uint8_t *buffer, uint16_t len);
+
+/** The keymap vendor feature report, see keymap_store.h. Called from the
+ * HID callbacks, on the report side. A commit writes flash and stalls
+ * everything for as long as that takes. */
+void keyboard_keymap_set_report(const uint8_t *buffer, uint16_t len);
+uint16_t keyboard_keymap_get_report(uint8_t *buffer, uint16_t len);
+
+/** Nothing to do until an interrupt: the matrix is idle and every event has
+ * been reported. The main loop sleeps (WFE) without a deadline while this
+ * holds. Always false without KEYBOARD_IDLE. */
+bool keyboard_idle(void);
+
+/** Nothing is down or on its way, and every event has been reported, as
+ * far as the report side can tell. Unlike keyboard_idle() it does not need
+ * idle mode: the matrix may still be scanned (or the PIO scanning it).
+ * Called on the report side. */
+bool keyboard_quiet(void);
+
+/** The scan period the governor has picked, KEYBOARD_SCAN_PERIOD_US
+ * without it. For SCHED_TASK_PACED(). */
+uint32_t keyboard_scan_period_us(void);
+
+/** The governor's band and counters. Scan side. */
+const governor_t &keyboard_governor(void);
+
+/** The scan to report event queue, for its overflow and depth counters. */
+const key_event_queue_t &keyboard_events(void);
+
+/** Run every stage once: scan the key matrix and send the report to the
+ * connected pc. */
+void key_scan(void);
+
+#endif /* KEYBOARD_H_ */
@@ -0,0 +1,234 @@
+#ifndef KEYMAP_H_
+#define KEYMAP_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <array>
+
+#include "tusb.h"
+#include "matrix.h"
+#include "layer.h"
+#include "combo.h"
+#include "macro.h"
+#include "mousekey.h"
+
+/** --------------------------------------------------------------------+ */
+/** Keymap */
+/** --------------------------------------------------------------------+ */
+/** Everything here is constexpr: the readable layout below is turned into
+ * flat per layer tables at compile time, so nothing is built on the heap at
+ * static init and a lookup is a single array index. Mistakes in the layout
+ * are compile errors. */
+enum
+{
+  LAYER_BASE,
+  LAYER_FN,
+  LAYER_COUNT
+};
+
+#define FN_KEY MO(LAYER_FN)
+
+/** The pins connected to each column of the key matrix. Left to right when
+ * looking at the keyboard face. */
+inline constexpr uint colPins[] = {10, 9, 8, 7, 6, 5, 16, 26, 18, 19, 20, 21,
+                                   22, 27, 28};
+
+/** The pins connected to each row of the key matrix. From top to bottom when
+ * looking at the keyboard face. */
+inline constexpr uint rowPins[] = {11, 12, 4, 14, 15};
+
+static_assert(std::size(colPins) == MATRIX_COLS, "colPins must have MATRIX_COLS pins");
+static_assert(std::size(rowPins) == MATRIX_ROWS, "rowPins must have MATRIX_ROWS pins");
+
+namespace keymap_detail
+{
+  typedef std::array<action_t, MATRIX_ROWS> column_t;
+
+  /** One column of the layout, top to bottom. Every column has to list all
+   * MATRIX_ROWS rows so a missing key can't shift the rest up a row. */
+  template <size_t N>
+  consteval column_t column(const action_t (&keys)[N])
+  {
+    static_assert(N == MATRIX_ROWS, "every layout column needs exactly MATRIX_ROWS keys, pad with HID_KEY_NONE");
+    column_t c{};
+    for (size_t i = 0; i < N; i++)
+      c[i] = keys[i];
+    return c;
+  }
+
+  /** Flatten a layout into a layer table indexed by MATRIX_POS(col, row),
+   * the same position every key event carries. */
+  template <size_t N>
+  consteval layer_table_t layer_table(const column_t (&layout)[N])
+  {
+    static_assert(N == MATRIX_COLS, "the layout needs exactly MATRIX_COLS columns");
+    layer_table_t table{};
+    for (size_t col = 0; col < N; col++)
+    {
+      for (size_t row = 0; row < MATRIX_ROWS; row++)
+        table[MATRIX_POS(col, row)] = layout[col][row];
+    }
+    return table;
+  }
+
+  struct translation_t
+  {
+    uint8_t from;
+    action_t to;
+  };
+
+  /** A layer that swaps the given usages of the base layer and leaves every
+   * other key transparent. Mapping the same usage twice does not compile. */
+  template <size_t N>
+  consteval layer_table_t translated_layer(const layer_table_t &base, const translation_t (&pairs)[N])
+  {
+    std::array<action_t, 256> translation{};
+    for (size_t i = 0; i < 256; i++)
+      translation[i] = KC_TRNS;
+    for (size_t i = 0; i < N; i++)
+    {
+      if (translation[pairs[i].from] != KC_TRNS)
+        throw "usage translated twice";
+      translation[pairs[i].from] = pairs[i].to;
+    }
+
+    layer_table_t table{};
+    for (size_t pos = 0; pos < LAYER_KEYS; pos++)
+    {
+      action_t key = base[pos];
+      table[pos] = ACTION_KIND(key) == ACTION_USAGE ? translation[key] : KC_TRNS;
+    }
+    return table;
+  }
+}
+
+/** key_layout[col][row] */
+/** Note, The HID_KEY_NONE are padding for keys that dont actually exist. */
+inline constexpr keymap_detail::column_t key_layout[] = {
+    keymap_detail::column({HID_KEY_ESCAPE, HID_KEY_TAB, HID_KEY_CAPS_LOCK, HID_KEY_SHIFT_LEFT, HID_KEY_CONTROL_LEFT}),
+    keymap_detail::column({HID_KEY_1, HID_KEY_Q, HID_KEY_A, HID_KEY_NONE, HID_KEY_GUI_LEFT}),
+    keymap_detail::column({HID_KEY_2, HID_KEY_W, HID_KEY_S, HID_KEY_Z, HID_KEY_NONE}),
+    keymap_detail::column({HID_KEY_3, HID_KEY_E, HID_KEY_D, HID_KEY_X, HID_KEY_ALT_LEFT}),
+    keymap_detail::column({HID_KEY_4, HID_KEY_R, HID_KEY_F, HID_KEY_C, HID_KEY_NONE}),
+    keymap_detail::column({HID_KEY_5, HID_KEY_T, HID_KEY_G, HID_KEY_V, HID_KEY_NONE}),
+    keymap_detail::column({HID_KEY_6, HID_KEY_Y, HID_KEY_H, HID_KEY_B, HID_KEY_SPACE}),
+    keymap_detail::column({HID_KEY_7, HID_KEY_U, HID_KEY_J, HID_KEY_N, HID_KEY_NONE}),
+    keymap_detail::column({HID_KEY_8, HID_KEY_I, HID_KEY_K, HID_KEY_M, HID_KEY_NONE}),
+    keymap_detail::column({HID_KEY_9, HID_KEY_O, HID_KEY_L, HID_KEY_COMMA, HID_KEY_NONE}),
+    keymap_detail::column({HID_KEY_0, HID_KEY_P, HID_KEY_SEMICOLON, HID_KEY_PERIOD, FN_KEY}),
+    keymap_detail::column({HID_KEY_MINUS, HID_KEY_BRACKET_LEFT, HID_KEY_APOSTROPHE, HID_KEY_SHIFT_RIGHT, HID_KEY_ALT_RIGHT}),
+    keymap_detail::column({HID_KEY_EQUAL, HID_KEY_BRACKET_RIGHT, HID_KEY_GRAVE, HID_KEY_NONE, HID_KEY_ARROW_LEFT}),
+    keymap_detail::column({HID_KEY_PRINT_SCREEN, HID_KEY_SLASH, HID_KEY_ENTER, HID_KEY_ARROW_UP, HID_KEY_ARROW_DOWN}),
+    keymap_detail::column({HID_KEY_BACKSPACE, HID_KEY_BACKSLASH, HID_KEY_NONE, HID_KEY_APPLICATION, HID_KEY_ARROW_RIGHT}),
+};
+
+namespace keymap_detail
+{
+  /** A combo of the keys whose base layer action is each of keys. A usage
+   * that is not on the layout does not compile. */
+  template <size_t N>
+  consteval combo_def_t combo(const action_t (&keys)[N], action_t action)
+  {
+    combo_def_t def{{}, action};
+    for (size_t i = 0; i < N; i++)
+    {
+      bool found = false;
+      for (size_t col = 0; col < MATRIX_COLS && !found; col++)
+      {
+        for (size_t row = 0; row < MATRIX_ROWS && !found; row++)
+        {
+          if (key_layout[col][row] == keys[i])
+          {
+            uint pos = MATRIX_POS(col, row);
+            def.keys.words[pos >> 5] |= 1u << (pos & 31);
+            found = true;
+          }
+        }
+      }
+      if (!found)
+        throw "combo key not on the layout";
+    }
+    return def;
+  }
+}
+
+/** Keys pressed together that send something else, see combo.h. None by
+ * default: every key in a combo waits up to COMBO_TERM_MS to be seen alone.
+ * J and K together for Escape would be
+ *   combo_list(keymap_detail::combo({HID_KEY_J, HID_KEY_K}, HID_KEY_ESCAPE)) */
+inline constexpr auto keymap_combos = combo_list();
+
+/** Macros, played by MACRO(n) keys. No key plays these examples by
+ * default: {HID_KEY_ENTER, MACRO(MACRO_SIGN_OFF)} in fn_transforms, or the
+ * same action put on a key over the keymap report, would. */
+enum
+{
+  MACRO_SIGN_OFF,
+  MACRO_COPY_ALL,
+  MACRO_COUNT
+};
+
+inline constexpr auto macro_sign_off =
+    macro(macro_type("Thanks,"), macro_tap(HID_KEY_ENTER));
+inline constexpr auto macro_copy_all =
+    macro(macro_press(HID_KEY_CONTROL_LEFT), macro_tap(HID_KEY_A), macro_tap(HID_KEY_C),
+          macro_release(HID_KEY_CONTROL_LEFT));
+
+inline constexpr const uint8_t *keymap_macros[] = {
+    macro_sign_off.data(),
+    macro_copy_all.data(),
+};
+static_assert(std::size(keymap_macros) == MACRO_COUNT, "every macro needs its program");
+
+/** Keys that change when the Fn key is held. CONSUMER() and MOUSE_KEY()
+ * actions go here too; none are bound by default. Media keys on [ ] \ , . /
+ * and mouse keys on IJKL, U and O to click and Y and H to scroll would be
+ *   {HID_KEY_BRACKET_LEFT, CONSUMER(HID_USAGE_CONSUMER_SCAN_PREVIOUS)},
+ *   {HID_KEY_BRACKET_RIGHT, CONSUMER(HID_USAGE_CONSUMER_SCAN_NEXT)},
+ *   {HID_KEY_BACKSLASH, CONSUMER(HID_USAGE_CONSUMER_PLAY_PAUSE)},
+ *   {HID_KEY_COMMA, CONSUMER(HID_USAGE_CONSUMER_VOLUME_DECREMENT)},
+ *   {HID_KEY_PERIOD, CONSUMER(HID_USAGE_CONSUMER_VOLUME_INCREMENT)},
+ *   {HID_KEY_SLASH, CONSUMER(HID_USAGE_CONSUMER_MUTE)},
+ *   {HID_KEY_I, MOUSE_KEY(MOUSEKEY_UP)},
+ *   {HID_KEY_K, MOUSE_KEY(MOUSEKEY_DOWN)},
+ *   {HID_KEY_J, MOUSE_KEY(MOUSEKEY_LEFT)},
+ *   {HID_KEY_L, MOUSE_KEY(MOUSEKEY_RIGHT)},
+ *   {HID_KEY_U, MOUSE_KEY(MOUSEKEY_BUTTON1)},
+ *   {HID_KEY_O, MOUSE_KEY(MOUSEKEY_BUTTON1 + 1)},
+ *   {HID_KEY_Y, MOUSE_KEY(MOUSEKEY_WHEEL_UP)},
+ *   {HID_KEY_H, MOUSE_KEY(MOUSEKEY_WHEEL_DOWN)}, */
+inline constexpr keymap_detail::translation_t fn_transforms[] = {
+    {HID_KEY_1, HID_KEY_F1},
+    {HID_KEY_2, HID_KEY_F2},
+    {HID_KEY_3, HID_KEY_F3},
+    {HID_KEY_4, HID_KEY_F4},
+    {HID_KEY_5, HID_KEY_F5},
+    {HID_KEY_6, HID_KEY_F6},
+    {HID_KEY_7, HID_KEY_F7},
+    {HID_KEY_8, HID_KEY_F8},
+    {HID_KEY_9, HID_KEY_F9},
+    {HID_KEY_0, HID_KEY_F10},
+    {HID_KEY_MINUS, HID_KEY_F11},
+    {HID_KEY_EQUAL, HID_KEY_F12},
+    {HID_KEY_W, HID_KEY_ARROW_UP},
+    {HID_KEY_S, HID_KEY_ARROW_DOWN},
+    {HID_KEY_A, HID_KEY_ARROW_LEFT},
+    {HID_KEY_D, HID_KEY_ARROW_RIGHT},
+    {HID_KEY_APPLICATION, HID_KEY_DELETE},
+};
+
+/** The generated tables: every layer's actions by MATRIX_POS, and which
+ * layers each key is not transparent on. */
+inline constexpr std::array<layer_table_t, LAYER_COUNT> keymap_layers = {
+    keymap_detail::layer_table(key_layout),
+    keymap_detail::translated_layer(keymap_detail::layer_table(key_layout), fn_transforms),
+};
+inline constexpr auto keymap_key_layers = layer_key_masks(keymap_layers);
+
+inline constexpr layer_keymap_t default_keymap = {keymap_layers.data(), LAYER_COUNT,
+                                                  keymap_key_layers.data(),
+                                                  layer_tap_hold_keys(keymap_layers)};
+inline constexpr combo_table_t default_combos = combo_table(keymap_combos);
+inline constexpr macro_table_t default_macros = {keymap_macros, MACRO_COUNT};
+
+#endif /* KEYMAP_H_ */
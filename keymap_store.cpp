@@ -0,0 +1,300 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "hal.h"
+#include "keymap_store.h"
+#include "crc32.h"
+
+static uint32_t image_size(uint count)
+{
+  return sizeof(keymap_image_t) + count * sizeof(layer_table_t);
+}
+
+static uint total_slots(const keymap_store_t &s)
+{
+  return s.sector_slots * KEYMAP_STORE_SECTORS;
+}
+
+static uint32_t slot_offset(const keymap_store_t &s, uint slot)
+{
+  return KEYMAP_STORE_OFFSET + slot / s.sector_slots * HAL_FLASH_SECTOR_SIZE +
+         slot % s.sector_slots * s.slot_size;
+}
+
+static const keymap_image_t *slot_image(const keymap_store_t &s, uint slot)
+{
+  return (const keymap_image_t *)(hal_flash_config() + slot_offset(s, slot));
+}
+
+/** The image in slot, if it is whole and made for this keymap (or is a
+ * reset, which has no layers). */
+static bool valid(const keymap_store_t &s, uint slot)
+{
+  const keymap_image_t *image = slot_image(s, slot);
+  if (image->magic != KEYMAP_STORE_MAGIC || image->version != KEYMAP_STORE_VERSION ||
+      (image->count != s.defaults->count && image->count != 0))
+    return false;
+  const uint8_t *bytes = (const uint8_t *)image;
+  uint32_t from = offsetof(keymap_image_t, crc) + sizeof(image->crc);
+  return ~crc32_update(~0u, bytes + from, image_size(image->count) - from) == image->crc;
+}
+
+static bool erased(const keymap_store_t &s, uint slot)
+{
+  const uint8_t *bytes = (const uint8_t *)slot_image(s, slot);
+  for (uint i = 0; i < s.slot_size; i++)
+  {
+    if (bytes[i] != 0xff)
+      return false;
+  }
+  return true;
+}
+
+/** Point the keymap at the image in slot, or at the defaults if it is a
+ * reset. */
+static void use(keymap_store_t &s, uint slot)
+{
+  const keymap_image_t *image = slot_image(s, slot);
+  s.image = image;
+  s.image_slot = slot;
+  if (image->count == 0)
+  {
+    s.keymap = *s.defaults;
+    return;
+  }
+  s.keymap.layers = (const layer_table_t *)(image + 1);
+  s.keymap.count = image->count;
+  s.keymap.key_layers = image->key_layers;
+  s.keymap.tap_hold_keys = image->tap_hold_keys;
+}
+
+void keymap_store_init(keymap_store_t &s, const layer_keymap_t &defaults)
+{
+  memset(&s, 0, sizeof(s));
+  s.defaults = &defaults;
+  s.keymap = defaults;
+  s.slot_size = (image_size(defaults.count) + HAL_FLASH_PAGE_SIZE - 1) & ~(HAL_FLASH_PAGE_SIZE - 1);
+  s.sector_slots = HAL_FLASH_SECTOR_SIZE / s.slot_size;
+  /** Too many layers for an image to fit a sector: the compiled-in keymap
+   * is all there is. */
+  if (s.sector_slots == 0)
+    return;
+
+  /** Sequence numbers only go up, so the newest image is the biggest
+   * one. The next commit goes after it. */
+  for (uint slot = 0; slot < total_slots(s); slot++)
+  {
+    if (valid(s, slot) && (!s.image || slot_image(s, slot)->sequence > s.image->sequence))
+      use(s, slot);
+  }
+  s.next_slot = s.image ? (s.image_slot + 1) % total_slots(s) : 0;
+}
+
+bool keymap_store_edit(keymap_store_t &s, uint layer, uint pos, action_t action)
+{
+  if (layer >= s.keymap.count || pos >= LAYER_KEYS || s.staged == KEYMAP_STORE_EDITS)
+    return false;
+  s.edits[s.staged++] = {(uint8_t)layer, (uint8_t)pos, action};
+  return true;
+}
+
+/** What pos is on layer in the image being written: the last edit of it,
+ * or what base has. */
+static action_t new_action(const keymap_store_t &s, const layer_keymap_t &base, uint layer,
+                           uint pos)
+{
+  for (int i = s.staged - 1; i >= 0; i--)
+  {
+    if (s.edits[i].layer == layer && s.edits[i].pos == pos)
+      return s.edits[i].action;
+  }
+  return base.layers[layer][pos];
+}
+
+/** Bytes [offset, offset + len) of the image being written, built as they
+ * are needed so the whole image never has to be in RAM. */
+static void image_bytes(const keymap_store_t &s, const layer_keymap_t &base,
+                        const keymap_image_t &header, uint32_t offset, uint8_t *out,
+                        uint32_t len)
+{
+  for (uint32_t i = 0; i < len; i++, offset++)
+  {
+    if (offset < sizeof(header))
+    {
+      out[i] = ((const uint8_t *)&header)[offset];
+      continue;
+    }
+    uint32_t at = offset - sizeof(header);
+    if (at >= header.count * sizeof(layer_table_t))
+    {
+      out[i] = 0xff;
+      continue;
+    }
+    action_t action = new_action(s, base, at / sizeof(layer_table_t),
+                                 at % sizeof(layer_table_t) / sizeof(action_t));
+    out[i] = at & 1 ? action >> 8 : action & 0xff;
+  }
+}
+
+/** Write the image to slot, the first page last. */
+static void write_image(const keymap_store_t &s, const layer_keymap_t &base,
+                        const keymap_image_t &header, uint slot)
+{
+  uint8_t page[HAL_FLASH_PAGE_SIZE];
+  uint32_t offset = slot_offset(s, slot);
+  for (uint32_t at = HAL_FLASH_PAGE_SIZE; at < s.slot_size; at += HAL_FLASH_PAGE_SIZE)
+  {
+    image_bytes(s, base, header, at, page, sizeof(page));
+    hal_flash_program(offset + at, page, sizeof(page));
+  }
+  image_bytes(s, base, header, 0, page, sizeof(page));
+  hal_flash_program(offset, page, sizeof(page));
+}
+
+/** Write base with the staged edits on top to the next slot that takes it,
+ * or with count 0 an image with no layers at all. */
+static bool commit(keymap_store_t &s, const layer_keymap_t &base, uint8_t count)
+{
+  if (total_slots(s) == 0)
+    return false;
+
+  /** The header: the masks layer.h would build for the new layers, and
+   * the CRC over them and the layers. */
+  keymap_image_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = KEYMAP_STORE_MAGIC;
+  header.version = KEYMAP_STORE_VERSION;
+  header.count = count;
+  header.sequence = s.image ? s.image->sequence + 1 : 1;
+  for (uint pos = 0; pos < LAYER_KEYS; pos++)
+  {
+    header.key_layers[pos] = 1;
+    for (uint layer = 0; layer < header.count; layer++)
+    {
+      action_t action = new_action(s, base, layer, pos);
+      if (layer > 0 && action != KC_TRNS)
+        header.key_layers[pos] |= 1 << layer;
+      if (action_is_tap_hold(action))
+        header.tap_hold_keys.words[pos >> 5] |= 1u << (pos & 31);
+    }
+  }
+  uint32_t crc = ~0u;
+  uint8_t chunk[64];
+  uint32_t from = offsetof(keymap_image_t, crc) + sizeof(header.crc);
+  for (uint32_t at = from; at < image_size(header.count); at += sizeof(chunk))
+  {
+    uint32_t n = image_size(header.count) - at;
+    if (n > sizeof(chunk))
+      n = sizeof(chunk);
+    image_bytes(s, base, header, at, chunk, n);
+    crc = crc32_update(crc, chunk, n);
+  }
+  header.crc = ~crc;
+
+  /** A slot a lost write left dirty is skipped, a new sector is erased
+   * first. Never the sector with the image in use. */
+  uint slot = s.next_slot;
+  for (uint tries = 0; tries < total_slots(s); tries++, slot = (slot + 1) % total_slots(s))
+  {
+    uint sector = slot / s.sector_slots;
+    if (slot % s.sector_slots == 0)
+    {
+      if (s.image && sector == s.image_slot / s.sector_slots)
+        return false;
+      hal_flash_erase(KEYMAP_STORE_OFFSET + sector * HAL_FLASH_SECTOR_SIZE);
+      s.erases++;
+    }
+    else if (!erased(s, slot))
+      continue;
+
+    write_image(s, base, header, slot);
+    if (!valid(s, slot) || slot_image(s, slot)->sequence != header.sequence)
+    {
+      s.failed++;
+      continue;
+    }
+    use(s, slot);
+    s.next_slot = (slot + 1) % total_slots(s);
+    s.staged = 0;
+    return true;
+  }
+  return false;
+}
+
+bool keymap_store_commit(keymap_store_t &s)
+{
+  /** The layers are read from the image in use while the new one is
+   * built, so copy out the keymap pointing at them first. */
+  layer_keymap_t base = s.keymap;
+  return commit(s, base, s.defaults->count);
+}
+
+bool keymap_store_reset(keymap_store_t &s)
+{
+  /** Not a copy of the defaults: those can change with the firmware, and
+   * the store has to keep following them. */
+  s.staged = 0;
+  return commit(s, *s.defaults, 0);
+}
+
+/** --------------------------------------------------------------------+ */
+/** Vendor report */
+/** --------------------------------------------------------------------+ */
+static bool run_op(keymap_store_t &s, const uint8_t *buffer, uint16_t len)
+{
+  switch (buffer[0])
+  {
+  case KEYMAP_OP_EDIT:
+  {
+    if (len < 2 || buffer[1] > KEYMAP_REPORT_EDITS || len < 2 + buffer[1] * 4)
+      return false;
+    for (uint i = 0; i < buffer[1]; i++)
+    {
+      const uint8_t *e = buffer + 2 + i * 4;
+      if (!keymap_store_edit(s, e[0], e[1], (action_t)(e[2] | e[3] << 8)))
+        return false;
+    }
+    return true;
+  }
+
+  case KEYMAP_OP_COMMIT:
+    return keymap_store_commit(s);
+
+  case KEYMAP_OP_RESET:
+    return keymap_store_reset(s);
+
+  case KEYMAP_OP_DISCARD:
+    s.staged = 0;
+    return true;
+  }
+  return false;
+}
+
+void keymap_store_set_report(keymap_store_t &s, const uint8_t *buffer, uint16_t len)
+{
+  if (len < 1)
+    return;
+  s.last_op = buffer[0];
+  s.last_ok = run_op(s, buffer, len);
+}
+
+uint16_t keymap_store_get_report(const keymap_store_t &s, uint8_t *buffer, uint16_t len)
+{
+  if (len < KEYMAP_REPORT_LEN)
+    return 0;
+
+  keymap_store_status_t status;
+  memset(&status, 0, sizeof(status));
+  status.version = KEYMAP_STORE_VERSION;
+  status.count = s.keymap.count;
+  status.staged = s.staged;
+  status.sequence = s.image && s.image->count ? s.image->sequence : 0;
+  status.erases = s.erases;
+  status.failed = s.failed;
+  status.last_op = s.last_op;
+  status.last_ok = s.last_ok;
+
+  memset(buffer, 0, KEYMAP_REPORT_LEN);
+  memcpy(buffer, &status, sizeof(status));
+  return KEYMAP_REPORT_LEN;
+}
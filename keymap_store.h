@@ -0,0 +1,156 @@
+#ifndef KEYMAP_STORE_H_
+#define KEYMAP_STORE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "hal.h"
+#include "layer.h"
+#include "usb_descriptors.h"
+
+/** --------------------------------------------------------------------+ */
+/** Keymap store */
+/** --------------------------------------------------------------------+ */
+/** The keymap can be changed without reflashing. The host sends edits over
+ * a vendor feature report, and each commit appends a complete image of the
+ * layers to a log in its part of the flash config region (hal.h). The log
+ * never rewrites anything in place:
+ *  - The region is cut into fixed size slots, one image each, and a commit
+ *    programs the next erased slot. A sector is only erased when the log
+ *    moves into it, so one erase covers every slot in the sector, and the
+ *    log goes round all the sectors so they wear evenly.
+ *  - An image has a CRC-32 and a sequence number. The newest one with a
+ *    good CRC is the keymap. Its first page, which holds the CRC, is
+ *    programmed last. A write cut short by a power loss leaves a bad CRC,
+ *    and the image before it is still the keymap.
+ *  - The sector holding the keymap is never the one erased.
+ *  - A reset writes an image with no layers, which says to use the
+ *    compiled-in keymap, whatever it is in the firmware running.
+ * An image is laid out the way layer_keymap_t wants it, so the keymap is
+ * read in place through XIP and never copied to RAM. A lookup is the same
+ * array index as on the compiled-in tables, which are in flash too. With
+ * no good image in the store the compiled-in keymap is used. */
+#define KEYMAP_STORE_MAGIC 0x50414d4b /** "KMAP" */
+#define KEYMAP_STORE_VERSION 1
+
+/** The store has the last KEYMAP_STORE_SECTORS sectors of the config
+ * region, where it has always been; telemetry snapshots go in front. */
+#ifndef KEYMAP_STORE_SECTORS
+#define KEYMAP_STORE_SECTORS 4
+#endif
+#define KEYMAP_STORE_OFFSET (HAL_FLASH_CONFIG_SIZE - KEYMAP_STORE_SECTORS * HAL_FLASH_SECTOR_SIZE)
+static_assert(KEYMAP_STORE_SECTORS <= HAL_FLASH_CONFIG_SECTORS,
+              "the keymap store has to fit the config region");
+
+/** Edits one commit can carry. */
+#ifndef KEYMAP_STORE_EDITS
+#define KEYMAP_STORE_EDITS 32
+#endif
+
+/** The start of an image. The layers follow it. Only naturally aligned
+ * fixed width fields, so the layout is the same on the RP2040 and on a
+ * little endian host. */
+struct keymap_image_t
+{
+  uint32_t magic;
+  /** CRC-32 of everything after it, layers included. */
+  uint32_t crc;
+  uint16_t version;
+  uint8_t count;
+  uint8_t reserved;
+  uint32_t sequence;
+  matrix_t tap_hold_keys;
+  uint8_t key_layers[LAYER_KEYS];
+};
+static_assert(sizeof(keymap_image_t) % 4 == 0, "the layers after the header must stay aligned");
+
+struct keymap_edit_t
+{
+  uint8_t layer;
+  uint8_t pos;
+  action_t action;
+};
+
+struct keymap_store_t
+{
+  /** The compiled-in keymap, what an image has to match in layer count and
+   * what a reset goes back to. */
+  const layer_keymap_t *defaults;
+  /** What layer_t and taphold_t are given: the defaults, or the newest
+   * image, pointed at in flash. A commit changes it in place. */
+  layer_keymap_t keymap;
+  /** The newest image and where it is, NULL without one. A reset image
+   * leaves the keymap on the defaults. */
+  const keymap_image_t *image;
+  uint16_t image_slot;
+  /** Slot size in bytes, slots per sector, and the slot the next commit
+   * tries first. */
+  uint16_t slot_size;
+  uint16_t sector_slots;
+  uint16_t next_slot;
+  /** Edits waiting for a commit. */
+  keymap_edit_t edits[KEYMAP_STORE_EDITS];
+  uint8_t staged;
+  /** Since boot: sectors erased, and slots written that did not read back
+   * right. */
+  uint32_t erases;
+  uint32_t failed;
+  /** The last vendor report op and whether it went through. */
+  uint8_t last_op;
+  bool last_ok;
+};
+
+/** Find the newest good image in flash and use it, or defaults. */
+void keymap_store_init(keymap_store_t &s, const layer_keymap_t &defaults);
+
+/** Stage action for pos on layer. False if there is no such key or layer,
+ * or no room for another edit. */
+bool keymap_store_edit(keymap_store_t &s, uint layer, uint pos, action_t action);
+
+/** Write the keymap with the staged edits on top as a new image and switch
+ * to it. False if no slot could be written, which leaves the keymap and
+ * the edits as they were. */
+bool keymap_store_commit(keymap_store_t &s);
+
+/** Drop the staged edits and go back to the compiled-in keymap, by writing
+ * a reset image. False if no slot could be written. */
+bool keymap_store_reset(keymap_store_t &s);
+
+/** --------------------------------------------------------------------+ */
+/** Vendor report */
+/** --------------------------------------------------------------------+ */
+/** SET_REPORT of REPORT_ID_KEYMAP, byte 0 is the op:
+ *  - KEYMAP_OP_EDIT, count, then count edits of layer, pos, action (low
+ *    byte first), at most KEYMAP_REPORT_EDITS.
+ *  - KEYMAP_OP_COMMIT: keymap_store_commit().
+ *  - KEYMAP_OP_RESET: back to the compiled-in keymap.
+ *  - KEYMAP_OP_DISCARD: drop the staged edits.
+ * GET_REPORT returns keymap_store_status_t, which says whether the last op
+ * went through. */
+#define KEYMAP_OP_EDIT 1
+#define KEYMAP_OP_COMMIT 2
+#define KEYMAP_OP_RESET 3
+#define KEYMAP_OP_DISCARD 4
+#define KEYMAP_REPORT_EDITS ((KEYMAP_REPORT_LEN - 2) / 4)
+
+struct keymap_store_status_t
+{
+  uint16_t version;
+  uint8_t count;
+  uint8_t staged;
+  /** Of the image in use, 0 for the compiled-in keymap. */
+  uint32_t sequence;
+  uint32_t erases;
+  uint32_t failed;
+  uint8_t last_op;
+  uint8_t last_ok;
+};
+static_assert(sizeof(keymap_store_status_t) <= KEYMAP_REPORT_LEN, "the status has to fit the report");
+
+/** Run the op in a SET_REPORT. */
+void keymap_store_set_report(keymap_store_t &s, const uint8_t *buffer, uint16_t len);
+
+/** Fill buffer with the status. Returns the report length. */
+uint16_t keymap_store_get_report(const keymap_store_t &s, uint8_t *buffer, uint16_t len);
+
+#endif /* KEYMAP_STORE_H_ */
@@ -0,0 +1,211 @@
+#include <string.h>
+
+#include "hal.h"
+#include "latency.h"
+
+#if KEYBOARD_LATENCY
+
+static latency_stats_t stats;
+/** The copy being paged out to the host. */
+static latency_stats_t snapshot;
+static uint8_t next_page;
+static const governor_t *governor;
+static const sched_task_t *tasks[LATENCY_TASKS];
+static uint task_count;
+
+/** Scan side: keys whose raw state disagrees with the debounced state, and
+ * when each one started to. */
+static matrix_t detecting;
+static uint32_t detect_us[MATRIX_WORDS * 32];
+
+/** Report side: detect times of the events applied since the last report,
+ * and of the ones riding in each interface's report. */
+struct latency_batch_t
+{
+  uint8_t count;
+  uint32_t queued_us;
+  uint32_t detect_us[LATENCY_INFLIGHT];
+  uint32_t accept_us[LATENCY_INFLIGHT];
+};
+
+static latency_batch_t applied;
+static latency_batch_t inflight[ITF_NUM_HID];
+
+static void record(uint stage, uint32_t us)
+{
+  uint bucket = us / LATENCY_BUCKET_US;
+  stats.histogram[stage][bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+  if (us > stats.max_us[stage])
+    stats.max_us[stage] = us;
+}
+
+void latency_init(void)
+{
+  memset(&stats, 0, sizeof(stats));
+  stats.version = LATENCY_VERSION;
+  stats.size = sizeof(stats);
+  stats.bucket_us = LATENCY_BUCKET_US;
+  stats.buckets = LATENCY_BUCKETS;
+  stats.stages = LATENCY_STAGES;
+  snapshot = stats;
+  next_page = 0;
+  task_count = 0;
+
+  detecting = {};
+  memset(&applied, 0, sizeof(applied));
+  memset(inflight, 0, sizeof(inflight));
+}
+
+/** --------------------------------------------------------------------+ */
+/** Scan side */
+/** --------------------------------------------------------------------+ */
+void latency_scan(const matrix_t &raw, const matrix_t &debounced, uint64_t now_us)
+{
+  for (uint w = 0; w < MATRIX_WORDS; w++)
+  {
+    uint32_t disagree = raw.words[w] ^ debounced.words[w];
+    uint32_t started = disagree & ~detecting.words[w];
+    detecting.words[w] = disagree;
+    while (started)
+    {
+      uint bit = __builtin_ctz(started);
+      started &= started - 1;
+      detect_us[w * 32 + bit] = (uint32_t)now_us;
+    }
+  }
+}
+
+uint32_t latency_detect_us(uint pos, uint32_t now_us)
+{
+  if ((detecting.words[pos >> 5] >> (pos & 31)) & 1)
+    return detect_us[pos];
+  return now_us;
+}
+
+void latency_accepted(const key_event_t &e)
+{
+  detecting.words[e.pos >> 5] &= ~(1u << (e.pos & 31));
+  record(LATENCY_DEBOUNCE, e.time_us - e.detect_us);
+}
+
+/** --------------------------------------------------------------------+ */
+/** Report side */
+/** --------------------------------------------------------------------+ */
+void latency_applied(const key_event_t &e)
+{
+  if (applied.count == LATENCY_INFLIGHT)
+  {
+    stats.untracked++;
+    return;
+  }
+  applied.detect_us[applied.count] = e.detect_us;
+  applied.accept_us[applied.count] = e.time_us;
+  applied.count++;
+}
+
+void latency_report_queued(uint8_t instance, uint64_t now_us)
+{
+  latency_batch_t &batch = inflight[instance];
+  /** A completion that never came, the keys in it are lost to the stats. */
+  stats.untracked += batch.count;
+
+  batch = applied;
+  batch.queued_us = (uint32_t)now_us;
+  applied.count = 0;
+  for (uint i = 0; i < batch.count; i++)
+    record(LATENCY_QUEUE, batch.queued_us - batch.accept_us[i]);
+}
+
+void latency_discard_applied(void)
+{
+  applied.count = 0;
+}
+
+void latency_report_complete(uint8_t instance, uint64_t now_us)
+{
+  latency_batch_t &batch = inflight[instance];
+  uint32_t now = (uint32_t)now_us;
+  for (uint i = 0; i < batch.count; i++)
+  {
+    record(LATENCY_USB, now - batch.queued_us);
+    record(LATENCY_TOTAL, now - batch.detect_us[i]);
+  }
+  stats.keystrokes += batch.count;
+  batch.count = 0;
+}
+
+void latency_missed_ready(void)
+{
+  stats.missed_ready++;
+}
+
+void latency_overrun(void)
+{
+  stats.overruns++;
+}
+
+void latency_governor(const governor_t *g)
+{
+  governor = g;
+}
+
+void latency_tasks(const sched_task_t *t, uint count)
+{
+  for (uint i = 0; i < count && task_count < LATENCY_TASKS; i++)
+    tasks[task_count++] = &t[i];
+}
+
+const latency_stats_t &latency_stats(void)
+{
+  return stats;
+}
+
+/** --------------------------------------------------------------------+ */
+/** Export */
+/** --------------------------------------------------------------------+ */
+void latency_select_page(uint8_t page)
+{
+  next_page = page;
+}
+
+uint16_t latency_read_page(uint8_t *buffer, uint16_t len)
+{
+  if (len < LATENCY_REPORT_LEN)
+    return 0;
+
+  uint8_t page = next_page < LATENCY_PAGES ? next_page : 0;
+  if (page == 0)
+  {
+    snapshot = stats;
+    /** Read from the other core in dual core builds: the counters are only
+     * as consistent as the stats are. */
+    if (governor)
+    {
+      uint64_t now = hal_time_us();
+      snapshot.scan_period_us = governor_period_us(*governor);
+      for (uint b = 0; b < GOVERNOR_BANDS; b++)
+        snapshot.scan_band_ms[b] = (uint32_t)(governor_band_us(*governor, b, now) / 1000);
+    }
+    for (uint i = 0; i < task_count; i++)
+    {
+      const sched_task_t &t = *tasks[i];
+      if (!t.periods)
+        continue;
+      snapshot.task_period_min_us[i] = t.period_min_us;
+      snapshot.task_period_mean_us[i] = sched_period_mean_us(t);
+      snapshot.task_period_max_us[i] = t.period_max_us;
+    }
+  }
+
+  memset(buffer, 0, LATENCY_REPORT_LEN);
+  buffer[0] = page;
+  size_t offset = page * LATENCY_PAGE_BYTES;
+  size_t n = sizeof(snapshot) - offset;
+  memcpy(buffer + 1, (const uint8_t *)&snapshot + offset,
+         n < LATENCY_PAGE_BYTES ? n : LATENCY_PAGE_BYTES);
+
+  next_page = page + 1;
+  return LATENCY_REPORT_LEN;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "governor.h"
+#include "scheduler.h"
+#include "usb_descriptors.h"
+
+/** --------------------------------------------------------------------+ */
+/** Keystroke latency instrumentation */
+/** --------------------------------------------------------------------+ */
+/** Built with KEYBOARD_LATENCY=1, every keystroke is timestamped when the
+ * scan first sees the switch disagree with the debounced state, when the
+ * debouncer accepts it, when the report carrying it is queued and when that
+ * report completes. The time between stages goes into fixed bucket
+ * histograms that the host reads back as a vendor feature report (see
+ * host/latency_reader.cpp). With KEYBOARD_LATENCY=0 none of this is compiled
+ * in. */
+#ifndef KEYBOARD_LATENCY
+#define KEYBOARD_LATENCY 0
+#endif
+
+#ifndef LATENCY_BUCKET_US
+#define LATENCY_BUCKET_US 250
+#endif
+/** The last bucket also counts everything past the end. */
+#define LATENCY_BUCKETS 16
+/** Keystrokes one report can carry through to its completion. */
+#define LATENCY_INFLIGHT 16
+/** Scheduler tasks whose loop periods go out with the stats: scan,
+ * debounce and report. */
+#define LATENCY_TASKS 3
+
+/** The stages, each one a histogram. */
+enum
+{
+  LATENCY_DEBOUNCE, /** raw detect -> debounce accept */
+  LATENCY_QUEUE,    /** debounce accept -> report queued */
+  LATENCY_USB,      /** report queued -> report complete */
+  LATENCY_TOTAL,    /** raw detect -> report complete */
+  LATENCY_STAGES
+};
+
+#define LATENCY_VERSION 3
+
+/** What the host reads. Only naturally aligned fixed width fields, so the
+ * layout is the same on the RP2040 and on a little endian host. */
+struct latency_stats_t
+{
+  uint16_t version;
+  uint16_t size;
+  uint16_t bucket_us;
+  uint8_t buckets;
+  uint8_t stages;
+  /** Keystrokes that made it into every histogram. */
+  uint32_t keystrokes;
+  /** Report runs that had events waiting but found the endpoint busy. */
+  uint32_t missed_ready;
+  /** Scheduler deadlines missed by a whole period. */
+  uint32_t overruns;
+  /** Keystrokes that could not be followed to completion. */
+  uint32_t untracked;
+  /** The scan rate governor as of the read: the scan period now and the
+   * time spent in each band, in ms. All 0 without KEYBOARD_GOVERNOR. */
+  uint32_t scan_period_us;
+  uint32_t scan_band_ms[GOVERNOR_BANDS];
+  /** Time between the starts of consecutive runs of each scheduler task,
+   * in the order they were handed to latency_tasks(). All 0 for a task that
+   * has not run twice. */
+  uint32_t task_period_min_us[LATENCY_TASKS];
+  uint32_t task_period_mean_us[LATENCY_TASKS];
+  uint32_t task_period_max_us[LATENCY_TASKS];
+  uint32_t max_us[LATENCY_STAGES];
+  uint32_t histogram[LATENCY_STAGES][LATENCY_BUCKETS];
+};
+
+/** The stats go out in pages, one per GET_REPORT of REPORT_ID_LATENCY:
+ * byte 0 is the page number, the rest is the next slice of the struct. A
+ * SET_REPORT with a page number picks where the next read starts, reading
+ * page 0 takes the snapshot the following pages come from. */
+#define LATENCY_PAGE_BYTES (LATENCY_REPORT_LEN - 1)
+#define LATENCY_PAGES ((sizeof(latency_stats_t) + LATENCY_PAGE_BYTES - 1) / LATENCY_PAGE_BYTES)
+
+#if KEYBOARD_LATENCY
+#include "matrix.h"
+#include "event_queue.h"
+
+void latency_init(void);
+
+/** Scan side: note the time of every key whose raw state has started to
+ * disagree with the debounced state. */
+void latency_scan(const matrix_t &raw, const matrix_t &debounced, uint64_t now_us);
+
+/** Scan side: when the change at pos was first seen, or now_us if it was
+ * not. */
+uint32_t latency_detect_us(uint pos, uint32_t now_us);
+
+/** Scan side: an event has been queued. */
+void latency_accepted(const key_event_t &e);
+
+/** Report side: an event has been applied to the next report. */
+void latency_applied(const key_event_t &e);
+
+/** Report side: the report carrying the applied events was queued. */
+void latency_report_queued(uint8_t instance, uint64_t now_us);
+
+/** Report side: the applied events did not change the report (a layer key,
+ * say), so there is nothing to follow. */
+void latency_discard_applied(void);
+
+/** Report side: the report on instance has been taken by the host. */
+void latency_report_complete(uint8_t instance, uint64_t now_us);
+
+void latency_missed_ready(void);
+void latency_overrun(void);
+
+/** The governor whose counters go out with the stats. */
+void latency_governor(const governor_t *g);
+
+/** Scheduler tasks whose periods go out with the stats, after the ones
+ * already given (up to LATENCY_TASKS in all). latency_init() forgets them. */
+void latency_tasks(const sched_task_t *tasks, uint count);
+
+/** Current totals. */
+const latency_stats_t &latency_stats(void);
+
+/** Pick the page the next latency_read_page() returns. */
+void latency_select_page(uint8_t page);
+
+/** Fill buffer with the selected page and move on to the next one. Returns
+ * the report length. */
+uint16_t latency_read_page(uint8_t *buffer, uint16_t len);
+#endif
+
+#endif /* LATENCY_H_ */
@@ -0,0 +1,81 @@
+#include <string.h>
+
+#include "layer.h"
+
+/** Recompute the active layers from what is holding each one on. */
+static void update_active(layer_t &l)
+{
+  uint8_t held = 0;
+  for (uint layer = 0; layer < LAYER_MAX; layer++)
+  {
+    if (l.holds[layer])
+      held |= 1 << layer;
+  }
+  l.active = 1 | l.toggled | l.oneshot | held;
+}
+
+void layer_init(layer_t &l, const layer_keymap_t &keymap)
+{
+  memset(&l, 0, sizeof(l));
+  l.keymap = &keymap;
+  l.active = 1;
+}
+
+action_t layer_press(layer_t &l, uint pos)
+{
+  return layer_press_action(l, pos, layer_resolve(l, pos));
+}
+
+action_t layer_press_action(layer_t &l, uint pos, action_t action)
+{
+  l.locked[pos] = action;
+
+  uint layer = ACTION_ARG(action);
+  switch (ACTION_KIND(action))
+  {
+  case ACTION_MOMENTARY:
+    if (layer < l.keymap->count)
+      l.holds[layer]++;
+    break;
+
+  case ACTION_TOGGLE:
+    if (layer < l.keymap->count)
+      l.toggled ^= 1 << layer;
+    break;
+
+  case ACTION_ONESHOT:
+    /** Held, it works like MO. Tapped, the layer stays armed until the
+     * next key press has resolved against it. */
+    if (layer < l.keymap->count)
+    {
+      l.holds[layer]++;
+      l.oneshot |= 1 << layer;
+    }
+    break;
+
+  default:
+    /** Any other key uses up the one shot layers. */
+    l.oneshot = 0;
+    break;
+  }
+  update_active(l);
+  return action;
+}
+
+action_t layer_release(layer_t &l, uint pos)
+{
+  action_t action = l.locked[pos];
+  l.locked[pos] = 0;
+
+  uint layer = ACTION_ARG(action);
+  switch (ACTION_KIND(action))
+  {
+  case ACTION_MOMENTARY:
+  case ACTION_ONESHOT:
+    if (layer < l.keymap->count && l.holds[layer])
+      l.holds[layer]--;
+    break;
+  }
+  update_active(l);
+  return action;
+}
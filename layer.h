@@ -0,0 +1,173 @@
+#ifndef LAYER_H_
+#define LAYER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <array>
+
+#include "matrix.h"
+
+/** --------------------------------------------------------------------+ */
+/** Keymap layers */
+/** --------------------------------------------------------------------+ */
+/** Every key position has an action on each layer. An action is either a
+ * HID usage or one of the layer actions below:
+ *  - MO(n): layer n is on while the key is held.
+ *  - TG(n): each press flips layer n on or off.
+ *  - OSL(n): layer n is on for the next key press only (or while held).
+ *  - KC_TRNS: fall through to the next active layer down.
+ *  - MT(mods, usage), LT(n, usage): dual role, tapped it sends usage, held
+ *    it holds the modifiers or layer n. taphold.h makes the call.
+ *  - MACRO(n): play macro n, see macro.h.
+ *  - CONSUMER(usage): a consumer control usage (media keys), one of the
+ *    first 256 of the page.
+ *  - MOUSE_KEY(n): mouse key n, see mousekey.h.
+ * A key resolves against the highest active layer that does not leave it
+ * transparent, and keeps that action until it is released, so layer changes
+ * while a key is held never change what the key sends. */
+typedef uint16_t action_t;
+
+/** Dual role actions need the low byte for the tap usage and bits above it
+ * for the hold, so they take the top two bits as their kind. */
+#define ACTION_KIND(action) ((action) & 0x8000 ? (action) & 0xc000 : (action) & 0xff00)
+#define ACTION_ARG(action) ((action) & 0x00ff)
+#define ACTION_HOLD_ARG(action) (((action) >> 8) & 0x1f)
+
+#define ACTION_USAGE 0x0000
+#define ACTION_TRANSPARENT 0x0100
+#define ACTION_MOMENTARY 0x0200
+#define ACTION_TOGGLE 0x0300
+#define ACTION_ONESHOT 0x0400
+#define ACTION_MACRO 0x0500
+#define ACTION_CONSUMER 0x0600
+#define ACTION_MOUSE 0x0700
+#define ACTION_MOD_TAP 0x8000
+#define ACTION_LAYER_TAP 0xc000
+
+#define KC_TRNS ACTION_TRANSPARENT
+#define MO(layer) (ACTION_MOMENTARY | (layer))
+#define TG(layer) (ACTION_TOGGLE | (layer))
+#define OSL(layer) (ACTION_ONESHOT | (layer))
+#define MACRO(n) (ACTION_MACRO | (n))
+#define CONSUMER(usage) (ACTION_CONSUMER | (usage))
+#define MOUSE_KEY(n) (ACTION_MOUSE | (n))
+#define MT(mods, usage) (ACTION_MOD_TAP | ((mods) << 8) | (usage))
+#define LT(layer, usage) (ACTION_LAYER_TAP | ((layer) << 8) | (usage))
+
+/** Modifiers for MT(): Ctrl, Shift, Alt and GUI, or'd together, with
+ * MOD_RIGHT making them the right hand ones. */
+#define MOD_CTRL 0x01
+#define MOD_SHIFT 0x02
+#define MOD_ALT 0x04
+#define MOD_GUI 0x08
+#define MOD_RIGHT 0x10
+#define MOD_LCTL MOD_CTRL
+#define MOD_LSFT MOD_SHIFT
+#define MOD_LALT MOD_ALT
+#define MOD_LGUI MOD_GUI
+#define MOD_RCTL (MOD_RIGHT | MOD_CTRL)
+#define MOD_RSFT (MOD_RIGHT | MOD_SHIFT)
+#define MOD_RALT (MOD_RIGHT | MOD_ALT)
+#define MOD_RGUI (MOD_RIGHT | MOD_GUI)
+
+/** The HID modifier byte an MT() action holds. */
+constexpr uint8_t action_hold_modifier(action_t action)
+{
+  uint mods = ACTION_HOLD_ARG(action);
+  return (uint8_t)((mods & 0x0f) << (mods & MOD_RIGHT ? 4 : 0));
+}
+
+constexpr bool action_is_tap_hold(action_t action)
+{
+  return action & 0x8000;
+}
+
+/** Layer state is a byte, bit n for layer n. Layer 0 is always on. */
+#define LAYER_MAX 8
+#define LAYER_KEYS (MATRIX_WORDS * 32)
+
+typedef std::array<action_t, LAYER_KEYS> layer_table_t;
+
+struct layer_keymap_t
+{
+  /** Actions by layer then MATRIX_POS. */
+  const layer_table_t *layers;
+  uint8_t count;
+  /** For each MATRIX_POS, bit n set if layer n has a non transparent action
+   * there. Bit 0 is always set. */
+  const uint8_t *key_layers;
+  /** Keys that are dual role on some layer. Every other key skips the tap
+   * hold engine entirely. */
+  matrix_t tap_hold_keys;
+};
+
+struct layer_t
+{
+  const layer_keymap_t *keymap;
+  /** The layers currently on, and the parts that make them up. */
+  uint8_t active;
+  uint8_t toggled;
+  uint8_t oneshot;
+  /** How many MO/OSL keys are holding each layer on. */
+  uint8_t holds[LAYER_MAX];
+  /** The action each key resolved to when it was pressed. */
+  action_t locked[LAYER_KEYS];
+};
+
+void layer_init(layer_t &l, const layer_keymap_t &keymap);
+
+/** The action pos would get if it were pressed now. Constant time: one mask
+ * and a count leading zeros picks the layer. */
+inline action_t layer_resolve(const layer_t &l, uint pos)
+{
+  uint32_t mask = l.active & l.keymap->key_layers[pos];
+  return l.keymap->layers[31 - __builtin_clz(mask | 1)][pos];
+}
+
+/** Resolve and lock in the action of a pressed key, applying any layer
+ * change it makes. Returns the action. */
+action_t layer_press(layer_t &l, uint pos);
+
+/** Press pos with an action already decided on (a dual role key's tap or
+ * hold, see taphold.h) instead of resolving it. */
+action_t layer_press_action(layer_t &l, uint pos, action_t action);
+
+/** Release a key, undoing its layer change if it made one. Returns the
+ * action it was pressed with. */
+action_t layer_release(layer_t &l, uint pos);
+
+/** Build the per-key layer masks of a keymap at compile time. */
+template <size_t N>
+consteval std::array<uint8_t, LAYER_KEYS> layer_key_masks(const std::array<layer_table_t, N> &layers)
+{
+  static_assert(N > 0 && N <= LAYER_MAX, "a keymap has 1 to LAYER_MAX layers");
+  std::array<uint8_t, LAYER_KEYS> masks{};
+  for (size_t pos = 0; pos < LAYER_KEYS; pos++)
+  {
+    masks[pos] = 1;
+    for (size_t layer = 1; layer < N; layer++)
+    {
+      if (layers[layer][pos] != KC_TRNS)
+        masks[pos] |= 1 << layer;
+    }
+  }
+  return masks;
+}
+
+/** The keys that are dual role on any layer, at compile time. */
+template <size_t N>
+consteval matrix_t layer_tap_hold_keys(const std::array<layer_table_t, N> &layers)
+{
+  matrix_t keys{};
+  for (size_t layer = 0; layer < N; layer++)
+  {
+    for (size_t pos = 0; pos < LAYER_KEYS; pos++)
+    {
+      if (action_is_tap_hold(layers[layer][pos]))
+        keys.words[pos >> 5] |= 1u << (pos & 31);
+    }
+  }
+  return keys;
+}
+
+#endif /* LAYER_H_ */
@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include "macro.h"
+
+void macro_init(macro_player_t &p, const macro_table_t &table)
+{
+  memset(&p, 0, sizeof(p));
+  p.table = &table;
+}
+
+bool macro_start(macro_player_t &p, uint n)
+{
+  if (macro_playing(p) || n >= p.table->count)
+    return false;
+  p.pc = p.table->macros[n];
+  p.typing = false;
+  p.delay_us = 0;
+  return true;
+}
+
+/** Put usage down, with modifier, to come up again on the next step. False
+ * if the live keys already hold it. */
+static bool tap(macro_player_t &p, uint8_t usage, uint8_t modifier,
+                const keyboard_report_t &live)
+{
+  if (report_has_key(live, usage))
+    return false;
+  p.tapped = true;
+  p.tapped_usage = usage;
+  p.tapped_modifier = modifier & ~p.report.modifier;
+  report_add_key(p.report, usage);
+  p.report.modifier |= modifier;
+  return true;
+}
+
+/** Stop as soon as the last step has been taken, so the next macro can
+ * start in the very next report. */
+static bool stepped(macro_player_t &p)
+{
+  if (p.typing && *p.pc == 0)
+  {
+    p.typing = false;
+    p.pc++;
+  }
+  if (!p.typing && p.pc && *p.pc == MACRO_END && report_empty(p.report) && !p.tapped)
+    p.pc = NULL;
+  return true;
+}
+
+bool macro_step(macro_player_t &p, const keyboard_report_t &live, uint32_t now_us)
+{
+  if (p.tapped)
+  {
+    report_remove_key(p.report, p.tapped_usage);
+    p.report.modifier &= ~p.tapped_modifier;
+    p.tapped = false;
+    return stepped(p);
+  }
+  if (p.delay_us)
+  {
+    if (now_us - p.delay_from_us < p.delay_us)
+      return false;
+    p.delay_us = 0;
+  }
+
+  while (p.pc)
+  {
+    if (p.typing)
+    {
+      uint8_t c = *p.pc;
+      if (c == 0)
+      {
+        p.typing = false;
+        p.pc++;
+        continue;
+      }
+      uint8_t code = macro_ascii[c & 0x7f];
+      if (!tap(p, code & ~MACRO_ASCII_SHIFT,
+               code & MACRO_ASCII_SHIFT ? KEYBOARD_MODIFIER_LEFTSHIFT : 0, live))
+        return false;
+      p.pc++;
+      return stepped(p);
+    }
+
+    uint8_t arg = p.pc[1];
+    switch (p.pc[0])
+    {
+    case MACRO_PRESS:
+      if (report_has_key(live, arg))
+        return false;
+      report_add_key(p.report, arg);
+      p.pc += 2;
+      return stepped(p);
+
+    case MACRO_RELEASE:
+      p.pc += 2;
+      if (!report_has_key(p.report, arg))
+        continue;
+      report_remove_key(p.report, arg);
+      return stepped(p);
+
+    case MACRO_TAP:
+      if (!tap(p, arg, 0, live))
+        return false;
+      p.pc += 2;
+      return stepped(p);
+
+    case MACRO_DELAY:
+      p.pc += 2;
+      p.delay_from_us = now_us;
+      p.delay_us = arg * 1000;
+      return false;
+
+    case MACRO_TYPE:
+      p.typing = true;
+      p.pc++;
+      continue;
+
+    default:
+      /** MACRO_END. Anything it left held goes up with it. */
+      p.pc = NULL;
+      if (report_empty(p.report))
+        return false;
+      p.report = {};
+      return true;
+    }
+  }
+  return false;
+}
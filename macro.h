@@ -0,0 +1,165 @@
+#ifndef MACRO_H_
+#define MACRO_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <array>
+
+#include "tusb.h"
+#include "report.h"
+
+/** --------------------------------------------------------------------+ */
+/** Macros */
+/** --------------------------------------------------------------------+ */
+/** A macro is a short byte code program in flash, one op byte and its
+ * argument:
+ *  - MACRO_PRESS usage, MACRO_RELEASE usage: hold or let go of a key.
+ *  - MACRO_TAP usage: press and release.
+ *  - MACRO_DELAY ms: wait 1 to 255 ms.
+ *  - MACRO_TYPE chars... 0: type US ASCII text, shifted where needed.
+ *  - MACRO_END.
+ * Built with macro() at compile time, so a character that can't be typed
+ * does not compile.
+ *
+ * The report side plays one step per report: every press and release the
+ * macro makes is its own report, so the host sees each one and the macro
+ * goes exactly as fast as the host polls. Live keys keep going into the
+ * same reports, the report is the macro's keys on top of them. A key can't
+ * go down twice, so a step waits while the live keys hold its usage, and a
+ * live press of a usage the macro holds waits for the macro (see
+ * keyboard_report()). Live modifiers do apply to what a macro types. */
+#define MACRO_END 0x00
+#define MACRO_PRESS 0x01
+#define MACRO_RELEASE 0x02
+#define MACRO_TAP 0x03
+#define MACRO_DELAY 0x04
+#define MACRO_TYPE 0x05
+
+/** US ASCII to usage, bit 7 set for shifted. 0 if it can't be typed. */
+#define MACRO_ASCII_SHIFT 0x80
+inline constexpr std::array<uint8_t, 128> macro_ascii = []
+{
+  std::array<uint8_t, 128> t{};
+  for (uint c = 0; c < 26; c++)
+  {
+    t['a' + c] = HID_KEY_A + c;
+    t['A' + c] = (HID_KEY_A + c) | MACRO_ASCII_SHIFT;
+  }
+  const char digits[] = "1234567890";
+  const char shifted_digits[] = "!@#$%^&*()";
+  for (uint i = 0; i < 10; i++)
+  {
+    t[digits[i]] = HID_KEY_1 + i;
+    t[shifted_digits[i]] = (HID_KEY_1 + i) | MACRO_ASCII_SHIFT;
+  }
+  struct
+  {
+    char plain;
+    char shifted;
+    uint8_t usage;
+  } const symbols[] = {
+      {' ', 0, HID_KEY_SPACE}, {'\n', 0, HID_KEY_ENTER}, {'\t', 0, HID_KEY_TAB},
+      {'-', '_', HID_KEY_MINUS}, {'=', '+', HID_KEY_EQUAL},
+      {'[', '{', HID_KEY_BRACKET_LEFT}, {']', '}', HID_KEY_BRACKET_RIGHT},
+      {'\\', '|', HID_KEY_BACKSLASH}, {';', ':', HID_KEY_SEMICOLON},
+      {'\'', '"', HID_KEY_APOSTROPHE}, {'`', '~', HID_KEY_GRAVE},
+      {',', '<', HID_KEY_COMMA}, {'.', '>', HID_KEY_PERIOD}, {'/', '?', HID_KEY_SLASH},
+  };
+  for (const auto &s : symbols)
+  {
+    t[s.plain] = s.usage;
+    if (s.shifted)
+      t[s.shifted] = s.usage | MACRO_ASCII_SHIFT;
+  }
+  return t;
+}();
+
+consteval std::array<uint8_t, 2> macro_press(uint8_t usage)
+{
+  return {MACRO_PRESS, usage};
+}
+
+consteval std::array<uint8_t, 2> macro_release(uint8_t usage)
+{
+  return {MACRO_RELEASE, usage};
+}
+
+consteval std::array<uint8_t, 2> macro_tap(uint8_t usage)
+{
+  return {MACRO_TAP, usage};
+}
+
+consteval std::array<uint8_t, 2> macro_delay(uint ms)
+{
+  if (ms == 0 || ms > 255)
+    throw "a macro delay is 1 to 255 ms";
+  return {MACRO_DELAY, (uint8_t)ms};
+}
+
+template <size_t N>
+consteval std::array<uint8_t, N + 1> macro_type(const char (&text)[N])
+{
+  std::array<uint8_t, N + 1> code{};
+  code[0] = MACRO_TYPE;
+  for (size_t i = 0; i + 1 < N; i++)
+  {
+    if ((uint8_t)text[i] >= 128 || macro_ascii[text[i]] == 0)
+      throw "character can't be typed by a macro";
+    code[i + 1] = text[i];
+  }
+  return code;
+}
+
+/** The steps joined into one program, with MACRO_END. */
+template <size_t... N>
+consteval std::array<uint8_t, (N + ... + 1)> macro(const std::array<uint8_t, N> &...steps)
+{
+  std::array<uint8_t, (N + ... + 1)> code{};
+  size_t at = 0;
+  ((std::copy(steps.begin(), steps.end(), code.begin() + at), at += N), ...);
+  code[at] = MACRO_END;
+  return code;
+}
+
+struct macro_table_t
+{
+  const uint8_t *const *macros;
+  uint8_t count;
+};
+
+struct macro_player_t
+{
+  const macro_table_t *table;
+  /** The next op, NULL when nothing is playing. While typing it is the
+   * next character instead. */
+  const uint8_t *pc;
+  bool typing;
+  /** What the macro holds down. */
+  keyboard_report_t report;
+  /** A tap or typed character that went down in the last step and comes
+   * up in the next: its usage, and the modifiers it added. */
+  bool tapped;
+  uint8_t tapped_usage;
+  uint8_t tapped_modifier;
+  /** A MACRO_DELAY: from when and how long. */
+  uint32_t delay_from_us;
+  uint32_t delay_us;
+};
+
+void macro_init(macro_player_t &p, const macro_table_t &table);
+
+/** Start macro n. False if one is still playing (or there is no n). */
+bool macro_start(macro_player_t &p, uint n);
+
+inline bool macro_playing(const macro_player_t &p)
+{
+  return p.pc != NULL || p.tapped;
+}
+
+/** Run up to the next step that changes p.report and take it. live is
+ * what the live keys put in the same report. False if the report is the
+ * same: nothing playing, a delay, or a step waiting on live. */
+bool macro_step(macro_player_t &p, const keyboard_report_t &live, uint32_t now_us);
+
+#endif /* MACRO_H_ */
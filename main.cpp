@@ -26,92 +26,90 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <vector>
-#include <map>
 
 #include "pico/stdlib.h"
+#if KEYBOARD_DUAL_CORE
+#include "pico/multicore.h"
+#include "pico/flash.h"
+#endif
 #include "bsp/board_api.h"
 #include "tusb.h"
 #include "usb_descriptors.h"
-
-using std::vector;
+#include "keyboard.h"
+#include "scheduler.h"
+#include "latency.h"
+#include "trace.h"
+#include "debug_log.h"
+#include "telemetry.h"
+#include "hal.h"
 
 /** --------------------------------------------------------------------+ */
 /** MACRO CONSTANT TYPEDEF PROTYPES */
 /** --------------------------------------------------------------------+ */
-#define POLLING_INTERVAL_MS 5
-#define GPIO_PIN_SETTLE_DELAY_US 10
-#define FN_KEY 0xff
-#define HIGH 1
-#define LOW 0
-
-void key_scan(void);
-
-/** The pins connected to each column of the key matrix. Left to right when
- * looking at the keyboard face. */
-const vector<uint> colPins{10, 9, 8, 7, 6, 5, 16, 26, 18, 19, 20, 21,
-                           22, 27, 28};
-
-/** The pins connected to each row of the key matrix. From top to bottom when
- * looking at the keyboard face. */
-const vector<uint> rowPins{11, 12, 4, 14, 15};
-
-/** keymap[col][row] */
-/** Note, The HID_KEY_NONE are padding for keys that dont actually exist. */
-const vector<vector<uint8_t>> keyMap{
-    {HID_KEY_ESCAPE, HID_KEY_TAB, HID_KEY_CAPS_LOCK, HID_KEY_SHIFT_LEFT, HID_KEY_CONTROL_LEFT},
-    {HID_KEY_1, HID_KEY_Q, HID_KEY_A, HID_KEY_NONE, HID_KEY_GUI_LEFT},
-    {HID_KEY_2, HID_KEY_W, HID_KEY_S, HID_KEY_Z},
-    {HID_KEY_3, HID_KEY_E, HID_KEY_D, HID_KEY_X, HID_KEY_ALT_LEFT},
-    {HID_KEY_4, HID_KEY_R, HID_KEY_F, HID_KEY_C},
-    {HID_KEY_5, HID_KEY_T, HID_KEY_G, HID_KEY_V},
-    {HID_KEY_6, HID_KEY_Y, HID_KEY_H, HID_KEY_B, HID_KEY_SPACE},
-    {HID_KEY_7, HID_KEY_U, HID_KEY_J, HID_KEY_N},
-    {HID_KEY_8, HID_KEY_I, HID_KEY_K, HID_KEY_M},
-    {HID_KEY_9, HID_KEY_O, HID_KEY_L, HID_KEY_COMMA},
-    {HID_KEY_0, HID_KEY_P, HID_KEY_SEMICOLON, HID_KEY_PERIOD, FN_KEY},
-    {HID_KEY_MINUS, HID_KEY_BRACKET_LEFT, HID_KEY_APOSTROPHE, HID_KEY_SHIFT_RIGHT, HID_KEY_ALT_RIGHT},
-    {HID_KEY_EQUAL, HID_KEY_BRACKET_RIGHT, HID_KEY_GRAVE, HID_KEY_NONE, HID_KEY_ARROW_LEFT},
-    {HID_KEY_PRINT_SCREEN, HID_KEY_SLASH, HID_KEY_ENTER, HID_KEY_ARROW_UP, HID_KEY_ARROW_DOWN},
-    {HID_KEY_BACKSPACE, HID_KEY_BACKSLASH, HID_KEY_NONE, HID_KEY_APPLICATION, HID_KEY_ARROW_RIGHT}};
-
-const std::map<uint8_t, uint8_t> fn_transforms{
-    {HID_KEY_1, HID_KEY_F1},
-    {HID_KEY_2, HID_KEY_F2},
-    {HID_KEY_3, HID_KEY_F3},
-    {HID_KEY_4, HID_KEY_F4},
-    {HID_KEY_5, HID_KEY_F5},
-    {HID_KEY_6, HID_KEY_F6},
-    {HID_KEY_7, HID_KEY_F7},
-    {HID_KEY_8, HID_KEY_F8},
-    {HID_KEY_9, HID_KEY_F9},
-    {HID_KEY_0, HID_KEY_F10},
-    {HID_KEY_MINUS, HID_KEY_F11},
-    {HID_KEY_EQUAL, HID_KEY_F12},
-    {HID_KEY_W, HID_KEY_ARROW_UP},
-    {HID_KEY_S, HID_KEY_ARROW_DOWN},
-    {HID_KEY_A, HID_KEY_ARROW_LEFT},
-    {HID_KEY_D, HID_KEY_ARROW_RIGHT},
-    {HID_KEY_APPLICATION, HID_KEY_DELETE},
+/** Run whichever stages are due, then sleep until the next one is. While
+ * the matrix is idle nothing is due at all: sleep until an interrupt (a row
+ * edge, or USB on core 0) and when a row edge is what it was, start the
+ * stages again from now. */
+static void run_tasks(sched_task_t *tasks, uint count)
+{
+  if (keyboard_idle())
+  {
+    hal_wait_until_us(UINT64_MAX);
+    if (!keyboard_idle())
+      sched_restart(tasks, count, hal_time_us());
+    return;
+  }
+
+  uint64_t next = sched_run_due(tasks, count);
+  hal_wait_until_us(next);
+}
+
+/** Scanning and debouncing. With the governor both go at the rate it
+ * picks after each scan, the debouncer on the same grid as the scan so it
+ * never sits on a scan it has not seen. */
+#if KEYBOARD_GOVERNOR
+#define MATRIX_TASKS                                      \
+  SCHED_TASK_PACED(keyboard_scan, keyboard_scan_period_us), \
+  SCHED_TASK_PACED(keyboard_debounce, keyboard_scan_period_us)
+#else
+#define MATRIX_TASKS                                \
+  SCHED_TASK(keyboard_scan, KEYBOARD_SCAN_PERIOD_US), \
+  SCHED_TASK(keyboard_debounce, KEYBOARD_DEBOUNCE_PERIOD_US)
+#endif
+
+#if KEYBOARD_DUAL_CORE
+/** Core 1 owns the matrix: scanning and debouncing. Its only link to core 0
+ * is the lock-free event queue, so neither core ever waits on the other. */
+static sched_task_t core1_tasks[] = {
+    MATRIX_TASKS,
 };
 
+/** Core 0 is left with USB: tud_task() and report assembly. */
+static sched_task_t tasks[] = {
+    SCHED_TASK(keyboard_report, KEYBOARD_REPORT_PERIOD_US),
+};
+
+static void core1_main(void)
+{
+  /** Lets core 0 park this core while it writes the keymap to flash. */
+  flash_safe_execute_core_init();
+  sched_init(core1_tasks, TU_ARRAY_SIZE(core1_tasks), hal_time_us());
+  while (1)
+    run_tasks(core1_tasks, TU_ARRAY_SIZE(core1_tasks));
+}
+#else
+/** The keyboard pipeline, each stage on its own period. */
+static sched_task_t tasks[] = {
+    MATRIX_TASKS,
+    SCHED_TASK(keyboard_report, KEYBOARD_REPORT_PERIOD_US),
+};
+#endif
+
 /*------------- MAIN -------------*/
 int main(void)
 {
   /** init the gpio pins and setting them up for input and output. */
-  for (auto pin : colPins)
-  {
-    gpio_init(pin);
-    gpio_set_dir(pin, GPIO_OUT);
-    gpio_put(pin, HIGH);
-  }
-
-  for (auto pin : rowPins)
-  {
-    gpio_init(pin);
-    gpio_set_dir(pin, GPIO_IN);
-    gpio_pull_up(pin);
-  }
+  keyboard_init();
 
   // led for capslock
   gpio_init(3);
@@ -127,17 +125,47 @@ int main(void)
     board_init_after_tusb();
   }
 
+#if KEYBOARD_LATENCY
+  /** Scan and debounce first, then the report, on either build. */
+#if KEYBOARD_DUAL_CORE
+  latency_tasks(core1_tasks, TU_ARRAY_SIZE(core1_tasks));
+#endif
+  latency_tasks(tasks, TU_ARRAY_SIZE(tasks));
+#endif
+
+  sched_init(tasks, TU_ARRAY_SIZE(tasks), hal_time_us());
+#if KEYBOARD_DUAL_CORE
+  multicore_launch_core1(core1_main);
+#endif
+
   while (1)
   {
     tud_task(); // tinyusb device task, needs to be called on a pico
-    key_scan(); // Scan the key matrix and send the report to the connected pc.
-
-    /** This is enforcing a delay between loops. If the time taken for
-     *  tud_task and key_scan is already greater than the time for the polling
-     *  interval then no busy waiting occurs */
-    static uint32_t last_poll_time = 0;
-    while (board_millis() - last_poll_time < POLLING_INTERVAL_MS);
-    last_poll_time = board_millis();
+#if KEYBOARD_DEBUG_LOG
+    /** Never waits: whatever does not fit in the CDC FIFO goes next time. */
+    debug_log_task();
+#endif
+#if KEYBOARD_TELEMETRY
+    /** A save stalls flash for milliseconds, so it waits for the matrix to
+     * go idle: nothing is down then and nothing is scanned. Without idle
+     * mode (the PIO backend) it waits for nothing to be down at least. */
+#if KEYBOARD_IDLE
+    if (keyboard_idle())
+#else
+    if (keyboard_quiet())
+#endif
+      telemetry_task(hal_time_us());
+#endif
+
+    /** A USB interrupt wakes the core early so tud_task() gets to handle
+     * it. */
+#if KEYBOARD_DUAL_CORE
+    /** The report stage has to keep up with core 1 and never idles. */
+    uint64_t next = sched_run_due(tasks, TU_ARRAY_SIZE(tasks));
+    hal_wait_until_us(next);
+#else
+    run_tasks(tasks, TU_ARRAY_SIZE(tasks));
+#endif
   }
 }
 
@@ -145,7 +173,12 @@ int main(void)
 /** Device callbacks */
 /** --------------------------------------------------------------------+ */
 /** Invoked when device is mounted */
-void tud_mount_cb(void) {}
+void tud_mount_cb(void)
+{
+  /** TinyUSB opens the interface in report protocol, the spec's default. */
+  keyboard_set_protocol(false);
+  DEBUG_LOG("usb mounted");
+}
 
 /** Invoked when device is unmounted */
 void tud_umount_cb(void) {}
@@ -156,120 +189,18 @@ void tud_umount_cb(void) {}
 void tud_suspend_cb(bool remote_wakeup_en)
 {
   (void)remote_wakeup_en;
+  DEBUG_LOG("usb suspended, remote wakeup %u", remote_wakeup_en);
 }
 
 /** Invoked when usb bus is resumed */
-void tud_resume_cb(void) {}
+void tud_resume_cb(void)
+{
+  DEBUG_LOG("usb resumed");
+}
 
 /** --------------------------------------------------------------------+ */
 /** USB HID */
 /** --------------------------------------------------------------------+ */
-void key_scan(void)
-{
-  /** Remote wakeup */
-  if (tud_suspended())
-  {
-    /** Originally this was done using the boot select button on the pico 
-     * but I don't want to open the keyboard to press the button so I'm
-     * just going to only scan the Esc key. */
-    gpio_put(colPins[0], LOW);
-    sleep_us(GPIO_PIN_SETTLE_DELAY_US);
-    if (gpio_get(rowPins[0]) == LOW)
-    {
-      tud_remote_wakeup();
-    }
-    gpio_put(colPins[0], HIGH);
-  }
-  else
-  {
-    if (!tud_hid_ready())
-      return;
-
-    bool fn_key_held = false;
-    bool any_key_held = false;
-    uint8_t modifiers_held = 0;
-    uint8_t key_index = 0;
-    uint8_t held_keys[6] = {HID_KEY_NONE, HID_KEY_NONE, HID_KEY_NONE,
-                            HID_KEY_NONE, HID_KEY_NONE, HID_KEY_NONE};
-
-    /** Now we can do the scanning. Set the column being scanned to LOW
-     * and then check the rows to see if any are LOW. If they are, then
-     * we know that the key at that row and column is pressed. */
-    for (int col = 0; col < colPins.size(); col++)
-    {
-      /** Pulling the column being scanned low */
-      gpio_put(colPins[col], LOW);
-      for (int row = 0; row < rowPins.size(); row++)
-      {
-        /** We have to delay for some short time otherwise we will be trying to
-         * read the pin before it has settled. */
-        sleep_us(GPIO_PIN_SETTLE_DELAY_US);
-        if (gpio_get(rowPins[row]) == LOW)
-        {
-          uint8_t key = keyMap.at(col).at(row);
-          any_key_held = true;
-
-          if (key == FN_KEY)
-          {
-            /** As far as the pc is concerned the Fn key doesn't exist.
-             * Also Fn doesn't map to a real key, it a identifer I made.
-             * So continue to the next cycle.  */
-            fn_key_held = true;
-            continue;
-          }
-
-          /** check if the key is a modifier key */
-          if (0xE0 <= key && key <= 0xE7)
-          {
-            /** Modifier keys are controlled by a bit string and we can get the
-             * bit position by subtracting 0xE0 (value of left ctrl)
-             * from the key value. */
-            modifiers_held |= (1 << (key - HID_KEY_CONTROL_LEFT));
-          }
-          /** Check if we have hit the max number of key we can send in a single
-           *  report and if so we can just break through the rest of the
-           *  loops */
-          if (key_index == 6)
-          {
-            break;
-          }
-          held_keys[key_index++] = key;
-        }
-      }
-      /** setting the column we just scanned back to high */
-      gpio_put(colPins[col], HIGH);
-    }
-
-    /** used to track if we previously sent a key report */
-    static bool has_keyboard_key = false;
-    if (any_key_held)
-    {
-      /** if the fn key is held down then go over all the keys being reported
-       * and overwrite them with the value in the fm map if it exists. */
-      if (fn_key_held)
-      {
-        for (int i = 0; i < 6; i++)
-        {
-          if (fn_transforms.contains(held_keys[i]))
-          {
-            held_keys[i] = fn_transforms.at(held_keys[i]);
-          }
-        }
-      }
-      tud_hid_keyboard_report(1, modifiers_held, held_keys);
-      has_keyboard_key = true;
-    }
-    else
-    {
-      /** send empty key report if previously has key pressed and all keys have
-       * been released now */
-      if (has_keyboard_key)
-        tud_hid_keyboard_report(1, 0, NULL);
-      has_keyboard_key = false;
-    }
-  }
-}
-
 /** Invoked when received SET_REPORT control request or
  * received data on OUT endpoint ( Report ID = 0, Type = 0 ) */
 void tud_hid_set_report_cb(
@@ -279,12 +210,38 @@ void tud_hid_set_report_cb(
     uint8_t const *buffer,
     uint16_t bufsize)
 {
-  (void)instance;
+  if (instance == ITF_NUM_NKRO && report_id == REPORT_ID_KEYMAP &&
+      report_type == HID_REPORT_TYPE_FEATURE)
+  {
+    keyboard_keymap_set_report(buffer, bufsize);
+    return;
+  }
+
+#if KEYBOARD_LATENCY
+  /** The latency reader picks the page it wants to start from. */
+  if (instance == ITF_NUM_NKRO && report_id == REPORT_ID_LATENCY &&
+      report_type == HID_REPORT_TYPE_FEATURE)
+  {
+    if (bufsize >= 1)
+      latency_select_page(buffer[0]);
+    return;
+  }
+#endif
+#if KEYBOARD_TELEMETRY
+  if (instance == ITF_NUM_NKRO && report_id == REPORT_ID_TELEMETRY &&
+      report_type == HID_REPORT_TYPE_FEATURE)
+  {
+    if (bufsize >= 1)
+      telemetry_select_page(buffer[0]);
+    return;
+  }
+#endif
 
   if (report_type == HID_REPORT_TYPE_OUTPUT)
   {
-    /** Set keyboard LED e.g Capslock, Numlock etc... */
-    if (report_id == 1)
+    /** Set keyboard LED e.g Capslock, Numlock etc... The keyboard interface
+     * has no report IDs so the LED report comes in as ID 0. */
+    if (instance == ITF_NUM_KEYBOARD && report_id == 0)
     {
       /** bufsize should be (at least) 1 */
       if (bufsize < 1)
@@ -307,6 +264,18 @@ void tud_hid_set_report_cb(
   }
 }
 
+/** Invoked when received SET_PROTOCOL request */
+/** protocol is either HID_PROTOCOL_BOOT (0) or HID_PROTOCOL_REPORT (1) */
+void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol)
+{
+  /** Only the keyboard interface has a boot protocol. */
+  if (instance == ITF_NUM_KEYBOARD)
+  {
+    DEBUG_LOG("protocol %u", protocol);
+    keyboard_set_protocol(protocol == HID_PROTOCOL_BOOT);
+  }
+}
+
 /** Invoked when received GET_REPORT control request */
 /** Application must fill buffer report's content and return its length. */
 /** Return zero will cause the stack to STALL request */
@@ -317,6 +286,39 @@ uint16_t tud_hid_get_report_cb(
     uint8_t *buffer,
     uint16_t reqlen)
 {
+  if (instance == ITF_NUM_NKRO && report_id == REPORT_ID_KEYMAP &&
+      report_type == HID_REPORT_TYPE_FEATURE)
+  {
+    return keyboard_keymap_get_report(buffer, reqlen);
+  }
+
+  /** Hosts that poll the keys instead of reading the endpoint get the
+   * last report sent, without waiting on a scan. */
+  if (report_type == HID_REPORT_TYPE_INPUT)
+    return keyboard_get_report(instance, report_id, buffer, reqlen);
+
+#if KEYBOARD_LATENCY
+  if (instance == ITF_NUM_NKRO && report_id == REPORT_ID_LATENCY &&
+      report_type == HID_REPORT_TYPE_FEATURE)
+  {
+    return latency_read_page(buffer, reqlen);
+  }
+#endif
+#if KEYBOARD_TRACE
+  if (instance == ITF_NUM_NKRO && report_id == REPORT_ID_TRACE &&
+      report_type == HID_REPORT_TYPE_FEATURE)
+  {
+    return trace_read_report(buffer, reqlen);
+  }
+#endif
+#if KEYBOARD_TELEMETRY
+  if (instance == ITF_NUM_NKRO && report_id == REPORT_ID_TELEMETRY &&
+      report_type == HID_REPORT_TYPE_FEATURE)
+  {
+    return telemetry_read_page(buffer, reqlen);
+  }
+#endif
+
   (void)instance;
   (void)report_id;
   (void)report_type;
@@ -324,4 +326,13 @@ uint16_t tud_hid_get_report_cb(
   (void)reqlen;
 
   return 0;
+}
+
+/** Invoked when a report has been sent to the host */
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+  (void)report;
+  (void)len;
+
+  keyboard_report_complete(instance);
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "hal.h"
+#include "keyboard.h"
+#include "matrix.h"
+
+/** Bit n set for every GPIO n that is a row pin. */
+static uint32_t row_bank_mask;
+
+void matrix_init(void)
+{
+  /** init the gpio pins and setting them up for input and output. */
+  for (auto pin : colPins)
+  {
+    hal_gpio_init_output(pin);
+    hal_gpio_put(pin, HIGH);
+  }
+
+  row_bank_mask = 0;
+  for (auto pin : rowPins)
+  {
+    hal_gpio_init_input_pullup(pin);
+    row_bank_mask |= 1u << pin;
+  }
+}
+
+uint8_t matrix_decode_rows(uint32_t gpio_bank)
+{
+  /** Rows are active LOW, so a pressed row is a 0 under the row mask. */
+  uint32_t low = ~gpio_bank & row_bank_mask;
+  if (low == 0)
+    return 0;
+
+  uint8_t rows = 0;
+  for (uint row = 0; row < MATRIX_ROWS; row++)
+  {
+    if (low & (1u << rowPins[row]))
+      rows |= 1 << row;
+  }
+  return rows;
+}
+
+void matrix_scan(matrix_t &out)
+{
+  out = {};
+  for (uint col = 0; col < MATRIX_COLS; col++)
+  {
+    /** Pulling the column being scanned low and giving the rows one settle
+     * delay before reading them all at once. */
+    hal_gpio_put(colPins[col], LOW);
+    hal_sleep_us(GPIO_PIN_SETTLE_DELAY_US);
+    uint32_t bank = hal_gpio_get_all();
+    hal_gpio_put(colPins[col], HIGH);
+
+    matrix_set_col(out, col, matrix_decode_rows(bank));
+  }
+}
+
+bool matrix_idle_enter(void)
+{
+  for (auto pin : colPins)
+    hal_gpio_put(pin, LOW);
+  hal_sleep_us(GPIO_PIN_SETTLE_DELAY_US);
+
+  /** Arm first and look second: a key that went down before the arming is
+   * LOW now, one that goes down after it is an edge. Either way it is seen. */
+  hal_gpio_edge_irq(row_bank_mask, true);
+  if (matrix_decode_rows(hal_gpio_get_all()) != 0)
+  {
+    matrix_idle_exit();
+    return false;
+  }
+  return true;
+}
+
+bool matrix_idle_woken(void)
+{
+  return hal_gpio_edge_pending();
+}
+
+void matrix_idle_exit(void)
+{
+  hal_gpio_edge_irq(row_bank_mask, false);
+  for (auto pin : colPins)
+    hal_gpio_put(pin, HIGH);
+}
+
+void matrix_scan_per_key(matrix_t &out)
+{
+  out = {};
+  for (uint col = 0; col < MATRIX_COLS; col++)
+  {
+    hal_gpio_put(colPins[col], LOW);
+    uint8_t rows = 0;
+    for (uint row = 0; row < MATRIX_ROWS; row++)
+    {
+      /** We have to delay for some short time otherwise we will be trying to
+       * read the pin before it has settled. */
+      hal_sleep_us(GPIO_PIN_SETTLE_DELAY_US);
+      if (hal_gpio_get(rowPins[row]) == LOW)
+        rows |= 1 << row;
+    }
+    hal_gpio_put(colPins[col], HIGH);
+
+    matrix_set_col(out, col, rows);
+  }
+}
+
+void matrix_build_strobe_table(uint32_t table[MATRIX_SNAPSHOT_WORDS])
+{
+  for (uint col = 0; col < MATRIX_SNAPSHOT_WORDS; col++)
+    table[col] = col < MATRIX_COLS ? 1u << colPins[col] : 0;
+}
+
+void matrix_decode_snapshot(const uint32_t raw[MATRIX_SNAPSHOT_WORDS],
+                            matrix_t &out)
+{
+  out = {};
+  for (uint col = 0; col < MATRIX_COLS; col++)
+    matrix_set_col(out, col, matrix_decode_rows(raw[col]));
+}
+
+matrix_t matrix_ambiguous(const matrix_t &m)
+{
+  /** Only columns with two or more rows down can be part of a rectangle. */
+  uint8_t cols[MATRIX_COLS];
+  uint8_t rows[MATRIX_COLS];
+  uint n = 0;
+  for (uint col = 0; col < MATRIX_COLS; col++)
+  {
+    uint8_t r = matrix_col(m, col);
+    if (__builtin_popcount(r) >= 2)
+    {
+      cols[n] = col;
+      rows[n++] = r;
+    }
+  }
+
+  /** Two such columns sharing two or more rows make a rectangle. */
+  uint8_t ambiguous[MATRIX_COLS] = {};
+  for (uint i = 0; i < n; i++)
+  {
+    for (uint j = i + 1; j < n; j++)
+    {
+      uint8_t shared = rows[i] & rows[j];
+      if (__builtin_popcount(shared) >= 2)
+      {
+        ambiguous[i] |= shared;
+        ambiguous[j] |= shared;
+      }
+    }
+  }
+
+  matrix_t out = {};
+  for (uint i = 0; i < n; i++)
+    matrix_set_col(out, cols[i], ambiguous[i]);
+  return out;
+}
+
+void matrix_filter_ghosts(matrix_t &raw, const matrix_t &previous)
+{
+  matrix_t ambiguous = matrix_ambiguous(raw);
+  for (uint w = 0; w < MATRIX_WORDS; w++)
+    raw.words[w] &= ~(ambiguous.words[w] & ~previous.words[w]);
+}
@@ -0,0 +1,110 @@
+#ifndef MATRIX_H_
+#define MATRIX_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/** --------------------------------------------------------------------+ */
+/** Key matrix state and scan engine */
+/** --------------------------------------------------------------------+ */
+#define MATRIX_COLS 15
+#define MATRIX_ROWS 5
+
+/** Key positions are packed as col * 8 + row, so every column's rows sit in
+ * one byte and the whole 15x5 matrix fits in four words. That keeps per
+ * column row masks a shift away while letting whole-matrix operations work a
+ * word at a time. */
+#define MATRIX_WORDS 4
+#define MATRIX_POS(col, row) ((col) * 8 + (row))
+
+struct matrix_t
+{
+  uint32_t words[MATRIX_WORDS];
+};
+
+inline uint8_t matrix_col(const matrix_t &m, uint col)
+{
+  return (uint8_t)(m.words[col >> 2] >> ((col & 3) * 8));
+}
+
+inline void matrix_set_col(matrix_t &m, uint col, uint8_t rows)
+{
+  uint shift = (col & 3) * 8;
+  m.words[col >> 2] = (m.words[col >> 2] & ~(0xffu << shift)) |
+                      ((uint32_t)rows << shift);
+}
+
+inline bool matrix_key(const matrix_t &m, uint col, uint row)
+{
+  return (m.words[col >> 2] >> ((col & 3) * 8 + row)) & 1;
+}
+
+inline bool matrix_empty(const matrix_t &m)
+{
+  return (m.words[0] | m.words[1] | m.words[2] | m.words[3]) == 0;
+}
+
+inline bool matrix_equal(const matrix_t &a, const matrix_t &b)
+{
+  return ((a.words[0] ^ b.words[0]) | (a.words[1] ^ b.words[1]) |
+          (a.words[2] ^ b.words[2]) | (a.words[3] ^ b.words[3])) == 0;
+}
+
+/** Set up the column pins as outputs (idle HIGH), the row pins as pulled up
+ * inputs and precompute the GPIO bank mask of the row pins. */
+void matrix_init(void);
+
+/** Scan the whole matrix. Each column is pulled LOW, given one settle delay
+ * and then all the row pins are sampled with a single GPIO bank read. */
+void matrix_scan(matrix_t &out);
+
+/** Idle mode: drive every column LOW and arm a falling edge interrupt on
+ * the rows, so the first key to go down wakes the core without anything
+ * being scanned. Returns false, with the matrix left ready to scan, if a row
+ * already reads LOW (a key is down). */
+bool matrix_idle_enter(void);
+
+/** A row has fallen since matrix_idle_enter(). */
+bool matrix_idle_woken(void);
+
+/** Disarm the rows and put the columns back HIGH for scanning. */
+void matrix_idle_exit(void);
+
+/** The original scan: a settle delay and a gpio_get() for every key. Kept as
+ * the reference the bank read is checked and benchmarked against. */
+void matrix_scan_per_key(matrix_t &out);
+
+/** The PIO backend (matrix_pio.cpp) captures one GPIO bank word per column
+ * plus an idle slot with every column released, so a snapshot is a power of
+ * two words long and the DMA can run it as a ring. */
+#define MATRIX_SNAPSHOT_WORDS 16
+
+/** Fill the PIO strobe table: word n is the pindirs mask that pulls
+ * colPins[n] LOW, the idle slot is 0. */
+void matrix_build_strobe_table(uint32_t table[MATRIX_SNAPSHOT_WORDS]);
+
+/** Decode a raw PIO snapshot into a matrix. */
+void matrix_decode_snapshot(const uint32_t raw[MATRIX_SNAPSHOT_WORDS],
+                            matrix_t &out);
+
+/** The matrix has no per-key diodes, so holding three corners of a rectangle
+ * (two columns sharing two rows) makes the fourth read as pressed too. With
+ * MATRIX_ANTI_GHOST each scan is checked for rectangles and keys in one are
+ * ambiguous: the ones already reported stay, new ones are held back until
+ * the ambiguity is gone. */
+#ifndef MATRIX_ANTI_GHOST
+#define MATRIX_ANTI_GHOST 1
+#endif
+
+/** Keys of m that are a corner of a rectangle. */
+matrix_t matrix_ambiguous(const matrix_t &m);
+
+/** Drop the ambiguous keys of raw that previous (the last filtered scan)
+ * did not already have. */
+void matrix_filter_ghosts(matrix_t &raw, const matrix_t &previous);
+
+/** Turn a GPIO bank read into the pressed rows of one column (bit n set for
+ * rowPins[n] reading LOW). */
+uint8_t matrix_decode_rows(uint32_t gpio_bank);
+
+#endif /* MATRIX_H_ */
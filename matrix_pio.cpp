@@ -0,0 +1,115 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+
+#include "keyboard.h"
+#include "matrix_pio.h"
+#include "matrix_scan.pio.h"
+
+/** DMA rings must be aligned to their size. */
+static uint32_t strobe_table[MATRIX_SNAPSHOT_WORDS]
+    __attribute__((aligned(MATRIX_SNAPSHOT_WORDS * 4)));
+static uint32_t snapshots[2][MATRIX_SNAPSHOT_WORDS]
+    __attribute__((aligned(2 * MATRIX_SNAPSHOT_WORDS * 4)));
+
+/** log2 of the ring sizes in bytes, for channel_config_set_ring(). */
+#define STROBE_RING_BITS 6
+#define SNAPSHOT_RING_BITS 7
+
+static PIO pio = pio0;
+static uint sm;
+static int strobe_chan;
+static int sample_chan;
+
+/** The last raw snapshot handed out, so an unchanged matrix is a 16 word
+ * compare instead of a decode. */
+static uint32_t previous[MATRIX_SNAPSHOT_WORDS];
+
+/** Run both channels for as many transfers as they can count. */
+static void dma_start(void)
+{
+  dma_channel_set_trans_count(sample_chan, UINT32_MAX, true);
+  dma_channel_set_trans_count(strobe_chan, UINT32_MAX, true);
+}
+
+void matrix_pio_init(void)
+{
+  /** Rows idle HIGH, so an all ones snapshot is an empty matrix. */
+  memset(snapshots, 0xff, sizeof(snapshots));
+  memset(previous, 0xff, sizeof(previous));
+  matrix_build_strobe_table(strobe_table);
+
+  uint32_t col_mask = 0;
+  for (auto pin : colPins)
+  {
+    pio_gpio_init(pio, pin);
+    gpio_pull_up(pin);
+    col_mask |= 1u << pin;
+  }
+
+  sm = pio_claim_unused_sm(pio, true);
+  uint offset = pio_add_program(pio, &matrix_scan_program);
+  pio_sm_config c = matrix_scan_program_get_default_config(offset);
+  sm_config_set_out_pins(&c, 0, 32);
+  sm_config_set_in_pins(&c, 0);
+  sm_config_set_out_shift(&c, true, false, 32);
+  sm_config_set_in_shift(&c, false, false, 32);
+
+  float div = (float)clock_get_hz(clk_sys) * MATRIX_PIO_SETTLE_US /
+              (1000000.0f * MATRIX_SCAN_SETTLE_CYCLES);
+  sm_config_set_clkdiv(&c, div < 1.0f ? 1.0f : div);
+
+  /** Columns output 0 whenever the pindirs mask enables them, and start
+   * released. */
+  pio_sm_set_pins_with_mask(pio, sm, 0, col_mask);
+  pio_sm_set_pindirs_with_mask(pio, sm, 0, col_mask);
+  pio_sm_init(pio, sm, offset, &c);
+
+  /** strobe table ring -> TX FIFO */
+  strobe_chan = dma_claim_unused_channel(true);
+  dma_channel_config tx = dma_channel_get_default_config(strobe_chan);
+  channel_config_set_transfer_data_size(&tx, DMA_SIZE_32);
+  channel_config_set_read_increment(&tx, true);
+  channel_config_set_write_increment(&tx, false);
+  channel_config_set_ring(&tx, false, STROBE_RING_BITS);
+  channel_config_set_dreq(&tx, pio_get_dreq(pio, sm, true));
+  dma_channel_configure(strobe_chan, &tx, &pio->txf[sm], strobe_table, 0, false);
+
+  /** RX FIFO -> snapshot ring */
+  sample_chan = dma_claim_unused_channel(true);
+  dma_channel_config rx = dma_channel_get_default_config(sample_chan);
+  channel_config_set_transfer_data_size(&rx, DMA_SIZE_32);
+  channel_config_set_read_increment(&rx, false);
+  channel_config_set_write_increment(&rx, true);
+  channel_config_set_ring(&rx, true, SNAPSHOT_RING_BITS);
+  channel_config_set_dreq(&rx, pio_get_dreq(pio, sm, false));
+  dma_channel_configure(sample_chan, &rx, snapshots, &pio->rxf[sm], 0, false);
+
+  dma_start();
+  pio_sm_set_enabled(pio, sm, true);
+}
+
+bool matrix_pio_read(matrix_t &out)
+{
+  /** UINT32_MAX transfers lasts hours at full scan rate, but not forever. */
+  if (!dma_channel_is_busy(sample_chan))
+    dma_start();
+
+  /** The half the DMA is not currently writing holds the latest complete
+   * snapshot. Copying it takes far less than the DMA needs to come back
+   * round to it, so it can't tear. */
+  uint32_t written = (dma_hw->ch[sample_chan].write_addr - (uintptr_t)snapshots) / 4;
+  const uint32_t *latest = snapshots[written < MATRIX_SNAPSHOT_WORDS ? 1 : 0];
+
+  uint32_t raw[MATRIX_SNAPSHOT_WORDS];
+  memcpy(raw, latest, sizeof(raw));
+  if (memcmp(raw, previous, sizeof(raw)) == 0)
+    return false;
+
+  memcpy(previous, raw, sizeof(raw));
+  matrix_decode_snapshot(raw, out);
+  return true;
+}
@@ -0,0 +1,26 @@
+#ifndef MATRIX_PIO_H_
+#define MATRIX_PIO_H_
+
+#include "matrix.h"
+
+/** --------------------------------------------------------------------+ */
+/** PIO + DMA matrix scan backend (MATRIX_SCAN_PIO) */
+/** --------------------------------------------------------------------+ */
+/** A PIO state machine strobes the columns and samples the rows while two DMA
+ * channels feed it the strobe table and write the samples into a double
+ * buffered snapshot ring, so scanning costs no CPU time at all. */
+
+/** Settle time given to each column before the rows are sampled. */
+#ifndef MATRIX_PIO_SETTLE_US
+#define MATRIX_PIO_SETTLE_US 2
+#endif
+
+/** Hand the column pins to the PIO and start the state machine and DMA.
+ * matrix_init() must have run first so the row pins are set up. */
+void matrix_pio_init(void);
+
+/** Decode the latest complete snapshot into out. Returns false, leaving out
+ * untouched, if the snapshot is the same as the last one read. */
+bool matrix_pio_read(matrix_t &out);
+
+#endif /* MATRIX_PIO_H_ */
@@ -0,0 +1,121 @@
+#include <string.h>
+
+#include "mousekey.h"
+
+/** How far a key held for t_us has gone, in 1/256 px: the integral of a
+ * speed that ramps from min to max px/s as (t / accel)^2, then stays at
+ * max. Integer only, the RP2040 has no FPU. */
+static uint32_t distance(uint32_t t_us, uint32_t min, uint32_t max)
+{
+  const uint32_t accel_us = MOUSEKEY_ACCEL_MS * 1000;
+  uint32_t ramp = t_us < accel_us ? t_us : accel_us;
+  /** (ramp / accel)^3 in 16.16 fixed point. */
+  uint64_t s = ((uint64_t)ramp << 16) / accel_us;
+  uint64_t cube = (s * s >> 16) * s >> 16;
+  uint64_t d = (uint64_t)min * ramp * 256 / 1000000 +
+               (uint64_t)(max - min) * MOUSEKEY_ACCEL_MS * 256 * cube / (3000ull << 16) +
+               (uint64_t)max * (t_us - ramp) * 256 / 1000000;
+  return (uint32_t)d;
+}
+
+void mousekey_init(mousekey_t &m)
+{
+  memset(&m, 0, sizeof(m));
+}
+
+/** Add step along move key k's direction to what is pending. */
+static void add(mousekey_t &m, uint k, int32_t step)
+{
+  /** Down, right and pan right are positive, and so is the wheel going
+   * up. */
+  bool positive = (k & 1) != (k == MOUSEKEY_WHEEL_UP || k == MOUSEKEY_WHEEL_DOWN);
+  m.pending[k / 2] += positive ? step : -step;
+}
+
+/** Add the motion of move key k up to at_us. */
+static void move(mousekey_t &m, uint k, uint32_t at_us)
+{
+  uint32_t t = at_us - m.down_us[k];
+  uint32_t d = k >= MOUSEKEY_WHEEL_UP ? distance(t, MOUSEKEY_WHEEL_RATE, MOUSEKEY_WHEEL_RATE)
+                                      : distance(t, MOUSEKEY_SPEED_MIN, MOUSEKEY_SPEED_MAX);
+  /** Negative if an update already went past a release. */
+  add(m, k, (int32_t)(d - m.moved[k]));
+  m.moved[k] = d;
+}
+
+void mousekey_key(mousekey_t &m, uint n, bool pressed, uint32_t at_us)
+{
+  uint16_t bit = 1 << n;
+  if (n >= MOUSEKEY_COUNT || pressed == !!(m.held & bit))
+    return;
+  if (n >= MOUSEKEY_MOVES)
+  {
+    m.held ^= bit;
+    return;
+  }
+
+  if (pressed)
+  {
+    /** The first step goes at once. */
+    m.down_us[n] = at_us;
+    m.moved[n] = 0;
+    add(m, n, 256);
+    m.held |= bit;
+    return;
+  }
+
+  move(m, n, at_us);
+  m.held &= ~bit;
+  /** A part pixel left over when the keys are let go is dropped, so it
+   * can't nudge the next move the wrong way. */
+  if (!(m.held & ((1 << MOUSEKEY_MOVES) - 1)))
+  {
+    for (int32_t &p : m.pending)
+    {
+      if (p > -256 && p < 256)
+        p = 0;
+    }
+  }
+}
+
+void mousekey_update(mousekey_t &m, uint32_t now_us)
+{
+  for (uint k = 0; k < MOUSEKEY_MOVES; k++)
+  {
+    if (m.held & (1 << k))
+      move(m, k, now_us);
+  }
+}
+
+bool mousekey_pending(const mousekey_t &m)
+{
+  if (((m.held >> MOUSEKEY_BUTTON1) & 0x1f) != m.sent_buttons)
+    return true;
+  for (int32_t p : m.pending)
+  {
+    if (p <= -256 || p >= 256)
+      return true;
+  }
+  return false;
+}
+
+void mousekey_take(mousekey_t &m, mouse_report_t &report)
+{
+  int8_t axes[4];
+  for (uint i = 0; i < 4; i++)
+  {
+    int32_t whole = m.pending[i] / 256;
+    if (whole > 127)
+      whole = 127;
+    else if (whole < -127)
+      whole = -127;
+    m.pending[i] -= whole * 256;
+    axes[i] = (int8_t)whole;
+  }
+  report.buttons = (m.held >> MOUSEKEY_BUTTON1) & 0x1f;
+  report.y = axes[0];
+  report.x = axes[1];
+  report.wheel = axes[2];
+  report.pan = axes[3];
+  m.sent_buttons = report.buttons;
+}
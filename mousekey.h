@@ -0,0 +1,88 @@
+#ifndef MOUSEKEY_H_
+#define MOUSEKEY_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/** --------------------------------------------------------------------+ */
+/** Mouse keys */
+/** --------------------------------------------------------------------+ */
+/** MOUSE_KEY(n) actions (layer.h) move the pointer or the wheel while they
+ * are held, or hold a mouse button. The pointer starts at
+ * MOUSEKEY_SPEED_MIN px/s and speeds up to MOUSEKEY_SPEED_MAX over
+ * MOUSEKEY_ACCEL_MS, quadratically, so it starts gently and never jumps.
+ * The wheel turns at MOUSEKEY_WHEEL_RATE detents/s. Both go one step as
+ * soon as the key goes down, so a tap always does something.
+ *
+ * How far a key has moved is worked out from when it went down and up, as
+ * scanned, in 1/256 px, not from how many reports went out. Whatever has
+ * built up since the last report goes out in the next one, so the pointer
+ * lands in the same place however often the host takes a mouse report. */
+#define MOUSEKEY_UP 0
+#define MOUSEKEY_DOWN 1
+#define MOUSEKEY_LEFT 2
+#define MOUSEKEY_RIGHT 3
+#define MOUSEKEY_WHEEL_UP 4
+#define MOUSEKEY_WHEEL_DOWN 5
+#define MOUSEKEY_WHEEL_LEFT 6
+#define MOUSEKEY_WHEEL_RIGHT 7
+/** Buttons 1 to 5: left, right, middle, back, forward. */
+#define MOUSEKEY_BUTTON1 8
+#define MOUSEKEY_BUTTON5 12
+#define MOUSEKEY_COUNT 13
+#define MOUSEKEY_MOVES 8
+
+#ifndef MOUSEKEY_SPEED_MIN
+#define MOUSEKEY_SPEED_MIN 100
+#endif
+#ifndef MOUSEKEY_SPEED_MAX
+#define MOUSEKEY_SPEED_MAX 1500
+#endif
+#ifndef MOUSEKEY_ACCEL_MS
+#define MOUSEKEY_ACCEL_MS 1000
+#endif
+#ifndef MOUSEKEY_WHEEL_RATE
+#define MOUSEKEY_WHEEL_RATE 16
+#endif
+
+/** The mouse report without its ID: buttons, pointer, wheel and pan. */
+struct mouse_report_t
+{
+  uint8_t buttons;
+  int8_t x;
+  int8_t y;
+  int8_t wheel;
+  int8_t pan;
+};
+
+struct mousekey_t
+{
+  /** Bit n for MOUSEKEY n, as of the last update. */
+  uint16_t held;
+  /** When each move key went down and how far it had gone by the last
+   * update, in 1/256 px or detent. */
+  uint32_t down_us[MOUSEKEY_MOVES];
+  uint32_t moved[MOUSEKEY_MOVES];
+  /** Motion not reported yet, in 1/256 px or detent: y, x, wheel and pan,
+   * each axis being what a pair of move keys drives. */
+  int32_t pending[4];
+  uint8_t sent_buttons;
+};
+
+void mousekey_init(mousekey_t &m);
+
+/** Mouse key n went down or up at at_us. */
+void mousekey_key(mousekey_t &m, uint n, bool pressed, uint32_t at_us);
+
+/** Bring the motion of the keys held up to now_us. */
+void mousekey_update(mousekey_t &m, uint32_t now_us);
+
+/** A report would say something new: a button changed, or at least a
+ * whole pixel or detent is pending. */
+bool mousekey_pending(const mousekey_t &m);
+
+/** Take the next report: the buttons and as much of the pending motion as
+ * fits, the rest stays pending. */
+void mousekey_take(mousekey_t &m, mouse_report_t &report);
+
+#endif /* MOUSEKEY_H_ */
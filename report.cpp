@@ -0,0 +1,61 @@
+#include <string.h>
+
+#include "report.h"
+
+/** HID usage reported in every slot when too many keys are held. */
+#define HID_KEY_ERROR_ROLLOVER 0x01
+
+bool report_empty(const keyboard_report_t &report)
+{
+  uint32_t any = report.modifier;
+  for (int w = 0; w < NKRO_WORDS; w++)
+    any |= report.keys[w];
+  return any == 0;
+}
+
+bool report_equal(const keyboard_report_t &a, const keyboard_report_t &b)
+{
+  uint32_t diff = a.modifier ^ b.modifier;
+  for (int w = 0; w < NKRO_WORDS; w++)
+    diff |= a.keys[w] ^ b.keys[w];
+  return diff == 0;
+}
+
+void report_update_boot(const keyboard_report_t &report, uint8_t keycode[6])
+{
+  int count = 0;
+  for (int w = 0; w < NKRO_WORDS; w++)
+    count += __builtin_popcount(report.keys[w]);
+  if (count > 6)
+  {
+    memset(keycode, HID_KEY_ERROR_ROLLOVER, 6);
+    return;
+  }
+
+  /** Keep the slots of keys that are still held, in order. Coming out of
+   * rollover there is no order left to keep. */
+  uint8_t slots[6] = {};
+  int slot = 0;
+  if (keycode[0] != HID_KEY_ERROR_ROLLOVER)
+  {
+    for (int i = 0; i < 6; i++)
+    {
+      if (keycode[i] != 0 && report_has_key(report, keycode[i]))
+        slots[slot++] = keycode[i];
+    }
+  }
+
+  /** Then append the new ones. */
+  for (int w = 0; w < NKRO_WORDS; w++)
+  {
+    uint32_t bits = report.keys[w];
+    while (bits)
+    {
+      uint8_t key = (uint8_t)(w * 32 + __builtin_ctz(bits));
+      bits &= bits - 1;
+      if (memchr(slots, key, slot) == NULL)
+        slots[slot++] = key;
+    }
+  }
+  memcpy(keycode, slots, 6);
+}
@@ -0,0 +1,65 @@
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include <stdint.h>
+
+#include "usb_descriptors.h"
+
+/** --------------------------------------------------------------------+ */
+/** Keyboard report assembly */
+/** --------------------------------------------------------------------+ */
+/** The logical keyboard state is a modifier byte plus a bitmap with one bit
+ * per usage, which is exactly the NKRO report. The 6KRO boot report is
+ * derived from it when the host is in boot protocol. */
+#define NKRO_WORDS (NKRO_KEY_COUNT / 32)
+
+struct keyboard_report_t
+{
+  uint8_t modifier;
+  uint32_t keys[NKRO_WORDS];
+};
+
+/** Add a usage to the report. Modifiers (0xE0 - 0xE7) go in the modifier
+ * byte, usage 0 and usages past the end of the bitmap are dropped. */
+inline void report_add_key(keyboard_report_t &report, uint8_t key)
+{
+  if (0xE0 <= key && key <= 0xE7)
+  {
+    /** Modifier keys are controlled by a bit string and we can get the
+     * bit position by subtracting 0xE0 (value of left ctrl)
+     * from the key value. */
+    report.modifier |= 1 << (key - 0xE0);
+  }
+  else if (key != 0 && key < NKRO_KEY_COUNT)
+  {
+    report.keys[key >> 5] |= 1u << (key & 31);
+  }
+}
+
+inline void report_remove_key(keyboard_report_t &report, uint8_t key)
+{
+  if (0xE0 <= key && key <= 0xE7)
+    report.modifier &= ~(1 << (key - 0xE0));
+  else if (key < NKRO_KEY_COUNT)
+    report.keys[key >> 5] &= ~(1u << (key & 31));
+}
+
+inline bool report_has_key(const keyboard_report_t &report, uint8_t key)
+{
+  if (0xE0 <= key && key <= 0xE7)
+    return report.modifier & (1 << (key - 0xE0));
+  return key < NKRO_KEY_COUNT && (report.keys[key >> 5] >> (key & 31)) & 1;
+}
+
+bool report_empty(const keyboard_report_t &report);
+
+bool report_equal(const keyboard_report_t &a, const keyboard_report_t &b);
+
+/** Bring the boot report slots already in keycode in line with the bitmap
+ * without reordering them: released keys are dropped and the rest shift
+ * down in the order they were pressed, new keys are appended lowest usage
+ * first. More than 6 keys is reported as ErrorRollOver in every slot, as
+ * the HID spec asks, rather than silently dropping some of them. */
+void report_update_boot(const keyboard_report_t &report, uint8_t keycode[6]);
+
+#endif /* REPORT_H_ */
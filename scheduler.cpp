@@ -0,0 +1,78 @@
+#include "hal.h"
+#include "scheduler.h"
+#include "latency.h"
+
+void sched_init(sched_task_t *tasks, uint count, uint64_t now_us)
+{
+  sched_restart(tasks, count, now_us);
+  sched_reset_stats(tasks, count);
+}
+
+uint64_t sched_run_due(sched_task_t *tasks, uint count)
+{
+  uint64_t next = UINT64_MAX;
+  for (uint i = 0; i < count; i++)
+  {
+    sched_task_t &t = tasks[i];
+    uint64_t now = hal_time_us();
+    if (now >= t.next_us)
+    {
+      if (t.runs)
+      {
+        uint32_t period = (uint32_t)(now - t.last_start_us);
+        t.period_min_us = period < t.period_min_us ? period : t.period_min_us;
+        t.period_max_us = period > t.period_max_us ? period : t.period_max_us;
+        t.period_total_us += period;
+        t.periods++;
+      }
+      t.last_start_us = now;
+      t.runs++;
+
+      t.run();
+      if (t.pace)
+        t.period_us = t.pace();
+
+      /** Stay on the period grid, unless we fell a whole period behind, in
+       * which case skip ahead rather than running back to back. */
+      t.next_us += t.period_us;
+      if (t.next_us <= now)
+      {
+        t.overruns++;
+#if KEYBOARD_LATENCY
+        latency_overrun();
+#endif
+        t.next_us = now + t.period_us;
+      }
+    }
+    next = t.next_us < next ? t.next_us : next;
+  }
+  return next;
+}
+
+uint32_t sched_period_mean_us(const sched_task_t &task)
+{
+  return task.periods ? (uint32_t)(task.period_total_us / task.periods) : 0;
+}
+
+void sched_restart(sched_task_t *tasks, uint count, uint64_t now_us)
+{
+  for (uint i = 0; i < count; i++)
+  {
+    tasks[i].next_us = now_us;
+    /** Nor is the gap a period. */
+    tasks[i].runs = 0;
+  }
+}
+
+void sched_reset_stats(sched_task_t *tasks, uint count)
+{
+  for (uint i = 0; i < count; i++)
+  {
+    tasks[i].runs = 0;
+    tasks[i].period_min_us = UINT32_MAX;
+    tasks[i].period_max_us = 0;
+    tasks[i].period_total_us = 0;
+    tasks[i].periods = 0;
+    tasks[i].overruns = 0;
+  }
+}
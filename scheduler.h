@@ -0,0 +1,59 @@
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** --------------------------------------------------------------------+ */
+/** Deadline scheduler */
+/** --------------------------------------------------------------------+ */
+/** Each task runs on its own period against microsecond deadlines. The main
+ * loop calls sched_run_due() and then sleeps until the deadline it returns
+ * (or an interrupt) instead of spinning on board_millis(). */
+struct sched_task_t
+{
+  void (*run)(void);
+  uint32_t period_us;
+  uint64_t next_us;
+  /** When set, asked for the period after every run, so a task can change
+   * its own rate from the next deadline on. */
+  uint32_t (*pace)(void);
+
+  /** Instrumentation: time between the starts of consecutive runs, and how
+   * many deadlines were missed by more than a whole period. runs counts
+   * from the last sched_restart(), periods is how many were measured. */
+  uint64_t last_start_us;
+  uint32_t runs;
+  uint32_t period_min_us;
+  uint32_t period_max_us;
+  uint64_t period_total_us;
+  uint32_t periods;
+  uint32_t overruns;
+};
+
+#define SCHED_TASK(fn, period) {fn, period, 0, NULL, 0, 0, UINT32_MAX, 0, 0, 0, 0}
+/** A task whose period pace() sets, from its first run. */
+#define SCHED_TASK_PACED(fn, pace) {fn, 0, 0, pace, 0, 0, UINT32_MAX, 0, 0, 0, 0}
+
+/** Make every task due at now_us with fresh instrumentation. Called once
+ * before the first sched_run_due(), so the time since boot does not count
+ * as a missed deadline. */
+void sched_init(sched_task_t *tasks, uint count, uint64_t now_us);
+
+/** Run every task that is due, in table order. Returns the earliest
+ * deadline of the next run. */
+uint64_t sched_run_due(sched_task_t *tasks, uint count);
+
+/** Mean period of a task so far, 0 before its second run. */
+uint32_t sched_period_mean_us(const sched_task_t &task);
+
+/** Make every task due at now_us, on a fresh grid from there. For coming
+ * back from a deliberate pause (the matrix idle): the deadlines skipped
+ * while paused are not overruns. */
+void sched_restart(sched_task_t *tasks, uint count, uint64_t now_us);
+
+/** Forget the instrumentation counters (not the deadlines). */
+void sched_reset_stats(sched_task_t *tasks, uint count);
+
+#endif /* SCHEDULER_H_ */
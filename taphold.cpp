@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "taphold.h"
+
+#define SLOT(t, i) (((t).head + (i)) & (TAPHOLD_BUFFER - 1))
+
+enum
+{
+  UNDECIDED,
+  TAP,
+  HOLD,
+};
+
+void taphold_init(taphold_t &t, const layer_keymap_t &keymap, uint32_t term_ms,
+                  uint8_t flags, uint32_t now_us)
+{
+  memset(&t, 0, sizeof(t));
+  t.keymap = &keymap;
+  t.term_us = term_ms * 1000;
+  t.flags = flags;
+  timer_wheel_init(t.timers, now_us);
+}
+
+void taphold_fill(taphold_t &t, key_event_queue_t &q)
+{
+  key_event_t e;
+  while (t.count < TAPHOLD_BUFFER && event_queue_peek(q, e))
+  {
+    uint slot = SLOT(t, t.count);
+    t.buffer[slot] = e;
+    t.count++;
+    event_queue_pop(q);
+
+    if (e.pressed && (action_is_tap_hold(e.action) ||
+                      (t.keymap->tap_hold_keys.words[e.pos >> 5] >> (e.pos & 31)) & 1))
+      timer_wheel_arm(t.timers, slot, e.time_us + t.term_us);
+  }
+}
+
+void taphold_tick(taphold_t &t, uint32_t now_us)
+{
+  t.expired |= timer_wheel_advance(t.timers, now_us);
+}
+
+/** Tap or hold for the dual role press at the front, going by what came
+ * after it in the buffer. */
+static uint decide(const taphold_t &t)
+{
+  const key_event_t &key = t.buffer[t.head];
+  matrix_t pressed_after = {};
+  for (uint i = 1; i < t.count; i++)
+  {
+    const key_event_t &e = t.buffer[SLOT(t, i)];
+    if (e.time_us - key.time_us >= t.term_us)
+      return HOLD;
+    /** The next event of the key itself can only be its release. */
+    if (e.pos == key.pos)
+      return TAP;
+
+    uint32_t mask = 1u << (e.pos & 31);
+    if (e.pressed)
+    {
+      if (t.flags & TAPHOLD_HOLD_ON_OTHER_PRESS)
+        return HOLD;
+      pressed_after.words[e.pos >> 5] |= mask;
+    }
+    else if (t.flags & TAPHOLD_PERMISSIVE_HOLD && pressed_after.words[e.pos >> 5] & mask)
+    {
+      return HOLD;
+    }
+  }
+
+  if (t.expired & (1u << t.head) || t.count == TAPHOLD_BUFFER)
+    return HOLD;
+  return UNDECIDED;
+}
+
+bool taphold_peek(taphold_t &t, const layer_t &layers, key_event_t &e, action_t &action)
+{
+  if (t.count == 0)
+    return false;
+
+  e = t.buffer[t.head];
+  action = 0;
+  if (!e.pressed)
+    return true;
+
+  /** Everything in front of it has been applied, so the layers are the
+   * ones it was pressed on. A combo brings its own action. */
+  action = e.action ? e.action : layer_resolve(layers, e.pos);
+  if (!action_is_tap_hold(action))
+    return true;
+
+  switch (decide(t))
+  {
+  case TAP:
+    action = ACTION_ARG(action);
+    return true;
+
+  case HOLD:
+    if (ACTION_KIND(action) == ACTION_LAYER_TAP)
+      action = MO(ACTION_HOLD_ARG(action));
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+void taphold_pop(taphold_t &t)
+{
+  timer_wheel_cancel(t.timers, t.head);
+  t.expired &= ~(1u << t.head);
+  t.head = SLOT(t, 1);
+  t.count--;
+}
@@ -0,0 +1,82 @@
+#ifndef TAPHOLD_H_
+#define TAPHOLD_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "event_queue.h"
+#include "layer.h"
+#include "timer_wheel.h"
+
+/** --------------------------------------------------------------------+ */
+/** Tap-hold */
+/** --------------------------------------------------------------------+ */
+/** Dual role keys (MT, LT) can't be resolved when they go down: a tap
+ * sends the usage, a hold is a modifier or layer. So on the report side
+ * events go through a buffer, and a dual role press at the front of it
+ * holds back everything behind it until its role is known:
+ *  - released within the tapping term: tap.
+ *  - still down when the term runs out: hold.
+ *  - TAPHOLD_HOLD_ON_OTHER_PRESS: any other key going down: hold.
+ *  - TAPHOLD_PERMISSIVE_HOLD: another key pressed and released while it is
+ *    down: hold.
+ * Then the buffer is replayed in order, so the keys behind it resolve
+ * against the layer or modifiers the hold turned on. Decisions go by the
+ * event timestamps, not by when the report side gets round to them. Every
+ * other key goes straight through when nothing is undecided. */
+#ifndef TAPHOLD_TERM_MS
+#define TAPHOLD_TERM_MS 200
+#endif
+
+#define TAPHOLD_PERMISSIVE_HOLD 0x01
+#define TAPHOLD_HOLD_ON_OTHER_PRESS 0x02
+#ifndef TAPHOLD_FLAGS
+#define TAPHOLD_FLAGS TAPHOLD_PERMISSIVE_HOLD
+#endif
+
+/** Events that can wait behind an undecided key. A full buffer decides it
+ * as a hold. One timer each, so no more than the wheel has. */
+#define TAPHOLD_BUFFER 32
+static_assert(TAPHOLD_BUFFER <= 32 && (TAPHOLD_BUFFER & (TAPHOLD_BUFFER - 1)) == 0,
+              "TAPHOLD_BUFFER must be a power of two no bigger than the timer wheel");
+
+struct taphold_t
+{
+  const layer_keymap_t *keymap;
+  uint32_t term_us;
+  uint8_t flags;
+
+  key_event_t buffer[TAPHOLD_BUFFER];
+  uint8_t head;
+  uint8_t count;
+
+  /** A tapping term timer for every dual role press in the buffer, named
+   * by its buffer slot, and the slots whose term has run out. */
+  timer_wheel_t timers;
+  uint32_t expired;
+};
+
+void taphold_init(taphold_t &t, const layer_keymap_t &keymap, uint32_t term_ms,
+                  uint8_t flags, uint32_t now_us);
+
+/** Take events off the scan side's queue while there is room. */
+void taphold_fill(taphold_t &t, key_event_queue_t &q);
+
+/** Run the tapping term timers up to now_us. */
+void taphold_tick(taphold_t &t, uint32_t now_us);
+
+/** The next event to apply. For a press, action is what the key locks in:
+ * its resolved action against layers (or a combo's own), or for a dual
+ * role key the tap usage or the hold (MT stays as it is, LT becomes MO).
+ * False when the buffer is empty or its front is still undecided. */
+bool taphold_peek(taphold_t &t, const layer_t &layers, key_event_t &e, action_t &action);
+
+/** Drop the event taphold_peek() returned. */
+void taphold_pop(taphold_t &t);
+
+inline bool taphold_empty(const taphold_t &t)
+{
+  return t.count == 0;
+}
+
+#endif /* TAPHOLD_H_ */
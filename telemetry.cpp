@@ -0,0 +1,252 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "hal.h"
+#include "telemetry.h"
+#include "keymap_store.h"
+#include "crc32.h"
+
+#if KEYBOARD_TELEMETRY
+
+static_assert(TELEMETRY_SECTORS * HAL_FLASH_SECTOR_SIZE <= KEYMAP_STORE_OFFSET,
+              "telemetry and the keymap store share the config region");
+
+static telemetry_stats_t stats;
+/** The copy being paged out to the host. */
+static telemetry_stats_t snapshot;
+static uint8_t next_page;
+
+/** Scan side: the debounced state as of the last run, when each key held
+ * went down, and how many changes there have been. */
+static matrix_t debounced;
+static uint32_t pressed_us[TELEMETRY_KEYS];
+static uint32_t changes;
+
+/** The image being written, the slot the next save tries first, and the
+ * changes and time as of the last save. */
+static telemetry_image_t image;
+static uint next_slot;
+static int image_slot;
+static uint32_t saved_changes;
+static uint64_t saved_us;
+
+#define SECTOR_SLOTS (HAL_FLASH_SECTOR_SIZE / TELEMETRY_SLOT_SIZE)
+
+static uint32_t slot_offset(uint slot)
+{
+  return slot / SECTOR_SLOTS * HAL_FLASH_SECTOR_SIZE + slot % SECTOR_SLOTS * TELEMETRY_SLOT_SIZE;
+}
+
+static const telemetry_image_t *slot_image(uint slot)
+{
+  return (const telemetry_image_t *)(hal_flash_config() + slot_offset(slot));
+}
+
+static uint32_t image_crc(const telemetry_image_t *i)
+{
+  uint32_t from = offsetof(telemetry_image_t, crc) + sizeof(i->crc);
+  return ~crc32_update(~0u, (const uint8_t *)i + from, sizeof(*i) - from);
+}
+
+static bool valid(uint slot)
+{
+  const telemetry_image_t *i = slot_image(slot);
+  return i->magic == TELEMETRY_MAGIC && i->version == TELEMETRY_VERSION &&
+         i->keys == TELEMETRY_KEYS && image_crc(i) == i->crc;
+}
+
+static bool erased(uint slot)
+{
+  const uint8_t *bytes = (const uint8_t *)slot_image(slot);
+  for (uint i = 0; i < TELEMETRY_SLOT_SIZE; i++)
+  {
+    if (bytes[i] != 0xff)
+      return false;
+  }
+  return true;
+}
+
+void telemetry_init(void)
+{
+  memset(&stats, 0, sizeof(stats));
+  stats.version = TELEMETRY_VERSION;
+  stats.size = sizeof(stats);
+  stats.cols = MATRIX_COLS;
+  stats.rows = MATRIX_ROWS;
+  stats.short_ms = TELEMETRY_SHORT_MS;
+  for (key_telemetry_t &k : stats.keys)
+    k.shortest_ms = TELEMETRY_NO_PRESS;
+
+  /** Carry on from the newest image. */
+  image_slot = -1;
+  for (uint slot = 0; slot < TELEMETRY_SLOTS; slot++)
+  {
+    if (valid(slot) && (image_slot < 0 || slot_image(slot)->sequence > stats.sequence))
+    {
+      image_slot = slot;
+      stats.sequence = slot_image(slot)->sequence;
+    }
+  }
+  if (image_slot >= 0)
+    memcpy(stats.keys, slot_image(image_slot)->counters, sizeof(stats.keys));
+  next_slot = image_slot < 0 ? 0 : (image_slot + 1) % TELEMETRY_SLOTS;
+  snapshot = stats;
+  next_page = 0;
+
+  debounced = {};
+  memset(pressed_us, 0, sizeof(pressed_us));
+  changes = 0;
+  saved_changes = 0;
+  saved_us = hal_time_us();
+}
+
+/** --------------------------------------------------------------------+ */
+/** Scan side */
+/** --------------------------------------------------------------------+ */
+void telemetry_scan(const matrix_t &raw, const matrix_t &previous)
+{
+  /** Every change counts as a bounce until the debouncer passes it on. */
+  for (uint w = 0; w < MATRIX_WORDS; w++)
+  {
+    uint32_t edges = raw.words[w] ^ previous.words[w];
+    while (edges)
+    {
+      uint bit = __builtin_ctz(edges);
+      edges &= edges - 1;
+      stats.keys[TELEMETRY_KEY(w * 32 + bit)].bounces++;
+    }
+  }
+}
+
+void telemetry_debounced(const matrix_t &state, uint32_t now_us)
+{
+  for (uint w = 0; w < MATRIX_WORDS; w++)
+  {
+    uint32_t changed = state.words[w] ^ debounced.words[w];
+    debounced.words[w] = state.words[w];
+    while (changed)
+    {
+      uint bit = __builtin_ctz(changed);
+      changed &= changed - 1;
+      uint key = TELEMETRY_KEY(w * 32 + bit);
+      key_telemetry_t &k = stats.keys[key];
+      k.bounces--;
+      changes++;
+      if ((state.words[w] >> bit) & 1)
+      {
+        k.presses++;
+        pressed_us[key] = now_us;
+        continue;
+      }
+      uint32_t held_ms = (now_us - pressed_us[key]) / 1000;
+      k.shortest_ms = held_ms < k.shortest_ms ? held_ms : k.shortest_ms;
+      k.short_presses += held_ms < TELEMETRY_SHORT_MS && k.short_presses != 0xffff;
+    }
+  }
+}
+
+/** --------------------------------------------------------------------+ */
+/** Flash */
+/** --------------------------------------------------------------------+ */
+/** Write the image to slot, the first page last. */
+static void write_image(uint slot)
+{
+  uint8_t page[HAL_FLASH_PAGE_SIZE];
+  uint32_t offset = slot_offset(slot);
+  for (int at = TELEMETRY_SLOT_SIZE - HAL_FLASH_PAGE_SIZE; at >= 0; at -= HAL_FLASH_PAGE_SIZE)
+  {
+    memset(page, 0xff, sizeof(page));
+    if ((size_t)at < sizeof(image))
+    {
+      size_t n = sizeof(image) - at;
+      memcpy(page, (const uint8_t *)&image + at, n < sizeof(page) ? n : sizeof(page));
+    }
+    hal_flash_program(offset + at, page, sizeof(page));
+  }
+}
+
+bool telemetry_save(void)
+{
+  /** The counters as one consistent image, whatever the scan does while
+   * it is written. */
+  image.magic = TELEMETRY_MAGIC;
+  image.version = TELEMETRY_VERSION;
+  image.keys = TELEMETRY_KEYS;
+  image.sequence = stats.sequence + 1;
+  memcpy(image.counters, stats.keys, sizeof(image.counters));
+  image.crc = image_crc(&image);
+  uint32_t at_changes = changes;
+
+  /** A slot a lost write left dirty is skipped, a new sector is erased
+   * first. Never the sector with the image in use. */
+  uint slot = next_slot;
+  for (uint tries = 0; tries < TELEMETRY_SLOTS; tries++, slot = (slot + 1) % TELEMETRY_SLOTS)
+  {
+    uint sector = slot / SECTOR_SLOTS;
+    if (slot % SECTOR_SLOTS == 0)
+    {
+      if (image_slot >= 0 && sector == (uint)image_slot / SECTOR_SLOTS)
+        return false;
+      hal_flash_erase(sector * HAL_FLASH_SECTOR_SIZE);
+    }
+    else if (!erased(slot))
+      continue;
+
+    write_image(slot);
+    if (!valid(slot) || slot_image(slot)->sequence != image.sequence)
+      continue;
+    image_slot = slot;
+    next_slot = (slot + 1) % TELEMETRY_SLOTS;
+    stats.sequence = image.sequence;
+    stats.saves++;
+    saved_changes = at_changes;
+    return true;
+  }
+  return false;
+}
+
+bool telemetry_task(uint64_t now_us)
+{
+  if (changes == saved_changes || now_us - saved_us < TELEMETRY_SAVE_US)
+    return false;
+  /** Even a save that fails waits the full period before the next try. */
+  saved_us = now_us;
+  return telemetry_save();
+}
+
+const telemetry_stats_t &telemetry_stats(void)
+{
+  return stats;
+}
+
+/** --------------------------------------------------------------------+ */
+/** Export */
+/** --------------------------------------------------------------------+ */
+void telemetry_select_page(uint8_t page)
+{
+  next_page = page;
+}
+
+uint16_t telemetry_read_page(uint8_t *buffer, uint16_t len)
+{
+  if (len < TELEMETRY_REPORT_LEN)
+    return 0;
+
+  /** Read from the other core in dual core builds: a counter is never
+   * torn, but the keys are not all from the same scan. */
+  uint8_t page = next_page < TELEMETRY_PAGES ? next_page : 0;
+  if (page == 0)
+    snapshot = stats;
+
+  memset(buffer, 0, TELEMETRY_REPORT_LEN);
+  buffer[0] = page;
+  size_t offset = page * TELEMETRY_PAGE_BYTES;
+  size_t n = sizeof(snapshot) - offset;
+  memcpy(buffer + 1, (const uint8_t *)&snapshot + offset,
+         n < TELEMETRY_PAGE_BYTES ? n : TELEMETRY_PAGE_BYTES);
+
+  next_page = page + 1;
+  return TELEMETRY_REPORT_LEN;
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "hal.h"
+#include "matrix.h"
+#include "usb_descriptors.h"
+
+/** --------------------------------------------------------------------+ */
+/** Per-key telemetry */
+/** --------------------------------------------------------------------+ */
+/** Built with KEYBOARD_TELEMETRY=1, the scan keeps a few counters for
+ * every key in the matrix, enough to spot a switch that is wearing out
+ * before it double types:
+ *  - presses the debouncer let through,
+ *  - bounces: changes the scan read that the debouncer did not pass on,
+ *  - the shortest press, and how many were under TELEMETRY_SHORT_MS. No
+ *    finger presses that briefly. A press that short is chatter that got
+ *    through the debouncer.
+ * The counters sit in one packed array, a key's entry found by arithmetic
+ * on its matrix position. A scan only touches the keys that changed, so a
+ * stable matrix costs a compare per matrix word and nothing else.
+ *
+ * Every TELEMETRY_SAVE_US at most, and only while the matrix is idle (or
+ * without idle mode, while nothing is down) so the flash stall costs no
+ * keystroke, the counters are saved to the first
+ * TELEMETRY_SECTORS sectors of the flash config region (hal.h). That works
+ * like the keymap store: images in slots, each with a CRC and sequence
+ * number, the first page programmed last. The newest good image is loaded
+ * at boot and counting carries on from it, so the counters cover the
+ * switch's life and not just the current power cycle. The host reads them
+ * as a vendor feature report (host/telemetry_reader.cpp). With
+ * KEYBOARD_TELEMETRY=0 none of this is compiled in. */
+#ifndef KEYBOARD_TELEMETRY
+#define KEYBOARD_TELEMETRY 0
+#endif
+
+#ifndef TELEMETRY_SHORT_MS
+#define TELEMETRY_SHORT_MS 20
+#endif
+#ifndef TELEMETRY_SAVE_US
+#define TELEMETRY_SAVE_US 600000000ull
+#endif
+#ifndef TELEMETRY_SECTORS
+#define TELEMETRY_SECTORS 2
+#endif
+
+/** A key is worth a look with any press under TELEMETRY_SHORT_MS, or when
+ * it bounces more than TELEMETRY_BOUNCES_PER_PRESS times a press, counted
+ * over at least TELEMETRY_MIN_PRESSES. */
+#define TELEMETRY_BOUNCES_PER_PRESS 4
+#define TELEMETRY_MIN_PRESSES 16
+
+/** Every position in the matrix, col by col. */
+#define TELEMETRY_KEYS (MATRIX_COLS * MATRIX_ROWS)
+#define TELEMETRY_KEY(pos) (((pos) >> 3) * MATRIX_ROWS + ((pos) & 7))
+static_assert(MATRIX_POS(1, 0) == 8 && MATRIX_ROWS <= 8,
+              "TELEMETRY_KEY() undoes MATRIX_POS()");
+
+/** No release seen yet. */
+#define TELEMETRY_NO_PRESS 0xffff
+
+#define TELEMETRY_MAGIC 0x594d4c54 /** "TLMY" */
+#define TELEMETRY_VERSION 1
+
+/** Only naturally aligned fixed width fields, so the layout is the same on
+ * the RP2040 and on a little endian host. */
+struct key_telemetry_t
+{
+  uint32_t presses;
+  uint32_t bounces;
+  uint16_t shortest_ms;
+  /** Presses under TELEMETRY_SHORT_MS, stops at 0xffff. */
+  uint16_t short_presses;
+};
+
+/** What the host reads. */
+struct telemetry_stats_t
+{
+  uint16_t version;
+  uint16_t size;
+  uint8_t cols;
+  uint8_t rows;
+  uint16_t short_ms;
+  /** Images saved since boot, and the sequence number of the newest one
+   * in flash, 0 for none. */
+  uint32_t saves;
+  uint32_t sequence;
+  key_telemetry_t keys[TELEMETRY_KEYS];
+};
+
+/** A saved image. The counters follow the header. */
+struct telemetry_image_t
+{
+  uint32_t magic;
+  /** CRC-32 of everything after it. */
+  uint32_t crc;
+  uint16_t version;
+  uint16_t keys;
+  uint32_t sequence;
+  key_telemetry_t counters[TELEMETRY_KEYS];
+};
+
+#define TELEMETRY_SLOT_SIZE \
+  ((sizeof(telemetry_image_t) + HAL_FLASH_PAGE_SIZE - 1) & ~(HAL_FLASH_PAGE_SIZE - 1))
+#define TELEMETRY_SLOTS (TELEMETRY_SECTORS * (HAL_FLASH_SECTOR_SIZE / TELEMETRY_SLOT_SIZE))
+static_assert(TELEMETRY_SECTORS >= 2, "one sector for the image in use, one to erase");
+
+/** The stats go out in pages like the latency stats: one per GET_REPORT of
+ * REPORT_ID_TELEMETRY, byte 0 the page number, the rest the next slice. A
+ * SET_REPORT with a page number picks where the next read starts, reading
+ * page 0 takes the snapshot the following pages come from. */
+#define TELEMETRY_PAGE_BYTES (TELEMETRY_REPORT_LEN - 1)
+#define TELEMETRY_PAGES ((sizeof(telemetry_stats_t) + TELEMETRY_PAGE_BYTES - 1) / TELEMETRY_PAGE_BYTES)
+
+/** Whether the counters say the switch is failing. */
+inline bool telemetry_suspect(const key_telemetry_t &k)
+{
+  return k.short_presses > 0 || (k.presses >= TELEMETRY_MIN_PRESSES &&
+                                 k.bounces > k.presses * TELEMETRY_BOUNCES_PER_PRESS);
+}
+
+#if KEYBOARD_TELEMETRY
+/** Start from the newest image in flash, or from nothing. */
+void telemetry_init(void);
+
+/** Scan side: raw was read after previous. */
+void telemetry_scan(const matrix_t &raw, const matrix_t &previous);
+
+/** Scan side: the debouncer's state after a run at now_us. */
+void telemetry_debounced(const matrix_t &state, uint32_t now_us);
+
+/** Save the counters to flash if they changed and the last save was
+ * TELEMETRY_SAVE_US ago. Only to be called while the matrix is idle, or
+ * keyboard_quiet() without idle mode. True if an image was written. */
+bool telemetry_task(uint64_t now_us);
+
+/** Save the counters to the next slot now. False if no slot would take
+ * them. */
+bool telemetry_save(void);
+
+/** Current counters. */
+const telemetry_stats_t &telemetry_stats(void);
+
+/** Pick the page the next telemetry_read_page() returns. */
+void telemetry_select_page(uint8_t page);
+
+/** Fill buffer with the selected page and move on to the next one. Returns
+ * the report length. */
+uint16_t telemetry_read_page(uint8_t *buffer, uint16_t len);
+#endif
+
+#endif /* TELEMETRY_H_ */
@@ -0,0 +1,72 @@
+#include <string.h>
+
+#include "timer_wheel.h"
+
+/** b to a in ticks. Ticks are the top bits of a 32 bit microsecond clock,
+ * so they wrap with it. */
+static inline int32_t ticks_between(uint32_t b, uint32_t a)
+{
+  return (int32_t)((a - b) << TIMER_WHEEL_TICK_SHIFT) >> TIMER_WHEEL_TICK_SHIFT;
+}
+
+void timer_wheel_init(timer_wheel_t &w, uint32_t now_us)
+{
+  memset(&w, 0, sizeof(w));
+  w.tick = now_us >> TIMER_WHEEL_TICK_SHIFT;
+}
+
+void timer_wheel_arm(timer_wheel_t &w, uint id, uint32_t deadline_us)
+{
+  timer_wheel_cancel(w, id);
+
+  /** A deadline already in the past goes off on the next advance. */
+  uint32_t tick = deadline_us >> TIMER_WHEEL_TICK_SHIFT;
+  if (ticks_between(w.tick, tick) < 0)
+    tick = w.tick;
+
+  uint32_t bit = 1u << id;
+  w.slot[id] = tick & (TIMER_WHEEL_SLOTS - 1);
+  w.slots[w.slot[id]] |= bit;
+  w.armed |= bit;
+  w.deadline_us[id] = deadline_us;
+}
+
+void timer_wheel_cancel(timer_wheel_t &w, uint id)
+{
+  uint32_t bit = 1u << id;
+  if (!(w.armed & bit))
+    return;
+  w.armed &= ~bit;
+  w.slots[w.slot[id]] &= ~bit;
+}
+
+uint32_t timer_wheel_advance(timer_wheel_t &w, uint32_t now_us)
+{
+  uint32_t now_tick = now_us >> TIMER_WHEEL_TICK_SHIFT;
+  int32_t gap = ticks_between(w.tick, now_tick);
+  if (gap < 0)
+    return 0;
+
+  /** After a gap of more than a turn every slot is looked at once. */
+  uint32_t ticks = gap < TIMER_WHEEL_SLOTS ? gap + 1 : TIMER_WHEEL_SLOTS;
+
+  uint32_t fired = 0;
+  for (uint32_t i = 0; i < ticks; i++)
+  {
+    uint32_t &slot = w.slots[(w.tick + i) & (TIMER_WHEEL_SLOTS - 1)];
+    uint32_t due = slot;
+    while (due)
+    {
+      uint id = __builtin_ctz(due);
+      due &= due - 1;
+      if ((int32_t)(now_us - w.deadline_us[id]) >= 0)
+      {
+        slot &= ~(1u << id);
+        fired |= 1u << id;
+      }
+    }
+  }
+  w.armed &= ~fired;
+  w.tick = now_tick;
+  return fired;
+}
@@ -0,0 +1,43 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/** --------------------------------------------------------------------+ */
+/** Timer wheel */
+/** --------------------------------------------------------------------+ */
+/** Up to 32 timers, each named by a bit. A timer sits in the slot of the
+ * tick its deadline falls on, so advancing the clock only looks at the
+ * slots of the ticks that went by instead of at every timer. Deadlines
+ * further out than one turn of the wheel are simply checked and left where
+ * they are each time the wheel comes round. */
+#define TIMER_WHEEL_TICK_SHIFT 10 /** 1024 us ticks */
+#define TIMER_WHEEL_SLOTS 32
+static_assert((TIMER_WHEEL_SLOTS & (TIMER_WHEEL_SLOTS - 1)) == 0,
+              "TIMER_WHEEL_SLOTS must be a power of two");
+
+struct timer_wheel_t
+{
+  /** Timers by the slot of their deadline tick. */
+  uint32_t slots[TIMER_WHEEL_SLOTS];
+  uint32_t armed;
+  uint32_t deadline_us[32];
+  uint8_t slot[32];
+  /** The tick of the last advance. It is looked at again on the next one,
+   * the rest of it was still to come. */
+  uint32_t tick;
+};
+
+void timer_wheel_init(timer_wheel_t &w, uint32_t now_us);
+
+/** Start (or move) timer id to go off at deadline_us. */
+void timer_wheel_arm(timer_wheel_t &w, uint id, uint32_t deadline_us);
+
+void timer_wheel_cancel(timer_wheel_t &w, uint id);
+
+/** Move the clock on to now_us. Returns the timers that went off, they are
+ * no longer armed. */
+uint32_t timer_wheel_advance(timer_wheel_t &w, uint32_t now_us);
+
+#endif /* TIMER_WHEEL_H_ */
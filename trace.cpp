@@ -0,0 +1,133 @@
+#include <string.h>
+#include <atomic>
+
+#include "trace.h"
+
+#if KEYBOARD_TRACE
+
+/** Single producer (the scan side) and single consumer (the USB callback)
+ * ring of bytes, the same hand off as the key event queue. */
+static uint8_t ring[TRACE_BUFFER];
+static std::atomic<uint32_t> head;
+static std::atomic<uint32_t> tail;
+static std::atomic<uint32_t> dropped;
+/** Consumer side: dropped as of the last report. */
+static uint32_t dropped_reported;
+
+/** Scan side: the last snapshot recorded, when, and whether the next
+ * record has to be a key frame. */
+static matrix_t last;
+static uint64_t last_us;
+static bool key_frame;
+
+void trace_init(void)
+{
+  head.store(0, std::memory_order_relaxed);
+  tail.store(0, std::memory_order_relaxed);
+  dropped.store(0, std::memory_order_relaxed);
+  dropped_reported = 0;
+  last = {};
+  last_us = 0;
+  key_frame = true;
+}
+
+static uint put_varint(uint8_t *out, uint64_t v)
+{
+  uint n = 0;
+  while (v >= 0x80)
+  {
+    out[n++] = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+void trace_scan(const matrix_t &raw, uint64_t scan_us)
+{
+  bool changed = !matrix_equal(raw, last);
+  if (!changed && !key_frame)
+    return;
+
+  uint8_t record[TRACE_RECORD_MAX];
+  uint len = 1;
+  if (key_frame)
+  {
+    record[0] = TRACE_KEY_FRAME;
+    len += put_varint(record + len, scan_us);
+    uint8_t *frame = record + len;
+    memset(frame, 0, TRACE_FRAME_BYTES);
+    for (uint col = 0; col < MATRIX_COLS; col++)
+    {
+      for (uint row = 0; row < MATRIX_ROWS; row++)
+      {
+        uint key = col * MATRIX_ROWS + row;
+        if (matrix_key(raw, col, row))
+          frame[key / 8] |= 1 << (key % 8);
+      }
+    }
+    len += TRACE_FRAME_BYTES;
+  }
+  else
+  {
+    len += put_varint(record + len, scan_us - last_us);
+    uint n = 0;
+    for (uint col = 0; col < MATRIX_COLS; col++)
+    {
+      uint8_t flipped = matrix_col(raw, col) ^ matrix_col(last, col);
+      for (uint row = 0; row < MATRIX_ROWS; row++)
+      {
+        if ((flipped >> row) & 1)
+        {
+          record[len++] = col * MATRIX_ROWS + row;
+          n++;
+        }
+      }
+    }
+    record[0] = n;
+  }
+
+  /** A full ring loses the record, and with it what the next delta would
+   * be against. A key frame still waiting for room is not a new loss. */
+  uint32_t h = head.load(std::memory_order_relaxed);
+  bool fits = TRACE_BUFFER - (h - tail.load(std::memory_order_acquire)) >= len;
+  if (fits)
+  {
+    for (uint i = 0; i < len; i++)
+      ring[(h + i) & (TRACE_BUFFER - 1)] = record[i];
+    head.store(h + len, std::memory_order_release);
+  }
+  else if (changed)
+    dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  last = raw;
+  last_us = scan_us;
+  key_frame = !fits;
+}
+
+uint16_t trace_read_report(uint8_t *buffer, uint16_t len)
+{
+  if (len < TRACE_REPORT_LEN)
+    return 0;
+
+  memset(buffer, 0, TRACE_REPORT_LEN);
+  uint32_t t = tail.load(std::memory_order_relaxed);
+  uint32_t n = head.load(std::memory_order_acquire) - t;
+  if (n > TRACE_REPORT_BYTES)
+    n = TRACE_REPORT_BYTES;
+  for (uint32_t i = 0; i < n; i++)
+    buffer[2 + i] = ring[(t + i) & (TRACE_BUFFER - 1)];
+  tail.store(t + n, std::memory_order_release);
+
+  uint32_t d = dropped.load(std::memory_order_acquire);
+  buffer[0] = (uint8_t)n;
+  buffer[1] = d != dropped_reported ? TRACE_REPORT_DROPPED : 0;
+  dropped_reported = d;
+  return TRACE_REPORT_LEN;
+}
+
+uint32_t trace_dropped(void)
+{
+  return dropped.load(std::memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "matrix.h"
+#include "usb_descriptors.h"
+
+/** --------------------------------------------------------------------+ */
+/** Matrix trace recorder */
+/** --------------------------------------------------------------------+ */
+/** Built with KEYBOARD_TRACE=1, every scan that reads the matrix different
+ * from the last one is recorded: when the scan started and the 75 keys as
+ * it read them, before the ghost filter. Records go into a RAM ring that
+ * the host drains through a vendor feature report (host/trace_reader.cpp).
+ * Recording never waits: a record that does not fit is dropped, and the
+ * next one is a key frame so the stream picks up again. host/trace_replay
+ * runs a trace back through the same scan, debounce, keymap and report
+ * code on the simulated matrix. With KEYBOARD_TRACE=0 none of this is
+ * compiled in.
+ *
+ * A record is a tag byte, a varint time and a payload:
+ *  - Delta, tag = n (1 to TRACE_KEYS): the time since the last record,
+ *    then the n keys that flipped, as col * MATRIX_ROWS + row.
+ *  - Key frame, tag = TRACE_KEY_FRAME: the scan start time itself, then a
+ *    bitmap of every key, key k in bit k % 8 of byte k / 8.
+ * Varints are 7 bits a byte, low first, the top bit set on all but the
+ * last. */
+#ifndef KEYBOARD_TRACE
+#define KEYBOARD_TRACE 0
+#endif
+
+#define TRACE_KEYS (MATRIX_COLS * MATRIX_ROWS)
+#define TRACE_FRAME_BYTES ((TRACE_KEYS + 7) / 8)
+#define TRACE_KEY_FRAME 0x80
+static_assert(TRACE_KEYS < TRACE_KEY_FRAME, "a delta's key count has to stay below the key frame tag");
+
+/** The biggest a record gets: every key flipping and a 64 bit time. */
+#define TRACE_RECORD_MAX (1 + 10 + TRACE_KEYS)
+
+/** Bytes of records the ring holds. */
+#ifndef TRACE_BUFFER
+#define TRACE_BUFFER 4096
+#endif
+static_assert((TRACE_BUFFER & (TRACE_BUFFER - 1)) == 0, "TRACE_BUFFER must be a power of two");
+
+/** GET_REPORT of REPORT_ID_TRACE: byte 0 is how many record bytes follow,
+ * byte 1 has TRACE_REPORT_DROPPED set if any were dropped since the last
+ * report. The rest is the next slice of the stream. */
+#define TRACE_REPORT_DROPPED 0x01
+#define TRACE_REPORT_BYTES (TRACE_REPORT_LEN - 2)
+
+/** A trace file: this header, then the stream. The periods are what the
+ * firmware ran at, so the replay can run at them too. Little endian. */
+#define TRACE_FILE_MAGIC 0x4352544b /** "KTRC" */
+#define TRACE_FILE_VERSION 1
+
+struct trace_file_header_t
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t keys;
+  uint32_t scan_period_us;
+  uint32_t poll_interval_us;
+};
+
+#if KEYBOARD_TRACE
+void trace_init(void);
+
+/** Scan side: the matrix as the scan that started at scan_us read it. */
+void trace_scan(const matrix_t &raw, uint64_t scan_us);
+
+/** Fill buffer with the next slice of the stream. Returns the report
+ * length. */
+uint16_t trace_read_report(uint8_t *buffer, uint16_t len);
+
+/** Changes of the matrix lost because the ring was full, since
+ * trace_init(). */
+uint32_t trace_dropped(void);
+#endif
+
+#endif /* TRACE_H_ */
@@ -91,14 +91,24 @@
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID               1
-#define CFG_TUD_CDC               0
+#define CFG_TUD_HID               2
+// The binary debug log, see debug_log.h
+#ifndef KEYBOARD_DEBUG_LOG
+#define KEYBOARD_DEBUG_LOG        0
+#endif
+#define CFG_TUD_CDC               KEYBOARD_DEBUG_LOG
 #define CFG_TUD_MSC               0
 #define CFG_TUD_MIDI              0
 #define CFG_TUD_VENDOR            0
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
-#define CFG_TUD_HID_EP_BUFSIZE    16
+// The largest report is NKRO: ID + modifiers + 16 byte usage bitmap = 18
+#define CFG_TUD_HID_EP_BUFSIZE    32
+
+// CDC FIFO sizes. The log only goes out, the RX side just has to exist.
+#define CFG_TUD_CDC_RX_BUFSIZE    64
+#define CFG_TUD_CDC_TX_BUFSIZE    512
+#define CFG_TUD_CDC_EP_BUFSIZE    64
 
 #ifdef __cplusplus
  }
@@ -48,9 +48,16 @@ tusb_desc_device_t const desc_device =
     .bLength            = sizeof(tusb_desc_device_t),
     .bDescriptorType    = TUSB_DESC_DEVICE,
     .bcdUSB             = USB_BCD,
+#if KEYBOARD_DEBUG_LOG
+    // The CDC pair is grouped by an IAD, which Windows wants announced here
+    .bDeviceClass       = TUSB_CLASS_MISC,
+    .bDeviceSubClass    = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol    = MISC_PROTOCOL_IAD,
+#else
     .bDeviceClass       = 0x00,
     .bDeviceSubClass    = 0x00,
     .bDeviceProtocol    = 0x00,
+#endif
     .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
 
     .idVendor           = USB_VID,
@@ -75,11 +82,115 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
-uint8_t const desc_hid_report[] =
+// Keyboard bitmap report: 8 modifier bits followed by one bit per usage
+// from 0 to NKRO_KEY_COUNT - 1
+#define TUD_HID_REPORT_DESC_NKRO(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP                   )         ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_KEYBOARD               )         ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION               )         ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    /* 8 bits Modifier Keys (Shift, Control, Alt) */ \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD                )         ,\
+      HID_USAGE_MIN    ( 224                                )         ,\
+      HID_USAGE_MAX    ( 231                                )         ,\
+      HID_LOGICAL_MIN  ( 0                                  )         ,\
+      HID_LOGICAL_MAX  ( 1                                  )         ,\
+      HID_REPORT_COUNT ( 8                                  )         ,\
+      HID_REPORT_SIZE  ( 1                                  )         ,\
+      HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )     ,\
+    /* One bit per key usage */ \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD                )         ,\
+      HID_USAGE_MIN    ( 0                                  )         ,\
+      HID_USAGE_MAX    ( NKRO_KEY_COUNT - 1                 )         ,\
+      HID_LOGICAL_MIN  ( 0                                  )         ,\
+      HID_LOGICAL_MAX  ( 1                                  )         ,\
+      HID_REPORT_COUNT ( NKRO_KEY_COUNT                     )         ,\
+      HID_REPORT_SIZE  ( 1                                  )         ,\
+      HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )     ,\
+  HID_COLLECTION_END \
+
+// Vendor defined feature report keymap edits come in through
+#define TUD_HID_REPORT_DESC_KEYMAP(...) \
+  HID_USAGE_PAGE_N ( HID_USAGE_PAGE_VENDOR, 2               )         ,\
+  HID_USAGE        ( 0x03                                   )         ,\
+  HID_COLLECTION   ( HID_COLLECTION_APPLICATION             )         ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    HID_USAGE        ( 0x04                                 )         ,\
+    HID_LOGICAL_MIN  ( 0x00                                 )         ,\
+    HID_LOGICAL_MAX_N( 0xff, 2                              )         ,\
+    HID_REPORT_SIZE  ( 8                                    )         ,\
+    HID_REPORT_COUNT ( KEYMAP_REPORT_LEN                    )         ,\
+    HID_FEATURE      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )       ,\
+  HID_COLLECTION_END \
+
+// Vendor defined feature report the latency stats are paged out through
+#define TUD_HID_REPORT_DESC_LATENCY(...) \
+  HID_USAGE_PAGE_N ( HID_USAGE_PAGE_VENDOR, 2               )         ,\
+  HID_USAGE        ( 0x01                                   )         ,\
+  HID_COLLECTION   ( HID_COLLECTION_APPLICATION             )         ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    HID_USAGE        ( 0x02                                 )         ,\
+    HID_LOGICAL_MIN  ( 0x00                                 )         ,\
+    HID_LOGICAL_MAX_N( 0xff, 2                              )         ,\
+    HID_REPORT_SIZE  ( 8                                    )         ,\
+    HID_REPORT_COUNT ( LATENCY_REPORT_LEN                   )         ,\
+    HID_FEATURE      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )       ,\
+  HID_COLLECTION_END \
+
+// Vendor defined feature report the matrix trace is drained through
+#define TUD_HID_REPORT_DESC_TRACE(...) \
+  HID_USAGE_PAGE_N ( HID_USAGE_PAGE_VENDOR, 2               )         ,\
+  HID_USAGE        ( 0x05                                   )         ,\
+  HID_COLLECTION   ( HID_COLLECTION_APPLICATION             )         ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    HID_USAGE        ( 0x06                                 )         ,\
+    HID_LOGICAL_MIN  ( 0x00                                 )         ,\
+    HID_LOGICAL_MAX_N( 0xff, 2                              )         ,\
+    HID_REPORT_SIZE  ( 8                                    )         ,\
+    HID_REPORT_COUNT ( TRACE_REPORT_LEN                     )         ,\
+    HID_FEATURE      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )       ,\
+  HID_COLLECTION_END \
+
+// Vendor defined feature report the per-key telemetry is paged out through
+#define TUD_HID_REPORT_DESC_TELEMETRY(...) \
+  HID_USAGE_PAGE_N ( HID_USAGE_PAGE_VENDOR, 2               )         ,\
+  HID_USAGE        ( 0x07                                   )         ,\
+  HID_COLLECTION   ( HID_COLLECTION_APPLICATION             )         ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    HID_USAGE        ( 0x08                                 )         ,\
+    HID_LOGICAL_MIN  ( 0x00                                 )         ,\
+    HID_LOGICAL_MAX_N( 0xff, 2                              )         ,\
+    HID_REPORT_SIZE  ( 8                                    )         ,\
+    HID_REPORT_COUNT ( TELEMETRY_REPORT_LEN                 )         ,\
+    HID_FEATURE      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )       ,\
+  HID_COLLECTION_END \
+
+// Boot keyboard: no report ID, so it is also the boot protocol report
+uint8_t const desc_hid_keyboard_report[] =
 {
-  TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD         ))
-  // TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE            )),
-  // TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )),
+  TUD_HID_REPORT_DESC_KEYBOARD()
+};
+
+uint8_t const desc_hid_nkro_report[] =
+{
+  TUD_HID_REPORT_DESC_NKRO( HID_REPORT_ID(REPORT_ID_NKRO            )),
+  TUD_HID_REPORT_DESC_KEYMAP( HID_REPORT_ID(REPORT_ID_KEYMAP        )),
+  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )),
+  TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE            )),
+#if KEYBOARD_LATENCY
+  TUD_HID_REPORT_DESC_LATENCY( HID_REPORT_ID(REPORT_ID_LATENCY      )),
+#endif
+#if KEYBOARD_TRACE
+  TUD_HID_REPORT_DESC_TRACE( HID_REPORT_ID(REPORT_ID_TRACE          )),
+#endif
+#if KEYBOARD_TELEMETRY
+  TUD_HID_REPORT_DESC_TELEMETRY( HID_REPORT_ID(REPORT_ID_TELEMETRY  )),
+#endif
   // TUD_HID_REPORT_DESC_GAMEPAD ( HID_REPORT_ID(REPORT_ID_GAMEPAD          ))
 };
 
@@ -88,23 +199,33 @@ uint8_t const desc_hid_report[] =
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 {
-  (void) instance;
-  return desc_hid_report;
+  return instance == ITF_NUM_NKRO ? desc_hid_nkro_report : desc_hid_keyboard_report;
 }
 
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
-enum
-{
-  ITF_NUM_HID,
-  ITF_NUM_TOTAL
+// String Descriptor Index, see string_desc_arr below
+enum {
+  STRID_LANGID = 0,
+  STRID_MANUFACTURER,
+  STRID_PRODUCT,
+  STRID_SERIAL,
+  STRID_CDC,
 };
 
-#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+#if KEYBOARD_DEBUG_LOG
+#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + 2 * TUD_HID_DESC_LEN + TUD_CDC_DESC_LEN)
+#else
+#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + 2 * TUD_HID_DESC_LEN)
+#endif
 
-#define EPNUM_HID   0x81
+#define EPNUM_HID_KEYBOARD   0x81
+#define EPNUM_HID_NKRO       0x82
+#define EPNUM_CDC_NOTIF      0x83
+#define EPNUM_CDC_OUT        0x04
+#define EPNUM_CDC_IN         0x84
 
 uint8_t const desc_configuration[] =
 {
@@ -112,7 +233,12 @@ uint8_t const desc_configuration[] =
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
   // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5)
+  TUD_HID_DESCRIPTOR(ITF_NUM_KEYBOARD, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_keyboard_report), EPNUM_HID_KEYBOARD, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL_MS),
+  TUD_HID_DESCRIPTOR(ITF_NUM_NKRO, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_nkro_report), EPNUM_HID_NKRO, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL_MS),
+#if KEYBOARD_DEBUG_LOG
+  // Interface number, string index, EP notification address and size, EP data address (out, in) and size
+  TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, STRID_CDC, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, CFG_TUD_CDC_EP_BUFSIZE),
+#endif
 };
 
 #if TUD_OPT_HIGH_SPEED
@@ -178,14 +304,6 @@ uint8_t const * tud_descriptor_configuration_cb(uint8_t index)
 // String Descriptors
 //--------------------------------------------------------------------+
 
-// String Descriptor Index
-enum {
-  STRID_LANGID = 0,
-  STRID_MANUFACTURER,
-  STRID_PRODUCT,
-  STRID_SERIAL,
-};
-
 // array of pointer to string descriptors
 char const *string_desc_arr[] =
 {
@@ -193,6 +311,7 @@ char const *string_desc_arr[] =
   "TinyUSB",                     // 1: Manufacturer
   "TinyUSB Device",              // 2: Product
   NULL,                          // 3: Serials will use unique ID if possible
+  "Keyboard debug log",          // 4: CDC interface
 };
 
 static uint16_t _desc_str[32 + 1];
@@ -25,10 +25,71 @@
 #ifndef USB_DESCRIPTORS_H_
 #define USB_DESCRIPTORS_H_
 
+/** HID interfaces, which are also the TinyUSB HID instance numbers. The
+ * keyboard interface is boot protocol capable and has no report IDs so a
+ * BIOS can read it, the NKRO interface carries everything else. With
+ * KEYBOARD_DEBUG_LOG the debug log's CDC-ACM pair comes after them. */
 enum
 {
-  REPORT_ID_KEYBOARD = 1,
+  ITF_NUM_KEYBOARD,
+  ITF_NUM_NKRO,
+#if KEYBOARD_DEBUG_LOG
+  ITF_NUM_CDC,
+  ITF_NUM_CDC_DATA,
+#endif
+  ITF_NUM_TOTAL
+};
+
+/** How many of the interfaces are HID. */
+#define ITF_NUM_HID (ITF_NUM_NKRO + 1)
+
+/** Report IDs on the NKRO interface */
+enum
+{
+  REPORT_ID_NKRO = 1,
+  REPORT_ID_KEYMAP,
+  REPORT_ID_CONSUMER_CONTROL,
+  REPORT_ID_MOUSE,
+#if KEYBOARD_LATENCY
+  REPORT_ID_LATENCY,
+#endif
+#if KEYBOARD_TRACE
+  REPORT_ID_TRACE,
+#endif
+#if KEYBOARD_TELEMETRY
+  REPORT_ID_TELEMETRY,
+#endif
   REPORT_ID_COUNT
 };
 
+/** bInterval of the HID endpoints. 1 ms is the fastest a full speed device
+ * can ask to be polled; the original descriptor used 5. */
+#ifndef HID_POLL_INTERVAL_MS
+#define HID_POLL_INTERVAL_MS 1
+#endif
+
+/** Usages 0 .. NKRO_KEY_COUNT - 1 get a bit in the NKRO report. That covers
+ * every key on the board (and everything below the keypad extras), the
+ * modifiers have their own byte. */
+#define NKRO_KEY_COUNT 128
+
+/** NKRO report: ID, modifiers, usage bitmap */
+#define NKRO_REPORT_LEN (1 + 1 + NKRO_KEY_COUNT / 8)
+
+/** Keymap feature report (without its ID): an op and its edits going out,
+ * the store's status coming back. */
+#define KEYMAP_REPORT_LEN 31
+
+/** Latency stats feature report (without its ID): page number and a slice
+ * of the stats, sized so ID + report fit CFG_TUD_HID_EP_BUFSIZE. */
+#define LATENCY_REPORT_LEN 31
+
+/** Matrix trace feature report (without its ID): a length, flags and the
+ * next bytes of the stream. */
+#define TRACE_REPORT_LEN 31
+
+/** Per-key telemetry feature report (without its ID): page number and a
+ * slice of the counters, like the latency stats. */
+#define TELEMETRY_REPORT_LEN 31
+
 #endif /* USB_DESCRIPTORS_H_ */